@@ -3,6 +3,16 @@
 set INCLUDES=-I..\src\ -I..\include\
 set CommonCompilerFlags=-diagnostics:column -std:c++20 -WL -Od -nologo -fp:fast -fp:except- -Gm- -GR- -EHsc- -Zo -Oi -WX -Wall -FC -Z7 -GS- -Gs9999999
 set CommonCompilerFlags=-DDEBUG %CommonCompilerFlags% %INCLUDES%
+REM RENDERER_SOFTWARE=1 swaps the OpenGL backend for the tile-binning CPU rasterizer
+set CommonCompilerFlags=-DRENDERER_SOFTWARE=0 %CommonCompilerFlags%
+REM SPRITE_BLITTER_BENCHMARK=1 prints sprite blitter throughput per SIMD path at startup
+set CommonCompilerFlags=-DSPRITE_BLITTER_BENCHMARK=0 %CommonCompilerFlags%
+REM BULK_MEMORY_BENCHMARK=1 prints clear and copy GB/s per SIMD path against memset and memcpy at startup
+set CommonCompilerFlags=-DBULK_MEMORY_BENCHMARK=0 %CommonCompilerFlags%
+REM BLOCK_COMPRESSION_BENCHMARK=1 prints BC1/BC3/BC4/BC5/BC7 encode MP/s and PSNR per quality preset at startup
+set CommonCompilerFlags=-DBLOCK_COMPRESSION_BENCHMARK=0 %CommonCompilerFlags%
+REM PNG_DECODER_BENCHMARK=1 prints PNG decode MB/s per path against the bit at a time reference inflate at startup
+set CommonCompilerFlags=-DPNG_DECODER_BENCHMARK=0 %CommonCompilerFlags%
 set CommonLinkerFlags=-STACK:0x100000,0x100000 -incremental:no -opt:ref user32.lib gdi32.lib winmm.lib kernel32.lib opengl32.lib
 
 IF NOT EXIST .\build mkdir .\build
@@ -13,4 +23,7 @@ del *.pdb > NUL 2> NUL
 REM Platforms
 cl %CommonCompilerFlags% ..\src\win32\win32_main.cpp -Fmwin32.map /link /SUBSYSTEM:windows %CommonLinkerFlags%
 
+REM Regression run: win32_main.exe -regression [-frames N] compares each scene with regression\<backend>\<scene>.tga.
+REM Golden images are not committed. Exit code 2 means they are missing, bootstrap them with win32_main.exe -regression-update
+
 popd
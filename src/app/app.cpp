@@ -3,128 +3,218 @@
 
 #include "camera.h"
 #include "resources/resources_catalog.h"
-
-static const char* vertex_shader_2d_source = R"(
-    #version 330 core
+#include "scene/bvh.h"
+#include "scene/occlusion.h"
+#include "scene/lod.h"
+#include "scene/light_clusters.h"
+#include "renderer/vertex_format.h"
+#include "renderer/mesh_optimizer.h"
+#include "renderer/shader_variants.h"
+
+#define SCENE_GRID_SIZE             32
+#define SCENE_GRID_SPACING          2.0f
+#define SCENE_GRID_ENTITY_COUNT     (SCENE_GRID_SIZE * SCENE_GRID_SIZE)
+#define SCENE_WALL_COUNT            3
+#define SCENE_ENTITY_COUNT          (SCENE_GRID_ENTITY_COUNT + SCENE_WALL_COUNT)
+#define SCENE_ANIMATED_COUNT        16
+#define SCENE_OCCLUDER_TRIANGLES    1024
+#define SCENE_REVEAL_RADIUS         4.0f    // Half extent of the box a right click shows cubes in
+
+#define SCENE_LIGHT_COUNT           1024    // The key light plus small lights scattered over the floor
+
+#define SPHERE_RINGS                64
+#define SPHERE_SEGMENTS             (2 * SPHERE_RINGS)
+#define SPHERE_LOD_COUNT            5
+
+// Every app shader is a variant of this source, see shader_variants.h for the FEATURE_ defines
+static const char* uber_shader_source = R"(
+#ifdef VERTEX_SHADER
+    #ifdef FEATURE_SCREEN_SPACE
     layout (location = 0) in vec2 aPos; // 2D Position only!
-    layout (location = 1) in vec3 aColor; // Color attribute
-    layout (location = 2) in vec2 aUV;  // Texture coordinates
+    layout (location = 1) in vec3 aColor;
+    layout (location = 2) in vec2 aTexCoord;
+    #else
+    // 'layout(location = 0)' matches the index we will use in glVertexAttribPointer later
+    layout (location = 0) in vec3 aPos;
+    layout (location = 1) in vec2 aNormal; // Octahedral encoded, see CompactVertex
+    layout (location = 2) in vec3 aColor;
+    layout (location = 3) in vec2 aTexCoord;
+    #endif
 
-    uniform mat4 projection; // Orthographic matrix
-    uniform mat4 model;      // Position/Scale of the button
+    // "Uniforms" are global variables we set from the CPU
+    uniform mat4 model;
+    uniform mat4 view;
+    uniform mat4 projection;
 
     out vec3 vColor;
     out vec2 vUV;
 
+    #ifdef FEATURE_LIT
+    out vec3 vNormal;
+    out vec3 vFragPos; // World position for the point lights
+    out float vViewDepth; // Picks the depth slice of the light cluster
+)" OCT_DECODE_GLSL R"(
+    #endif
+
     void main() {
+    #ifdef FEATURE_SCREEN_SPACE
         // Note: Z is 0.0, W is 1.0
         gl_Position = projection * model * vec4(aPos, 0.0, 1.0);
+    #else
+        vec4 viewPos = view * model * vec4(aPos, 1.0);
+        gl_Position = projection * viewPos;
+    #endif
+
+    #ifdef FEATURE_LIT
+        vViewDepth = -viewPos.z;
+        // Note: Technically we should use the "Normal Matrix" (inverse transpose)
+        // to handle non-uniform scaling, but for the scene's meshes this works.
+        vNormal = OctDecode(aNormal);
+        vFragPos = vec3(model * vec4(aPos, 1.0));
+    #endif
         vColor = aColor;
-        vUV = aUV;
+        vUV = aTexCoord;
     }
-)";
+#endif
 
-static const char* fragment_shader_2d_source = R"(
-    #version 330 core
+#ifdef FRAGMENT_SHADER
     out vec4 FragColor;
 
     in vec3 vColor;
     in vec2 vUV;
 
+    #ifdef FEATURE_UNIFORM_COLOR
+    uniform vec3 color;
+    #endif
+    #ifdef FEATURE_TEXTURED
     uniform sampler2D spriteTexture;
+    #endif
 
-    void main() {
-        vec4 texColor = texture(spriteTexture, vUV);
-        FragColor = texColor * vec4(vColor, 1.0);
-    }
-)";
-
-static const char* vertex_line_shader_source = R"(
-    #version 330 core
-    layout (location = 0) in vec3 aPos;
-
-    uniform mat4 projection;
-    uniform mat4 view;
-    uniform mat4 model;
-
-    void main() {
-        gl_Position = projection * view * model * vec4(aPos, 1.0);
-    }
-)";
-
-static const char* fragment_line_shader_source = R"(
-    #version 330 core
-    out vec4 FragColor;
-
-    uniform vec3 color;
+    #ifdef FEATURE_LIT
+    in vec3 vNormal;
+    in vec3 vFragPos;
+    in float vViewDepth;
+)" CLUSTERED_LIGHTING_GLSL R"(
+    #endif
 
     void main() {
-        FragColor = vec4(color, 1.0);
+        vec4 result = vec4(1.0);
+    #ifdef FEATURE_VERTEX_COLOR
+        result.rgb *= vColor;
+    #endif
+    #ifdef FEATURE_UNIFORM_COLOR
+        result.rgb *= color;
+    #endif
+    #ifdef FEATURE_TEXTURED
+        result *= texture(spriteTexture, vUV);
+    #endif
+    #ifdef FEATURE_LIT
+        // Ambient plus diffuse from the point lights binned into this fragment's cluster only
+        vec3 ambient = vec3(0.1);
+        vec3 diffuse = ShadeClusteredLights(vFragPos, normalize(vNormal), vViewDepth);
+        result.rgb *= ambient + diffuse;
+    #endif
+        FragColor = result;
     }
+#endif
 )";
 
-static const char* vertex_shader_source = R"(
-    #version 330 core
-    // 'layout(location = 0)' matches the index we will use in glVertexAttribPointer later
-    layout (location = 0) in vec3 aPos;
-    layout (location = 1) in vec3 aNormal;
-    layout (location = 2) in vec3 aColor;
-    layout (location = 3) in vec2 aTexCoord;
-
-    out vec3 vNormal; // Output to fragment shader
-    out vec3 vFragPos; // Output world position (for advanced lighting)
-    out vec3 vColor;
+#define SHADER_VARIANT_MESH     (SHADER_FEATURE_LIT | SHADER_FEATURE_VERTEX_COLOR)
+#define SHADER_VARIANT_LINE     (SHADER_FEATURE_UNIFORM_COLOR)
+#define SHADER_VARIANT_SPRITE   (SHADER_FEATURE_SCREEN_SPACE | SHADER_FEATURE_TEXTURED | SHADER_FEATURE_VERTEX_COLOR)
 
-    // "Uniforms" are global variables we set from the CPU
-    uniform mat4 model; // We need the Model matrix separately now
-    uniform mat4 view;
-    uniform mat4 projection;
+// Compiled at startup, anything else compiles the first frame it is drawn with
+static const u32 prewarm_shader_variants[] = {
+    SHADER_VARIANT_MESH,
+    SHADER_VARIANT_SPRITE,
+};
 
-    void main() {
-        // gl_Position is a built-in output variable required by OpenGL
-        gl_Position = projection * view * model * vec4(aPos, 1.0);
+// Draw order key: shader first so program binds are shared, then mesh so VAO binds are, then LOD
+internal u64 GetMeshSortKey(const RenderMeshCommand& cmd)
+{
+    return ((u64)GetHandleIndex(cmd.shader.id) << 40) | ((u64)GetHandleIndex(cmd.mesh.id) << 8) | (u64)MinInt((i32)cmd.lod, 0xFF);
+}
 
-        // Transform the normal by the model matrix (rotation)
-        // Note: Technically we should use the "Normal Matrix" (inverse transpose) 
-        // to handle non-uniform scaling, but for a rotating cube, this works.
-        vNormal = aNormal; // Pass the normal to the fragment shader
+internal int CompareMeshCommands(const void* a, const void* b)
+{
+    u64 key_a = GetMeshSortKey(((const RenderCommand*)a)->mesh_cmd);
+    u64 key_b = GetMeshSortKey(((const RenderCommand*)b)->mesh_cmd);
+    return key_a < key_b ? -1 : key_a > key_b ? 1 : 0;
+}
 
-        vFragPos = vec3(model * vec4(aPos, 1.0)); // Pass the world position to the fragment shader
-        vColor = aColor; // Pass the color to the fragment shader
+// UV sphere whose coarser LODs skip every other ring and segment of the finer one,
+// so the whole chain shares a single vertex buffer
+internal MeshHandle CreateSphereWithLods(VMArena* scratch_arena, f32 radius, MeshLod* out_lods)
+{
+    int vertex_count = (SPHERE_RINGS + 1) * (SPHERE_SEGMENTS + 1);
+    Vertex* vertices = (Vertex*)memory::VMArenaAlloc(scratch_arena, vertex_count * sizeof(Vertex));
+    for (i32 ring = 0; ring <= SPHERE_RINGS; ++ring)
+    {
+        f32 theta = glm::pi<f32>() * (f32)ring / (f32)SPHERE_RINGS;
+        for (i32 segment = 0; segment <= SPHERE_SEGMENTS; ++segment)
+        {
+            f32 phi = 2.0f * glm::pi<f32>() * (f32)segment / (f32)SPHERE_SEGMENTS;
+            glm::vec3 normal = glm::vec3(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+
+            Vertex& vertex = vertices[ring * (SPHERE_SEGMENTS + 1) + segment];
+            vertex.position[0] = normal.x * radius;
+            vertex.position[1] = normal.y * radius;
+            vertex.position[2] = normal.z * radius;
+            vertex.normal[0] = normal.x;
+            vertex.normal[1] = normal.y;
+            vertex.normal[2] = normal.z;
+            vertex.color[0] = 0.9f;
+            vertex.color[1] = 0.8f;
+            vertex.color[2] = 0.3f;
+            vertex.uv[0] = (f32)segment / (f32)SPHERE_SEGMENTS;
+            vertex.uv[1] = (f32)ring / (f32)SPHERE_RINGS;
+        }
     }
-)";
-
-static const char* fragment_shader_source = R"(
-    #version 330 core
-    out vec4 FragColor; // We define our own output variable
 
-    in vec3 vNormal;
-    in vec3 vFragPos;
-    in vec3 vColor;
+    int index_count = 0;
+    for (i32 level = 0; level < SPHERE_LOD_COUNT; ++level)
+    {
+        i32 step = 1 << level;
+        index_count += 6 * (SPHERE_RINGS / step) * (SPHERE_SEGMENTS / step);
+    }
 
-    // Hardcode a light position for now (or pass as uniform)
-    vec3 lightPos = vec3(2.0, 2.0, 2.0); 
-    vec3 lightColor = vec3(1.0, 1.0, 1.0);
+    int* indices = (int*)memory::VMArenaAlloc(scratch_arena, index_count * sizeof(int));
+    int cursor = 0;
+    for (i32 level = 0; level < SPHERE_LOD_COUNT; ++level)
+    {
+        i32 step = 1 << level;
+        out_lods[level].index_offset = (u32)cursor;
+
+        for (i32 ring = 0; ring < SPHERE_RINGS; ring += step)
+        {
+            for (i32 segment = 0; segment < SPHERE_SEGMENTS; segment += step)
+            {
+                int a = ring * (SPHERE_SEGMENTS + 1) + segment;
+                int b = (ring + step) * (SPHERE_SEGMENTS + 1) + segment;
+                int c = (ring + step) * (SPHERE_SEGMENTS + 1) + segment + step;
+                int d = ring * (SPHERE_SEGMENTS + 1) + segment + step;
+                indices[cursor++] = a;
+                indices[cursor++] = c;
+                indices[cursor++] = b;
+                indices[cursor++] = a;
+                indices[cursor++] = d;
+                indices[cursor++] = c;
+            }
+        }
+
+        // Sagitta of the widest chord: how far the coarse facets sink below the surface.
+        // LOD 0 is the reference, so its error is zero by definition.
+        f32 angle_step = glm::pi<f32>() * (f32)step / (f32)SPHERE_RINGS;
+        out_lods[level].index_count = (u32)cursor - out_lods[level].index_offset;
+        out_lods[level].error = level == 0 ? 0.0f : radius * (1.0f - cos(angle_step * 0.5f));
+    }
 
-    void main() {
-        float ambientStrength = 0.1;
-        vec3 ambient = ambientStrength * lightColor;
-        
-        // 2. Diffuse Light (Directional)
-        vec3 norm = normalize(vNormal);
-        vec3 lightDir = normalize(lightPos - vFragPos);
-        
-        // Calculate angle: Dot product
-        // max(0.0) ensures we don't get negative light (darker than black)
-        float diff = max(dot(norm, lightDir), 0.0);
-        vec3 diffuse = diff * lightColor;
+    // The rings above are emitted row by row, which keeps very little in the vertex cache
+    mesh_optimizer::OptimizeMesh(scratch_arena, vertices, (u32)vertex_count, (u32*)indices, out_lods, SPHERE_LOD_COUNT);
 
-        // 3. Combine
-        vec3 result = (ambient + diffuse) * vColor;
-        
-        FragColor = vec4(result, 1.0);
-    }
-)";
+    // The data is copied, the scratch memory can go as soon as this returns
+    return renderer::CreateMeshAsync(vertices, vertex_count, indices, index_count, out_lods, SPHERE_LOD_COUNT);
+}
 
 RenderQueue AppUpdate(Memory& app_memory, RenderQueue& render_queue, const Input& curr_input, const Input& old_input, float width, float height, float delta_time)
 {
@@ -135,8 +225,20 @@ RenderQueue AppUpdate(Memory& app_memory, RenderQueue& render_queue, const Input
     static ShaderHandle shader = {};
     static ShaderHandle axis_shader = {};
     static ShaderHandle shader_2d = {};
+    static ShaderVariantCache shader_variants;
     static SpriteHandle sprite = {};
     static Camera* camera = nullptr;
+    static Entity* entities = nullptr;
+    static Bvh scene_bvh;
+    static OcclusionBuffer* occlusion_buffer = nullptr;
+    static glm::vec3 cube_positions[24];
+    static u32 cube_indices[36];
+    static MeshLod cube_lod = {};
+    static MeshHandle sphere_mesh = {};
+    static MeshLod sphere_lods[SPHERE_LOD_COUNT] = {};
+    static f32 time = 0.0f;
+    static PointLight* lights = nullptr;
+    static glm::vec3* light_origins = nullptr;
     float speed = 2.5f;
     float sensitivity = 0.1f;
 
@@ -188,8 +290,11 @@ RenderQueue AppUpdate(Memory& app_memory, RenderQueue& render_queue, const Input
            20,21,22,22,23,20          // Right face
         };
 
+        shader_variants::Init(&shader_variants, uber_shader_source);
+        shader_variants::Prewarm(&shader_variants, prewarm_shader_variants, ArrayCount(prewarm_shader_variants));
+
         mesh = renderer::CreateMesh(vertices, sizeof(vertices) / sizeof(Vertex), indices, sizeof(indices) / sizeof(int));
-        shader = renderer::CreateShader(vertex_shader_source, fragment_shader_source);
+        shader = shader_variants::Get(&shader_variants, SHADER_VARIANT_MESH);
         
         camera = (Camera*)memory::VMArenaAlloc(&app_memory.permanent_storage, sizeof(Camera));
 
@@ -212,13 +317,97 @@ RenderQueue AppUpdate(Memory& app_memory, RenderQueue& render_queue, const Input
             4, 5  // Z Axis
         };
         axis_mesh = renderer::CreateMesh(vertices, sizeof(vertices) / sizeof(Vertex), indices, sizeof(indices) / sizeof(int));
-        axis_shader = renderer::CreateShader(vertex_line_shader_source, fragment_line_shader_source);
+        axis_shader = shader_variants::Get(&shader_variants, SHADER_VARIANT_LINE);
 
-        shader_2d = renderer::CreateShader(vertex_shader_2d_source, fragment_shader_2d_source);
+        shader_2d = shader_variants::Get(&shader_variants, SHADER_VARIANT_SPRITE);
         resources = Catalog_Create();
         renderer::SetResourceCatalog(resources);
-        //auto s = Catalog_Load(resources, "assets/debug_sprite.data", ResourceType::RES_SPRITE);
-        sprite = renderer::CreateSprite(0, 1.0f, 1.0f);
+        ResourceID sprite_resource = Catalog_Load(resources, "assets/debug_sprite.png", ResourceType::RES_SPRITE);
+        sprite = renderer::CreateSprite(sprite_resource, 1.0f, 1.0f);
+
+        cube_lod.index_offset = 0;
+        cube_lod.index_count = ArrayCount(indices);
+        cube_lod.error = 0.0f;
+        sphere_mesh = CreateSphereWithLods(&app_memory.render_storage, 0.5f, sphere_lods);
+
+        // A floor of cubes and spheres in front of the camera, spatially indexed for culling and picking
+        Aabb cube_bounds = {};
+        cube_bounds.min = glm::vec3(-0.5f, -0.5f, -0.5f);
+        cube_bounds.max = glm::vec3(0.5f, 0.5f, 0.5f);
+
+        entities = (Entity*)memory::VMArenaAlloc(&app_memory.permanent_storage, SCENE_ENTITY_COUNT * sizeof(Entity));
+        Aabb* entity_bounds = (Aabb*)memory::VMArenaAlloc(&app_memory.render_storage, SCENE_ENTITY_COUNT * sizeof(Aabb));
+        for (u32 i = 0; i < SCENE_GRID_ENTITY_COUNT; ++i)
+        {
+            f32 x = ((f32)(i % SCENE_GRID_SIZE) - (f32)SCENE_GRID_SIZE * 0.5f) * SCENE_GRID_SPACING;
+            f32 z = -(f32)(i / SCENE_GRID_SIZE) * SCENE_GRID_SPACING;
+
+            Entity& entity = entities[i];
+            entity.model = glm::translate(glm::mat4(1.0f), glm::vec3(x, -1.0f, z));
+            entity.local_bounds = cube_bounds;
+            bool is_sphere = ((i + i / SCENE_GRID_SIZE) & 1) != 0;
+            entity.mesh_id = is_sphere ? sphere_mesh : mesh;
+            entity.lods = is_sphere ? sphere_lods : &cube_lod;
+            entity.lod_count = is_sphere ? SPHERE_LOD_COUNT : 1;
+            entity.lod = 0;
+            entity.is_visible = true;
+            entity.is_occluder = false;
+            entity_bounds[i] = bounds::Transform(entity.local_bounds, entity.model);
+        }
+
+        // A few walls across the floor, rasterized as occluders for the cubes behind them
+        for (u32 i = 0; i < SCENE_WALL_COUNT; ++i)
+        {
+            Entity& entity = entities[SCENE_GRID_ENTITY_COUNT + i];
+            glm::vec3 position = glm::vec3(((f32)i - 1.0f) * 12.0f, 0.5f, -8.0f - 16.0f * (f32)i);
+            entity.model = glm::scale(glm::translate(glm::mat4(1.0f), position), glm::vec3(16.0f, 4.0f, 0.5f));
+            entity.local_bounds = cube_bounds;
+            entity.mesh_id = mesh;
+            entity.lods = &cube_lod;
+            entity.lod_count = 1;
+            entity.lod = 0;
+            entity.is_visible = true;
+            entity.is_occluder = true;
+            entity_bounds[SCENE_GRID_ENTITY_COUNT + i] = bounds::Transform(entity.local_bounds, entity.model);
+        }
+        bvh::Build(&scene_bvh, entity_bounds, SCENE_ENTITY_COUNT);
+
+        for (u32 i = 0; i < ArrayCount(cube_positions); ++i)
+        {
+            cube_positions[i] = glm::vec3(vertices[i].position[0], vertices[i].position[1], vertices[i].position[2]);
+        }
+        for (u32 i = 0; i < ArrayCount(cube_indices); ++i)
+        {
+            cube_indices[i] = (u32)indices[i];
+        }
+        occlusion_buffer = (OcclusionBuffer*)memory::VMArenaAllocAligned(&app_memory.permanent_storage, sizeof(OcclusionBuffer), 16);
+
+        // Light 0 replaces the old hardcoded light, the rest are small colored lights over the floor
+        lights = (PointLight*)memory::VMArenaAlloc(&app_memory.permanent_storage, SCENE_LIGHT_COUNT * sizeof(PointLight));
+        light_origins = (glm::vec3*)memory::VMArenaAlloc(&app_memory.permanent_storage, SCENE_LIGHT_COUNT * sizeof(glm::vec3));
+        lights[0].position = glm::vec3(2.0f, 2.0f, 2.0f);
+        lights[0].radius = 200.0f;
+        lights[0].color = glm::vec3(1.0f, 1.0f, 1.0f);
+        lights[0].intensity = 1.0f;
+        light_origins[0] = lights[0].position;
+        u32 seed = 0x9E3779B9u;
+        for (u32 i = 1; i < SCENE_LIGHT_COUNT; ++i)
+        {
+            f32 random[6];
+            for (u32 r = 0; r < ArrayCount(random); ++r)
+            {
+                seed ^= seed << 13;
+                seed ^= seed >> 17;
+                seed ^= seed << 5;
+                random[r] = (f32)(seed & 0xFFFF) / 65535.0f;
+            }
+            light_origins[i] = glm::vec3((random[0] - 0.5f) * (f32)SCENE_GRID_SIZE * SCENE_GRID_SPACING,
+                                         -0.2f + 0.6f * random[1],
+                                         -random[2] * (f32)SCENE_GRID_SIZE * SCENE_GRID_SPACING);
+            lights[i].radius = 1.5f + 1.5f * random[3];
+            lights[i].color = glm::vec3(0.3f + 0.7f * random[4], 0.3f + 0.7f * random[5], 0.3f + 0.7f * (1.0f - random[4]));
+            lights[i].intensity = 2.0f;
+        }
     }
     camera::UpdateDimensions(camera, width, height);
 
@@ -257,28 +446,140 @@ RenderQueue AppUpdate(Memory& app_memory, RenderQueue& render_queue, const Input
     //command->shader = axis_shader;
     //command->draw_mode = DrawMode::LINES;
 
-    RenderCommand* command = (RenderCommand*)memory::VMArenaAlloc(&app_memory.render_storage, sizeof(RenderCommand));
-    //command->mesh_cmd.mesh = mesh;
-    //command->mesh_cmd.shader = shader;
-    //command->mode = RenderMode::MESH;
-
-    //static int count = 0;
-    //float angle = glm::radians(1.0f * (f32)count++);
-    //glm::mat4 model = glm::rotate(glm::mat4(1.0f), angle, glm::vec3(0.5f, 1.0f, 0.5f));
-    //glm::mat4 view  = camera::GetViewMatrix(camera);
-    //glm::mat4 view  = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -3.0f));
-    //glm::mat4 projection = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, 100.0f);
-    //command->mesh_cmd.model = model;
-    //command->mesh_cmd.view = view;
-    //command->mesh_cmd.projection = projection;
+    time += delta_time;
+
+    // Bob a few cubes up and down; only their paths through the BVH get refit
+    u32 moved_ids[SCENE_ANIMATED_COUNT];
+    Aabb moved_bounds[SCENE_ANIMATED_COUNT];
+    for (u32 i = 0; i < SCENE_ANIMATED_COUNT; ++i)
+    {
+        Entity& entity = entities[i];
+        entity.model[3].y = -1.0f + 0.5f * sin(2.0f * time + (f32)i);
+        moved_ids[i] = i;
+        moved_bounds[i] = bounds::Transform(entity.local_bounds, entity.model);
+    }
+    bvh::Refit(&scene_bvh, moved_ids, moved_bounds, SCENE_ANIMATED_COUNT);
+
+    glm::mat4 view = camera::GetViewMatrix(camera);
+    glm::mat4 projection = camera::GetProjectionMatrix(camera);
+    glm::mat4 view_projection = projection * view;
+
+    // Lights circle around their origin, then get binned into the camera's clusters
+    for (u32 i = 1; i < SCENE_LIGHT_COUNT; ++i)
+    {
+        f32 phase = time * 0.8f + (f32)i * 0.37f;
+        lights[i].position = light_origins[i] + glm::vec3(cos(phase), 0.0f, sin(phase)) * 0.75f;
+    }
+    LightClusters* light_clusters = (LightClusters*)memory::VMArenaAlloc(&app_memory.render_storage, sizeof(LightClusters));
+    light_clusters::Build(app_memory.work_queue, &app_memory.render_storage, lights, SCENE_LIGHT_COUNT, view,
+                          camera->fov, camera->aspect_ratio, camera->near_plane, camera->far_plane, light_clusters);
+
+    // Left click toggles the visibility of the cube under the cursor, right click shows
+    // every cube within SCENE_REVEAL_RADIUS of it again
+    bool left_clicked = curr_input.mouse.left.is_down && !old_input.mouse.left.is_down;
+    bool right_clicked = curr_input.mouse.right.is_down && !old_input.mouse.right.is_down;
+    if (left_clicked || right_clicked)
+    {
+        f32 ndc_x = 2.0f * (f32)curr_input.mouse.x_pos / width - 1.0f;
+        f32 ndc_y = 1.0f - 2.0f * (f32)curr_input.mouse.y_pos / height;
+        glm::mat4 inv_view_projection = glm::inverse(view_projection);
+        glm::vec4 near_point = inv_view_projection * glm::vec4(ndc_x, ndc_y, -1.0f, 1.0f);
+        glm::vec4 far_point = inv_view_projection * glm::vec4(ndc_x, ndc_y, 1.0f, 1.0f);
+
+        Ray ray = {};
+        ray.origin = glm::vec3(near_point) / near_point.w;
+        ray.direction = glm::normalize(glm::vec3(far_point) / far_point.w - ray.origin);
+
+        u32 picked_id = 0;
+        f32 picked_t = 0.0f;
+        if (bvh::RayCast(&scene_bvh, ray, camera->far_plane, &picked_id, &picked_t))
+        {
+            if (left_clicked)
+            {
+                entities[picked_id].is_visible = !entities[picked_id].is_visible;
+                printf("Picked entity %u at distance %.02f\n", picked_id, picked_t);
+            }
+            else
+            {
+                glm::vec3 hit_point = ray.origin + ray.direction * picked_t;
+                Aabb reveal_bounds = {};
+                reveal_bounds.min = hit_point - glm::vec3(SCENE_REVEAL_RADIUS);
+                reveal_bounds.max = hit_point + glm::vec3(SCENE_REVEAL_RADIUS);
+
+                u32* nearby_ids = (u32*)memory::VMArenaAlloc(&app_memory.render_storage, SCENE_ENTITY_COUNT * sizeof(u32));
+                u32 nearby_count = bvh::QueryAabb(&scene_bvh, reveal_bounds, nearby_ids, SCENE_ENTITY_COUNT);
+                for (u32 i = 0; i < nearby_count; ++i)
+                {
+                    entities[nearby_ids[i]].is_visible = true;
+                }
+                printf("Revealed %u entities around %u\n", nearby_count, picked_id);
+            }
+        }
+    }
+
+    Frustum frustum = bounds::FrustumFromMatrix(view_projection);
+    u32* visible_ids = (u32*)memory::VMArenaAlloc(&app_memory.render_storage, SCENE_ENTITY_COUNT * sizeof(u32));
+    u32 visible_count = bvh::CullFrustum(&scene_bvh, frustum, visible_ids, SCENE_ENTITY_COUNT);
+
+    // Rasterize the walls into the low resolution depth buffer, then test everything
+    // that survived frustum culling against it on the worker threads
+    occlusion::Begin(occlusion_buffer, view_projection, &app_memory.render_storage, SCENE_OCCLUDER_TRIANGLES);
+    for (u32 i = 0; i < visible_count; ++i)
+    {
+        const Entity& entity = entities[visible_ids[i]];
+        if (entity.is_occluder && entity.is_visible)
+        {
+            occlusion::AddOccluder(occlusion_buffer, entity.model, cube_positions, cube_indices, ArrayCount(cube_indices));
+        }
+    }
+    occlusion::Rasterize(occlusion_buffer, app_memory.work_queue);
+
+    u8* unoccluded = (u8*)memory::VMArenaAlloc(&app_memory.render_storage, visible_count + 1);
+    occlusion::TestAabbs(occlusion_buffer, app_memory.work_queue, scene_bvh.prim_bounds.data(), visible_ids, visible_count, unoccluded);
+
+    f32 projection_scale = lod::GetProjectionScale(camera->fov, camera->height);
+
+    // One command per visible entity, plus the sprite overlay
+    RenderCommand* commands = (RenderCommand*)memory::VMArenaAlloc(&app_memory.render_storage, (visible_count + 1) * sizeof(RenderCommand));
+    u32 command_count = 0;
+    for (u32 i = 0; i < visible_count; ++i)
+    {
+        Entity& entity = entities[visible_ids[i]];
+        if (!entity.is_visible || (!entity.is_occluder && !unoccluded[i]))
+        {
+            continue;
+        }
+
+        const Aabb& world_bounds = scene_bvh.prim_bounds[visible_ids[i]];
+        f32 distance = glm::length(bounds::Center(world_bounds) - camera->position);
+        f32 radius = 0.5f * glm::length(world_bounds.max - world_bounds.min);
+        entity.lod = lod::Select(entity.lods, entity.lod_count, distance, radius, projection_scale, entity.lod);
+        if (entity.lod == LOD_CULLED)
+        {
+            continue;
+        }
+
+        RenderCommand* command = &commands[command_count++];
+        command->mode = RenderMode::MESH;
+        command->mesh_cmd.mesh = entity.mesh_id;
+        command->mesh_cmd.shader = shader;
+        command->mesh_cmd.draw_mode = DrawMode::TRIANGLES;
+        command->mesh_cmd.lod = entity.lod;
+        command->mesh_cmd.model = entity.model;
+        command->mesh_cmd.view = view;
+        command->mesh_cmd.projection = projection;
+    }
+    qsort(commands, command_count, sizeof(RenderCommand), CompareMeshCommands);
 
+    RenderCommand* command = &commands[command_count++];
     command->mode = RenderMode::SPRITE;
     command->sprite_cmd.sprite = sprite;
     command->sprite_cmd.shader = shader_2d;
     command->sprite_cmd.model = glm::mat4(1.0f); // Identity matrix
     command->sprite_cmd.projection = glm::mat4(1.0f); // Identity matrix - vertices already in NDC
 
-    render_queue.commands = command;
-    render_queue.command_count = 1;
+    render_queue.commands = commands;
+    render_queue.command_count = command_count;
+    render_queue.light_clusters = light_clusters;
     return render_queue;
 }
@@ -2,12 +2,17 @@
 
 #include "core.h"
 #include "renderer/renderer.h"
+#include "scene/bounds.h"
 #include "app.h"
 
 struct Entity {
-    //vec3 position;
-    //vec3 rotation;
-    MeshHandle mesh_id;
+    glm::mat4 model;
+    Aabb local_bounds;
     //TextureHandle texture_id;
+    MeshHandle mesh_id;
+    const MeshLod* lods;    // LOD chain of mesh_id, finest first
+    u32 lod_count;
+    u32 lod;                // Last selected LOD, kept for hysteresis
     bool is_visible;
+    bool is_occluder;
 };
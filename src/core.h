@@ -58,17 +58,6 @@ constexpr float TARGET_SECONDS_PER_FRAME = (TARGET_MICROSECONDS_PER_FRAME / 1000
 
 #define ArrayCount(array) (sizeof(array) / sizeof((array)[0]))
 
-#define ZeroArray(count, ptr) ZeroSize(count * sizeof((ptr)[0]), ptr)
-
-internal void ZeroSize(size_t size, void* ptr)
-{
-    u8* byte = (u8*)ptr;
-    while (size--)
-    {
-        *byte++ = 0;
-    }
-}
-
 struct Framebuffer
 {
     void* memory;
@@ -76,6 +65,7 @@ struct Framebuffer
     i32 height;
     i32 pitch;
     i32 bytes_per_pixel;
+    struct DirtyRegion* dirty;  // Optional, CPU drawing marks what it touches for the next present
 };
 
 struct ButtonState
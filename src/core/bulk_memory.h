@@ -0,0 +1,410 @@
+#pragma once
+
+#include "core.h"
+#include "core/memory.h"
+#include "core/work_queue.h"
+#include "core/cpu_features.h"
+
+#include <immintrin.h>
+#include <string.h>
+#include <time.h>
+#include <stdio.h>
+
+#define BULK_MEMORY_STREAM_THRESHOLD    Megabytes(4)    // Past this the stores go around the cache, the data would only evict the rest
+#define BULK_MEMORY_PARALLEL_THRESHOLD  Megabytes(8)    // One thread gets most of the bandwidth below this
+#define BULK_MEMORY_CHUNK_SIZE          Megabytes(1)    // Per task, a multiple of the vector width keeps the alignment
+
+#define BULK_BENCHMARK_MIN_BYTES        Gigabytes(1)    // Every size is repeated until at least this much was moved
+
+#define ZeroArray(count, ptr) ZeroSize(count * sizeof((ptr)[0]), ptr)
+
+// The kernel a fill or copy runs with, the public functions pick the widest one the CPU supports
+enum BulkMemoryPath
+{
+    BULK_MEMORY_PATH_SCALAR,    // One element per iteration, what ZeroSize() used to be
+    BULK_MEMORY_PATH_SSE2,      // 64 bytes per iteration
+    BULK_MEMORY_PATH_AVX2,      // 128 bytes per iteration
+    BULK_MEMORY_PATH_COUNT
+};
+
+static const char* bulk_memory_path_names[BULK_MEMORY_PATH_COUNT] = {
+    "scalar",
+    "SSE2",
+    "AVX2",
+};
+
+enum BulkMemoryOp
+{
+    BULK_MEMORY_OP_FILL,
+    BULK_MEMORY_OP_COPY,
+};
+
+struct BulkMemoryJob
+{
+    BulkMemoryOp op;
+    BulkMemoryPath path;
+    u8* dest;
+    const u8* source;
+    size_t size;
+    u32 value;
+    bool stream;
+};
+
+namespace bulk_memory
+{
+
+BulkMemoryPath GetBestPath()
+{
+    const CpuFeatures* features = cpu_features::Get();
+    return features->avx2 ? BULK_MEMORY_PATH_AVX2 : BULK_MEMORY_PATH_SSE2;
+}
+
+// Bytes of a 32-bit pattern laid from a 4 byte aligned base, so a fill can start and end anywhere
+internal void FillBytesScalar(u8* dest, size_t size, u32 value)
+{
+    for (size_t i = 0; i < size; ++i)
+    {
+        dest[i] = (u8)(value >> (8 * ((uintptr_t)(dest + i) & 3)));
+    }
+}
+
+internal void FillSse2(u8* dest, size_t size, u32 value, bool stream)
+{
+    size_t head = (16 - ((uintptr_t)dest & 15)) & 15;
+    head = head < size ? head : size;
+    FillBytesScalar(dest, head, value);
+    dest += head;
+    size -= head;
+
+    __m128i pattern = _mm_set1_epi32((i32)value);
+    size_t blocks = size / 64;
+    if (stream)
+    {
+        for (size_t i = 0; i < blocks; ++i, dest += 64)
+        {
+            _mm_stream_si128((__m128i*)dest, pattern);
+            _mm_stream_si128((__m128i*)(dest + 16), pattern);
+            _mm_stream_si128((__m128i*)(dest + 32), pattern);
+            _mm_stream_si128((__m128i*)(dest + 48), pattern);
+        }
+        _mm_sfence();
+    }
+    else
+    {
+        for (size_t i = 0; i < blocks; ++i, dest += 64)
+        {
+            _mm_store_si128((__m128i*)dest, pattern);
+            _mm_store_si128((__m128i*)(dest + 16), pattern);
+            _mm_store_si128((__m128i*)(dest + 32), pattern);
+            _mm_store_si128((__m128i*)(dest + 48), pattern);
+        }
+    }
+    size -= blocks * 64;
+
+    for (; size >= 16; size -= 16, dest += 16)
+    {
+        _mm_store_si128((__m128i*)dest, pattern);
+    }
+    FillBytesScalar(dest, size, value);
+}
+
+internal void FillAvx2(u8* dest, size_t size, u32 value, bool stream)
+{
+    size_t head = (32 - ((uintptr_t)dest & 31)) & 31;
+    head = head < size ? head : size;
+    FillBytesScalar(dest, head, value);
+    dest += head;
+    size -= head;
+
+    __m256i pattern = _mm256_set1_epi32((i32)value);
+    size_t blocks = size / 128;
+    if (stream)
+    {
+        for (size_t i = 0; i < blocks; ++i, dest += 128)
+        {
+            _mm256_stream_si256((__m256i*)dest, pattern);
+            _mm256_stream_si256((__m256i*)(dest + 32), pattern);
+            _mm256_stream_si256((__m256i*)(dest + 64), pattern);
+            _mm256_stream_si256((__m256i*)(dest + 96), pattern);
+        }
+        _mm_sfence();
+    }
+    else
+    {
+        for (size_t i = 0; i < blocks; ++i, dest += 128)
+        {
+            _mm256_store_si256((__m256i*)dest, pattern);
+            _mm256_store_si256((__m256i*)(dest + 32), pattern);
+            _mm256_store_si256((__m256i*)(dest + 64), pattern);
+            _mm256_store_si256((__m256i*)(dest + 96), pattern);
+        }
+    }
+    size -= blocks * 128;
+
+    for (; size >= 32; size -= 32, dest += 32)
+    {
+        _mm256_store_si256((__m256i*)dest, pattern);
+    }
+    FillBytesScalar(dest, size, value);
+}
+
+// The destination gets aligned, the source is read unaligned
+internal void CopySse2(u8* dest, const u8* source, size_t size, bool stream)
+{
+    size_t head = (16 - ((uintptr_t)dest & 15)) & 15;
+    head = head < size ? head : size;
+    for (size_t i = 0; i < head; ++i) dest[i] = source[i];
+    dest += head;
+    source += head;
+    size -= head;
+
+    size_t blocks = size / 64;
+    for (size_t i = 0; i < blocks; ++i, dest += 64, source += 64)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*)source);
+        __m128i b = _mm_loadu_si128((const __m128i*)(source + 16));
+        __m128i c = _mm_loadu_si128((const __m128i*)(source + 32));
+        __m128i d = _mm_loadu_si128((const __m128i*)(source + 48));
+        if (stream)
+        {
+            _mm_stream_si128((__m128i*)dest, a);
+            _mm_stream_si128((__m128i*)(dest + 16), b);
+            _mm_stream_si128((__m128i*)(dest + 32), c);
+            _mm_stream_si128((__m128i*)(dest + 48), d);
+        }
+        else
+        {
+            _mm_store_si128((__m128i*)dest, a);
+            _mm_store_si128((__m128i*)(dest + 16), b);
+            _mm_store_si128((__m128i*)(dest + 32), c);
+            _mm_store_si128((__m128i*)(dest + 48), d);
+        }
+    }
+    if (stream)
+    {
+        _mm_sfence();
+    }
+    size -= blocks * 64;
+
+    for (; size >= 16; size -= 16, dest += 16, source += 16)
+    {
+        _mm_store_si128((__m128i*)dest, _mm_loadu_si128((const __m128i*)source));
+    }
+    for (size_t i = 0; i < size; ++i) dest[i] = source[i];
+}
+
+internal void CopyAvx2(u8* dest, const u8* source, size_t size, bool stream)
+{
+    size_t head = (32 - ((uintptr_t)dest & 31)) & 31;
+    head = head < size ? head : size;
+    for (size_t i = 0; i < head; ++i) dest[i] = source[i];
+    dest += head;
+    source += head;
+    size -= head;
+
+    size_t blocks = size / 128;
+    for (size_t i = 0; i < blocks; ++i, dest += 128, source += 128)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i*)source);
+        __m256i b = _mm256_loadu_si256((const __m256i*)(source + 32));
+        __m256i c = _mm256_loadu_si256((const __m256i*)(source + 64));
+        __m256i d = _mm256_loadu_si256((const __m256i*)(source + 96));
+        if (stream)
+        {
+            _mm256_stream_si256((__m256i*)dest, a);
+            _mm256_stream_si256((__m256i*)(dest + 32), b);
+            _mm256_stream_si256((__m256i*)(dest + 64), c);
+            _mm256_stream_si256((__m256i*)(dest + 96), d);
+        }
+        else
+        {
+            _mm256_store_si256((__m256i*)dest, a);
+            _mm256_store_si256((__m256i*)(dest + 32), b);
+            _mm256_store_si256((__m256i*)(dest + 64), c);
+            _mm256_store_si256((__m256i*)(dest + 96), d);
+        }
+    }
+    if (stream)
+    {
+        _mm_sfence();
+    }
+    size -= blocks * 128;
+
+    for (; size >= 32; size -= 32, dest += 32, source += 32)
+    {
+        _mm256_store_si256((__m256i*)dest, _mm256_loadu_si256((const __m256i*)source));
+    }
+    for (size_t i = 0; i < size; ++i) dest[i] = source[i];
+}
+
+internal void RunKernel(const BulkMemoryJob* job, u8* dest, const u8* source, size_t size)
+{
+    if (job->op == BULK_MEMORY_OP_COPY)
+    {
+        switch (job->path)
+        {
+            case BULK_MEMORY_PATH_AVX2: CopyAvx2(dest, source, size, job->stream); break;
+            case BULK_MEMORY_PATH_SSE2: CopySse2(dest, source, size, job->stream); break;
+            default: for (size_t i = 0; i < size; ++i) dest[i] = source[i]; break;
+        }
+    }
+    else
+    {
+        switch (job->path)
+        {
+            case BULK_MEMORY_PATH_AVX2: FillAvx2(dest, size, job->value, job->stream); break;
+            case BULK_MEMORY_PATH_SSE2: FillSse2(dest, size, job->value, job->stream); break;
+            default: FillBytesScalar(dest, size, job->value); break;
+        }
+    }
+}
+
+internal void RunChunks(void* data, u32 begin, u32 end)
+{
+    const BulkMemoryJob* job = (const BulkMemoryJob*)data;
+    size_t offset = (size_t)begin * BULK_MEMORY_CHUNK_SIZE;
+    size_t end_offset = (size_t)end * BULK_MEMORY_CHUNK_SIZE;
+    end_offset = end_offset < job->size ? end_offset : job->size;
+    RunKernel(job, job->dest + offset, job->source ? job->source + offset : nullptr, end_offset - offset);
+}
+
+// Large buffers are split in chunks over the queue when there is one, everything else runs here
+internal void Run(BulkMemoryJob* job, WorkQueue* queue)
+{
+    job->stream = job->size >= BULK_MEMORY_STREAM_THRESHOLD;
+    if (!queue || job->size < BULK_MEMORY_PARALLEL_THRESHOLD)
+    {
+        RunKernel(job, job->dest, job->source, job->size);
+        return;
+    }
+
+    u32 chunk_count = (u32)((job->size + BULK_MEMORY_CHUNK_SIZE - 1) / BULK_MEMORY_CHUNK_SIZE);
+    work_queue::ParallelFor(queue, chunk_count, 1, RunChunks, job);
+}
+
+void FillWithPath(void* dest, size_t size, u32 value, WorkQueue* queue, BulkMemoryPath path)
+{
+    BulkMemoryJob job = {};
+    job.op = BULK_MEMORY_OP_FILL;
+    job.path = path;
+    job.dest = (u8*)dest;
+    job.size = size;
+    job.value = value;
+    Run(&job, queue);
+}
+
+void CopyWithPath(void* dest, const void* source, size_t size, WorkQueue* queue, BulkMemoryPath path)
+{
+    BulkMemoryJob job = {};
+    job.op = BULK_MEMORY_OP_COPY;
+    job.path = path;
+    job.dest = (u8*)dest;
+    job.source = (const u8*)source;
+    job.size = size;
+    Run(&job, queue);
+}
+
+// dest has to be 4 byte aligned
+void Fill32(u32* dest, u32 value, size_t count, WorkQueue* queue)
+{
+    Assert(((uintptr_t)dest & 3) == 0);
+    FillWithPath(dest, count * sizeof(u32), value, queue, GetBestPath());
+}
+
+void Clear(void* dest, size_t size, WorkQueue* queue)
+{
+    FillWithPath(dest, size, 0, queue, GetBestPath());
+}
+
+// The ranges must not overlap
+void Copy(void* dest, const void* source, size_t size, WorkQueue* queue)
+{
+    Assert((const u8*)dest + size <= (const u8*)source || (const u8*)source + size <= (const u8*)dest);
+    CopyWithPath(dest, source, size, queue, GetBestPath());
+}
+
+internal f64 GetBenchmarkSeconds()
+{
+    timespec now;
+    timespec_get(&now, TIME_UTC);
+    return (f64)now.tv_sec + (f64)now.tv_nsec * 1e-9;
+}
+
+// Gigabytes per second written, the fill or copy repeated until enough bytes went through
+internal f32 RunBenchmarkPass(u8* dest, const u8* source, size_t size, WorkQueue* queue, i32 path)
+{
+    u32 repeat_count = size < BULK_BENCHMARK_MIN_BYTES ? (u32)(BULK_BENCHMARK_MIN_BYTES / size) : 1;
+    f64 start = GetBenchmarkSeconds();
+    for (u32 i = 0; i < repeat_count; ++i)
+    {
+        if (path < 0)
+        {
+            if (source) memcpy(dest, source, size);
+            else memset(dest, 0, size);
+        }
+        else if (source)
+        {
+            CopyWithPath(dest, source, size, queue, (BulkMemoryPath)path);
+        }
+        else
+        {
+            FillWithPath(dest, size, 0, queue, (BulkMemoryPath)path);
+        }
+    }
+    f64 seconds = GetBenchmarkSeconds() - start;
+    return (f32)((f64)size * (f64)repeat_count / 1e9 / (seconds > 1e-9 ? seconds : 1e-9));
+}
+
+// Clears and copies cache sized to framebuffer sized buffers with every path the CPU has, single threaded
+// and on the queue, and prints GB/s next to the CRT memset and memcpy
+void Benchmark(WorkQueue* queue, VMArena* scratch_arena)
+{
+    local const size_t sizes[] = { Kilobytes(64), Megabytes(1), 3840 * 2160 * 4, Megabytes(256) };
+    size_t max_size = sizes[ArrayCount(sizes) - 1];
+    u8* source = (u8*)memory::VMArenaAllocAligned(scratch_arena, max_size, 64);
+    u8* dest = (u8*)memory::VMArenaAllocAligned(scratch_arena, max_size, 64);
+    if (!source || !dest)
+    {
+        printf("Bulk memory benchmark: not enough scratch memory\n");
+        return;
+    }
+
+    // Commit the pages up front, first touch page faults would dominate the first pass
+    memset(source, 1, max_size);
+    memset(dest, 0, max_size);
+
+    BulkMemoryPath best_path = GetBestPath();
+    for (u32 op = BULK_MEMORY_OP_FILL; op <= BULK_MEMORY_OP_COPY; ++op)
+    {
+        const char* op_name = op == BULK_MEMORY_OP_FILL ? "clear" : "copy ";
+        const u8* op_source = op == BULK_MEMORY_OP_FILL ? nullptr : source;
+        for (u32 s = 0; s < ArrayCount(sizes); ++s)
+        {
+            size_t size = sizes[s];
+            f32 crt = RunBenchmarkPass(dest, op_source, size, nullptr, -1);
+            printf("Bulk %s %8zu KB  %-6s 1 thread : %6.2f GB/s\n", op_name, size / 1024, op == BULK_MEMORY_OP_FILL ? "memset" : "memcpy", crt);
+
+            // The byte loop is too slow for the big sizes to be worth the wait
+            u32 first_path = size <= Megabytes(1) ? (u32)BULK_MEMORY_PATH_SCALAR : (u32)BULK_MEMORY_PATH_SSE2;
+            for (u32 path = first_path; path <= (u32)best_path; ++path)
+            {
+                f32 single = RunBenchmarkPass(dest, op_source, size, nullptr, (i32)path);
+                printf("Bulk %s %8zu KB  %-6s 1 thread : %6.2f GB/s, %.2fx CRT\n", op_name, size / 1024, bulk_memory_path_names[path], single, single / crt);
+            }
+            if (size >= BULK_MEMORY_PARALLEL_THRESHOLD)
+            {
+                f32 threaded = RunBenchmarkPass(dest, op_source, size, queue, (i32)best_path);
+                printf("Bulk %s %8zu KB  %-6s %u threads: %6.2f GB/s, %.2fx CRT\n", op_name, size / 1024, bulk_memory_path_names[best_path],
+                       work_queue::GetWorkerCount(queue) + 1, threaded, threaded / crt);
+            }
+        }
+    }
+}
+
+} // namespace bulk_memory
+
+// Kept for the existing callers, single threaded so jobs can use it too
+internal void ZeroSize(size_t size, void* ptr)
+{
+    bulk_memory::Clear(ptr, size, nullptr);
+}
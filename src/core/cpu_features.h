@@ -0,0 +1,88 @@
+#pragma once
+
+#include "core.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+// Instruction sets the SIMD kernels can pick from at runtime. The build targets plain x64,
+// so anything past SSE2 is only used when both the CPU and the OS (saved YMM/ZMM state) support it.
+struct CpuFeatures
+{
+    bool sse41;
+    bool avx2;
+    bool fma;
+    bool f16c;
+    bool avx512f;
+    bool avx512bw;
+    bool is_detected;
+};
+
+global CpuFeatures g_cpu_features;
+
+namespace cpu_features
+{
+
+internal void ReadCpuid(u32 leaf, u32 subleaf, u32* registers)
+{
+#if defined(_MSC_VER)
+    int values[4];
+    __cpuidex(values, (int)leaf, (int)subleaf);
+    for (u32 i = 0; i < 4; ++i) registers[i] = (u32)values[i];
+#else
+    __cpuid_count(leaf, subleaf, registers[0], registers[1], registers[2], registers[3]);
+#endif
+}
+
+internal u64 ReadXcr0()
+{
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    u32 low, high;
+    __asm__ volatile("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+    return ((u64)high << 32) | low;
+#endif
+}
+
+// Detects on the first call, make that one from the main thread before any job uses the result
+const CpuFeatures* Get()
+{
+    if (g_cpu_features.is_detected)
+    {
+        return &g_cpu_features;
+    }
+
+    u32 leaf0[4];
+    u32 leaf1[4] = {};
+    u32 leaf7[4] = {};
+    ReadCpuid(0, 0, leaf0);
+    if (leaf0[0] >= 1) ReadCpuid(1, 0, leaf1);
+    if (leaf0[0] >= 7) ReadCpuid(7, 0, leaf7);
+
+    bool os_saves_ymm = false;
+    bool os_saves_zmm = false;
+    if (leaf1[2] & (1u << 27)) // OSXSAVE
+    {
+        u64 xcr0 = ReadXcr0();
+        os_saves_ymm = (xcr0 & 0x06) == 0x06;
+        os_saves_zmm = (xcr0 & 0xE6) == 0xE6;
+    }
+
+    CpuFeatures features = {};
+    features.sse41 = (leaf1[2] & (1u << 19)) != 0;
+    features.avx2 = os_saves_ymm && (leaf1[2] & (1u << 28)) && (leaf7[1] & (1u << 5));
+    features.fma = os_saves_ymm && (leaf1[2] & (1u << 12));
+    features.f16c = os_saves_ymm && (leaf1[2] & (1u << 29));
+    features.avx512f = os_saves_zmm && (leaf7[1] & (1u << 16));
+    features.avx512bw = features.avx512f && (leaf7[1] & (1u << 30));
+    features.is_detected = true;
+
+    g_cpu_features = features;
+    return &g_cpu_features;
+}
+
+} // namespace cpu_features
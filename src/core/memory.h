@@ -21,10 +21,14 @@ struct VMArena
     size_t curr_offset;       // Current allocation bump pointer
 };
 
+struct WorkQueue;
+
 struct Memory
 {
     VMArena permanent_storage;
     VMArena render_storage;
+
+    WorkQueue* work_queue;  // Owned by the platform layer, shared with the app for parallel work
 };
 
 namespace memory
@@ -96,6 +100,18 @@ void* VMArenaAlloc(VMArena* a, size_t size)
     return ptr;
 }
 
+// Alignment must be a power of two. The arena base is page aligned, so only the offset needs padding.
+void* VMArenaAllocAligned(VMArena* a, size_t size, size_t alignment)
+{
+    size_t padding = (alignment - (a->curr_offset & (alignment - 1))) & (alignment - 1);
+    unsigned char* ptr = (unsigned char*)VMArenaAlloc(a, size + padding);
+    if (!ptr)
+    {
+        return nullptr;
+    }
+    return ptr + padding;
+}
+
 void VMArenaReset(VMArena* a)
 {
     a->curr_offset = 0;
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "core.h"
+
+#define WORK_QUEUE_MAX_ENTRIES      256
+#define WORK_QUEUE_MAX_WORKERS      64
+#define PARALLEL_FOR_TASKS_PER_THREAD   4
+
+// Opaque, the platform layer owns the threads
+struct WorkQueue;
+
+typedef void WorkQueueCallback(WorkQueue* queue, void* data);
+typedef void ParallelForCallback(void* data, u32 begin, u32 end);
+
+struct ParallelForTask
+{
+    ParallelForCallback* callback;
+    void* data;
+    u32 begin;
+    u32 end;
+};
+
+namespace work_queue
+{
+
+// The Interface - Functions implemented by the platform layer.
+// Entries are added from the main thread only; CompleteAllWork() makes the
+// calling thread help drain the queue until every entry has finished.
+internal void AddEntry(WorkQueue* queue, WorkQueueCallback* callback, void* data);
+internal void CompleteAllWork(WorkQueue* queue);
+internal u32 GetWorkerCount(WorkQueue* queue);
+
+internal void ParallelForEntry(WorkQueue* queue, void* data)
+{
+    ParallelForTask* task = (ParallelForTask*)data;
+    task->callback(task->data, task->begin, task->end);
+}
+
+// Splits [0, count) into batches of at least min_batch items and blocks until all
+// of them ran. Falls back to a plain call without a queue or for small counts.
+void ParallelFor(WorkQueue* queue, u32 count, u32 min_batch, ParallelForCallback* callback, void* data)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    if (!queue || count <= min_batch)
+    {
+        callback(data, 0, count);
+        return;
+    }
+
+    u32 task_count = (GetWorkerCount(queue) + 1) * PARALLEL_FOR_TASKS_PER_THREAD;
+    u32 max_tasks = (count + min_batch - 1) / min_batch;
+    if (task_count > max_tasks) task_count = max_tasks;
+    if (task_count > WORK_QUEUE_MAX_ENTRIES / 2) task_count = WORK_QUEUE_MAX_ENTRIES / 2;
+
+    ParallelForTask tasks[WORK_QUEUE_MAX_ENTRIES / 2];
+    u32 batch = (count + task_count - 1) / task_count;
+    u32 begin = 0;
+    for (u32 i = 0; i < task_count && begin < count; ++i)
+    {
+        ParallelForTask& task = tasks[i];
+        task.callback = callback;
+        task.data = data;
+        task.begin = begin;
+        task.end = (begin + batch < count) ? begin + batch : count;
+        begin = task.end;
+        AddEntry(queue, ParallelForEntry, &task);
+    }
+
+    CompleteAllWork(queue);
+}
+
+} // namespace work_queue
@@ -0,0 +1,1077 @@
+#pragma once
+
+#include "core.h"
+#include "core/memory.h"
+#include "core/work_queue.h"
+#include "renderer/renderer.h"
+#include "utils/handmade_math.h"
+
+#include <immintrin.h>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define BC_BLOCK_DIM            4
+#define BC_BLOCK_TEXELS         (BC_BLOCK_DIM * BC_BLOCK_DIM)
+#define BC1_ALPHA_THRESHOLD     128.0f  // BC1 texels with less alpha use the transparent index
+#define BC4_HIGH_SEARCH_RADIUS  4       // Endpoint offsets tried around the min/max at HIGH quality
+#define BC_MAX_PSNR             100.0   // Reported for lossless blocks instead of infinity
+#define BC_BENCHMARK_SIZE       512
+
+enum class CompressionQuality
+{
+    FAST,       // Principal axis endpoints only
+    NORMAL,     // Plus one least squares refinement pass
+    HIGH        // Plus several refinement passes and a wider single channel search
+};
+
+// One 4x4 block of texels stored channel by channel, so four texels go through SSE at once
+struct BcBlock
+{
+    alignas(16) f32 channel[4][BC_BLOCK_TEXELS];
+    alignas(16) f32 weight[BC_BLOCK_TEXELS]; // 0 for texels that must not count towards the error
+};
+
+struct BcColorResult
+{
+    u16 color0;
+    u16 color1;
+    u8 indices[BC_BLOCK_TEXELS];
+    f32 error;
+};
+
+struct Bc7Mode6Result
+{
+    u8 endpoint[2][4];  // 7 bits per channel, the p-bit supplies the low bit
+    u8 pbit[2];
+    u8 indices[BC_BLOCK_TEXELS];
+    f32 error;
+};
+
+struct BcCompressJob
+{
+    TextureFormat format;
+    CompressionQuality quality;
+    const u8* pixels;
+    i32 width;
+    i32 height;
+    u8* out;
+    u32 blocks_x;
+    u32 block_bytes;
+};
+
+namespace block_compression
+{
+
+global const char* texture_format_names[] = { "RGBA8", "BC1", "BC3", "BC4", "BC5", "BC7" };
+
+// How far from endpoint 0 towards endpoint 1 each index sits
+global const f32 bc1_four_color_weights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+global const f32 bc1_three_color_weights[4] = { 0.0f, 1.0f, 0.5f, 0.0f };
+global const u32 bc7_index_weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+u32 GetBlockBytes(TextureFormat format)
+{
+    switch (format)
+    {
+        case TextureFormat::BC1:
+        case TextureFormat::BC4:
+            return 8;
+        case TextureFormat::BC3:
+        case TextureFormat::BC5:
+        case TextureFormat::BC7:
+            return 16;
+        default:
+            return 0;
+    }
+}
+
+u32 GetCompressedSize(TextureFormat format, i32 width, i32 height)
+{
+    u32 blocks_x = (u32)(width + BC_BLOCK_DIM - 1) / BC_BLOCK_DIM;
+    u32 blocks_y = (u32)(height + BC_BLOCK_DIM - 1) / BC_BLOCK_DIM;
+    return blocks_x * blocks_y * GetBlockBytes(format);
+}
+
+internal u32 GetRefinementPasses(CompressionQuality quality)
+{
+    switch (quality)
+    {
+        case CompressionQuality::FAST:   return 0;
+        case CompressionQuality::NORMAL: return 1;
+        default:                         return 4;
+    }
+}
+
+// Gathers a 4x4 block, repeating the last row/column for blocks hanging over the edge
+internal void LoadBlock(const u8* pixels, i32 width, i32 height, i32 block_x, i32 block_y, BcBlock* block)
+{
+    for (i32 y = 0; y < BC_BLOCK_DIM; ++y)
+    {
+        i32 source_y = MinInt(block_y * BC_BLOCK_DIM + y, height - 1);
+        for (i32 x = 0; x < BC_BLOCK_DIM; ++x)
+        {
+            i32 source_x = MinInt(block_x * BC_BLOCK_DIM + x, width - 1);
+            const u8* texel = pixels + ((size_t)source_y * width + source_x) * 4;
+            i32 i = y * BC_BLOCK_DIM + x;
+            for (u32 c = 0; c < 4; ++c)
+            {
+                block->channel[c][i] = (f32)texel[c];
+            }
+            block->weight[i] = 1.0f;
+        }
+    }
+}
+
+// Writes the closest palette entry for every texel over channels [first_channel, first_channel + channel_count)
+// and returns the weighted squared error. Palette entries are indexed by absolute channel.
+internal f32 FindClosestIndices(const BcBlock* block, u32 first_channel, u32 channel_count,
+                                const f32 palette[][4], u32 palette_count, u8* indices)
+{
+    __m128 total_error = _mm_setzero_ps();
+    for (u32 i = 0; i < BC_BLOCK_TEXELS; i += 4)
+    {
+        __m128 best_error = _mm_set1_ps(FLT_MAX);
+        __m128 best_index = _mm_setzero_ps();
+        for (u32 p = 0; p < palette_count; ++p)
+        {
+            __m128 error = _mm_setzero_ps();
+            for (u32 c = first_channel; c < first_channel + channel_count; ++c)
+            {
+                __m128 delta = _mm_sub_ps(_mm_load_ps(&block->channel[c][i]), _mm_set1_ps(palette[p][c]));
+                error = _mm_add_ps(error, _mm_mul_ps(delta, delta));
+            }
+
+            __m128 closer = _mm_cmplt_ps(error, best_error);
+            best_error = _mm_min_ps(error, best_error);
+            best_index = _mm_or_ps(_mm_and_ps(closer, _mm_set1_ps((f32)p)), _mm_andnot_ps(closer, best_index));
+        }
+
+        total_error = _mm_add_ps(total_error, _mm_mul_ps(best_error, _mm_load_ps(&block->weight[i])));
+
+        alignas(16) i32 lanes[4];
+        _mm_store_si128((__m128i*)lanes, _mm_cvttps_epi32(best_index));
+        for (u32 lane = 0; lane < 4; ++lane)
+        {
+            indices[i + lane] = (u8)lanes[lane];
+        }
+    }
+
+    alignas(16) f32 sums[4];
+    _mm_store_ps(sums, total_error);
+    return sums[0] + sums[1] + sums[2] + sums[3];
+}
+
+// Line through the weighted texels: their mean and the dominant direction of the
+// covariance matrix, found by power iteration. The axis is zero for flat blocks.
+internal void FitPrincipalAxis(const BcBlock* block, u32 channel_count, f32* mean, f32* axis)
+{
+    f32 total_weight = 0.0f;
+    for (u32 c = 0; c < channel_count; ++c)
+    {
+        mean[c] = 0.0f;
+        axis[c] = 0.0f;
+    }
+    for (u32 i = 0; i < BC_BLOCK_TEXELS; ++i)
+    {
+        total_weight += block->weight[i];
+        for (u32 c = 0; c < channel_count; ++c)
+        {
+            mean[c] += block->weight[i] * block->channel[c][i];
+        }
+    }
+    if (total_weight <= 0.0f)
+    {
+        return;
+    }
+    for (u32 c = 0; c < channel_count; ++c)
+    {
+        mean[c] /= total_weight;
+    }
+
+    f32 covariance[4][4] = {};
+    for (u32 i = 0; i < BC_BLOCK_TEXELS; ++i)
+    {
+        f32 delta[4];
+        for (u32 c = 0; c < channel_count; ++c)
+        {
+            delta[c] = block->channel[c][i] - mean[c];
+        }
+        for (u32 a = 0; a < channel_count; ++a)
+        {
+            for (u32 b = 0; b < channel_count; ++b)
+            {
+                covariance[a][b] += block->weight[i] * delta[a] * delta[b];
+            }
+        }
+    }
+
+    // Start from the row of the channel with the most variance, it can't be orthogonal to the answer
+    u32 start = 0;
+    for (u32 c = 1; c < channel_count; ++c)
+    {
+        if (covariance[c][c] > covariance[start][start]) start = c;
+    }
+    if (covariance[start][start] < 1e-4f)
+    {
+        return;
+    }
+
+    f32 direction[4];
+    for (u32 c = 0; c < channel_count; ++c)
+    {
+        direction[c] = covariance[start][c];
+    }
+    for (u32 iteration = 0; iteration < 8; ++iteration)
+    {
+        f32 next[4] = {};
+        f32 length_sq = 0.0f;
+        for (u32 a = 0; a < channel_count; ++a)
+        {
+            for (u32 b = 0; b < channel_count; ++b)
+            {
+                next[a] += covariance[a][b] * direction[b];
+            }
+            length_sq += next[a] * next[a];
+        }
+        if (length_sq < 1e-12f)
+        {
+            break;
+        }
+        f32 inv_length = 1.0f / sqrtf(length_sq);
+        for (u32 c = 0; c < channel_count; ++c)
+        {
+            direction[c] = next[c] * inv_length;
+        }
+    }
+
+    for (u32 c = 0; c < channel_count; ++c)
+    {
+        axis[c] = direction[c];
+    }
+}
+
+// Endpoints at the extreme projections of the weighted texels onto the principal axis
+internal void FitEndpoints(const BcBlock* block, u32 channel_count, f32* endpoint0, f32* endpoint1)
+{
+    f32 mean[4];
+    f32 axis[4];
+    FitPrincipalAxis(block, channel_count, mean, axis);
+
+    f32 min_t = FLT_MAX;
+    f32 max_t = -FLT_MAX;
+    for (u32 i = 0; i < BC_BLOCK_TEXELS; ++i)
+    {
+        if (block->weight[i] <= 0.0f) continue;
+
+        f32 t = 0.0f;
+        for (u32 c = 0; c < channel_count; ++c)
+        {
+            t += (block->channel[c][i] - mean[c]) * axis[c];
+        }
+        min_t = MinFloat(min_t, t);
+        max_t = MaxFloat(max_t, t);
+    }
+    if (min_t > max_t)
+    {
+        min_t = max_t = 0.0f;
+    }
+
+    for (u32 c = 0; c < channel_count; ++c)
+    {
+        endpoint0[c] = mean[c] + axis[c] * min_t;
+        endpoint1[c] = mean[c] + axis[c] * max_t;
+    }
+}
+
+// Least squares endpoints that best reproduce the texels given their current indices.
+// Returns false when every texel sits on the same index and the system is singular.
+internal bool SolveEndpoints(const BcBlock* block, u32 channel_count, const u8* indices, const f32* index_weights,
+                             f32* endpoint0, f32* endpoint1)
+{
+    f32 aa = 0.0f;
+    f32 ab = 0.0f;
+    f32 bb = 0.0f;
+    f32 ax[4] = {};
+    f32 bx[4] = {};
+    for (u32 i = 0; i < BC_BLOCK_TEXELS; ++i)
+    {
+        f32 w = block->weight[i];
+        if (w <= 0.0f) continue;
+
+        f32 b = index_weights[indices[i]];
+        f32 a = 1.0f - b;
+        aa += w * a * a;
+        ab += w * a * b;
+        bb += w * b * b;
+        for (u32 c = 0; c < channel_count; ++c)
+        {
+            ax[c] += w * a * block->channel[c][i];
+            bx[c] += w * b * block->channel[c][i];
+        }
+    }
+
+    f32 determinant = aa * bb - ab * ab;
+    if (fabsf(determinant) < 1e-6f)
+    {
+        return false;
+    }
+
+    f32 inv_determinant = 1.0f / determinant;
+    for (u32 c = 0; c < channel_count; ++c)
+    {
+        endpoint0[c] = (ax[c] * bb - bx[c] * ab) * inv_determinant;
+        endpoint1[c] = (bx[c] * aa - ax[c] * ab) * inv_determinant;
+    }
+    return true;
+}
+
+internal u32 QuantizeChannel(f32 value, u32 max_value)
+{
+    f32 clamped = MinFloat(MaxFloat(value, 0.0f), 255.0f);
+    return RoundFloatToUInt(clamped * (f32)max_value / 255.0f);
+}
+
+internal u16 PackColor565(const f32* color)
+{
+    u32 r = QuantizeChannel(color[0], 31);
+    u32 g = QuantizeChannel(color[1], 63);
+    u32 b = QuantizeChannel(color[2], 31);
+    return (u16)((r << 11) | (g << 5) | b);
+}
+
+internal void UnpackColor565(u16 packed, f32* color)
+{
+    u32 r = (packed >> 11) & 31;
+    u32 g = (packed >> 5) & 63;
+    u32 b = packed & 31;
+    color[0] = (f32)((r << 3) | (r >> 2));
+    color[1] = (f32)((g << 2) | (g >> 4));
+    color[2] = (f32)((b << 3) | (b >> 2));
+    color[3] = 0.0f;
+}
+
+// Quantizes the endpoints and picks the texel indices. The endpoint order selects the
+// decoder mode: color0 > color1 is four colors, otherwise three colors plus transparent.
+internal void EvaluateColorEndpoints(const BcBlock* block, const f32* endpoint0, const f32* endpoint1,
+                                     bool three_color, BcColorResult* result)
+{
+    u16 color0 = PackColor565(endpoint0);
+    u16 color1 = PackColor565(endpoint1);
+    if (three_color)
+    {
+        if (color0 > color1)
+        {
+            u16 swap = color0; color0 = color1; color1 = swap;
+        }
+    }
+    else if (color0 < color1)
+    {
+        u16 swap = color0; color0 = color1; color1 = swap;
+    }
+    else if (color0 == color1)
+    {
+        // Equal endpoints would put the decoder in three color mode, nudge one by a step
+        if (color1 > 0) --color1;
+        else ++color0;
+    }
+
+    f32 palette[4][4];
+    UnpackColor565(color0, palette[0]);
+    UnpackColor565(color1, palette[1]);
+    u32 palette_count = 4;
+    for (u32 c = 0; c < 3; ++c)
+    {
+        if (three_color)
+        {
+            palette[2][c] = (palette[0][c] + palette[1][c]) * 0.5f;
+        }
+        else
+        {
+            palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+            palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+        }
+    }
+    if (three_color)
+    {
+        palette_count = 3;
+    }
+
+    result->color0 = color0;
+    result->color1 = color1;
+    result->error = FindClosestIndices(block, 0, 3, palette, palette_count, result->indices);
+}
+
+// BC1 color block (also the second half of BC3). With allow_transparent, texels below
+// the alpha threshold switch the block to three color mode and use index 3.
+internal void EncodeColorBlock(BcBlock* block, CompressionQuality quality, bool allow_transparent, u8* out)
+{
+    bool three_color = false;
+    bool any_opaque = false;
+    for (u32 i = 0; i < BC_BLOCK_TEXELS; ++i)
+    {
+        bool transparent = allow_transparent && block->channel[3][i] < BC1_ALPHA_THRESHOLD;
+        block->weight[i] = transparent ? 0.0f : 1.0f;
+        three_color |= transparent;
+        any_opaque |= !transparent;
+    }
+
+    u16 color0 = 0;
+    u16 color1 = 0;
+    u32 index_bits = 0xFFFFFFFF; // Fully transparent block
+    if (any_opaque)
+    {
+        f32 endpoint0[4];
+        f32 endpoint1[4];
+        FitEndpoints(block, 3, endpoint0, endpoint1);
+
+        BcColorResult best;
+        EvaluateColorEndpoints(block, endpoint0, endpoint1, three_color, &best);
+
+        const f32* index_weights = three_color ? bc1_three_color_weights : bc1_four_color_weights;
+        u32 passes = GetRefinementPasses(quality);
+        for (u32 pass = 0; pass < passes; ++pass)
+        {
+            if (!SolveEndpoints(block, 3, best.indices, index_weights, endpoint0, endpoint1))
+            {
+                break;
+            }
+
+            BcColorResult candidate;
+            EvaluateColorEndpoints(block, endpoint0, endpoint1, three_color, &candidate);
+            if (candidate.error >= best.error)
+            {
+                break;
+            }
+            best = candidate;
+        }
+
+        color0 = best.color0;
+        color1 = best.color1;
+        index_bits = 0;
+        for (u32 i = 0; i < BC_BLOCK_TEXELS; ++i)
+        {
+            u32 index = block->weight[i] > 0.0f ? best.indices[i] : 3;
+            index_bits |= index << (2 * i);
+        }
+    }
+
+    out[0] = (u8)(color0 & 0xFF);
+    out[1] = (u8)(color0 >> 8);
+    out[2] = (u8)(color1 & 0xFF);
+    out[3] = (u8)(color1 >> 8);
+    out[4] = (u8)(index_bits & 0xFF);
+    out[5] = (u8)((index_bits >> 8) & 0xFF);
+    out[6] = (u8)((index_bits >> 16) & 0xFF);
+    out[7] = (u8)(index_bits >> 24);
+}
+
+// endpoint0 > endpoint1 interpolates 8 values, otherwise 6 values plus exact 0 and 255
+internal f32 EvaluateSingleChannelEndpoints(const BcBlock* block, u32 channel, u32 endpoint0, u32 endpoint1, u8* indices)
+{
+    f32 palette[8][4];
+    f32 e0 = (f32)endpoint0;
+    f32 e1 = (f32)endpoint1;
+    palette[0][channel] = e0;
+    palette[1][channel] = e1;
+    if (endpoint0 > endpoint1)
+    {
+        for (u32 i = 1; i < 7; ++i)
+        {
+            palette[1 + i][channel] = ((f32)(7 - i) * e0 + (f32)i * e1) / 7.0f;
+        }
+    }
+    else
+    {
+        for (u32 i = 1; i < 5; ++i)
+        {
+            palette[1 + i][channel] = ((f32)(5 - i) * e0 + (f32)i * e1) / 5.0f;
+        }
+        palette[6][channel] = 0.0f;
+        palette[7][channel] = 255.0f;
+    }
+
+    return FindClosestIndices(block, channel, 1, palette, 8, indices);
+}
+
+// BC4 block for one channel (also the alpha half of BC3 and both halves of BC5)
+internal void EncodeSingleChannelBlock(BcBlock* block, u32 channel, CompressionQuality quality, u8* out)
+{
+    f32 min_value = 255.0f;
+    f32 max_value = 0.0f;
+    f32 inner_min = 255.0f;  // Ignoring the 0 and 255 the six value mode gets for free
+    f32 inner_max = 0.0f;
+    bool has_extremes = false;
+    for (u32 i = 0; i < BC_BLOCK_TEXELS; ++i)
+    {
+        f32 value = block->channel[channel][i];
+        block->weight[i] = 1.0f;
+        min_value = MinFloat(min_value, value);
+        max_value = MaxFloat(max_value, value);
+        if (value == 0.0f || value == 255.0f)
+        {
+            has_extremes = true;
+        }
+        else
+        {
+            inner_min = MinFloat(inner_min, value);
+            inner_max = MaxFloat(inner_max, value);
+        }
+    }
+
+    u32 best_endpoint0 = (u32)max_value;
+    u32 best_endpoint1 = (u32)min_value;
+    u8 best_indices[BC_BLOCK_TEXELS];
+    f32 best_error = EvaluateSingleChannelEndpoints(block, channel, best_endpoint0, best_endpoint1, best_indices);
+
+    u8 indices[BC_BLOCK_TEXELS];
+    if (quality != CompressionQuality::FAST && has_extremes && inner_min <= inner_max)
+    {
+        f32 error = EvaluateSingleChannelEndpoints(block, channel, (u32)inner_min, (u32)inner_max, indices);
+        if (error < best_error)
+        {
+            best_error = error;
+            best_endpoint0 = (u32)inner_min;
+            best_endpoint1 = (u32)inner_max;
+            memcpy(best_indices, indices, sizeof(indices));
+        }
+    }
+
+    if (quality == CompressionQuality::HIGH && best_error > 0.0f)
+    {
+        // Pulling the endpoints inwards often lands the interpolated values closer to the texels
+        i32 base0 = (i32)max_value;
+        i32 base1 = (i32)min_value;
+        for (i32 offset0 = -BC4_HIGH_SEARCH_RADIUS; offset0 <= BC4_HIGH_SEARCH_RADIUS; ++offset0)
+        {
+            for (i32 offset1 = -BC4_HIGH_SEARCH_RADIUS; offset1 <= BC4_HIGH_SEARCH_RADIUS; ++offset1)
+            {
+                i32 endpoint0 = base0 + offset0;
+                i32 endpoint1 = base1 + offset1;
+                if (endpoint0 > 255 || endpoint1 < 0 || endpoint0 <= endpoint1) continue;
+
+                f32 error = EvaluateSingleChannelEndpoints(block, channel, (u32)endpoint0, (u32)endpoint1, indices);
+                if (error < best_error)
+                {
+                    best_error = error;
+                    best_endpoint0 = (u32)endpoint0;
+                    best_endpoint1 = (u32)endpoint1;
+                    memcpy(best_indices, indices, sizeof(indices));
+                }
+            }
+        }
+    }
+
+    u64 index_bits = 0;
+    for (u32 i = 0; i < BC_BLOCK_TEXELS; ++i)
+    {
+        index_bits |= (u64)best_indices[i] << (3 * i);
+    }
+
+    out[0] = (u8)best_endpoint0;
+    out[1] = (u8)best_endpoint1;
+    for (u32 i = 0; i < 6; ++i)
+    {
+        out[2 + i] = (u8)(index_bits >> (8 * i));
+    }
+}
+
+// Tries the four p-bit combinations for a pair of endpoints, keeping the best in result
+internal void EvaluateBc7Mode6Endpoints(const BcBlock* block, const f32* endpoint0, const f32* endpoint1, Bc7Mode6Result* result)
+{
+    for (u32 p0 = 0; p0 < 2; ++p0)
+    {
+        for (u32 p1 = 0; p1 < 2; ++p1)
+        {
+            Bc7Mode6Result candidate;
+            candidate.pbit[0] = (u8)p0;
+            candidate.pbit[1] = (u8)p1;
+
+            f32 palette[16][4];
+            for (u32 c = 0; c < 4; ++c)
+            {
+                u32 q0 = (u32)MinInt(MaxInt(RoundFloatToInt((endpoint0[c] - (f32)p0) * 0.5f), 0), 127);
+                u32 q1 = (u32)MinInt(MaxInt(RoundFloatToInt((endpoint1[c] - (f32)p1) * 0.5f), 0), 127);
+                candidate.endpoint[0][c] = (u8)q0;
+                candidate.endpoint[1][c] = (u8)q1;
+
+                u32 value0 = (q0 << 1) | p0;
+                u32 value1 = (q1 << 1) | p1;
+                for (u32 i = 0; i < 16; ++i)
+                {
+                    u32 w = bc7_index_weights[i];
+                    palette[i][c] = (f32)(((64 - w) * value0 + w * value1 + 32) >> 6);
+                }
+            }
+
+            candidate.error = FindClosestIndices(block, 0, 4, palette, 16, candidate.indices);
+            if (candidate.error < result->error)
+            {
+                *result = candidate;
+            }
+        }
+    }
+}
+
+internal void PutBits(u8* out, u32* bit_position, u32 value, u32 bit_count)
+{
+    for (u32 i = 0; i < bit_count; ++i)
+    {
+        u32 bit = *bit_position + i;
+        out[bit >> 3] |= (u8)(((value >> i) & 1) << (bit & 7));
+    }
+    *bit_position += bit_count;
+}
+
+// BC7 using mode 6 only: one subset, RGBA 7.7.7.7 endpoints with a p-bit each, 4 bit indices.
+// It covers opaque and alpha blocks alike; the partitioned modes would do better on blocks
+// with several distinct colors.
+internal void EncodeBc7Block(BcBlock* block, CompressionQuality quality, u8* out)
+{
+    for (u32 i = 0; i < BC_BLOCK_TEXELS; ++i)
+    {
+        block->weight[i] = 1.0f;
+    }
+
+    f32 endpoint0[4];
+    f32 endpoint1[4];
+    FitEndpoints(block, 4, endpoint0, endpoint1);
+
+    Bc7Mode6Result best;
+    best.error = FLT_MAX;
+    EvaluateBc7Mode6Endpoints(block, endpoint0, endpoint1, &best);
+
+    f32 index_weights[16];
+    for (u32 i = 0; i < 16; ++i)
+    {
+        index_weights[i] = (f32)bc7_index_weights[i] / 64.0f;
+    }
+
+    u32 passes = GetRefinementPasses(quality);
+    for (u32 pass = 0; pass < passes; ++pass)
+    {
+        if (!SolveEndpoints(block, 4, best.indices, index_weights, endpoint0, endpoint1))
+        {
+            break;
+        }
+
+        f32 previous_error = best.error;
+        EvaluateBc7Mode6Endpoints(block, endpoint0, endpoint1, &best);
+        if (best.error >= previous_error)
+        {
+            break;
+        }
+    }
+
+    // The first index drops its top bit, so it must be below 8: flip the endpoints if not
+    if (best.indices[0] >= 8)
+    {
+        for (u32 c = 0; c < 4; ++c)
+        {
+            u8 swap = best.endpoint[0][c];
+            best.endpoint[0][c] = best.endpoint[1][c];
+            best.endpoint[1][c] = swap;
+        }
+        u8 swap = best.pbit[0];
+        best.pbit[0] = best.pbit[1];
+        best.pbit[1] = swap;
+        for (u32 i = 0; i < BC_BLOCK_TEXELS; ++i)
+        {
+            best.indices[i] = (u8)(15 - best.indices[i]);
+        }
+    }
+
+    memset(out, 0, 16);
+    u32 bit_position = 0;
+    PutBits(out, &bit_position, 1 << 6, 7); // Mode 6: six zero bits then a one
+    for (u32 c = 0; c < 4; ++c)
+    {
+        PutBits(out, &bit_position, best.endpoint[0][c], 7);
+        PutBits(out, &bit_position, best.endpoint[1][c], 7);
+    }
+    PutBits(out, &bit_position, best.pbit[0], 1);
+    PutBits(out, &bit_position, best.pbit[1], 1);
+    PutBits(out, &bit_position, best.indices[0], 3);
+    for (u32 i = 1; i < BC_BLOCK_TEXELS; ++i)
+    {
+        PutBits(out, &bit_position, best.indices[i], 4);
+    }
+}
+
+// Encodes one block, out must hold GetBlockBytes(format) bytes. The block is used as scratch.
+void CompressBlock(TextureFormat format, CompressionQuality quality, BcBlock* block, u8* out)
+{
+    switch (format)
+    {
+        case TextureFormat::BC1:
+            EncodeColorBlock(block, quality, true, out);
+            break;
+        case TextureFormat::BC3:
+            EncodeSingleChannelBlock(block, 3, quality, out);
+            EncodeColorBlock(block, quality, false, out + 8);
+            break;
+        case TextureFormat::BC4:
+            EncodeSingleChannelBlock(block, 0, quality, out);
+            break;
+        case TextureFormat::BC5:
+            EncodeSingleChannelBlock(block, 0, quality, out);
+            EncodeSingleChannelBlock(block, 1, quality, out + 8);
+            break;
+        case TextureFormat::BC7:
+            EncodeBc7Block(block, quality, out);
+            break;
+        default:
+            break;
+    }
+}
+
+internal void CompressBlockRows(void* data, u32 begin, u32 end)
+{
+    BcCompressJob* job = (BcCompressJob*)data;
+    for (u32 block_y = begin; block_y < end; ++block_y)
+    {
+        u8* out = job->out + (size_t)block_y * job->blocks_x * job->block_bytes;
+        for (u32 block_x = 0; block_x < job->blocks_x; ++block_x)
+        {
+            BcBlock block;
+            LoadBlock(job->pixels, job->width, job->height, (i32)block_x, (i32)block_y, &block);
+            CompressBlock(job->format, job->quality, &block, out);
+            out += job->block_bytes;
+        }
+    }
+}
+
+// Encodes a tightly packed RGBA8 image, spreading rows of blocks over the work queue
+// (or running on the calling thread without one). out must hold GetCompressedSize() bytes.
+void Compress(WorkQueue* queue, TextureFormat format, CompressionQuality quality,
+              const u8* pixels, i32 width, i32 height, u8* out)
+{
+    BcCompressJob job = {};
+    job.format = format;
+    job.quality = quality;
+    job.pixels = pixels;
+    job.width = width;
+    job.height = height;
+    job.out = out;
+    job.blocks_x = (u32)(width + BC_BLOCK_DIM - 1) / BC_BLOCK_DIM;
+    job.block_bytes = GetBlockBytes(format);
+    if (job.block_bytes == 0 || width <= 0 || height <= 0)
+    {
+        return;
+    }
+
+    u32 blocks_y = (u32)(height + BC_BLOCK_DIM - 1) / BC_BLOCK_DIM;
+    work_queue::ParallelFor(queue, blocks_y, 1, CompressBlockRows, &job);
+}
+
+// How many of the RGBA channels the format stores, the rest decode to 0 (alpha to 255)
+u32 GetChannelCount(TextureFormat format)
+{
+    switch (format)
+    {
+        case TextureFormat::BC4: return 1;
+        case TextureFormat::BC5: return 2;
+        default:                 return 4;
+    }
+}
+
+internal u32 GetBits(const u8* in, u32* bit_position, u32 bit_count)
+{
+    u32 value = 0;
+    for (u32 i = 0; i < bit_count; ++i)
+    {
+        u32 bit = *bit_position + i;
+        value |= (u32)((in[bit >> 3] >> (bit & 7)) & 1) << i;
+    }
+    *bit_position += bit_count;
+    return value;
+}
+
+// BC1 color block. BC3 color halves always use the four color palette, whatever the endpoint order.
+internal void DecodeColorBlock(const u8* in, bool allow_three_color, u8 (*out)[4])
+{
+    u16 color0 = (u16)(in[0] | (in[1] << 8));
+    u16 color1 = (u16)(in[2] | (in[3] << 8));
+    u32 index_bits = (u32)in[4] | ((u32)in[5] << 8) | ((u32)in[6] << 16) | ((u32)in[7] << 24);
+    bool three_color = allow_three_color && color0 <= color1;
+
+    f32 endpoint0[4];
+    f32 endpoint1[4];
+    UnpackColor565(color0, endpoint0);
+    UnpackColor565(color1, endpoint1);
+    u8 palette[4][4];
+    for (u32 c = 0; c < 3; ++c)
+    {
+        palette[0][c] = (u8)endpoint0[c];
+        palette[1][c] = (u8)endpoint1[c];
+        if (three_color)
+        {
+            palette[2][c] = (u8)RoundFloatToUInt((endpoint0[c] + endpoint1[c]) * 0.5f);
+            palette[3][c] = 0;
+        }
+        else
+        {
+            palette[2][c] = (u8)RoundFloatToUInt((2.0f * endpoint0[c] + endpoint1[c]) / 3.0f);
+            palette[3][c] = (u8)RoundFloatToUInt((endpoint0[c] + 2.0f * endpoint1[c]) / 3.0f);
+        }
+    }
+    palette[0][3] = 255;
+    palette[1][3] = 255;
+    palette[2][3] = 255;
+    palette[3][3] = three_color ? 0 : 255;
+
+    for (u32 i = 0; i < BC_BLOCK_TEXELS; ++i)
+    {
+        memcpy(out[i], palette[(index_bits >> (2 * i)) & 3], 4);
+    }
+}
+
+internal void DecodeSingleChannelBlock(const u8* in, u32 channel, u8 (*out)[4])
+{
+    u32 endpoint0 = in[0];
+    u32 endpoint1 = in[1];
+    u8 palette[8];
+    palette[0] = (u8)endpoint0;
+    palette[1] = (u8)endpoint1;
+    if (endpoint0 > endpoint1)
+    {
+        for (u32 i = 1; i < 7; ++i)
+        {
+            palette[1 + i] = (u8)(((7 - i) * endpoint0 + i * endpoint1 + 3) / 7);
+        }
+    }
+    else
+    {
+        for (u32 i = 1; i < 5; ++i)
+        {
+            palette[1 + i] = (u8)(((5 - i) * endpoint0 + i * endpoint1 + 2) / 5);
+        }
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+
+    u64 index_bits = 0;
+    for (u32 i = 0; i < 6; ++i)
+    {
+        index_bits |= (u64)in[2 + i] << (8 * i);
+    }
+    for (u32 i = 0; i < BC_BLOCK_TEXELS; ++i)
+    {
+        out[i][channel] = palette[(index_bits >> (3 * i)) & 7];
+    }
+}
+
+// Mode 6 only, the one EncodeBc7Block writes. Other modes decode to transparent black.
+internal void DecodeBc7Block(const u8* in, u8 (*out)[4])
+{
+    if ((in[0] & 0x7F) != (1 << 6))
+    {
+        memset(out, 0, BC_BLOCK_TEXELS * 4);
+        return;
+    }
+
+    u32 bit_position = 7;
+    u32 endpoint[2][4];
+    for (u32 c = 0; c < 4; ++c)
+    {
+        endpoint[0][c] = GetBits(in, &bit_position, 7);
+        endpoint[1][c] = GetBits(in, &bit_position, 7);
+    }
+    u32 pbit0 = GetBits(in, &bit_position, 1);
+    u32 pbit1 = GetBits(in, &bit_position, 1);
+    for (u32 c = 0; c < 4; ++c)
+    {
+        endpoint[0][c] = (endpoint[0][c] << 1) | pbit0;
+        endpoint[1][c] = (endpoint[1][c] << 1) | pbit1;
+    }
+
+    for (u32 i = 0; i < BC_BLOCK_TEXELS; ++i)
+    {
+        u32 w = bc7_index_weights[GetBits(in, &bit_position, i == 0 ? 3 : 4)];
+        for (u32 c = 0; c < 4; ++c)
+        {
+            out[i][c] = (u8)(((64 - w) * endpoint[0][c] + w * endpoint[1][c] + 32) >> 6);
+        }
+    }
+}
+
+// Decodes one block into 4x4 RGBA8 texels, row by row
+void DecompressBlock(TextureFormat format, const u8* in, u8 (*out)[4])
+{
+    for (u32 i = 0; i < BC_BLOCK_TEXELS; ++i)
+    {
+        out[i][0] = 0;
+        out[i][1] = 0;
+        out[i][2] = 0;
+        out[i][3] = 255;
+    }
+
+    switch (format)
+    {
+        case TextureFormat::BC1:
+            DecodeColorBlock(in, true, out);
+            break;
+        case TextureFormat::BC3:
+            DecodeColorBlock(in + 8, false, out);
+            DecodeSingleChannelBlock(in, 3, out);
+            break;
+        case TextureFormat::BC4:
+            DecodeSingleChannelBlock(in, 0, out);
+            break;
+        case TextureFormat::BC5:
+            DecodeSingleChannelBlock(in, 0, out);
+            DecodeSingleChannelBlock(in + 8, 1, out);
+            break;
+        case TextureFormat::BC7:
+            DecodeBc7Block(in, out);
+            break;
+        default:
+            break;
+    }
+}
+
+// Decodes a whole image into tightly packed RGBA8, e.g. for a backend that can't sample the blocks
+void Decompress(TextureFormat format, const u8* blocks, i32 width, i32 height, u8* out)
+{
+    u32 block_bytes = GetBlockBytes(format);
+    if (block_bytes == 0 || width <= 0 || height <= 0)
+    {
+        return;
+    }
+
+    i32 blocks_x = (width + BC_BLOCK_DIM - 1) / BC_BLOCK_DIM;
+    i32 blocks_y = (height + BC_BLOCK_DIM - 1) / BC_BLOCK_DIM;
+    for (i32 block_y = 0; block_y < blocks_y; ++block_y)
+    {
+        for (i32 block_x = 0; block_x < blocks_x; ++block_x)
+        {
+            u8 texels[BC_BLOCK_TEXELS][4];
+            DecompressBlock(format, blocks, texels);
+            blocks += block_bytes;
+
+            i32 rows = MinInt(BC_BLOCK_DIM, height - block_y * BC_BLOCK_DIM);
+            i32 columns = MinInt(BC_BLOCK_DIM, width - block_x * BC_BLOCK_DIM);
+            for (i32 y = 0; y < rows; ++y)
+            {
+                u8* row = out + ((size_t)(block_y * BC_BLOCK_DIM + y) * (size_t)width + (size_t)(block_x * BC_BLOCK_DIM)) * 4;
+                memcpy(row, texels[y * BC_BLOCK_DIM], (size_t)columns * 4);
+            }
+        }
+    }
+}
+
+// PSNR in dB of the encoded image against its tightly packed RGBA8 source, over the channels
+// the format stores. BC1 alpha counts as well: partial alpha is something it can't keep.
+f64 MeasurePsnr(TextureFormat format, const u8* pixels, i32 width, i32 height, const u8* blocks)
+{
+    u32 block_bytes = GetBlockBytes(format);
+    if (block_bytes == 0 || width <= 0 || height <= 0)
+    {
+        return BC_MAX_PSNR;
+    }
+
+    u32 channel_count = GetChannelCount(format);
+    i32 blocks_x = (width + BC_BLOCK_DIM - 1) / BC_BLOCK_DIM;
+    i32 blocks_y = (height + BC_BLOCK_DIM - 1) / BC_BLOCK_DIM;
+    u64 squared_error = 0;
+    for (i32 block_y = 0; block_y < blocks_y; ++block_y)
+    {
+        for (i32 block_x = 0; block_x < blocks_x; ++block_x)
+        {
+            u8 texels[BC_BLOCK_TEXELS][4];
+            DecompressBlock(format, blocks, texels);
+            blocks += block_bytes;
+
+            i32 rows = MinInt(BC_BLOCK_DIM, height - block_y * BC_BLOCK_DIM);
+            i32 columns = MinInt(BC_BLOCK_DIM, width - block_x * BC_BLOCK_DIM);
+            for (i32 y = 0; y < rows; ++y)
+            {
+                const u8* source = pixels + ((size_t)(block_y * BC_BLOCK_DIM + y) * (size_t)width + (size_t)(block_x * BC_BLOCK_DIM)) * 4;
+                for (i32 x = 0; x < columns; ++x)
+                {
+                    for (u32 c = 0; c < channel_count; ++c)
+                    {
+                        i32 delta = (i32)source[x * 4 + (i32)c] - (i32)texels[y * BC_BLOCK_DIM + x][c];
+                        squared_error += (u64)(delta * delta);
+                    }
+                }
+            }
+        }
+    }
+
+    if (squared_error == 0)
+    {
+        return BC_MAX_PSNR;
+    }
+    f64 mse = (f64)squared_error / ((f64)width * (f64)height * (f64)channel_count);
+    f64 psnr = 10.0 * log10(255.0 * 255.0 / mse);
+    return psnr < BC_MAX_PSNR ? psnr : BC_MAX_PSNR;
+}
+
+internal f64 GetBenchmarkSeconds()
+{
+    timespec now;
+    timespec_get(&now, TIME_UTC);
+    return (f64)now.tv_sec + (f64)now.tv_nsec * 1e-9;
+}
+
+// Encodes a synthetic image with every format and preset on the queue and prints megapixels
+// per second and the PSNR against the source, decoded back on the CPU
+void Benchmark(WorkQueue* queue, VMArena* scratch_arena)
+{
+    size_t arena_offset = scratch_arena->curr_offset;
+    u8* pixels = (u8*)memory::VMArenaAlloc(scratch_arena, (size_t)BC_BENCHMARK_SIZE * BC_BENCHMARK_SIZE * 4);
+    u8* blocks = (u8*)memory::VMArenaAlloc(scratch_arena, GetCompressedSize(TextureFormat::BC7, BC_BENCHMARK_SIZE, BC_BENCHMARK_SIZE));
+    if (!pixels || !blocks)
+    {
+        printf("Block compression benchmark: not enough scratch memory\n");
+        return;
+    }
+
+    // Smooth ramps with a little noise, hard edged squares and a soft alpha disc, like sprite art
+    u32 seed = 0x9E3779B9u;
+    for (u32 y = 0; y < BC_BENCHMARK_SIZE; ++y)
+    {
+        for (u32 x = 0; x < BC_BENCHMARK_SIZE; ++x)
+        {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            u32 noise = seed & 7;
+            bool square = ((x / 48) + (y / 48)) % 3 == 0;
+            f32 dx = ((f32)x + 0.5f) / (f32)BC_BENCHMARK_SIZE - 0.5f;
+            f32 dy = ((f32)y + 0.5f) / (f32)BC_BENCHMARK_SIZE - 0.5f;
+            f32 coverage = MinFloat(MaxFloat((0.5f - sqrtf(dx * dx + dy * dy)) * 8.0f, 0.0f), 1.0f);
+
+            u8* texel = pixels + ((size_t)y * BC_BENCHMARK_SIZE + x) * 4;
+            texel[0] = (u8)(square ? 230 : (x / 2 + noise));
+            texel[1] = (u8)(square ? 40 : (y / 2 + noise));
+            texel[2] = (u8)((x + y) / 4 + noise);
+            texel[3] = (u8)(coverage * 255.0f);
+        }
+    }
+
+    local const TextureFormat formats[] = { TextureFormat::BC1, TextureFormat::BC3, TextureFormat::BC4, TextureFormat::BC5, TextureFormat::BC7 };
+    local const char* quality_names[] = { "fast", "normal", "high" };
+    printf("Block compression %dx%d, %u threads\n", BC_BENCHMARK_SIZE, BC_BENCHMARK_SIZE, queue ? work_queue::GetWorkerCount(queue) + 1 : 1);
+    for (u32 f = 0; f < ArrayCount(formats); ++f)
+    {
+        for (u32 quality = 0; quality < ArrayCount(quality_names); ++quality)
+        {
+            f64 start = GetBenchmarkSeconds();
+            Compress(queue, formats[f], (CompressionQuality)quality, pixels, BC_BENCHMARK_SIZE, BC_BENCHMARK_SIZE, blocks);
+            f64 seconds = GetBenchmarkSeconds() - start;
+
+            f64 megapixels = (f64)BC_BENCHMARK_SIZE * BC_BENCHMARK_SIZE / 1000000.0;
+            f64 psnr = MeasurePsnr(formats[f], pixels, BC_BENCHMARK_SIZE, BC_BENCHMARK_SIZE, blocks);
+            printf("Block compression %s %-6s: %8.1f MP/s, %6.2f dB\n", texture_format_names[(u32)formats[f]], quality_names[quality],
+                   megapixels / (seconds > 1e-9 ? seconds : 1e-9), psnr);
+        }
+    }
+
+    scratch_arena->curr_offset = arena_offset;
+}
+
+} // namespace block_compression
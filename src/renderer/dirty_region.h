@@ -0,0 +1,224 @@
+#pragma once
+
+#include "core.h"
+#include "utils/handmade_math.h"
+
+#define DIRTY_TILE_SIZE         32      // Pixels
+#define DIRTY_MAX_DIMENSION     4096
+#define DIRTY_MAX_TILES         (DIRTY_MAX_DIMENSION / DIRTY_TILE_SIZE)
+#define DIRTY_TILE_WORDS        (DIRTY_MAX_TILES / 64)
+#define DIRTY_MAX_RECTS         16      // What BuildRects() merges down to
+#define DIRTY_MAX_RAW_RECTS     128     // Past this many runs everything merges into the bounds
+
+// Min inclusive, max exclusive, in pixels from the top-left like the framebuffer rows
+struct DirtyRect
+{
+    i32 min_x;
+    i32 min_y;
+    i32 max_x;
+    i32 max_y;
+};
+
+// Which parts of a framebuffer changed since the last present, one bit per tile
+struct DirtyRegion
+{
+    i32 width;
+    i32 height;
+    i32 tiles_x;
+    i32 tiles_y;
+    u64 rows[DIRTY_MAX_TILES][DIRTY_TILE_WORDS];
+};
+
+namespace dirty_region
+{
+
+void MarkAll(DirtyRegion* region)
+{
+    for (i32 y = 0; y < region->tiles_y; ++y)
+    {
+        for (i32 x = 0; x < region->tiles_x; ++x)
+        {
+            region->rows[y][x / 64] |= 1ull << (x % 64);
+        }
+    }
+}
+
+// Everything starts dirty, nothing has been presented at the new size yet
+void Init(DirtyRegion* region, i32 width, i32 height)
+{
+    Assert(width <= DIRTY_MAX_DIMENSION && height <= DIRTY_MAX_DIMENSION);
+    *region = {};
+    region->width = width;
+    region->height = height;
+    region->tiles_x = (width + DIRTY_TILE_SIZE - 1) / DIRTY_TILE_SIZE;
+    region->tiles_y = (height + DIRTY_TILE_SIZE - 1) / DIRTY_TILE_SIZE;
+    MarkAll(region);
+}
+
+// Not thread safe: tiles share words, mark from one thread once the drawing is done
+void MarkRect(DirtyRegion* region, i32 min_x, i32 min_y, i32 max_x, i32 max_y)
+{
+    min_x = MaxInt(min_x, 0);
+    min_y = MaxInt(min_y, 0);
+    max_x = MinInt(max_x, region->width);
+    max_y = MinInt(max_y, region->height);
+    if (min_x >= max_x || min_y >= max_y)
+    {
+        return;
+    }
+
+    i32 tile_x0 = min_x / DIRTY_TILE_SIZE;
+    i32 tile_x1 = (max_x - 1) / DIRTY_TILE_SIZE;
+    for (i32 y = min_y / DIRTY_TILE_SIZE; y <= (max_y - 1) / DIRTY_TILE_SIZE; ++y)
+    {
+        for (i32 x = tile_x0; x <= tile_x1; ++x)
+        {
+            region->rows[y][x / 64] |= 1ull << (x % 64);
+        }
+    }
+}
+
+void Reset(DirtyRegion* region)
+{
+    for (i32 y = 0; y < region->tiles_y; ++y)
+    {
+        for (u32 word = 0; word < DIRTY_TILE_WORDS; ++word)
+        {
+            region->rows[y][word] = 0;
+        }
+    }
+}
+
+internal bool IsTileDirty(const DirtyRegion* region, i32 x, i32 y)
+{
+    return (region->rows[y][x / 64] >> (x % 64)) & 1;
+}
+
+internal i64 GetRectArea(const DirtyRect& rect)
+{
+    return (i64)(rect.max_x - rect.min_x) * (i64)(rect.max_y - rect.min_y);
+}
+
+internal DirtyRect GetRectUnion(const DirtyRect& a, const DirtyRect& b)
+{
+    DirtyRect result = {};
+    result.min_x = MinInt(a.min_x, b.min_x);
+    result.min_y = MinInt(a.min_y, b.min_y);
+    result.max_x = MaxInt(a.max_x, b.max_x);
+    result.max_y = MaxInt(a.max_y, b.max_y);
+    return result;
+}
+
+// Bounds of every dirty tile, false when there is none
+internal bool GetDirtyBounds(const DirtyRegion* region, DirtyRect* bounds)
+{
+    bool found = false;
+    for (i32 y = 0; y < region->tiles_y; ++y)
+    {
+        for (i32 x = 0; x < region->tiles_x; ++x)
+        {
+            if (!IsTileDirty(region, x, y))
+            {
+                continue;
+            }
+
+            DirtyRect tile = { x * DIRTY_TILE_SIZE, y * DIRTY_TILE_SIZE,
+                               MinInt((x + 1) * DIRTY_TILE_SIZE, region->width), MinInt((y + 1) * DIRTY_TILE_SIZE, region->height) };
+            *bounds = found ? GetRectUnion(*bounds, tile) : tile;
+            found = true;
+        }
+    }
+    return found;
+}
+
+// Turns the dirty tiles into at most max_count rects in pixels and returns how many.
+// Runs of tiles on a row become rects, which grow down while the next row has the same run;
+// past max_count the pair whose union adds the least clean area is merged, one at a time.
+u32 BuildRects(const DirtyRegion* region, DirtyRect* rects, u32 max_count)
+{
+    Assert(max_count > 0);
+    DirtyRect raw[DIRTY_MAX_RAW_RECTS];
+    u32 count = 0;
+
+    for (i32 y = 0; y < region->tiles_y; ++y)
+    {
+        u32 row_start = count;
+        i32 x = 0;
+        while (x < region->tiles_x)
+        {
+            if (!IsTileDirty(region, x, y))
+            {
+                ++x;
+                continue;
+            }
+
+            i32 run_begin = x;
+            while (x < region->tiles_x && IsTileDirty(region, x, y))
+            {
+                ++x;
+            }
+
+            DirtyRect run = {};
+            run.min_x = run_begin * DIRTY_TILE_SIZE;
+            run.min_y = y * DIRTY_TILE_SIZE;
+            run.max_x = MinInt(x * DIRTY_TILE_SIZE, region->width);
+            run.max_y = MinInt((y + 1) * DIRTY_TILE_SIZE, region->height);
+
+            // Only rects that reached the previous row can take it
+            bool extended = false;
+            for (u32 i = 0; i < row_start; ++i)
+            {
+                if (raw[i].min_x == run.min_x && raw[i].max_x == run.max_x && raw[i].max_y == run.min_y)
+                {
+                    raw[i].max_y = run.max_y;
+                    extended = true;
+                    break;
+                }
+            }
+            if (extended)
+            {
+                continue;
+            }
+
+            // Scattered noise, merging it pairwise would cost more than presenting the bounds
+            if (count == DIRTY_MAX_RAW_RECTS)
+            {
+                GetDirtyBounds(region, &rects[0]);
+                return 1;
+            }
+            raw[count++] = run;
+        }
+    }
+
+    while (count > max_count)
+    {
+        u32 best_a = 0;
+        u32 best_b = 1;
+        i64 best_cost = 0;
+        bool has_best = false;
+        for (u32 a = 0; a < count; ++a)
+        {
+            for (u32 b = a + 1; b < count; ++b)
+            {
+                i64 cost = GetRectArea(GetRectUnion(raw[a], raw[b])) - GetRectArea(raw[a]) - GetRectArea(raw[b]);
+                if (!has_best || cost < best_cost)
+                {
+                    best_cost = cost;
+                    best_a = a;
+                    best_b = b;
+                    has_best = true;
+                }
+            }
+        }
+        raw[best_a] = GetRectUnion(raw[best_a], raw[best_b]);
+        raw[best_b] = raw[--count];
+    }
+
+    for (u32 i = 0; i < count; ++i)
+    {
+        rects[i] = raw[i];
+    }
+    return count;
+}
+
+} // namespace dirty_region
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "core.h"
+#include "utils/handmade_math.h"
+
+#include <math.h>
+
+#define DYNAMIC_RESOLUTION_SMOOTHING        0.1f    // Weight of the newest frame time
+#define DYNAMIC_RESOLUTION_DOWN_THRESHOLD   0.95f   // Fraction of the budget that triggers a downscale
+#define DYNAMIC_RESOLUTION_UP_THRESHOLD     0.80f   // Fraction of the budget that allows an upscale
+#define DYNAMIC_RESOLUTION_UP_STEP          0.02f
+#define DYNAMIC_RESOLUTION_COOLDOWN_FRAMES  8       // GPU timings lag a few frames behind the scale change
+
+struct DynamicResolution
+{
+    f32 min_scale;
+    f32 max_scale;
+    f32 target_ms;
+    f32 smoothed_ms;
+    f32 scale;              // Fraction of the window resolution along each axis
+    u32 cooldown;
+};
+
+namespace dynamic_resolution
+{
+
+void Init(DynamicResolution* controller, f32 min_scale, f32 max_scale, f32 target_ms)
+{
+    controller->min_scale = min_scale;
+    controller->max_scale = max_scale;
+    controller->target_ms = target_ms;
+    controller->smoothed_ms = target_ms * DYNAMIC_RESOLUTION_UP_THRESHOLD;
+    controller->scale = max_scale;
+    controller->cooldown = 0;
+}
+
+// Feeds one measured frame time and returns the scale to render the next frame at.
+// Cost is roughly proportional to the pixel count, so going down jumps straight to the
+// scale predicted to fit the budget; going up creeps so that it doesn't oscillate.
+f32 Update(DynamicResolution* controller, f32 frame_ms)
+{
+    controller->smoothed_ms += (frame_ms - controller->smoothed_ms) * DYNAMIC_RESOLUTION_SMOOTHING;
+    if (controller->cooldown > 0)
+    {
+        --controller->cooldown;
+        return controller->scale;
+    }
+
+    f32 scale = controller->scale;
+    if (controller->smoothed_ms > controller->target_ms * DYNAMIC_RESOLUTION_DOWN_THRESHOLD)
+    {
+        f32 pixel_ratio = (controller->target_ms * DYNAMIC_RESOLUTION_UP_THRESHOLD) / controller->smoothed_ms;
+        scale *= sqrtf(pixel_ratio);
+    }
+    else if (controller->smoothed_ms < controller->target_ms * DYNAMIC_RESOLUTION_UP_THRESHOLD)
+    {
+        scale += DYNAMIC_RESOLUTION_UP_STEP;
+    }
+
+    scale = MinFloat(MaxFloat(scale, controller->min_scale), controller->max_scale);
+    if (scale != controller->scale)
+    {
+        // Assume the new scale lands proportionally so the next decision isn't based on stale timings
+        f32 area_ratio = (scale * scale) / (controller->scale * controller->scale);
+        controller->smoothed_ms *= area_ratio;
+        controller->scale = scale;
+        controller->cooldown = DYNAMIC_RESOLUTION_COOLDOWN_FRAMES;
+    }
+    return controller->scale;
+}
+
+} // namespace dynamic_resolution
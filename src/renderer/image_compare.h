@@ -0,0 +1,316 @@
+#pragma once
+
+#include "core.h"
+#include "core/memory.h"
+#include "core/work_queue.h"
+#include "renderer/pixel_convert.h"
+#include "utils/handmade_math.h"
+
+#include <emmintrin.h>
+#include <math.h>
+
+#define IMAGE_COMPARE_ROWS_PER_TASK     16
+#define IMAGE_COMPARE_MAX_PSNR          100.0   // Reported for identical images instead of infinity
+#define IMAGE_COMPARE_FLUSH_INTERVAL    4096    // Iterations before the 32-bit squared error lanes could overflow
+
+// SSIM over the luma in 8x8 windows every 4 pixels, uniform weights
+#define IMAGE_SSIM_WINDOW               8
+#define IMAGE_SSIM_STRIDE               4
+#define IMAGE_SSIM_C1                   (0.01f * 255.0f * 0.01f * 255.0f)
+#define IMAGE_SSIM_C2                   (0.03f * 255.0f * 0.03f * 255.0f)
+
+// Only the color channels count: alpha in a readback is whatever the backend left there
+struct ImageCompareResult
+{
+    f64 psnr;               // In dB over the RGB channels
+    f64 ssim;               // Mean over the windows, 1 when identical
+    u32 differing_pixels;   // Pixels with a channel off by more than the tolerance
+    u32 max_difference;     // Largest channel difference anywhere
+};
+
+struct ImageDifferenceJob
+{
+    const PixelImage* a;
+    const PixelImage* b;
+    u32 tolerance;
+    u64* row_squared_error;
+    u32* row_differing_pixels;
+    u32* row_max_difference;
+};
+
+struct ImageLumaJob
+{
+    const PixelImage* image;
+    f32* luma;
+};
+
+struct ImageSsimJob
+{
+    const f32* luma_a;
+    const f32* luma_b;
+    i32 width;
+    u32 windows_x;
+    f64* row_ssim;
+};
+
+namespace image_compare
+{
+
+// Set bits in a 4-bit mask, there is no POPCNT in the baseline
+global const u8 image_compare_bit_count[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+
+internal __m128i AbsDifference(__m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+}
+
+internal u64 HorizontalSum(__m128i value)
+{
+    alignas(16) u32 lanes[4];
+    _mm_store_si128((__m128i*)lanes, value);
+    return (u64)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+// Squared error, pixels over the tolerance and the largest difference, one entry per row
+internal void DifferenceRows(void* data, u32 begin, u32 end)
+{
+    ImageDifferenceJob* job = (ImageDifferenceJob*)data;
+    i32 width = job->a->width;
+    __m128i color_mask = _mm_set1_epi32(0x00FFFFFF);
+    __m128i tolerance = _mm_set1_epi8((char)MinInt((i32)job->tolerance, 255));
+    __m128i zero = _mm_setzero_si128();
+
+    for (u32 y = begin; y < end; ++y)
+    {
+        const u8* row_a = (const u8*)job->a->pixels + (size_t)y * (size_t)job->a->pitch;
+        const u8* row_b = (const u8*)job->b->pixels + (size_t)y * (size_t)job->b->pitch;
+        __m128i squared_sum = _mm_setzero_si128();     // Each lane grows by at most 4 * 255^2 per iteration
+        __m128i max_difference = _mm_setzero_si128();
+        u64 squared_error = 0;
+        u32 differing = 0;
+        u32 iterations = 0;
+
+        i32 x = 0;
+        for (; x + 4 <= width; x += 4)
+        {
+            __m128i a = _mm_and_si128(_mm_loadu_si128((const __m128i*)(row_a + x * 4)), color_mask);
+            __m128i b = _mm_and_si128(_mm_loadu_si128((const __m128i*)(row_b + x * 4)), color_mask);
+            __m128i difference = AbsDifference(a, b);
+            max_difference = _mm_max_epu8(max_difference, difference);
+
+            __m128i low = _mm_unpacklo_epi8(difference, zero);
+            __m128i high = _mm_unpackhi_epi8(difference, zero);
+            squared_sum = _mm_add_epi32(squared_sum, _mm_add_epi32(_mm_madd_epi16(low, low), _mm_madd_epi16(high, high)));
+
+            // A pixel is over the tolerance when any of its bytes still is after subtracting it
+            __m128i over = _mm_subs_epu8(difference, tolerance);
+            differing += 4 - image_compare_bit_count[_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(over, zero)))];
+
+            if (++iterations == IMAGE_COMPARE_FLUSH_INTERVAL)
+            {
+                squared_error += HorizontalSum(squared_sum);
+                squared_sum = _mm_setzero_si128();
+                iterations = 0;
+            }
+        }
+
+        alignas(16) u8 maxima[16];
+        _mm_store_si128((__m128i*)maxima, max_difference);
+        squared_error += HorizontalSum(squared_sum);
+        u32 row_max = 0;
+        for (u32 i = 0; i < 16; ++i)
+        {
+            row_max = maxima[i] > row_max ? maxima[i] : row_max;
+        }
+
+        for (; x < width; ++x)
+        {
+            bool is_over = false;
+            for (i32 c = 0; c < 3; ++c)
+            {
+                i32 difference = (i32)row_a[x * 4 + c] - (i32)row_b[x * 4 + c];
+                u32 magnitude = (u32)(difference < 0 ? -difference : difference);
+                squared_error += (u64)(magnitude * magnitude);
+                row_max = magnitude > row_max ? magnitude : row_max;
+                is_over |= magnitude > job->tolerance;
+            }
+            differing += is_over ? 1 : 0;
+        }
+
+        job->row_squared_error[y] = squared_error;
+        job->row_differing_pixels[y] = differing;
+        job->row_max_difference[y] = row_max;
+    }
+}
+
+// Rec. 601 luma, the same weights for RGBA and BGRA with the channels swapped
+internal void LumaRows(void* data, u32 begin, u32 end)
+{
+    ImageLumaJob* job = (ImageLumaJob*)data;
+    const PixelImage* image = job->image;
+    bool is_bgra = image->format == PIXEL_FORMAT_BGRA8;
+    __m128 weight_r = _mm_set1_ps(0.299f);
+    __m128 weight_g = _mm_set1_ps(0.587f);
+    __m128 weight_b = _mm_set1_ps(0.114f);
+    __m128i byte_mask = _mm_set1_epi32(0xFF);
+
+    for (u32 y = begin; y < end; ++y)
+    {
+        const u8* row = (const u8*)image->pixels + (size_t)y * (size_t)image->pitch;
+        f32* luma = job->luma + (size_t)y * (size_t)image->width;
+        i32 x = 0;
+        for (; x + 4 <= image->width; x += 4)
+        {
+            __m128i pixels = _mm_loadu_si128((const __m128i*)(row + x * 4));
+            __m128 c0 = _mm_cvtepi32_ps(_mm_and_si128(pixels, byte_mask));
+            __m128 c1 = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(pixels, 8), byte_mask));
+            __m128 c2 = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(pixels, 16), byte_mask));
+            __m128 r = is_bgra ? c2 : c0;
+            __m128 b = is_bgra ? c0 : c2;
+            __m128 value = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, weight_r), _mm_mul_ps(c1, weight_g)), _mm_mul_ps(b, weight_b));
+            _mm_storeu_ps(luma + x, value);
+        }
+        for (; x < image->width; ++x)
+        {
+            f32 r = (f32)row[x * 4 + (is_bgra ? 2 : 0)];
+            f32 g = (f32)row[x * 4 + 1];
+            f32 b = (f32)row[x * 4 + (is_bgra ? 0 : 2)];
+            luma[x] = r * 0.299f + g * 0.587f + b * 0.114f;
+        }
+    }
+}
+
+internal f32 HorizontalSum(__m128 value)
+{
+    __m128 pairs = _mm_add_ps(value, _mm_movehl_ps(value, value));
+    return _mm_cvtss_f32(_mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, 1)));
+}
+
+// Sum of the SSIM of every window in the window rows [begin, end)
+internal void SsimRows(void* data, u32 begin, u32 end)
+{
+    ImageSsimJob* job = (ImageSsimJob*)data;
+    const f32 inverse_count = 1.0f / (f32)(IMAGE_SSIM_WINDOW * IMAGE_SSIM_WINDOW);
+
+    for (u32 window_y = begin; window_y < end; ++window_y)
+    {
+        f64 row_sum = 0.0;
+        for (u32 window_x = 0; window_x < job->windows_x; ++window_x)
+        {
+            __m128 sum_a = _mm_setzero_ps();
+            __m128 sum_b = _mm_setzero_ps();
+            __m128 sum_aa = _mm_setzero_ps();
+            __m128 sum_bb = _mm_setzero_ps();
+            __m128 sum_ab = _mm_setzero_ps();
+            size_t offset = (size_t)window_y * IMAGE_SSIM_STRIDE * (size_t)job->width + (size_t)window_x * IMAGE_SSIM_STRIDE;
+            for (u32 row = 0; row < IMAGE_SSIM_WINDOW; ++row)
+            {
+                const f32* row_a = job->luma_a + offset + (size_t)row * (size_t)job->width;
+                const f32* row_b = job->luma_b + offset + (size_t)row * (size_t)job->width;
+                for (u32 half = 0; half < IMAGE_SSIM_WINDOW; half += 4)
+                {
+                    __m128 a = _mm_loadu_ps(row_a + half);
+                    __m128 b = _mm_loadu_ps(row_b + half);
+                    sum_a = _mm_add_ps(sum_a, a);
+                    sum_b = _mm_add_ps(sum_b, b);
+                    sum_aa = _mm_add_ps(sum_aa, _mm_mul_ps(a, a));
+                    sum_bb = _mm_add_ps(sum_bb, _mm_mul_ps(b, b));
+                    sum_ab = _mm_add_ps(sum_ab, _mm_mul_ps(a, b));
+                }
+            }
+
+            f32 mean_a = HorizontalSum(sum_a) * inverse_count;
+            f32 mean_b = HorizontalSum(sum_b) * inverse_count;
+            f32 variance_a = MaxFloat(HorizontalSum(sum_aa) * inverse_count - mean_a * mean_a, 0.0f);
+            f32 variance_b = MaxFloat(HorizontalSum(sum_bb) * inverse_count - mean_b * mean_b, 0.0f);
+            f32 covariance = HorizontalSum(sum_ab) * inverse_count - mean_a * mean_b;
+            f32 numerator = (2.0f * mean_a * mean_b + IMAGE_SSIM_C1) * (2.0f * covariance + IMAGE_SSIM_C2);
+            f32 denominator = (mean_a * mean_a + mean_b * mean_b + IMAGE_SSIM_C1) * (variance_a + variance_b + IMAGE_SSIM_C2);
+            row_sum += (f64)(numerator / denominator);
+        }
+        job->row_ssim[window_y] = row_sum;
+    }
+}
+
+// Compares two 8-bit images of the same size, RGBA8 or BGRA8 in any mix. The per row partial
+// results are added up in order, so the outcome does not depend on the thread count.
+void Compare(const PixelImage* a, const PixelImage* b, u32 tolerance, VMArena* scratch, WorkQueue* queue, ImageCompareResult* result)
+{
+    Assert(a->width == b->width && a->height == b->height);
+    Assert(a->format == PIXEL_FORMAT_RGBA8 || a->format == PIXEL_FORMAT_BGRA8);
+    Assert(b->format == PIXEL_FORMAT_RGBA8 || b->format == PIXEL_FORMAT_BGRA8);
+    *result = {};
+    result->psnr = IMAGE_COMPARE_MAX_PSNR;
+    result->ssim = 1.0;
+    if (a->width <= 0 || a->height <= 0)
+    {
+        return;
+    }
+
+    size_t scratch_start = scratch->curr_offset;
+    u32 height = (u32)a->height;
+
+    // The difference works on bytes as stored, so both sides need the same channel order
+    PixelImage b_matched = *b;
+    if (a->format != b->format)
+    {
+        b_matched.pitch = a->width * 4;
+        b_matched.format = a->format;
+        b_matched.pixels = memory::VMArenaAllocAligned(scratch, (size_t)b_matched.pitch * height, 16);
+        pixel_convert::Convert(b, &b_matched, 0, queue);
+    }
+
+    ImageDifferenceJob difference_job = {};
+    difference_job.a = a;
+    difference_job.b = &b_matched;
+    difference_job.tolerance = tolerance;
+    difference_job.row_squared_error = (u64*)memory::VMArenaAlloc(scratch, height * sizeof(u64));
+    difference_job.row_differing_pixels = (u32*)memory::VMArenaAlloc(scratch, height * sizeof(u32));
+    difference_job.row_max_difference = (u32*)memory::VMArenaAlloc(scratch, height * sizeof(u32));
+    work_queue::ParallelFor(queue, height, IMAGE_COMPARE_ROWS_PER_TASK, DifferenceRows, &difference_job);
+
+    u64 squared_error = 0;
+    for (u32 y = 0; y < height; ++y)
+    {
+        squared_error += difference_job.row_squared_error[y];
+        result->differing_pixels += difference_job.row_differing_pixels[y];
+        u32 row_max = difference_job.row_max_difference[y];
+        result->max_difference = row_max > result->max_difference ? row_max : result->max_difference;
+    }
+    if (squared_error > 0)
+    {
+        f64 mse = (f64)squared_error / ((f64)a->width * (f64)a->height * 3.0);
+        f64 psnr = 10.0 * log10(255.0 * 255.0 / mse);
+        result->psnr = psnr < IMAGE_COMPARE_MAX_PSNR ? psnr : IMAGE_COMPARE_MAX_PSNR;
+    }
+
+    // Images smaller than a window keep the SSIM of 1, the PSNR already covers them
+    if (a->width >= IMAGE_SSIM_WINDOW && a->height >= IMAGE_SSIM_WINDOW && squared_error > 0)
+    {
+        size_t plane_size = (size_t)a->width * height * sizeof(f32);
+        ImageLumaJob luma_a = { a, (f32*)memory::VMArenaAllocAligned(scratch, plane_size, 16) };
+        ImageLumaJob luma_b = { &b_matched, (f32*)memory::VMArenaAllocAligned(scratch, plane_size, 16) };
+        work_queue::ParallelFor(queue, height, IMAGE_COMPARE_ROWS_PER_TASK, LumaRows, &luma_a);
+        work_queue::ParallelFor(queue, height, IMAGE_COMPARE_ROWS_PER_TASK, LumaRows, &luma_b);
+
+        ImageSsimJob ssim_job = {};
+        ssim_job.luma_a = luma_a.luma;
+        ssim_job.luma_b = luma_b.luma;
+        ssim_job.width = a->width;
+        ssim_job.windows_x = (u32)((a->width - IMAGE_SSIM_WINDOW) / IMAGE_SSIM_STRIDE + 1);
+        u32 windows_y = (u32)((a->height - IMAGE_SSIM_WINDOW) / IMAGE_SSIM_STRIDE + 1);
+        ssim_job.row_ssim = (f64*)memory::VMArenaAlloc(scratch, windows_y * sizeof(f64));
+        work_queue::ParallelFor(queue, windows_y, 1, SsimRows, &ssim_job);
+
+        f64 ssim_sum = 0.0;
+        for (u32 y = 0; y < windows_y; ++y)
+        {
+            ssim_sum += ssim_job.row_ssim[y];
+        }
+        result->ssim = ssim_sum / ((f64)ssim_job.windows_x * (f64)windows_y);
+    }
+
+    scratch->curr_offset = scratch_start;
+}
+
+} // namespace image_compare
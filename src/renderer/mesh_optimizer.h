@@ -0,0 +1,401 @@
+#pragma once
+
+#include "core.h"
+#include "core/memory.h"
+#include "renderer/renderer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MESH_CACHE_SIZE             16      // Post-transform FIFO entries assumed by the optimizer
+#define MESH_OVERDRAW_THRESHOLD     1.05f   // How much ACMR the overdraw pass may give back
+
+struct VertexCacheStats
+{
+    u32 transformed;    // Vertex shader invocations with a FIFO cache
+    f32 acmr;           // Average cache miss ratio: transformed vertices per triangle
+    f32 atvr;           // Average transformed to vertex ratio, 1.0 is optimal
+};
+
+struct MeshCluster
+{
+    u32 first_triangle;
+    u32 triangle_count;
+    f32 sort_key;
+};
+
+namespace mesh_optimizer
+{
+
+// Triangles around every vertex, as offsets into a single list
+struct Adjacency
+{
+    u32* offsets;
+    u32* counts;
+    u32* triangles;
+};
+
+internal Adjacency BuildAdjacency(VMArena* scratch, const u32* indices, u32 index_count, u32 vertex_count)
+{
+    Adjacency adjacency = {};
+    adjacency.offsets = (u32*)memory::VMArenaAlloc(scratch, sizeof(u32) * vertex_count);
+    adjacency.counts = (u32*)memory::VMArenaAlloc(scratch, sizeof(u32) * vertex_count);
+    adjacency.triangles = (u32*)memory::VMArenaAlloc(scratch, sizeof(u32) * index_count);
+    memset(adjacency.counts, 0, sizeof(u32) * vertex_count);
+
+    for (u32 i = 0; i < index_count; ++i)
+    {
+        adjacency.counts[indices[i]]++;
+    }
+
+    u32 offset = 0;
+    for (u32 v = 0; v < vertex_count; ++v)
+    {
+        adjacency.offsets[v] = offset;
+        offset += adjacency.counts[v];
+        adjacency.counts[v] = 0;
+    }
+
+    for (u32 i = 0; i < index_count; ++i)
+    {
+        u32 v = indices[i];
+        adjacency.triangles[adjacency.offsets[v] + adjacency.counts[v]++] = i / 3;
+    }
+    return adjacency;
+}
+
+// Number of vertices a FIFO cache of cache_size misses on; cache_time holds per-vertex
+// insertion times and *timestamp carries on between calls, so clusters can share a cache.
+internal u32 SimulateFifoCache(const u32* indices, u32 index_count, u32 cache_size, u32* cache_time, u32* timestamp)
+{
+    u32 misses = 0;
+    for (u32 i = 0; i < index_count; ++i)
+    {
+        u32 v = indices[i];
+        if (*timestamp - cache_time[v] > cache_size)
+        {
+            cache_time[v] = (*timestamp)++;
+            ++misses;
+        }
+    }
+    return misses;
+}
+
+VertexCacheStats AnalyzeVertexCache(VMArena* scratch, const u32* indices, u32 index_count, u32 vertex_count, u32 cache_size)
+{
+    size_t scratch_start = scratch->curr_offset;
+    u32* cache_time = (u32*)memory::VMArenaAlloc(scratch, sizeof(u32) * vertex_count);
+    memset(cache_time, 0, sizeof(u32) * vertex_count);
+
+    u32 timestamp = cache_size + 1;
+    VertexCacheStats stats = {};
+    stats.transformed = SimulateFifoCache(indices, index_count, cache_size, cache_time, &timestamp);
+
+    u32 unique_vertices = 0;
+    for (u32 v = 0; v < vertex_count; ++v)
+    {
+        unique_vertices += cache_time[v] != 0 ? 1 : 0;
+    }
+    stats.acmr = index_count > 0 ? (f32)stats.transformed / (f32)(index_count / 3) : 0.0f;
+    stats.atvr = unique_vertices > 0 ? (f32)stats.transformed / (f32)unique_vertices : 0.0f;
+
+    scratch->curr_offset = scratch_start;
+    return stats;
+}
+
+// Tipsify (Sander, Nehab and Barczak 2007): fans around a vertex, then moves to the
+// candidate that will still be in the cache when all its triangles are emitted. Writes the
+// triangle index where every hard cluster starts (a jump to a vertex not in the cache),
+// out_clusters needs room for one entry per triangle. Returns the cluster count.
+u32 OptimizeVertexCache(VMArena* scratch, const u32* indices, u32 index_count, u32 vertex_count, u32 cache_size,
+                        u32* out_indices, u32* out_clusters)
+{
+    u32 triangle_count = index_count / 3;
+    if (triangle_count == 0)
+    {
+        return 0;
+    }
+
+    size_t scratch_start = scratch->curr_offset;
+    Adjacency adjacency = BuildAdjacency(scratch, indices, index_count, vertex_count);
+
+    u32* live_triangles = (u32*)memory::VMArenaAlloc(scratch, sizeof(u32) * vertex_count);
+    u32* cache_time = (u32*)memory::VMArenaAlloc(scratch, sizeof(u32) * vertex_count);
+    u32* dead_end_stack = (u32*)memory::VMArenaAlloc(scratch, sizeof(u32) * index_count);
+    u8* emitted = (u8*)memory::VMArenaAlloc(scratch, triangle_count);
+    memcpy(live_triangles, adjacency.counts, sizeof(u32) * vertex_count);
+    memset(cache_time, 0, sizeof(u32) * vertex_count);
+    memset(emitted, 0, triangle_count);
+
+    u32 dead_end_top = 0;
+    u32 timestamp = cache_size + 1;
+    u32 cursor = 0;         // Next vertex to scan when the dead-end stack runs dry
+    u32 output_cursor = 0;
+    u32 cluster_count = 0;
+
+    u32 fanning_vertex = indices[0];
+    out_clusters[cluster_count++] = 0;
+    for (;;)
+    {
+        // Emit every remaining triangle around the fanning vertex
+        u32 candidates_begin = dead_end_top;
+        u32 first = adjacency.offsets[fanning_vertex];
+        for (u32 t = 0; t < adjacency.counts[fanning_vertex]; ++t)
+        {
+            u32 triangle = adjacency.triangles[first + t];
+            if (emitted[triangle]) continue;
+
+            for (u32 k = 0; k < 3; ++k)
+            {
+                u32 v = indices[triangle * 3 + k];
+                out_indices[output_cursor++] = v;
+                dead_end_stack[dead_end_top++] = v;
+                live_triangles[v]--;
+                if (timestamp - cache_time[v] > cache_size)
+                {
+                    cache_time[v] = timestamp++;
+                }
+            }
+            emitted[triangle] = 1;
+        }
+
+        // Prefer the oldest candidate that stays cached while its own fan is emitted
+        u32 next_vertex = 0xFFFFFFFF;
+        u32 best_priority = 0;
+        bool found = false;
+        for (u32 c = candidates_begin; c < dead_end_top; ++c)
+        {
+            u32 v = dead_end_stack[c];
+            if (live_triangles[v] == 0) continue;
+
+            u32 priority = 0;
+            u32 age = timestamp - cache_time[v];
+            if (age + 2 * live_triangles[v] <= cache_size)
+            {
+                priority = age;
+            }
+            if (!found || priority > best_priority)
+            {
+                best_priority = priority;
+                next_vertex = v;
+                found = true;
+            }
+        }
+
+        if (!found)
+        {
+            // Dead end: fall back to recently used vertices, then scan for any live one
+            while (dead_end_top > 0)
+            {
+                u32 v = dead_end_stack[--dead_end_top];
+                if (live_triangles[v] > 0)
+                {
+                    next_vertex = v;
+                    break;
+                }
+            }
+            if (next_vertex == 0xFFFFFFFF)
+            {
+                while (cursor < vertex_count && live_triangles[cursor] == 0)
+                {
+                    ++cursor;
+                }
+                if (cursor == vertex_count)
+                {
+                    break;
+                }
+                next_vertex = cursor;
+            }
+
+            if (timestamp - cache_time[next_vertex] > cache_size && out_clusters[cluster_count - 1] != output_cursor / 3)
+            {
+                out_clusters[cluster_count++] = output_cursor / 3;
+            }
+        }
+
+        fanning_vertex = next_vertex;
+    }
+
+    scratch->curr_offset = scratch_start;
+    return cluster_count;
+}
+
+internal int CompareClusters(const void* a, const void* b)
+{
+    f32 key_a = ((const MeshCluster*)a)->sort_key;
+    f32 key_b = ((const MeshCluster*)b)->sort_key;
+    return key_a > key_b ? -1 : (key_a < key_b ? 1 : 0);
+}
+
+// Sander et al.'s overdraw pass: splits the hard clusters wherever the running ACMR is
+// already within the threshold of the whole cluster, then draws the clusters facing away
+// from the mesh center first so they occlude the inner ones.
+void OptimizeOverdraw(VMArena* scratch, u32* indices, u32 index_count, const f32* positions, u32 position_stride,
+                      u32 vertex_count, const u32* hard_clusters, u32 hard_cluster_count, u32 cache_size, f32 threshold)
+{
+    u32 triangle_count = index_count / 3;
+    if (triangle_count == 0 || hard_cluster_count == 0)
+    {
+        return;
+    }
+
+    size_t scratch_start = scratch->curr_offset;
+    u32* cache_time = (u32*)memory::VMArenaAlloc(scratch, sizeof(u32) * vertex_count);
+    MeshCluster* clusters = (MeshCluster*)memory::VMArenaAlloc(scratch, sizeof(MeshCluster) * triangle_count);
+    memset(cache_time, 0, sizeof(u32) * vertex_count);
+
+    u32 cluster_count = 0;
+    u32 timestamp = cache_size + 1;
+    for (u32 c = 0; c < hard_cluster_count; ++c)
+    {
+        u32 start = hard_clusters[c];
+        u32 end = c + 1 < hard_cluster_count ? hard_clusters[c + 1] : triangle_count;
+
+        timestamp += cache_size + 1;
+        u32 cluster_misses = SimulateFifoCache(indices + start * 3, (end - start) * 3, cache_size, cache_time, &timestamp);
+        f32 cluster_threshold = threshold * (f32)cluster_misses / (f32)(end - start);
+
+        timestamp += cache_size + 1;
+        u32 soft_start = start;
+        u32 running_misses = 0;
+        for (u32 t = start; t < end; ++t)
+        {
+            running_misses += SimulateFifoCache(indices + t * 3, 3, cache_size, cache_time, &timestamp);
+            if (t + 1 < end && (f32)running_misses / (f32)(t + 1 - soft_start) <= cluster_threshold)
+            {
+                clusters[cluster_count++] = { soft_start, t + 1 - soft_start, 0.0f };
+                soft_start = t + 1;
+                running_misses = 0;
+                timestamp += cache_size + 1;
+            }
+        }
+        clusters[cluster_count++] = { soft_start, end - soft_start, 0.0f };
+    }
+
+    // Area weighted centroid and normal of every cluster, and of the whole mesh
+    glm::vec3 mesh_centroid = glm::vec3(0.0f);
+    f32 mesh_area = 0.0f;
+    glm::vec3* centroids = (glm::vec3*)memory::VMArenaAlloc(scratch, sizeof(glm::vec3) * cluster_count);
+    glm::vec3* normals = (glm::vec3*)memory::VMArenaAlloc(scratch, sizeof(glm::vec3) * cluster_count);
+    for (u32 c = 0; c < cluster_count; ++c)
+    {
+        glm::vec3 centroid = glm::vec3(0.0f);
+        glm::vec3 normal = glm::vec3(0.0f);
+        f32 area = 0.0f;
+        for (u32 t = clusters[c].first_triangle; t < clusters[c].first_triangle + clusters[c].triangle_count; ++t)
+        {
+            const f32* p0 = positions + (size_t)indices[t * 3 + 0] * position_stride;
+            const f32* p1 = positions + (size_t)indices[t * 3 + 1] * position_stride;
+            const f32* p2 = positions + (size_t)indices[t * 3 + 2] * position_stride;
+            glm::vec3 a = glm::vec3(p0[0], p0[1], p0[2]);
+            glm::vec3 b = glm::vec3(p1[0], p1[1], p1[2]);
+            glm::vec3 d = glm::vec3(p2[0], p2[1], p2[2]);
+
+            glm::vec3 cross = glm::cross(b - a, d - a);
+            f32 triangle_area = glm::length(cross);
+            centroid += (a + b + d) * (triangle_area / 3.0f);
+            normal += cross;
+            area += triangle_area;
+        }
+
+        mesh_centroid += centroid;
+        mesh_area += area;
+        centroids[c] = area > 0.0f ? centroid / area : centroid;
+        f32 normal_length = glm::length(normal);
+        normals[c] = normal_length > 0.0f ? normal / normal_length : normal;
+    }
+    if (mesh_area > 0.0f)
+    {
+        mesh_centroid /= mesh_area;
+    }
+
+    for (u32 c = 0; c < cluster_count; ++c)
+    {
+        clusters[c].sort_key = glm::dot(centroids[c] - mesh_centroid, normals[c]);
+    }
+    qsort(clusters, cluster_count, sizeof(MeshCluster), CompareClusters);
+
+    u32* sorted = (u32*)memory::VMArenaAlloc(scratch, sizeof(u32) * index_count);
+    u32 output_cursor = 0;
+    for (u32 c = 0; c < cluster_count; ++c)
+    {
+        u32 count = clusters[c].triangle_count * 3;
+        memcpy(sorted + output_cursor, indices + clusters[c].first_triangle * 3, sizeof(u32) * count);
+        output_cursor += count;
+    }
+    memcpy(indices, sorted, sizeof(u32) * index_count);
+
+    scratch->curr_offset = scratch_start;
+}
+
+// Renumbers vertices in the order the index buffer first touches them, so vertex fetch walks
+// the buffer forwards. Unreferenced vertices move to the end. Returns the referenced count.
+u32 OptimizeVertexFetch(VMArena* scratch, Vertex* vertices, u32 vertex_count, u32* indices, u32 index_count)
+{
+    size_t scratch_start = scratch->curr_offset;
+    u32* remap = (u32*)memory::VMArenaAlloc(scratch, sizeof(u32) * vertex_count);
+    Vertex* reordered = (Vertex*)memory::VMArenaAlloc(scratch, sizeof(Vertex) * vertex_count);
+    memset(remap, 0xFF, sizeof(u32) * vertex_count);
+
+    u32 next = 0;
+    for (u32 i = 0; i < index_count; ++i)
+    {
+        u32 v = indices[i];
+        if (remap[v] == 0xFFFFFFFF)
+        {
+            remap[v] = next++;
+        }
+        indices[i] = remap[v];
+    }
+
+    u32 referenced_count = next;
+    for (u32 v = 0; v < vertex_count; ++v)
+    {
+        if (remap[v] == 0xFFFFFFFF)
+        {
+            remap[v] = next++;
+        }
+        reordered[remap[v]] = vertices[v];
+    }
+    memcpy(vertices, reordered, sizeof(Vertex) * vertex_count);
+
+    scratch->curr_offset = scratch_start;
+    return referenced_count;
+}
+
+// Runs the whole pipeline on a mesh whose LODs are index ranges over one vertex buffer:
+// vertex cache and overdraw per LOD, then one vertex fetch pass. Prints LOD 0 statistics.
+void OptimizeMesh(VMArena* scratch, Vertex* vertices, u32 vertex_count, u32* indices, const MeshLod* lods, u32 lod_count)
+{
+    size_t scratch_start = scratch->curr_offset;
+    VertexCacheStats before = AnalyzeVertexCache(scratch, indices + lods[0].index_offset, lods[0].index_count, vertex_count, MESH_CACHE_SIZE);
+
+    for (u32 l = 0; l < lod_count; ++l)
+    {
+        u32* lod_indices = indices + lods[l].index_offset;
+        u32 index_count = lods[l].index_count;
+        u32* optimized = (u32*)memory::VMArenaAlloc(scratch, sizeof(u32) * index_count);
+        u32* clusters = (u32*)memory::VMArenaAlloc(scratch, sizeof(u32) * (index_count / 3 + 1));
+
+        u32 cluster_count = OptimizeVertexCache(scratch, lod_indices, index_count, vertex_count, MESH_CACHE_SIZE, optimized, clusters);
+        OptimizeOverdraw(scratch, optimized, index_count, vertices[0].position, sizeof(Vertex) / sizeof(f32),
+                         vertex_count, clusters, cluster_count, MESH_CACHE_SIZE, MESH_OVERDRAW_THRESHOLD);
+        memcpy(lod_indices, optimized, sizeof(u32) * index_count);
+    }
+
+    u32 index_count = 0;
+    for (u32 l = 0; l < lod_count; ++l)
+    {
+        index_count = lods[l].index_offset + lods[l].index_count > index_count ? lods[l].index_offset + lods[l].index_count : index_count;
+    }
+    OptimizeVertexFetch(scratch, vertices, vertex_count, indices, index_count);
+
+    VertexCacheStats after = AnalyzeVertexCache(scratch, indices + lods[0].index_offset, lods[0].index_count, vertex_count, MESH_CACHE_SIZE);
+    printf("Mesh optimizer: %u triangles, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n",
+           lods[0].index_count / 3, before.acmr, after.acmr, before.atvr, after.atvr);
+
+    scratch->curr_offset = scratch_start;
+}
+
+} // namespace mesh_optimizer
@@ -0,0 +1,445 @@
+#pragma once
+
+#include "core.h"
+#include "core/memory.h"
+#include "core/work_queue.h"
+#include "renderer/renderer.h"
+#include "utils/handmade_math.h"
+
+#include <immintrin.h>
+#include <stdio.h>
+
+#define MIP_MAX_LEVELS          16
+#define MIP_KERNEL_RADIUS       3.0f    // Lanczos and Kaiser support, in destination texels
+#define MIP_KAISER_ALPHA        4.0f
+#define MIP_SRGB_ENCODE_STEPS   4096    // Linear to sRGB table resolution
+#define MIP_ROWS_PER_BATCH      8
+
+enum class MipFilter
+{
+    BOX,        // Exact area average, cheapest
+    KAISER,     // Kaiser windowed sinc, sharp with little ringing
+    LANCZOS     // Lanczos 3, sharpest, rings a little around hard edges
+};
+
+struct MipChain
+{
+    TextureLevel levels[MIP_MAX_LEVELS];
+    u32 level_count;
+};
+
+// Source texels and normalized weights for each destination texel along one axis.
+// Every destination texel has tap_count taps; indices are already clamped to the edge.
+struct MipFilterTaps
+{
+    i32* indices;
+    f32* weights;
+    i32 tap_count;
+};
+
+struct MipResampleJob
+{
+    const f32* source;      // RGBA float texels of the level above
+    f32* temp;              // Horizontally filtered: dest_width x source_height
+    f32* dest;              // RGBA float texels of the new level
+    u8* dest_rgba8;         // Optional quantized copy of dest
+    i32 source_width;
+    i32 source_height;
+    i32 dest_width;
+    i32 dest_height;
+    MipFilterTaps taps_x;
+    MipFilterTaps taps_y;
+    bool srgb;
+};
+
+struct MipConvertJob
+{
+    const u8* source;
+    f32* dest;
+    i32 width;
+    bool srgb;
+};
+
+namespace mipmap
+{
+
+global f32 srgb_to_linear_table[256];
+global u8 linear_to_srgb_table[MIP_SRGB_ENCODE_STEPS + 1];
+global bool srgb_tables_initialized = false;
+
+// Built on the calling thread before any job reads them
+internal void InitSrgbTables()
+{
+    if (srgb_tables_initialized)
+    {
+        return;
+    }
+
+    for (u32 i = 0; i < 256; ++i)
+    {
+        f32 value = (f32)i / 255.0f;
+        srgb_to_linear_table[i] = value <= 0.04045f ? value / 12.92f : powf((value + 0.055f) / 1.055f, 2.4f);
+    }
+    for (u32 i = 0; i <= MIP_SRGB_ENCODE_STEPS; ++i)
+    {
+        f32 value = (f32)i / (f32)MIP_SRGB_ENCODE_STEPS;
+        f32 encoded = value <= 0.0031308f ? value * 12.92f : 1.055f * powf(value, 1.0f / 2.4f) - 0.055f;
+        linear_to_srgb_table[i] = (u8)RoundFloatToUInt(MinFloat(MaxFloat(encoded, 0.0f), 1.0f) * 255.0f);
+    }
+    srgb_tables_initialized = true;
+}
+
+u32 GetLevelCount(i32 width, i32 height)
+{
+    i32 size = MaxInt(width, height);
+    u32 count = 1;
+    while (size > 1 && count < MIP_MAX_LEVELS)
+    {
+        size >>= 1;
+        ++count;
+    }
+    return count;
+}
+
+internal f32 Sinc(f32 x)
+{
+    if (fabsf(x) < 1e-5f)
+    {
+        return 1.0f;
+    }
+    f32 pi_x = 3.14159265f * x;
+    return sinf(pi_x) / pi_x;
+}
+
+// Zeroth order modified Bessel function of the first kind, for the Kaiser window
+internal f32 BesselI0(f32 x)
+{
+    f32 sum = 1.0f;
+    f32 term = 1.0f;
+    f32 half_x_sq = x * x * 0.25f;
+    for (u32 k = 1; k < 20; ++k)
+    {
+        term *= half_x_sq / (f32)(k * k);
+        sum += term;
+    }
+    return sum;
+}
+
+// Kernel value at a distance measured in destination texels
+internal f32 EvaluateKernel(MipFilter filter, f32 x)
+{
+    f32 abs_x = fabsf(x);
+    if (abs_x >= MIP_KERNEL_RADIUS)
+    {
+        return 0.0f;
+    }
+
+    if (filter == MipFilter::LANCZOS)
+    {
+        return Sinc(x) * Sinc(x / MIP_KERNEL_RADIUS);
+    }
+
+    f32 ratio = abs_x / MIP_KERNEL_RADIUS;
+    return Sinc(x) * BesselI0(MIP_KAISER_ALPHA * sqrtf(1.0f - ratio * ratio)) / BesselI0(MIP_KAISER_ALPHA);
+}
+
+// Precomputes the taps for resampling source_size texels down to dest_size along one axis.
+// Odd sizes give a non-integer ratio, so the weights differ per destination texel.
+// False when the arena ran out.
+internal bool BuildFilterTaps(VMArena* arena, MipFilter filter, i32 source_size, i32 dest_size, MipFilterTaps* out_taps)
+{
+    f32 scale = (f32)source_size / (f32)dest_size;
+    f32 support = filter == MipFilter::BOX ? 0.5f * scale : MIP_KERNEL_RADIUS * scale;
+
+    MipFilterTaps& taps = *out_taps;
+    taps = {};
+    taps.tap_count = CeilFloatToInt(support * 2.0f) + 1;
+    taps.indices = (i32*)memory::VMArenaAlloc(arena, sizeof(i32) * dest_size * taps.tap_count);
+    taps.weights = (f32*)memory::VMArenaAlloc(arena, sizeof(f32) * dest_size * taps.tap_count);
+    if (!taps.indices || !taps.weights)
+    {
+        return false;
+    }
+
+    for (i32 d = 0; d < dest_size; ++d)
+    {
+        f32 center = ((f32)d + 0.5f) * scale;
+        i32 first = FloorFloatToInt(center - support);
+        i32* indices = taps.indices + d * taps.tap_count;
+        f32* weights = taps.weights + d * taps.tap_count;
+
+        f32 total = 0.0f;
+        for (i32 t = 0; t < taps.tap_count; ++t)
+        {
+            i32 s = first + t;
+            f32 weight = 0.0f;
+            if (filter == MipFilter::BOX)
+            {
+                // Overlap between the source texel and the destination footprint
+                f32 overlap = MinFloat((f32)s + 1.0f, center + support) - MaxFloat((f32)s, center - support);
+                weight = MaxFloat(overlap, 0.0f);
+            }
+            else
+            {
+                weight = EvaluateKernel(filter, ((f32)s + 0.5f - center) / scale);
+            }
+
+            indices[t] = MinInt(MaxInt(s, 0), source_size - 1);
+            weights[t] = weight;
+            total += weight;
+        }
+
+        f32 inv_total = total != 0.0f ? 1.0f / total : 0.0f;
+        for (i32 t = 0; t < taps.tap_count; ++t)
+        {
+            weights[t] *= inv_total;
+        }
+    }
+
+    return true;
+}
+
+// Premultiplies after decoding, so the color of fully transparent texels never bleeds into the smaller levels
+internal void ConvertRowsToFloat(void* data, u32 begin, u32 end)
+{
+    MipConvertJob* job = (MipConvertJob*)data;
+    for (u32 y = begin; y < end; ++y)
+    {
+        const u8* source = job->source + (size_t)y * job->width * 4;
+        f32* dest = job->dest + (size_t)y * job->width * 4;
+        for (i32 x = 0; x < job->width * 4; x += 4)
+        {
+            f32 alpha = (f32)source[x + 3] / 255.0f;
+            for (u32 c = 0; c < 3; ++c)
+            {
+                f32 value = job->srgb ? srgb_to_linear_table[source[x + c]] : (f32)source[x + c] / 255.0f;
+                dest[x + c] = value * alpha;
+            }
+            dest[x + 3] = alpha;
+        }
+    }
+}
+
+internal void ResampleRowsHorizontal(void* data, u32 begin, u32 end)
+{
+    MipResampleJob* job = (MipResampleJob*)data;
+    const MipFilterTaps& taps = job->taps_x;
+    for (u32 y = begin; y < end; ++y)
+    {
+        const f32* source = job->source + (size_t)y * job->source_width * 4;
+        f32* dest = job->temp + (size_t)y * job->dest_width * 4;
+        for (i32 x = 0; x < job->dest_width; ++x)
+        {
+            const i32* indices = taps.indices + x * taps.tap_count;
+            const f32* weights = taps.weights + x * taps.tap_count;
+            __m128 sum = _mm_setzero_ps();
+            for (i32 t = 0; t < taps.tap_count; ++t)
+            {
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(source + indices[t] * 4), _mm_set1_ps(weights[t])));
+            }
+            _mm_storeu_ps(dest + x * 4, sum);
+        }
+    }
+}
+
+internal void ResampleRowsVertical(void* data, u32 begin, u32 end)
+{
+    MipResampleJob* job = (MipResampleJob*)data;
+    const MipFilterTaps& taps = job->taps_y;
+    i32 row_floats = job->dest_width * 4;
+    for (u32 y = begin; y < end; ++y)
+    {
+        const i32* indices = taps.indices + y * taps.tap_count;
+        const f32* weights = taps.weights + y * taps.tap_count;
+        f32* dest = job->dest + (size_t)y * row_floats;
+
+        // Four floats (one texel) at a time, accumulating one source row after the other
+        for (i32 x = 0; x < row_floats; x += 4)
+        {
+            _mm_storeu_ps(dest + x, _mm_setzero_ps());
+        }
+        for (i32 t = 0; t < taps.tap_count; ++t)
+        {
+            const f32* source = job->temp + (size_t)indices[t] * row_floats;
+            __m128 weight = _mm_set1_ps(weights[t]);
+            for (i32 x = 0; x < row_floats; x += 4)
+            {
+                __m128 sum = _mm_add_ps(_mm_loadu_ps(dest + x), _mm_mul_ps(_mm_loadu_ps(source + x), weight));
+                _mm_storeu_ps(dest + x, sum);
+            }
+        }
+
+        if (job->dest_rgba8)
+        {
+            u8* out = job->dest_rgba8 + (size_t)y * row_floats;
+            __m128 zero = _mm_setzero_ps();
+            __m128 one = _mm_set1_ps(1.0f);
+            for (i32 x = 0; x < row_floats; x += 4)
+            {
+                // Sharp kernels overshoot, clamp before quantizing. The floats are premultiplied,
+                // the texture is not: divide alpha back out, fully transparent texels come out black.
+                alignas(16) f32 texel[4];
+                _mm_store_ps(texel, _mm_min_ps(_mm_max_ps(_mm_loadu_ps(dest + x), zero), one));
+                f32 inv_alpha = texel[3] > 0.0f ? 1.0f / texel[3] : 0.0f;
+                for (u32 c = 0; c < 3; ++c)
+                {
+                    f32 value = MinFloat(texel[c] * inv_alpha, 1.0f);
+                    out[x + c] = job->srgb ? linear_to_srgb_table[RoundFloatToUInt(value * MIP_SRGB_ENCODE_STEPS)]
+                                           : (u8)RoundFloatToUInt(value * 255.0f);
+                }
+                out[x + 3] = (u8)RoundFloatToUInt(texel[3] * 255.0f);
+            }
+        }
+    }
+}
+
+// Filters one level down to the next, both passes spread over the work queue by rows.
+// False without touching the destination when the scratch arena ran out.
+internal bool ResampleLevel(WorkQueue* queue, VMArena* scratch, MipFilter filter, MipResampleJob* job)
+{
+    if (!BuildFilterTaps(scratch, filter, job->source_width, job->dest_width, &job->taps_x) ||
+        !BuildFilterTaps(scratch, filter, job->source_height, job->dest_height, &job->taps_y))
+    {
+        return false;
+    }
+    job->temp = (f32*)memory::VMArenaAllocAligned(scratch, sizeof(f32) * 4 * job->dest_width * job->source_height, 16);
+    if (!job->temp)
+    {
+        return false;
+    }
+
+    work_queue::ParallelFor(queue, (u32)job->source_height, MIP_ROWS_PER_BATCH, ResampleRowsHorizontal, job);
+    work_queue::ParallelFor(queue, (u32)job->dest_height, MIP_ROWS_PER_BATCH, ResampleRowsVertical, job);
+    return true;
+}
+
+internal void InitChain(const void* pixels, i32 width, i32 height, MipChain* chain)
+{
+    chain->level_count = GetLevelCount(width, height);
+    chain->levels[0].width = width;
+    chain->levels[0].height = height;
+    chain->levels[0].pixels = pixels;
+    for (u32 level = 1; level < chain->level_count; ++level)
+    {
+        chain->levels[level].width = MaxInt(chain->levels[level - 1].width / 2, 1);
+        chain->levels[level].height = MaxInt(chain->levels[level - 1].height / 2, 1);
+    }
+}
+
+// Gives up on the smaller levels when the arena ran out: the chain is left with level 0 only
+// and the arena where it was before the call, like the PNG decoder does
+internal bool FailChain(VMArena* arena, size_t arena_start, MipChain* chain)
+{
+    printf("Mipmap: not enough scratch memory for a %dx%d chain\n", chain->levels[0].width, chain->levels[0].height);
+    arena->curr_offset = arena_start;
+    chain->level_count = 1;
+    return false;
+}
+
+// Builds the full chain of a tightly packed RGBA8 image with straight alpha. Level 0 points at the
+// source, the smaller levels are allocated from the arena. Filtering happens in linear space on
+// premultiplied colors: with srgb, color channels are decoded first and re-encoded after, alpha is
+// always linear. Scratch memory comes from the same arena and is released before returning.
+// Returns false, with a one level chain, when the arena runs out.
+bool GenerateRgba8(WorkQueue* queue, VMArena* arena, const u8* pixels, i32 width, i32 height,
+                   bool srgb, MipFilter filter, MipChain* chain)
+{
+    size_t arena_start = arena->curr_offset;
+    InitChain(pixels, width, height, chain);
+    for (u32 level = 1; level < chain->level_count; ++level)
+    {
+        TextureLevel& mip = chain->levels[level];
+        mip.pixels = memory::VMArenaAlloc(arena, (size_t)mip.width * mip.height * 4);
+        if (!mip.pixels)
+        {
+            return FailChain(arena, arena_start, chain);
+        }
+    }
+    if (chain->level_count == 1)
+    {
+        return true;
+    }
+
+    InitSrgbTables();
+    size_t scratch_start = arena->curr_offset;
+
+    // Every level is filtered from the float version of the one above, never from 8-bit texels
+    MipConvertJob convert = {};
+    convert.source = pixels;
+    convert.dest = (f32*)memory::VMArenaAllocAligned(arena, sizeof(f32) * 4 * width * height, 16);
+    if (!convert.dest)
+    {
+        return FailChain(arena, arena_start, chain);
+    }
+    convert.width = width;
+    convert.srgb = srgb;
+    work_queue::ParallelFor(queue, (u32)height, MIP_ROWS_PER_BATCH, ConvertRowsToFloat, &convert);
+
+    const f32* source = convert.dest;
+    for (u32 level = 1; level < chain->level_count; ++level)
+    {
+        const TextureLevel& above = chain->levels[level - 1];
+        TextureLevel& mip = chain->levels[level];
+
+        MipResampleJob job = {};
+        job.source = source;
+        job.dest = (f32*)memory::VMArenaAllocAligned(arena, sizeof(f32) * 4 * mip.width * mip.height, 16);
+        job.dest_rgba8 = (u8*)mip.pixels;
+        job.source_width = above.width;
+        job.source_height = above.height;
+        job.dest_width = mip.width;
+        job.dest_height = mip.height;
+        job.srgb = srgb;
+        if (!job.dest || !ResampleLevel(queue, arena, filter, &job))
+        {
+            return FailChain(arena, arena_start, chain);
+        }
+
+        source = job.dest;
+    }
+
+    arena->curr_offset = scratch_start;
+    return true;
+}
+
+// Same as GenerateRgba8 for RGBA float images, filtered as they are without clamping. Colors must
+// already be premultiplied by alpha, otherwise transparent texels bleed into the smaller levels.
+bool GenerateFloat(WorkQueue* queue, VMArena* arena, const f32* pixels, i32 width, i32 height,
+                   MipFilter filter, MipChain* chain)
+{
+    size_t arena_start = arena->curr_offset;
+    InitChain(pixels, width, height, chain);
+    for (u32 level = 1; level < chain->level_count; ++level)
+    {
+        TextureLevel& mip = chain->levels[level];
+        mip.pixels = memory::VMArenaAllocAligned(arena, sizeof(f32) * 4 * mip.width * mip.height, 16);
+        if (!mip.pixels)
+        {
+            return FailChain(arena, arena_start, chain);
+        }
+    }
+
+    size_t scratch_start = arena->curr_offset;
+    for (u32 level = 1; level < chain->level_count; ++level)
+    {
+        const TextureLevel& above = chain->levels[level - 1];
+        TextureLevel& mip = chain->levels[level];
+
+        MipResampleJob job = {};
+        job.source = (const f32*)above.pixels;
+        job.dest = (f32*)mip.pixels;
+        job.source_width = above.width;
+        job.source_height = above.height;
+        job.dest_width = mip.width;
+        job.dest_height = mip.height;
+        if (!ResampleLevel(queue, arena, filter, &job))
+        {
+            return FailChain(arena, arena_start, chain);
+        }
+
+        arena->curr_offset = scratch_start;
+    }
+    return true;
+}
+
+} // namespace mipmap
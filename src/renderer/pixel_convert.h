@@ -0,0 +1,808 @@
+#pragma once
+
+#include "core.h"
+#include "core/work_queue.h"
+#include "core/cpu_features.h"
+#include "renderer/mipmap.h"
+#include "utils/handmade_math.h"
+
+#include <immintrin.h>
+#include <string.h>
+
+#define PIXEL_CONVERT_PIXELS_PER_TASK   (64 * 1024)     // Rows are batched until a task covers about this many pixels
+#define PIXEL_ALPHA_BYTES_512           0x8888888888888888ull
+
+enum PixelFormat
+{
+    PIXEL_FORMAT_RGBA8,
+    PIXEL_FORMAT_BGRA8,     // Framebuffer and DIB section layout
+    PIXEL_FORMAT_RGBA16F,   // Sources only
+    PIXEL_FORMAT_RGBA32F,   // Sources only
+    PIXEL_FORMAT_COUNT
+};
+
+// Applied in this order, on top of the RGBA <-> BGRA swizzle implied by the two formats:
+// unpremultiply, sRGB encode or decode (color only, alpha stays linear), premultiply.
+// Float sources are unpremultiplied and encoded before they get quantized.
+enum PixelConvertFlags : u32
+{
+    PIXEL_CONVERT_FLIP_Y        = 1u << 0,  // Bottom-up rows (GL readback) to top-down (DIB) or back
+    PIXEL_CONVERT_UNPREMULTIPLY = 1u << 1,
+    PIXEL_CONVERT_SRGB_ENCODE   = 1u << 2,
+    PIXEL_CONVERT_SRGB_DECODE   = 1u << 3,  // 8-bit sources only
+    PIXEL_CONVERT_PREMULTIPLY   = 1u << 4,
+};
+
+// The kernels a conversion runs with, Convert() picks the widest one the CPU supports
+enum PixelConvertPath
+{
+    PIXEL_CONVERT_PATH_SCALAR,
+    PIXEL_CONVERT_PATH_SSE,         // 4 pixels per iteration
+    PIXEL_CONVERT_PATH_AVX2,        // 8 pixels per iteration, F16C halves, gathered sRGB encoding
+    PIXEL_CONVERT_PATH_AVX512,      // 16 pixels per iteration
+    PIXEL_CONVERT_PATH_COUNT
+};
+
+static const char* pixel_convert_path_names[PIXEL_CONVERT_PATH_COUNT] = {
+    "scalar",
+    "SSE",
+    "AVX2",
+    "AVX-512",
+};
+
+struct PixelImage
+{
+    void* pixels;
+    i32 width;
+    i32 height;
+    i32 pitch;      // In bytes, rows may be padded
+    PixelFormat format;
+};
+
+struct PixelConvertJob
+{
+    const u8* source;
+    u8* dest;
+    i32 source_pitch;
+    i32 dest_pitch;
+    i32 width;
+    i32 height;
+    PixelFormat source_format;
+    bool swizzle;
+    bool flip;
+    u32 flags;
+    PixelConvertPath path;
+};
+
+struct PixelFlipJob
+{
+    u8* pixels;
+    i32 pitch;
+    i32 height;
+    size_t row_size;
+};
+
+namespace pixel_convert
+{
+
+global u8 srgb_encode_table_u8[256];
+global u8 srgb_decode_table_u8[256];
+global i32 srgb_encode_table[MIP_SRGB_ENCODE_STEPS + 1];    // Widened for the gathers
+global bool tables_initialized = false;
+
+// Built on the calling thread before any job reads them
+internal void InitTables()
+{
+    if (tables_initialized)
+    {
+        return;
+    }
+
+    mipmap::InitSrgbTables();
+    for (u32 i = 0; i <= MIP_SRGB_ENCODE_STEPS; ++i)
+    {
+        srgb_encode_table[i] = mipmap::linear_to_srgb_table[i];
+    }
+    for (u32 i = 0; i < 256; ++i)
+    {
+        srgb_encode_table_u8[i] = mipmap::linear_to_srgb_table[(i * MIP_SRGB_ENCODE_STEPS + 127) / 255];
+        srgb_decode_table_u8[i] = (u8)RoundFloatToUInt(mipmap::srgb_to_linear_table[i] * 255.0f);
+    }
+    tables_initialized = true;
+}
+
+u32 GetBytesPerPixel(PixelFormat format)
+{
+    switch (format)
+    {
+        case PIXEL_FORMAT_RGBA16F: return 8;
+        case PIXEL_FORMAT_RGBA32F: return 16;
+        default: return 4;
+    }
+}
+
+PixelConvertPath GetBestPath()
+{
+    const CpuFeatures* features = cpu_features::Get();
+    if (features->avx512bw && features->f16c) return PIXEL_CONVERT_PATH_AVX512;
+    if (features->avx2 && features->f16c) return PIXEL_CONVERT_PATH_AVX2;
+    if (features->sse41) return PIXEL_CONVERT_PATH_SSE;
+    return PIXEL_CONVERT_PATH_SCALAR;
+}
+
+// Round half to even like the SIMD conversions, so every path agrees to the bit
+internal i32 RoundToEven(f32 value)
+{
+    return _mm_cvtss_si32(_mm_set_ss(value));
+}
+
+// Exact round(c * a / 255)
+internal u32 MultiplyAlpha(u32 c, u32 a)
+{
+    u32 t = c * a + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+internal f32 HalfToFloat(u16 half)
+{
+    u32 sign = (u32)(half & 0x8000) << 16;
+    u32 exponent = (half >> 10) & 0x1F;
+    u32 mantissa = half & 0x3FF;
+    u32 bits;
+    if (exponent == 0x1F)
+    {
+        bits = sign | 0x7F800000 | (mantissa << 13);
+    }
+    else if (exponent != 0)
+    {
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+    else if (mantissa == 0)
+    {
+        bits = sign;
+    }
+    else
+    {
+        // Denormal: shift the leading one into the implicit bit
+        exponent = 113;
+        while (!(mantissa & 0x400))
+        {
+            mantissa <<= 1;
+            --exponent;
+        }
+        bits = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+    }
+
+    f32 result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+// ---------------------------------------------------------------------------------------------
+// Scalar kernels, the reference the SIMD ones are checked against and their tail handlers
+
+internal void SwizzleScalar(const u8* source, u8* dest, i32 count)
+{
+    for (i32 i = 0; i < count; ++i)
+    {
+        u32 pixel;
+        memcpy(&pixel, source + i * 4, 4);
+        pixel = (pixel & 0xFF00FF00) | ((pixel >> 16) & 0xFF) | ((pixel & 0xFF) << 16);
+        memcpy(dest + i * 4, &pixel, 4);
+    }
+}
+
+internal void PremultiplyScalar(u8* pixels, i32 count)
+{
+    for (i32 i = 0; i < count; ++i)
+    {
+        u8* pixel = pixels + i * 4;
+        u32 a = pixel[3];
+        pixel[0] = (u8)MultiplyAlpha(pixel[0], a);
+        pixel[1] = (u8)MultiplyAlpha(pixel[1], a);
+        pixel[2] = (u8)MultiplyAlpha(pixel[2], a);
+    }
+}
+
+// Fully transparent pixels come out as zero, colors brighter than alpha saturate
+internal void UnpremultiplyScalar(u8* pixels, i32 count)
+{
+    for (i32 i = 0; i < count; ++i)
+    {
+        u8* pixel = pixels + i * 4;
+        u32 a = pixel[3];
+        if (a == 0)
+        {
+            pixel[0] = pixel[1] = pixel[2] = 0;
+            continue;
+        }
+
+        f32 scale = 255.0f / (f32)a;
+        for (u32 c = 0; c < 3; ++c)
+        {
+            pixel[c] = (u8)MinInt(RoundToEven((f32)pixel[c] * scale), 255);
+        }
+    }
+}
+
+// Lookups only, there is no byte permute wide enough before AVX-512 VBMI to beat this
+internal void ApplyTable(u8* pixels, i32 count, const u8* table)
+{
+    for (i32 i = 0; i < count; ++i)
+    {
+        u8* pixel = pixels + i * 4;
+        pixel[0] = table[pixel[0]];
+        pixel[1] = table[pixel[1]];
+        pixel[2] = table[pixel[2]];
+    }
+}
+
+internal void LoadFloatPixel(const PixelConvertJob* job, const u8* source, i32 x, f32* values)
+{
+    if (job->source_format == PIXEL_FORMAT_RGBA16F)
+    {
+        const u16* halves = (const u16*)source + x * 4;
+        for (u32 c = 0; c < 4; ++c) values[c] = HalfToFloat(halves[c]);
+    }
+    else
+    {
+        memcpy(values, source + x * 16, 16);
+    }
+}
+
+internal void QuantizeScalar(const PixelConvertJob* job, const u8* source, u8* dest, i32 x_begin, i32 x_end)
+{
+    for (i32 x = x_begin; x < x_end; ++x)
+    {
+        f32 values[4];
+        LoadFloatPixel(job, source, x, values);
+        if (job->flags & PIXEL_CONVERT_UNPREMULTIPLY)
+        {
+            f32 inverse_alpha = values[3] > 0.0f ? 1.0f / values[3] : 0.0f;
+            for (u32 c = 0; c < 3; ++c) values[c] *= inverse_alpha;
+        }
+
+        u8 channels[4];
+        for (u32 c = 0; c < 4; ++c)
+        {
+            f32 value = MinFloat(MaxFloat(values[c], 0.0f), 1.0f);
+            if (c < 3 && (job->flags & PIXEL_CONVERT_SRGB_ENCODE))
+            {
+                channels[c] = (u8)srgb_encode_table[RoundToEven(value * (f32)MIP_SRGB_ENCODE_STEPS)];
+            }
+            else
+            {
+                channels[c] = (u8)RoundToEven(value * 255.0f);
+            }
+        }
+
+        u8* pixel = dest + x * 4;
+        pixel[0] = channels[job->swizzle ? 2 : 0];
+        pixel[1] = channels[1];
+        pixel[2] = channels[job->swizzle ? 0 : 2];
+        pixel[3] = channels[3];
+    }
+}
+
+// ---------------------------------------------------------------------------------------------
+// SSE4.1
+
+internal __m128i GetSwizzleMaskSse()
+{
+    return _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+}
+
+internal void SwizzleSse(const u8* source, u8* dest, i32 count)
+{
+    __m128i mask = GetSwizzleMaskSse();
+    i32 x = 0;
+    for (; x + 4 <= count; x += 4)
+    {
+        __m128i pixels = _mm_loadu_si128((const __m128i*)(source + x * 4));
+        _mm_storeu_si128((__m128i*)(dest + x * 4), _mm_shuffle_epi8(pixels, mask));
+    }
+    SwizzleScalar(source + x * 4, dest + x * 4, count - x);
+}
+
+// Two pixels widened to 16 bits per channel, the alpha lanes get squared and are restored by the caller
+internal __m128i MultiplyAlphaSse(__m128i half)
+{
+    __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(half, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    __m128i t = _mm_add_epi16(_mm_mullo_epi16(half, alpha), _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+internal void PremultiplySse(u8* pixels, i32 count)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i alpha_mask = _mm_set1_epi32((i32)0xFF000000);
+    i32 x = 0;
+    for (; x + 4 <= count; x += 4)
+    {
+        __m128i source = _mm_loadu_si128((const __m128i*)(pixels + x * 4));
+        __m128i low = MultiplyAlphaSse(_mm_unpacklo_epi8(source, zero));
+        __m128i high = MultiplyAlphaSse(_mm_unpackhi_epi8(source, zero));
+        __m128i result = _mm_blendv_epi8(_mm_packus_epi16(low, high), source, alpha_mask);
+        _mm_storeu_si128((__m128i*)(pixels + x * 4), result);
+    }
+    PremultiplyScalar(pixels + x * 4, count - x);
+}
+
+// One pixel per register. Zero alpha turns the scale into infinity, which converts to
+// 0x80000000 and saturates to zero on the way down, like the scalar special case.
+internal __m128i UnpremultiplyPixelSse(__m128i pixel)
+{
+    __m128 color = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(pixel));
+    __m128 alpha = _mm_shuffle_ps(color, color, _MM_SHUFFLE(3, 3, 3, 3));
+    return _mm_cvtps_epi32(_mm_mul_ps(color, _mm_div_ps(_mm_set1_ps(255.0f), alpha)));
+}
+
+internal void UnpremultiplySse(u8* pixels, i32 count)
+{
+    __m128i alpha_mask = _mm_set1_epi32((i32)0xFF000000);
+    i32 x = 0;
+    for (; x + 4 <= count; x += 4)
+    {
+        __m128i source = _mm_loadu_si128((const __m128i*)(pixels + x * 4));
+        __m128i p0 = UnpremultiplyPixelSse(source);
+        __m128i p1 = UnpremultiplyPixelSse(_mm_srli_si128(source, 4));
+        __m128i p2 = UnpremultiplyPixelSse(_mm_srli_si128(source, 8));
+        __m128i p3 = UnpremultiplyPixelSse(_mm_srli_si128(source, 12));
+        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(p0, p1), _mm_packs_epi32(p2, p3));
+        _mm_storeu_si128((__m128i*)(pixels + x * 4), _mm_blendv_epi8(packed, source, alpha_mask));
+    }
+    UnpremultiplyScalar(pixels + x * 4, count - x);
+}
+
+internal __m128 LoadFloatPixelSse(const PixelConvertJob* job, const u8* source, i32 x)
+{
+    if (job->source_format == PIXEL_FORMAT_RGBA16F)
+    {
+        // F16C comes with the AVX2 path
+        f32 values[4];
+        LoadFloatPixel(job, source, x, values);
+        return _mm_loadu_ps(values);
+    }
+    return _mm_loadu_ps((const f32*)(source + x * 16));
+}
+
+internal __m128i QuantizePixelSse(const PixelConvertJob* job, __m128 value)
+{
+    __m128 zero = _mm_setzero_ps();
+    __m128 one = _mm_set1_ps(1.0f);
+    if (job->flags & PIXEL_CONVERT_UNPREMULTIPLY)
+    {
+        __m128 alpha = _mm_shuffle_ps(value, value, _MM_SHUFFLE(3, 3, 3, 3));
+        __m128 inverse_alpha = _mm_and_ps(_mm_div_ps(one, alpha), _mm_cmpgt_ps(alpha, zero));
+        value = _mm_mul_ps(value, _mm_blend_ps(inverse_alpha, one, 0x8));
+    }
+
+    value = _mm_min_ps(_mm_max_ps(value, zero), one);
+    __m128i result = _mm_cvtps_epi32(_mm_mul_ps(value, _mm_set1_ps(255.0f)));
+    if (job->flags & PIXEL_CONVERT_SRGB_ENCODE)
+    {
+        alignas(16) i32 index[4];
+        _mm_store_si128((__m128i*)index, _mm_cvtps_epi32(_mm_mul_ps(value, _mm_set1_ps((f32)MIP_SRGB_ENCODE_STEPS))));
+        __m128i encoded = _mm_setr_epi32(srgb_encode_table[index[0]], srgb_encode_table[index[1]], srgb_encode_table[index[2]], 0);
+        result = _mm_blend_epi16(encoded, result, 0xC0);
+    }
+    return result;
+}
+
+internal void QuantizeSse(const PixelConvertJob* job, const u8* source, u8* dest, i32 count)
+{
+    __m128i mask = GetSwizzleMaskSse();
+    i32 x = 0;
+    for (; x + 4 <= count; x += 4)
+    {
+        __m128i p0 = QuantizePixelSse(job, LoadFloatPixelSse(job, source, x));
+        __m128i p1 = QuantizePixelSse(job, LoadFloatPixelSse(job, source, x + 1));
+        __m128i p2 = QuantizePixelSse(job, LoadFloatPixelSse(job, source, x + 2));
+        __m128i p3 = QuantizePixelSse(job, LoadFloatPixelSse(job, source, x + 3));
+        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(p0, p1), _mm_packs_epi32(p2, p3));
+        if (job->swizzle) packed = _mm_shuffle_epi8(packed, mask);
+        _mm_storeu_si128((__m128i*)(dest + x * 4), packed);
+    }
+    QuantizeScalar(job, source, dest, x, count);
+}
+
+// ---------------------------------------------------------------------------------------------
+// AVX2
+
+internal void SwizzleAvx2(const u8* source, u8* dest, i32 count)
+{
+    __m256i mask = _mm256_broadcastsi128_si256(GetSwizzleMaskSse());
+    i32 x = 0;
+    for (; x + 8 <= count; x += 8)
+    {
+        __m256i pixels = _mm256_loadu_si256((const __m256i*)(source + x * 4));
+        _mm256_storeu_si256((__m256i*)(dest + x * 4), _mm256_shuffle_epi8(pixels, mask));
+    }
+    SwizzleScalar(source + x * 4, dest + x * 4, count - x);
+}
+
+internal __m256i MultiplyAlphaAvx2(__m256i half)
+{
+    __m256i alpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(half, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(half, alpha), _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+internal void PremultiplyAvx2(u8* pixels, i32 count)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i alpha_mask = _mm256_set1_epi32((i32)0xFF000000);
+    i32 x = 0;
+    for (; x + 8 <= count; x += 8)
+    {
+        // Unpack and pack both stay within 128-bit lanes, so the pixel order survives
+        __m256i source = _mm256_loadu_si256((const __m256i*)(pixels + x * 4));
+        __m256i low = MultiplyAlphaAvx2(_mm256_unpacklo_epi8(source, zero));
+        __m256i high = MultiplyAlphaAvx2(_mm256_unpackhi_epi8(source, zero));
+        __m256i result = _mm256_blendv_epi8(_mm256_packus_epi16(low, high), source, alpha_mask);
+        _mm256_storeu_si256((__m256i*)(pixels + x * 4), result);
+    }
+    PremultiplyScalar(pixels + x * 4, count - x);
+}
+
+// Two pixels per register
+internal __m256i UnpremultiplyPairAvx2(__m128i pixels)
+{
+    __m256 color = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(pixels));
+    __m256 alpha = _mm256_shuffle_ps(color, color, _MM_SHUFFLE(3, 3, 3, 3));
+    return _mm256_cvtps_epi32(_mm256_mul_ps(color, _mm256_div_ps(_mm256_set1_ps(255.0f), alpha)));
+}
+
+// Packing pairs (0 1)(2 3)(4 5)(6 7) leaves the lanes as 0 2 4 6 | 1 3 5 7
+internal __m256i PackPairsAvx2(__m256i p01, __m256i p23, __m256i p45, __m256i p67)
+{
+    __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(p01, p23), _mm256_packs_epi32(p45, p67));
+    return _mm256_permutevar8x32_epi32(packed, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+}
+
+internal void UnpremultiplyAvx2(u8* pixels, i32 count)
+{
+    __m256i alpha_mask = _mm256_set1_epi32((i32)0xFF000000);
+    i32 x = 0;
+    for (; x + 8 <= count; x += 8)
+    {
+        __m256i source = _mm256_loadu_si256((const __m256i*)(pixels + x * 4));
+        __m128i low = _mm256_castsi256_si128(source);
+        __m128i high = _mm256_extracti128_si256(source, 1);
+        __m256i packed = PackPairsAvx2(UnpremultiplyPairAvx2(low), UnpremultiplyPairAvx2(_mm_srli_si128(low, 8)),
+                                       UnpremultiplyPairAvx2(high), UnpremultiplyPairAvx2(_mm_srli_si128(high, 8)));
+        _mm256_storeu_si256((__m256i*)(pixels + x * 4), _mm256_blendv_epi8(packed, source, alpha_mask));
+    }
+    UnpremultiplyScalar(pixels + x * 4, count - x);
+}
+
+internal __m256 LoadFloatPairAvx2(const PixelConvertJob* job, const u8* source, i32 x)
+{
+    if (job->source_format == PIXEL_FORMAT_RGBA16F)
+    {
+        return _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(source + x * 8)));
+    }
+    return _mm256_loadu_ps((const f32*)(source + x * 16));
+}
+
+internal __m256i QuantizePairAvx2(const PixelConvertJob* job, __m256 value)
+{
+    __m256 zero = _mm256_setzero_ps();
+    __m256 one = _mm256_set1_ps(1.0f);
+    if (job->flags & PIXEL_CONVERT_UNPREMULTIPLY)
+    {
+        __m256 alpha = _mm256_shuffle_ps(value, value, _MM_SHUFFLE(3, 3, 3, 3));
+        __m256 inverse_alpha = _mm256_and_ps(_mm256_div_ps(one, alpha), _mm256_cmp_ps(alpha, zero, _CMP_GT_OQ));
+        value = _mm256_mul_ps(value, _mm256_blend_ps(inverse_alpha, one, 0x88));
+    }
+
+    value = _mm256_min_ps(_mm256_max_ps(value, zero), one);
+    __m256i result = _mm256_cvtps_epi32(_mm256_mul_ps(value, _mm256_set1_ps(255.0f)));
+    if (job->flags & PIXEL_CONVERT_SRGB_ENCODE)
+    {
+        __m256i index = _mm256_cvtps_epi32(_mm256_mul_ps(value, _mm256_set1_ps((f32)MIP_SRGB_ENCODE_STEPS)));
+        __m256i encoded = _mm256_i32gather_epi32(srgb_encode_table, index, 4);
+        result = _mm256_blend_epi32(encoded, result, 0x88);
+    }
+    return result;
+}
+
+internal void QuantizeAvx2(const PixelConvertJob* job, const u8* source, u8* dest, i32 count)
+{
+    __m256i mask = _mm256_broadcastsi128_si256(GetSwizzleMaskSse());
+    i32 x = 0;
+    for (; x + 8 <= count; x += 8)
+    {
+        __m256i packed = PackPairsAvx2(QuantizePairAvx2(job, LoadFloatPairAvx2(job, source, x)),
+                                       QuantizePairAvx2(job, LoadFloatPairAvx2(job, source, x + 2)),
+                                       QuantizePairAvx2(job, LoadFloatPairAvx2(job, source, x + 4)),
+                                       QuantizePairAvx2(job, LoadFloatPairAvx2(job, source, x + 6)));
+        if (job->swizzle) packed = _mm256_shuffle_epi8(packed, mask);
+        _mm256_storeu_si256((__m256i*)(dest + x * 4), packed);
+    }
+    QuantizeScalar(job, source, dest, x, count);
+}
+
+// ---------------------------------------------------------------------------------------------
+// AVX-512 (F and BW)
+
+internal void SwizzleAvx512(const u8* source, u8* dest, i32 count)
+{
+    __m512i mask = _mm512_broadcast_i32x4(GetSwizzleMaskSse());
+    i32 x = 0;
+    for (; x + 16 <= count; x += 16)
+    {
+        __m512i pixels = _mm512_loadu_si512(source + x * 4);
+        _mm512_storeu_si512(dest + x * 4, _mm512_shuffle_epi8(pixels, mask));
+    }
+    SwizzleScalar(source + x * 4, dest + x * 4, count - x);
+}
+
+internal __m512i MultiplyAlphaAvx512(__m512i half)
+{
+    __m512i alpha = _mm512_shufflehi_epi16(_mm512_shufflelo_epi16(half, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    __m512i t = _mm512_add_epi16(_mm512_mullo_epi16(half, alpha), _mm512_set1_epi16(128));
+    return _mm512_srli_epi16(_mm512_add_epi16(t, _mm512_srli_epi16(t, 8)), 8);
+}
+
+internal void PremultiplyAvx512(u8* pixels, i32 count)
+{
+    __m512i zero = _mm512_setzero_si512();
+    i32 x = 0;
+    for (; x + 16 <= count; x += 16)
+    {
+        __m512i source = _mm512_loadu_si512(pixels + x * 4);
+        __m512i low = MultiplyAlphaAvx512(_mm512_unpacklo_epi8(source, zero));
+        __m512i high = MultiplyAlphaAvx512(_mm512_unpackhi_epi8(source, zero));
+        __m512i result = _mm512_mask_blend_epi8(PIXEL_ALPHA_BYTES_512, _mm512_packus_epi16(low, high), source);
+        _mm512_storeu_si512(pixels + x * 4, result);
+    }
+    PremultiplyScalar(pixels + x * 4, count - x);
+}
+
+// Four pixels per register, clamped before the truncating narrow to match the saturating packs
+internal __m128i UnpremultiplyQuadAvx512(__m128i pixels)
+{
+    __m512 color = _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(pixels));
+    __m512 alpha = _mm512_shuffle_ps(color, color, _MM_SHUFFLE(3, 3, 3, 3));
+    __m512i result = _mm512_cvtps_epi32(_mm512_mul_ps(color, _mm512_div_ps(_mm512_set1_ps(255.0f), alpha)));
+    result = _mm512_min_epi32(_mm512_max_epi32(result, _mm512_setzero_si512()), _mm512_set1_epi32(255));
+    return _mm_blendv_epi8(_mm512_cvtepi32_epi8(result), pixels, _mm_set1_epi32((i32)0xFF000000));
+}
+
+internal void UnpremultiplyAvx512(u8* pixels, i32 count)
+{
+    i32 x = 0;
+    for (; x + 16 <= count; x += 16)
+    {
+        for (i32 quad = 0; quad < 16; quad += 4)
+        {
+            __m128i* address = (__m128i*)(pixels + (x + quad) * 4);
+            _mm_storeu_si128(address, UnpremultiplyQuadAvx512(_mm_loadu_si128(address)));
+        }
+    }
+    UnpremultiplyScalar(pixels + x * 4, count - x);
+}
+
+internal __m512 LoadFloatQuadAvx512(const PixelConvertJob* job, const u8* source, i32 x)
+{
+    if (job->source_format == PIXEL_FORMAT_RGBA16F)
+    {
+        return _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*)(source + x * 8)));
+    }
+    return _mm512_loadu_ps(source + x * 16);
+}
+
+internal __m128i QuantizeQuadAvx512(const PixelConvertJob* job, __m512 value)
+{
+    __m512 zero = _mm512_setzero_ps();
+    __m512 one = _mm512_set1_ps(1.0f);
+    if (job->flags & PIXEL_CONVERT_UNPREMULTIPLY)
+    {
+        __m512 alpha = _mm512_shuffle_ps(value, value, _MM_SHUFFLE(3, 3, 3, 3));
+        __mmask16 positive = _mm512_cmp_ps_mask(alpha, zero, _CMP_GT_OQ);
+        __m512 inverse_alpha = _mm512_maskz_div_ps(positive, one, alpha);
+        value = _mm512_mul_ps(value, _mm512_mask_blend_ps(0x8888, inverse_alpha, one));
+    }
+
+    value = _mm512_min_ps(_mm512_max_ps(value, zero), one);
+    __m512i result = _mm512_cvtps_epi32(_mm512_mul_ps(value, _mm512_set1_ps(255.0f)));
+    if (job->flags & PIXEL_CONVERT_SRGB_ENCODE)
+    {
+        __m512i index = _mm512_cvtps_epi32(_mm512_mul_ps(value, _mm512_set1_ps((f32)MIP_SRGB_ENCODE_STEPS)));
+        __m512i encoded = _mm512_i32gather_epi32(index, srgb_encode_table, 4);
+        result = _mm512_mask_blend_epi32(0x8888, encoded, result);
+    }
+    return _mm512_cvtepi32_epi8(result);
+}
+
+internal void QuantizeAvx512(const PixelConvertJob* job, const u8* source, u8* dest, i32 count)
+{
+    __m128i mask = GetSwizzleMaskSse();
+    i32 x = 0;
+    for (; x + 16 <= count; x += 16)
+    {
+        for (i32 quad = 0; quad < 16; quad += 4)
+        {
+            __m128i packed = QuantizeQuadAvx512(job, LoadFloatQuadAvx512(job, source, x + quad));
+            if (job->swizzle) packed = _mm_shuffle_epi8(packed, mask);
+            _mm_storeu_si128((__m128i*)(dest + (x + quad) * 4), packed);
+        }
+    }
+    QuantizeScalar(job, source, dest, x, count);
+}
+
+// ---------------------------------------------------------------------------------------------
+
+internal void Swizzle(PixelConvertPath path, const u8* source, u8* dest, i32 count)
+{
+    switch (path)
+    {
+        case PIXEL_CONVERT_PATH_AVX512: SwizzleAvx512(source, dest, count); break;
+        case PIXEL_CONVERT_PATH_AVX2: SwizzleAvx2(source, dest, count); break;
+        case PIXEL_CONVERT_PATH_SSE: SwizzleSse(source, dest, count); break;
+        default: SwizzleScalar(source, dest, count); break;
+    }
+}
+
+internal void Premultiply(PixelConvertPath path, u8* pixels, i32 count)
+{
+    switch (path)
+    {
+        case PIXEL_CONVERT_PATH_AVX512: PremultiplyAvx512(pixels, count); break;
+        case PIXEL_CONVERT_PATH_AVX2: PremultiplyAvx2(pixels, count); break;
+        case PIXEL_CONVERT_PATH_SSE: PremultiplySse(pixels, count); break;
+        default: PremultiplyScalar(pixels, count); break;
+    }
+}
+
+internal void Unpremultiply(PixelConvertPath path, u8* pixels, i32 count)
+{
+    switch (path)
+    {
+        case PIXEL_CONVERT_PATH_AVX512: UnpremultiplyAvx512(pixels, count); break;
+        case PIXEL_CONVERT_PATH_AVX2: UnpremultiplyAvx2(pixels, count); break;
+        case PIXEL_CONVERT_PATH_SSE: UnpremultiplySse(pixels, count); break;
+        default: UnpremultiplyScalar(pixels, count); break;
+    }
+}
+
+internal void Quantize(const PixelConvertJob* job, const u8* source, u8* dest, i32 count)
+{
+    switch (job->path)
+    {
+        case PIXEL_CONVERT_PATH_AVX512: QuantizeAvx512(job, source, dest, count); break;
+        case PIXEL_CONVERT_PATH_AVX2: QuantizeAvx2(job, source, dest, count); break;
+        case PIXEL_CONVERT_PATH_SSE: QuantizeSse(job, source, dest, count); break;
+        default: QuantizeScalar(job, source, dest, 0, count); break;
+    }
+}
+
+// Each row runs the stages back to back while it is still in the cache
+internal void ConvertRows(void* data, u32 begin, u32 end)
+{
+    const PixelConvertJob* job = (const PixelConvertJob*)data;
+    bool is_float = job->source_format == PIXEL_FORMAT_RGBA16F || job->source_format == PIXEL_FORMAT_RGBA32F;
+    for (u32 y = begin; y < end; ++y)
+    {
+        const u8* source = job->source + (size_t)y * (size_t)job->source_pitch;
+        u32 dest_y = job->flip ? (u32)job->height - 1 - y : y;
+        u8* dest = job->dest + (size_t)dest_y * (size_t)job->dest_pitch;
+
+        if (is_float)
+        {
+            Quantize(job, source, dest, job->width);
+        }
+        else
+        {
+            if (job->swizzle)
+            {
+                Swizzle(job->path, source, dest, job->width);
+            }
+            else if (source != dest)
+            {
+                memcpy(dest, source, (size_t)job->width * 4);
+            }
+
+            if (job->flags & PIXEL_CONVERT_UNPREMULTIPLY)
+            {
+                Unpremultiply(job->path, dest, job->width);
+            }
+            if (job->flags & PIXEL_CONVERT_SRGB_ENCODE)
+            {
+                ApplyTable(dest, job->width, srgb_encode_table_u8);
+            }
+            if (job->flags & PIXEL_CONVERT_SRGB_DECODE)
+            {
+                ApplyTable(dest, job->width, srgb_decode_table_u8);
+            }
+        }
+
+        if (job->flags & PIXEL_CONVERT_PREMULTIPLY)
+        {
+            Premultiply(job->path, dest, job->width);
+        }
+    }
+}
+
+internal void FlipRowPairs(void* data, u32 begin, u32 end)
+{
+    const PixelFlipJob* job = (const PixelFlipJob*)data;
+    u8 temp[4096];
+    for (u32 y = begin; y < end; ++y)
+    {
+        u8* top = job->pixels + (size_t)y * (size_t)job->pitch;
+        u8* bottom = job->pixels + (size_t)(job->height - 1 - (i32)y) * (size_t)job->pitch;
+        for (size_t offset = 0; offset < job->row_size; offset += sizeof(temp))
+        {
+            size_t size = job->row_size - offset < sizeof(temp) ? job->row_size - offset : sizeof(temp);
+            memcpy(temp, top + offset, size);
+            memcpy(top + offset, bottom + offset, size);
+            memcpy(bottom + offset, temp, size);
+        }
+    }
+}
+
+// Turns the image upside down in place, swapping rows from both ends in parallel
+void FlipRows(PixelImage* image, WorkQueue* queue)
+{
+    PixelFlipJob job = {};
+    job.pixels = (u8*)image->pixels;
+    job.pitch = image->pitch;
+    job.height = image->height;
+    job.row_size = (size_t)image->width * GetBytesPerPixel(image->format);
+    u32 rows_per_task = (u32)MaxInt(PIXEL_CONVERT_PIXELS_PER_TASK / MaxInt(image->width, 1), 1);
+    work_queue::ParallelFor(queue, (u32)(image->height / 2), rows_per_task, FlipRowPairs, &job);
+}
+
+// Converts source into dest, both the same size. The destination has to be 8-bit. Converting
+// in place works between 8-bit formats with the same pitch, flipped or not.
+void ConvertWithPath(const PixelImage* source, PixelImage* dest, u32 flags, WorkQueue* queue, PixelConvertPath path)
+{
+    Assert(source->width == dest->width && source->height == dest->height);
+    Assert(dest->format == PIXEL_FORMAT_RGBA8 || dest->format == PIXEL_FORMAT_BGRA8);
+    Assert(!((flags & PIXEL_CONVERT_PREMULTIPLY) && (flags & PIXEL_CONVERT_UNPREMULTIPLY)));
+    Assert(!((flags & PIXEL_CONVERT_SRGB_ENCODE) && (flags & PIXEL_CONVERT_SRGB_DECODE)));
+    if (source->width <= 0 || source->height <= 0)
+    {
+        return;
+    }
+
+    bool is_float = source->format == PIXEL_FORMAT_RGBA16F || source->format == PIXEL_FORMAT_RGBA32F;
+    Assert(!(is_float && (flags & PIXEL_CONVERT_SRGB_DECODE)));
+    bool in_place = source->pixels == dest->pixels;
+    Assert(!in_place || (!is_float && source->pitch == dest->pitch));
+    InitTables();
+
+    PixelConvertJob job = {};
+    job.source = (const u8*)source->pixels;
+    job.dest = (u8*)dest->pixels;
+    job.source_pitch = source->pitch;
+    job.dest_pitch = dest->pitch;
+    job.width = source->width;
+    job.height = source->height;
+    job.source_format = source->format;
+    job.swizzle = (source->format == PIXEL_FORMAT_BGRA8) != (dest->format == PIXEL_FORMAT_BGRA8);
+    job.flip = (flags & PIXEL_CONVERT_FLIP_Y) && !in_place;
+    job.flags = flags;
+    job.path = path;
+
+    // Every stage works on rows as they are
+    bool has_work = job.swizzle || !in_place || (flags & ~PIXEL_CONVERT_FLIP_Y);
+    if (has_work)
+    {
+        u32 rows_per_task = (u32)MaxInt(PIXEL_CONVERT_PIXELS_PER_TASK / source->width, 1);
+        work_queue::ParallelFor(queue, (u32)source->height, rows_per_task, ConvertRows, &job);
+    }
+    if (in_place && (flags & PIXEL_CONVERT_FLIP_Y))
+    {
+        FlipRows(dest, queue);
+    }
+}
+
+void Convert(const PixelImage* source, PixelImage* dest, u32 flags, WorkQueue* queue)
+{
+    ConvertWithPath(source, dest, flags, queue, GetBestPath());
+}
+
+} // namespace pixel_convert
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "core.h"
+#include "renderer/dirty_region.h"
+
+namespace present
+{
+
+// The Interface - Functions implemented by the platform layer.
+// Copies the rects of a 32bpp top-down framebuffer to the window, stretched to its client
+// area. The rest of the window keeps what was presented before, unless the platform lost it
+// (first present, uncovered, resized): then the whole framebuffer goes out regardless.
+internal void PresentFramebuffer(void* window, const Framebuffer* framebuffer, const DirtyRect* rects, u32 rect_count);
+internal void InvalidateWindow(void* window);
+
+// Presents what changed since the last call and starts tracking the next frame
+void PresentDirtyRegion(void* window, Framebuffer* framebuffer)
+{
+    Assert(framebuffer->dirty);
+    DirtyRect rects[DIRTY_MAX_RECTS];
+    u32 rect_count = dirty_region::BuildRects(framebuffer->dirty, rects, DIRTY_MAX_RECTS);
+    PresentFramebuffer(window, framebuffer, rects, rect_count);
+    dirty_region::Reset(framebuffer->dirty);
+}
+
+} // namespace present
@@ -5,6 +5,7 @@
 
 // Forward declaration
 struct ResourceCatalog;
+struct VMArena;
 
 enum class DrawMode
 {
@@ -19,11 +20,104 @@ enum class RenderMode
     SPRITE
 };
 
-// Handle types: Just integers or pointers, hiding the real GLuint IDs
+enum class ShaderStatus
+{
+    PENDING,    // Still compiling, draws use the backend's fallback shader
+    READY,
+    FAILED
+};
+
+enum class TextureFormat
+{
+    RGBA8,
+    BC1,    // RGB with 1 bit alpha, 4 bits per texel
+    BC3,    // RGBA, 8 bits per texel
+    BC4,    // R, 4 bits per texel
+    BC5,    // RG, 8 bits per texel
+    BC7     // RGBA, 8 bits per texel, highest quality
+};
+
+// One mip level of a texture, tightly packed: RGBA8 texels, or blocks for the compressed formats
+struct TextureLevel {
+    i32 width;
+    i32 height;
+    const void* pixels;
+};
+
+#define MAX_MESH_LODS 8
+#define MAX_GPU_SCOPES 16
+
+// Counters from ARB_pipeline_statistics_query (core in 4.6), only for outermost scopes
+struct GpuPipelineStats {
+    u64 vertices_submitted;
+    u64 primitives_submitted;
+    u64 vertex_shader_invocations;
+    u64 fragment_shader_invocations;
+};
+
+struct GpuScopeStats {
+    const char* label;
+    u32 depth;
+    f32 gpu_ms;
+    bool has_pipeline_stats;
+    GpuPipelineStats pipeline;
+};
+
+#define MAX_FRAMES_IN_FLIGHT 3
+
+#define MIN_RENDER_SCALE 0.25f
+#define MAX_RENDER_SCALE 1.0f
+
+// How evenly frames leave the CPU and how long it waited on the GPU to get there
+struct FramePacingStats {
+    u32 max_frames_in_flight;
+    f32 last_wait_ms;
+    f32 avg_wait_ms;            // Exponential moving averages
+    f32 avg_present_interval_ms;
+    f32 present_jitter_ms;      // Mean absolute deviation of the present interval
+    u32 timeout_count;
+};
+
+// GPU timings of one frame, read back a few frames after it was submitted
+struct GpuFrameStats {
+    u64 frame_index;
+    f32 frame_gpu_ms;
+    u32 scope_count;
+    GpuScopeStats scopes[MAX_GPU_SCOPES];
+};
+
+// CPU side counters of the frame since BeginFrame()
+struct RenderStats {
+    u32 draw_calls;         // Draws that reached the backend, skipped ones excluded
+    u32 state_changes;      // Binds and toggles actually issued for them: programs, vertex arrays, textures, depth state
+};
+
+// Handle types: Just integers or pointers, hiding the real GLuint IDs.
+// The id packs the backend's slot index with the slot's generation. Destroying a resource bumps the
+// generation, so a handle kept past its Destroy*() never matches whatever reuses the slot.
+#define HANDLE_INDEX_BITS       20
+#define HANDLE_INDEX_MASK       ((1u << HANDLE_INDEX_BITS) - 1)
+#define HANDLE_GENERATION_MASK  (0xFFFFFFFFu >> HANDLE_INDEX_BITS)
+
 struct ShaderHandle { u32 id; };
 struct MeshHandle { u32 id; };
 struct SpriteHandle { u32 id; };
 
+inline u32 MakeHandleId(u32 index, u32 generation)
+{
+    return ((generation & HANDLE_GENERATION_MASK) << HANDLE_INDEX_BITS) | (index & HANDLE_INDEX_MASK);
+}
+
+inline u32 GetHandleIndex(u32 id)
+{
+    return id & HANDLE_INDEX_MASK;
+}
+
+inline u32 GetHandleGeneration(u32 id)
+{
+    return id >> HANDLE_INDEX_BITS;
+}
+
 struct Vertex {
     float position[3];
     float normal[3];
@@ -37,10 +131,18 @@ struct Vertex2D {
     float uv[2];
 };
 
+// One level of detail: a range of the mesh index buffer over the shared vertex buffer
+struct MeshLod {
+    u32 index_offset;
+    u32 index_count;
+    float error; // Geometric deviation from LOD 0, in object space units
+};
+
 struct RenderMeshCommand {
     MeshHandle mesh;
     ShaderHandle shader;
     DrawMode draw_mode;
+    u32 lod;
     glm::mat4 model;
     glm::mat4 view;
     glm::mat4 projection;
@@ -61,10 +163,39 @@ struct RenderCommand {
     };
 };
 
+// Point lights are binned into a froxel grid: CLUSTER_GRID_X * CLUSTER_GRID_Y screen tiles,
+// each split into CLUSTER_GRID_Z exponential depth slices. Cluster index = x + X * (y + Y * z),
+// tile y counts from the bottom of the screen like gl_FragCoord.
+#define CLUSTER_GRID_X      16
+#define CLUSTER_GRID_Y      9
+#define CLUSTER_GRID_Z      24
+#define CLUSTER_COUNT       (CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z)
+#define MAX_POINT_LIGHTS    4096    // Light indices are 16-bit
+
+// Uploaded as is, two RGBA32F texels per light
+struct PointLight {
+    glm::vec3 position;     // World space
+    float radius;           // No contribution past this distance
+    glm::vec3 color;
+    float intensity;
+};
+
+// Result of the CPU light binning, uploaded by the backend before the meshes are drawn
+struct LightClusters {
+    const PointLight* lights;
+    u32 light_count;
+    const u32* cluster_ranges;  // Offset into light_indices and light count, per cluster
+    const u16* light_indices;
+    u32 index_count;
+    float near_plane;           // Depth range split by the slices
+    float far_plane;
+};
+
 struct RenderQueue {
     RenderCommand* commands;
     u64 command_count;
     u64 capacity;
+    const LightClusters* light_clusters;    // Optional, meshes only get ambient light without it
 };
 
 namespace renderer
@@ -75,15 +206,59 @@ namespace renderer
 internal bool Init(void* window_handle);
 internal void Resize(i32 width, i32 height);
 internal void ClearScreen(f32 r, f32 g, f32 b, f32 a);
+internal void SetMaxFramesInFlight(u32 count);
+internal void WaitForFrameLatency();
+internal void BeginFrame();
 internal void Present();
+
+// Dynamic resolution. The scene pass renders into an offscreen target at scale * window
+// size; EndScene() upscales it to the window, anything drawn afterwards is at full size.
+internal void SetRenderScale(f32 scale);
+internal void GetRenderResolution(i32* width, i32* height);
+internal void BeginScene();
+internal void EndScene();
 internal void SetResourceCatalog(ResourceCatalog* catalog);
 
 // Resource creation functions
 internal MeshHandle CreateMesh(const Vertex* vertices, int v_count, int* indices, int i_count);
+internal MeshHandle CreateMeshWithLods(const Vertex* vertices, int v_count, int* indices, int i_count, const MeshLod* lods, u32 lod_count);
+internal MeshHandle CreateMeshAsync(const Vertex* vertices, int v_count, int* indices, int i_count, const MeshLod* lods, u32 lod_count);
 internal ShaderHandle CreateShader(const char* vertex_source, const char* fragment_source);
+internal ShaderHandle CreateShaderAsync(const char* vertex_source, const char* fragment_source);
+internal ShaderStatus GetShaderStatus(ShaderHandle shader);
 internal SpriteHandle CreateSprite(ResourceID resource_id, float width, float height);
+internal SpriteHandle CreateSpriteAsync(ResourceID resource_id, float width, float height);
+internal SpriteHandle CreateSpriteWithMips(const TextureLevel* levels, u32 level_count, bool srgb, float width, float height);
+internal SpriteHandle CreateCompressedSprite(TextureFormat format, const TextureLevel* levels, u32 level_count, bool srgb, float width, float height);
+
+// The Async variants build buffers and textures on the upload thread, copying the mesh data.
+// Handles are valid right away; until the upload fence signals meshes are skipped and sprites
+// show the fallback texture.
+internal bool IsMeshReady(MeshHandle mesh);
+internal bool IsSpriteReady(SpriteHandle sprite);
+// Live meshes and sprites that are not ready yet, 0 once everything created so far draws for real
+internal u32 GetPendingUploadCount();
+
+// Destruction is deferred: the GL objects are freed and the handle's slot reused once every
+// frame that may still draw it has finished on the GPU. Destroyed handles draw nothing.
+internal void DestroyMesh(MeshHandle mesh);
+internal void DestroySprite(SpriteHandle sprite);
+internal void DestroyShader(ShaderHandle shader);
+
+// Profiling functions. Scopes nest; labels must outlive the frame's readback.
+// GetGpuFrameStats() returns true when a newer frame resolved since the last call.
+internal void BeginGpuScope(const char* label);
+internal void EndGpuScope();
+internal bool GetGpuFrameStats(GpuFrameStats* stats);
+internal void GetFramePacingStats(FramePacingStats* stats);
+internal void GetRenderStats(RenderStats* stats);
+
+// Copies the finished frame into the arena as BGRA8, top row first, width * 4 bytes per row.
+// Call after Present() and before the platform swaps the buffers.
+internal bool ReadFramebuffer(VMArena* arena, u8** pixels, i32* width, i32* height);
 
 // Rendering functions
+internal void UploadLightClusters(const LightClusters* clusters);
 internal void Draw(RenderCommand* cmd);
 internal void DrawMesh(RenderMeshCommand* cmd);
 internal void DrawSprite(RenderSpriteCommand* cmd);
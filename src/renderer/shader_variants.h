@@ -0,0 +1,96 @@
+#pragma once
+
+#include "core.h"
+#include "renderer/renderer.h"
+
+#include <stdio.h>
+
+// Every feature becomes a FEATURE_<NAME> define in both stages of the uber shader source.
+// A variant key is the OR of the features it enables.
+enum ShaderFeature : u32
+{
+    SHADER_FEATURE_LIT              = 1u << 0,  // Octahedral normals and clustered point lights
+    SHADER_FEATURE_VERTEX_COLOR     = 1u << 1,
+    SHADER_FEATURE_UNIFORM_COLOR    = 1u << 2,  // Multiplied by the "color" uniform
+    SHADER_FEATURE_TEXTURED         = 1u << 3,  // Multiplied by "spriteTexture"
+    SHADER_FEATURE_SCREEN_SPACE     = 1u << 4,  // Vertex2D input, no view matrix
+};
+
+#define SHADER_FEATURE_COUNT        5
+#define SHADER_VARIANT_COUNT        (1u << SHADER_FEATURE_COUNT)
+#define SHADER_VARIANT_SOURCE_SIZE  Kilobytes(16)
+
+static const char* shader_feature_names[SHADER_FEATURE_COUNT] = {
+    "LIT",
+    "VERTEX_COLOR",
+    "UNIFORM_COLOR",
+    "TEXTURED",
+    "SCREEN_SPACE",
+};
+
+// Variants of one uber shader source, compiled the first time a key is asked for
+struct ShaderVariantCache
+{
+    const char* source;     // Both stages, split by VERTEX_SHADER / FRAGMENT_SHADER
+    ShaderHandle handles[SHADER_VARIANT_COUNT];
+    bool is_created[SHADER_VARIANT_COUNT];
+    u32 created_count;
+};
+
+namespace shader_variants
+{
+
+void Init(ShaderVariantCache* cache, const char* source)
+{
+    *cache = {};
+    cache->source = source;
+}
+
+// Writes the version line and the stage and feature defines in front of the shared source.
+// #line keeps compile errors pointing at lines of the original source.
+internal void BuildStageSource(const char* source, const char* stage, u32 key, char* out, size_t out_size)
+{
+    int length = snprintf(out, out_size, "#version 330 core\n#define %s\n", stage);
+    for (u32 feature = 0; feature < SHADER_FEATURE_COUNT; ++feature)
+    {
+        if (key & (1u << feature))
+        {
+            length += snprintf(out + length, out_size - (size_t)length, "#define FEATURE_%s\n", shader_feature_names[feature]);
+        }
+    }
+    length += snprintf(out + length, out_size - (size_t)length, "#line 1\n");
+    int written = snprintf(out + length, out_size - (size_t)length, "%s", source);
+    Assert(written >= 0 && (size_t)(length + written) < out_size);
+}
+
+// Returns the program for a variant, compiling it in the background on first use.
+// Until it is ready, draws with it use the backend's fallback shader.
+ShaderHandle Get(ShaderVariantCache* cache, u32 key)
+{
+    Assert(key < SHADER_VARIANT_COUNT);
+    Assert(!((key & SHADER_FEATURE_LIT) && (key & SHADER_FEATURE_SCREEN_SPACE))); // 2D vertices carry no normal
+    if (!cache->is_created[key])
+    {
+        // The backend hands the text to the driver right away, it doesn't have to outlive the call
+        local char vertex_source[SHADER_VARIANT_SOURCE_SIZE];
+        local char fragment_source[SHADER_VARIANT_SOURCE_SIZE];
+        BuildStageSource(cache->source, "VERTEX_SHADER", key, vertex_source, sizeof(vertex_source));
+        BuildStageSource(cache->source, "FRAGMENT_SHADER", key, fragment_source, sizeof(fragment_source));
+
+        cache->handles[key] = renderer::CreateShaderAsync(vertex_source, fragment_source);
+        cache->is_created[key] = true;
+        ++cache->created_count;
+    }
+    return cache->handles[key];
+}
+
+// Kicks off the variants known to be needed at startup so their first draw doesn't wait
+void Prewarm(ShaderVariantCache* cache, const u32* keys, u32 key_count)
+{
+    for (u32 i = 0; i < key_count; ++i)
+    {
+        Get(cache, keys[i]);
+    }
+}
+
+} // namespace shader_variants
@@ -0,0 +1,970 @@
+#pragma once
+
+#include "core.h"
+#include "core/memory.h"
+#include "core/bulk_memory.h"
+#include "core/work_queue.h"
+#include "utils/handmade_math.h"
+#include "renderer/sprite_blitter.h"
+#include "renderer/texture_sampler.h"
+
+#include <immintrin.h>
+
+#define SOFTWARE_TILE_SIZE          64      // Pixels, even so that 2x2 quads never straddle two tiles
+#define SOFTWARE_SUBPIXEL_BITS      4
+#define SOFTWARE_SUBPIXEL_SCALE     (1 << SOFTWARE_SUBPIXEL_BITS)
+#define SOFTWARE_GUARD_BAND         2.0f    // Triangles are clipped to |x|, |y| <= GUARD_BAND * w
+#define SOFTWARE_MAX_DIMENSION      4096    // With the guard band, keeps the tile local edge values in 32 bits
+#define SOFTWARE_ATTRIBUTE_COUNT    5       // Color rgb, uv
+#define SOFTWARE_CLIP_PLANE_COUNT   6
+#define SOFTWARE_MAX_CLIP_VERTICES  (3 + SOFTWARE_CLIP_PLANE_COUNT)
+#define SOFTWARE_BIN_CHUNK_SIZE     64
+#define SOFTWARE_FRAME_ARENA_SIZE   Gigabytes(1)
+#define SOFTWARE_FRAME_ARENA_SLACK  Megabytes(4)    // Room for one more triangle binned into every tile
+#define SOFTWARE_DEPTH_ARENA_SIZE   Megabytes(128)
+#define SOFTWARE_HASH_SEED          0xCBF29CE484222325ull
+#define SOFTWARE_HASH_PRIME         0x100000001B3ull
+
+// Tiled RGBA8 levels and the GL sampler parameters they were created with
+struct SoftwareTexture
+{
+    SamplerTexture sampler;
+    SamplerState state;
+};
+
+// Output of the vertex stage, attributes are interpolated perspective correct
+struct SoftwareVertex
+{
+    glm::vec4 clip;
+    f32 attributes[SOFTWARE_ATTRIBUTE_COUNT];
+};
+
+enum SoftwareRasterFlags : u32
+{
+    SOFTWARE_RASTER_DEPTH_TEST  = 1u << 0,  // GL_LESS
+    SOFTWARE_RASTER_DEPTH_WRITE = 1u << 1,
+};
+
+// Counter-clockwise in screen space (origin bottom-left) after setup
+struct SoftwareTriangle
+{
+    i32 min_x;              // Pixels whose centers may be covered, max exclusive
+    i32 min_y;
+    i32 max_x;
+    i32 max_y;
+
+    // E = a * X + b * Y + c over subpixel coordinates, covered where E >= 0 on all three.
+    // The top-left fill rule is folded into c.
+    i32 edge_a[3];
+    i32 edge_b[3];
+    i64 edge_c[3];
+
+    // Plane equations: value, d/dx, d/dy in pixels relative to the origin (vertex 0)
+    f32 origin_x;
+    f32 origin_y;
+    f32 z[3];
+    f32 inv_w[3];
+    f32 attributes[SOFTWARE_ATTRIBUTE_COUNT][3];   // Divided by w
+
+    const SoftwareTexture* texture;
+    u32 flags;
+    u64 signature;          // Hash of all of the above, compared across frames
+};
+
+struct SoftwareClear
+{
+    u32 color;
+    u64 signature;
+};
+
+// A sprite blit, run by every tile it overlaps clipped to the tile
+struct SoftwareBlit
+{
+    SpriteBlit blit;
+    BlitImage image;
+    BlitPath path;
+    u64 signature;
+};
+
+enum SoftwareCommandType : u32
+{
+    SOFTWARE_COMMAND_TRIANGLE,
+    SOFTWARE_COMMAND_CLEAR,
+    SOFTWARE_COMMAND_BLIT,
+};
+
+struct SoftwareTileCommand
+{
+    SoftwareCommandType type;
+    const void* data;
+};
+
+struct SoftwareBinChunk
+{
+    SoftwareTileCommand commands[SOFTWARE_BIN_CHUNK_SIZE];
+    u32 count;
+    SoftwareBinChunk* next;
+};
+
+// Commands touching a tile, in submission order
+struct SoftwareTileBin
+{
+    SoftwareBinChunk* first;
+    SoftwareBinChunk* last;
+};
+
+struct SoftwareRasterizer
+{
+    Framebuffer* target;        // 32bpp BGRA, rows top-down like the DIB section
+    f32* depth;                 // Rows bottom-up like GL, padded to even dimensions
+    i32 depth_pitch;
+    i32 tiles_x;
+    i32 tiles_y;
+    i32 viewport_width;         // Anchored at the bottom-left corner of the target
+    i32 viewport_height;
+
+    SoftwareTileBin* bins;
+    u32 binned_command_count;
+    u32 submitted_triangle_count;
+
+    // A tile whose commands start with a clear and hash the same as last frame's already
+    // holds their result, EndFrame() skips it. Frames flushed early redraw every tile.
+    u64* tile_signatures;       // 0 when the tile's content is not known to match
+    u8* tile_executed;          // Written by each tile's job, read back on the main thread
+    bool compare_signatures;
+    bool frame_is_split;
+    u32 skipped_tile_count;     // By the last EndFrame()
+
+    VMArena frame_arena;        // Bins and commands, reset by every Flush()
+    VMArena depth_arena;
+    WorkQueue* queue;
+};
+
+struct SoftwareTileRect
+{
+    i32 x0;
+    i32 y0;
+    i32 x1;
+    i32 y1;
+};
+
+namespace software_rasterizer
+{
+
+internal u32 PackColor(f32 r, f32 g, f32 b, f32 a)
+{
+    u32 r8 = RoundFloatToUInt(MinFloat(MaxFloat(r, 0.0f), 1.0f) * 255.0f);
+    u32 g8 = RoundFloatToUInt(MinFloat(MaxFloat(g, 0.0f), 1.0f) * 255.0f);
+    u32 b8 = RoundFloatToUInt(MinFloat(MaxFloat(b, 0.0f), 1.0f) * 255.0f);
+    u32 a8 = RoundFloatToUInt(MinFloat(MaxFloat(a, 0.0f), 1.0f) * 255.0f);
+    return (a8 << 24) | (r8 << 16) | (g8 << 8) | b8;
+}
+
+internal void ResetBins(SoftwareRasterizer* rasterizer)
+{
+    memory::VMArenaReset(&rasterizer->frame_arena);
+    size_t bins_size = (size_t)(rasterizer->tiles_x * rasterizer->tiles_y) * sizeof(SoftwareTileBin);
+    rasterizer->bins = (SoftwareTileBin*)memory::VMArenaAlloc(&rasterizer->frame_arena, bins_size);
+    ZeroSize(bins_size, rasterizer->bins);
+    rasterizer->binned_command_count = 0;
+}
+
+internal u64 HashWords(u64 hash, const void* data, size_t size)
+{
+    const u32* words = (const u32*)data;
+    for (size_t i = 0; i < size / sizeof(u32); ++i)
+    {
+        hash = (hash ^ words[i]) * SOFTWARE_HASH_PRIME;
+    }
+    return hash;
+}
+
+internal void AppendToBin(SoftwareRasterizer* rasterizer, SoftwareTileBin* bin, SoftwareCommandType type, const void* data)
+{
+    if (!bin->last || bin->last->count == SOFTWARE_BIN_CHUNK_SIZE)
+    {
+        SoftwareBinChunk* chunk = (SoftwareBinChunk*)memory::VMArenaAlloc(&rasterizer->frame_arena, sizeof(SoftwareBinChunk));
+        chunk->count = 0;
+        chunk->next = nullptr;
+        if (bin->last)
+        {
+            bin->last->next = chunk;
+        }
+        else
+        {
+            bin->first = chunk;
+        }
+        bin->last = chunk;
+    }
+    SoftwareTileCommand& command = bin->last->commands[bin->last->count++];
+    command.type = type;
+    command.data = data;
+}
+
+internal void PushClear(SoftwareRasterizer* rasterizer, u32 color)
+{
+    SoftwareClear* clear = (SoftwareClear*)memory::VMArenaAlloc(&rasterizer->frame_arena, sizeof(SoftwareClear));
+    clear->color = color;
+    clear->signature = HashWords(SOFTWARE_HASH_SEED, &color, sizeof(color));
+    for (i32 i = 0; i < rasterizer->tiles_x * rasterizer->tiles_y; ++i)
+    {
+        AppendToBin(rasterizer, &rasterizer->bins[i], SOFTWARE_COMMAND_CLEAR, clear);
+    }
+    ++rasterizer->binned_command_count;
+}
+
+// Forgets what the tiles hold, the next frame redraws all of them. Needed whenever
+// something a signature refers to by address, like a texture, may have changed.
+void InvalidateTiles(SoftwareRasterizer* rasterizer)
+{
+    for (i32 i = 0; i < rasterizer->tiles_x * rasterizer->tiles_y; ++i)
+    {
+        rasterizer->tile_signatures[i] = 0;
+    }
+}
+
+void Init(SoftwareRasterizer* rasterizer, WorkQueue* queue)
+{
+    *rasterizer = {};
+    rasterizer->queue = queue;
+    memory::InitVMArena(&rasterizer->frame_arena, SOFTWARE_FRAME_ARENA_SIZE);
+    memory::InitVMArena(&rasterizer->depth_arena, SOFTWARE_DEPTH_ARENA_SIZE);
+    cpu_features::Get();
+}
+
+// Call whenever the target's memory or size changes. Pending triangles are dropped.
+void Resize(SoftwareRasterizer* rasterizer, Framebuffer* target)
+{
+    Assert(target->bytes_per_pixel == 4);
+    Assert(target->width <= SOFTWARE_MAX_DIMENSION && target->height <= SOFTWARE_MAX_DIMENSION);
+
+    rasterizer->target = target;
+    rasterizer->tiles_x = (target->width + SOFTWARE_TILE_SIZE - 1) / SOFTWARE_TILE_SIZE;
+    rasterizer->tiles_y = (target->height + SOFTWARE_TILE_SIZE - 1) / SOFTWARE_TILE_SIZE;
+    rasterizer->viewport_width = target->width;
+    rasterizer->viewport_height = target->height;
+
+    // Quads read two depth values per row, so odd sizes get a padding column and row
+    i32 padded_height = (target->height + 1) & ~1;
+    rasterizer->depth_pitch = (target->width + 1) & ~1;
+    memory::VMArenaReset(&rasterizer->depth_arena);
+    rasterizer->depth = (f32*)memory::VMArenaAllocAligned(&rasterizer->depth_arena,
+                                                         (size_t)(rasterizer->depth_pitch * padded_height) * sizeof(f32), 16);
+
+    u32 tile_count = (u32)(rasterizer->tiles_x * rasterizer->tiles_y);
+    rasterizer->tile_signatures = (u64*)memory::VMArenaAlloc(&rasterizer->depth_arena, tile_count * sizeof(u64));
+    rasterizer->tile_executed = (u8*)memory::VMArenaAlloc(&rasterizer->depth_arena, tile_count);
+    InvalidateTiles(rasterizer);
+    rasterizer->frame_is_split = false;
+
+    ResetBins(rasterizer);
+    PushClear(rasterizer, PackColor(0.0f, 0.0f, 0.0f, 1.0f));
+}
+
+void SetViewport(SoftwareRasterizer* rasterizer, i32 width, i32 height)
+{
+    rasterizer->viewport_width = MinInt(MaxInt(width, 1), rasterizer->target->width);
+    rasterizer->viewport_height = MinInt(MaxInt(height, 1), rasterizer->target->height);
+}
+
+// Transforms points stored as separate x, y and z arrays, four at a time.
+// The arrays must be readable up to count rounded up to a multiple of four.
+void TransformPoints(const glm::mat4& m, const f32* x, const f32* y, const f32* z, u32 count, glm::vec4* out)
+{
+    __m128 m00 = _mm_set1_ps(m[0][0]), m01 = _mm_set1_ps(m[0][1]), m02 = _mm_set1_ps(m[0][2]), m03 = _mm_set1_ps(m[0][3]);
+    __m128 m10 = _mm_set1_ps(m[1][0]), m11 = _mm_set1_ps(m[1][1]), m12 = _mm_set1_ps(m[1][2]), m13 = _mm_set1_ps(m[1][3]);
+    __m128 m20 = _mm_set1_ps(m[2][0]), m21 = _mm_set1_ps(m[2][1]), m22 = _mm_set1_ps(m[2][2]), m23 = _mm_set1_ps(m[2][3]);
+    __m128 m30 = _mm_set1_ps(m[3][0]), m31 = _mm_set1_ps(m[3][1]), m32 = _mm_set1_ps(m[3][2]), m33 = _mm_set1_ps(m[3][3]);
+
+    for (u32 i = 0; i < count; i += 4)
+    {
+        __m128 px = _mm_loadu_ps(x + i);
+        __m128 py = _mm_loadu_ps(y + i);
+        __m128 pz = _mm_loadu_ps(z + i);
+
+        // Column major: result = m[0] * x + m[1] * y + m[2] * z + m[3]
+        __m128 rx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m00, px), _mm_mul_ps(m10, py)), _mm_add_ps(_mm_mul_ps(m20, pz), m30));
+        __m128 ry = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m01, px), _mm_mul_ps(m11, py)), _mm_add_ps(_mm_mul_ps(m21, pz), m31));
+        __m128 rz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m02, px), _mm_mul_ps(m12, py)), _mm_add_ps(_mm_mul_ps(m22, pz), m32));
+        __m128 rw = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m03, px), _mm_mul_ps(m13, py)), _mm_add_ps(_mm_mul_ps(m23, pz), m33));
+        _MM_TRANSPOSE4_PS(rx, ry, rz, rw);
+
+        u32 remaining = count - i;
+        _mm_storeu_ps(&out[i].x, rx);
+        if (remaining > 1) _mm_storeu_ps(&out[i + 1].x, ry);
+        if (remaining > 2) _mm_storeu_ps(&out[i + 2].x, rz);
+        if (remaining > 3) _mm_storeu_ps(&out[i + 3].x, rw);
+    }
+}
+
+// Largest edge value over the pixel centers of [x0, x1) x [y0, y1)
+internal i64 GetEdgeMax(const SoftwareTriangle* tri, u32 edge, i32 x0, i32 y0, i32 x1, i32 y1)
+{
+    i64 a = tri->edge_a[edge];
+    i64 b = tri->edge_b[edge];
+    i64 x = (a > 0 ? x1 - 1 : x0) * SOFTWARE_SUBPIXEL_SCALE + SOFTWARE_SUBPIXEL_SCALE / 2;
+    i64 y = (b > 0 ? y1 - 1 : y0) * SOFTWARE_SUBPIXEL_SCALE + SOFTWARE_SUBPIXEL_SCALE / 2;
+    return a * x + b * y + tri->edge_c[edge];
+}
+
+internal i64 GetEdgeMin(const SoftwareTriangle* tri, u32 edge, i32 x0, i32 y0, i32 x1, i32 y1)
+{
+    i64 a = tri->edge_a[edge];
+    i64 b = tri->edge_b[edge];
+    i64 x = (a > 0 ? x0 : x1 - 1) * SOFTWARE_SUBPIXEL_SCALE + SOFTWARE_SUBPIXEL_SCALE / 2;
+    i64 y = (b > 0 ? y0 : y1 - 1) * SOFTWARE_SUBPIXEL_SCALE + SOFTWARE_SUBPIXEL_SCALE / 2;
+    return a * x + b * y + tri->edge_c[edge];
+}
+
+// Gradient of a value given at the three vertices, over pixel offsets from vertex 0
+internal void SetupPlane(f32 f0, f32 f1, f32 f2, f32 dx1, f32 dy1, f32 dx2, f32 dy2, f32 inv_det, f32* out)
+{
+    out[0] = f0;
+    out[1] = ((f1 - f0) * dy2 - (f2 - f0) * dy1) * inv_det;
+    out[2] = ((f2 - f0) * dx1 - (f1 - f0) * dx2) * inv_det;
+}
+
+void Flush(SoftwareRasterizer* rasterizer);
+
+// Vertices must be inside the clip volume with the guard band
+internal void SetupTriangle(SoftwareRasterizer* rasterizer, const SoftwareVertex* v0, const SoftwareVertex* v1, const SoftwareVertex* v2,
+                            const SoftwareTexture* texture, u32 flags)
+{
+    const SoftwareVertex* vertices[3] = { v0, v1, v2 };
+    i32 sx[3];
+    i32 sy[3];
+    f32 z[3];
+    f32 inv_w[3];
+    f32 half_width = 0.5f * (f32)rasterizer->viewport_width;
+    f32 half_height = 0.5f * (f32)rasterizer->viewport_height;
+    for (u32 v = 0; v < 3; ++v)
+    {
+        const glm::vec4& clip = vertices[v]->clip;
+        inv_w[v] = 1.0f / clip.w;
+        f32 x = (clip.x * inv_w[v] + 1.0f) * half_width;
+        f32 y = (clip.y * inv_w[v] + 1.0f) * half_height;
+        sx[v] = FloorFloatToInt(x * (f32)SOFTWARE_SUBPIXEL_SCALE + 0.5f);
+        sy[v] = FloorFloatToInt(y * (f32)SOFTWARE_SUBPIXEL_SCALE + 0.5f);
+        z[v] = clip.z * inv_w[v] * 0.5f + 0.5f;
+    }
+
+    i64 area = (i64)(sx[1] - sx[0]) * (i64)(sy[2] - sy[0]) - (i64)(sy[1] - sy[0]) * (i64)(sx[2] - sx[0]);
+    if (area == 0)
+    {
+        return;
+    }
+    if (area < 0)
+    {
+        // No face culling, like the GL path: flip clockwise triangles around
+        i32 temp_x = sx[1]; sx[1] = sx[2]; sx[2] = temp_x;
+        i32 temp_y = sy[1]; sy[1] = sy[2]; sy[2] = temp_y;
+        f32 temp_z = z[1]; z[1] = z[2]; z[2] = temp_z;
+        f32 temp_w = inv_w[1]; inv_w[1] = inv_w[2]; inv_w[2] = temp_w;
+        const SoftwareVertex* temp_v = vertices[1]; vertices[1] = vertices[2]; vertices[2] = temp_v;
+    }
+
+    // Pixel p is a candidate when its center p * 16 + 8 lies within the snapped bounds
+    i32 min_sx = MinInt(sx[0], MinInt(sx[1], sx[2]));
+    i32 max_sx = MaxInt(sx[0], MaxInt(sx[1], sx[2]));
+    i32 min_sy = MinInt(sy[0], MinInt(sy[1], sy[2]));
+    i32 max_sy = MaxInt(sy[0], MaxInt(sy[1], sy[2]));
+    i32 half_pixel = SOFTWARE_SUBPIXEL_SCALE / 2;
+    i32 min_x = MaxInt((min_sx - half_pixel + SOFTWARE_SUBPIXEL_SCALE - 1) >> SOFTWARE_SUBPIXEL_BITS, 0);
+    i32 min_y = MaxInt((min_sy - half_pixel + SOFTWARE_SUBPIXEL_SCALE - 1) >> SOFTWARE_SUBPIXEL_BITS, 0);
+    i32 max_x = MinInt(((max_sx - half_pixel) >> SOFTWARE_SUBPIXEL_BITS) + 1, rasterizer->viewport_width);
+    i32 max_y = MinInt(((max_sy - half_pixel) >> SOFTWARE_SUBPIXEL_BITS) + 1, rasterizer->viewport_height);
+    if (min_x >= max_x || min_y >= max_y)
+    {
+        return;
+    }
+
+    if (rasterizer->frame_arena.curr_offset + SOFTWARE_FRAME_ARENA_SLACK > SOFTWARE_FRAME_ARENA_SIZE)
+    {
+        Flush(rasterizer);
+    }
+
+    SoftwareTriangle* tri = (SoftwareTriangle*)memory::VMArenaAlloc(&rasterizer->frame_arena, sizeof(SoftwareTriangle));
+    tri->min_x = min_x;
+    tri->min_y = min_y;
+    tri->max_x = max_x;
+    tri->max_y = max_y;
+    tri->texture = texture;
+    tri->flags = flags;
+
+    // Edge i runs from vertex i + 1 to vertex i + 2, positive on the inside
+    for (u32 i = 0; i < 3; ++i)
+    {
+        u32 j = (i + 1) % 3;
+        u32 k = (i + 2) % 3;
+        i32 a = sy[j] - sy[k];
+        i32 b = sx[k] - sx[j];
+        i64 c = -((i64)a * sx[j] + (i64)b * sy[j]);
+
+        // Top-left rule: centers exactly on a right or bottom edge belong to the neighbour
+        bool is_top_left = a > 0 || (a == 0 && b < 0);
+        tri->edge_a[i] = a;
+        tri->edge_b[i] = b;
+        tri->edge_c[i] = is_top_left ? c : c - 1;
+    }
+
+    f32 scale = 1.0f / (f32)SOFTWARE_SUBPIXEL_SCALE;
+    tri->origin_x = (f32)sx[0] * scale;
+    tri->origin_y = (f32)sy[0] * scale;
+    f32 dx1 = (f32)(sx[1] - sx[0]) * scale;
+    f32 dy1 = (f32)(sy[1] - sy[0]) * scale;
+    f32 dx2 = (f32)(sx[2] - sx[0]) * scale;
+    f32 dy2 = (f32)(sy[2] - sy[0]) * scale;
+    f32 inv_det = 1.0f / (dx1 * dy2 - dx2 * dy1);
+
+    SetupPlane(z[0], z[1], z[2], dx1, dy1, dx2, dy2, inv_det, tri->z);
+    SetupPlane(inv_w[0], inv_w[1], inv_w[2], dx1, dy1, dx2, dy2, inv_det, tri->inv_w);
+    for (u32 a = 0; a < SOFTWARE_ATTRIBUTE_COUNT; ++a)
+    {
+        SetupPlane(vertices[0]->attributes[a] * inv_w[0], vertices[1]->attributes[a] * inv_w[1], vertices[2]->attributes[a] * inv_w[2],
+                   dx1, dy1, dx2, dy2, inv_det, tri->attributes[a]);
+    }
+
+    // Everything up to the texture pointer is plain 32 bit values without padding
+    u64 signature = HashWords(SOFTWARE_HASH_SEED, tri, offsetof(SoftwareTriangle, attributes) + sizeof(tri->attributes));
+    signature = HashWords(signature, &tri->flags, sizeof(tri->flags));
+    if (texture)
+    {
+        signature = HashWords(signature, texture, sizeof(SoftwareTexture));
+    }
+    tri->signature = signature;
+
+    // Bin into every tile the bounds touch, skipping tiles entirely outside one of the edges
+    i32 tile_x0 = min_x / SOFTWARE_TILE_SIZE;
+    i32 tile_y0 = min_y / SOFTWARE_TILE_SIZE;
+    i32 tile_x1 = (max_x - 1) / SOFTWARE_TILE_SIZE;
+    i32 tile_y1 = (max_y - 1) / SOFTWARE_TILE_SIZE;
+    bool single_tile = tile_x0 == tile_x1 && tile_y0 == tile_y1;
+    for (i32 tile_y = tile_y0; tile_y <= tile_y1; ++tile_y)
+    {
+        for (i32 tile_x = tile_x0; tile_x <= tile_x1; ++tile_x)
+        {
+            if (!single_tile)
+            {
+                i32 x0 = MaxInt(tile_x * SOFTWARE_TILE_SIZE, min_x);
+                i32 y0 = MaxInt(tile_y * SOFTWARE_TILE_SIZE, min_y);
+                i32 x1 = MinInt((tile_x + 1) * SOFTWARE_TILE_SIZE, max_x);
+                i32 y1 = MinInt((tile_y + 1) * SOFTWARE_TILE_SIZE, max_y);
+                if (GetEdgeMax(tri, 0, x0, y0, x1, y1) < 0 || GetEdgeMax(tri, 1, x0, y0, x1, y1) < 0 || GetEdgeMax(tri, 2, x0, y0, x1, y1) < 0)
+                {
+                    continue;
+                }
+            }
+            AppendToBin(rasterizer, &rasterizer->bins[tile_y * rasterizer->tiles_x + tile_x], SOFTWARE_COMMAND_TRIANGLE, tri);
+        }
+    }
+    ++rasterizer->binned_command_count;
+}
+
+// Signed distance to clip plane p: near, far, then the guard band left, right, bottom, top
+internal f32 GetClipDistance(const glm::vec4& clip, u32 plane)
+{
+    switch (plane)
+    {
+        case 0: return clip.z + clip.w;
+        case 1: return clip.w - clip.z;
+        case 2: return clip.x + SOFTWARE_GUARD_BAND * clip.w;
+        case 3: return SOFTWARE_GUARD_BAND * clip.w - clip.x;
+        case 4: return clip.y + SOFTWARE_GUARD_BAND * clip.w;
+        default: return SOFTWARE_GUARD_BAND * clip.w - clip.y;
+    }
+}
+
+internal u32 GetOutcode(const glm::vec4& clip)
+{
+    u32 outcode = 0;
+    for (u32 plane = 0; plane < SOFTWARE_CLIP_PLANE_COUNT; ++plane)
+    {
+        if (GetClipDistance(clip, plane) < 0.0f)
+        {
+            outcode |= 1u << plane;
+        }
+    }
+    return outcode;
+}
+
+// Sutherland-Hodgman against the planes in outcode, then fans out what is left
+internal void ClipAndSetupTriangle(SoftwareRasterizer* rasterizer, const SoftwareVertex* v0, const SoftwareVertex* v1, const SoftwareVertex* v2,
+                                   u32 outcode, const SoftwareTexture* texture, u32 flags)
+{
+    SoftwareVertex buffers[2][SOFTWARE_MAX_CLIP_VERTICES];
+    buffers[0][0] = *v0;
+    buffers[0][1] = *v1;
+    buffers[0][2] = *v2;
+    u32 count = 3;
+    u32 current = 0;
+
+    for (u32 plane = 0; plane < SOFTWARE_CLIP_PLANE_COUNT && count >= 3; ++plane)
+    {
+        if ((outcode & (1u << plane)) == 0)
+        {
+            continue;
+        }
+
+        const SoftwareVertex* in = buffers[current];
+        SoftwareVertex* out = buffers[current ^ 1];
+        u32 out_count = 0;
+        for (u32 i = 0; i < count; ++i)
+        {
+            const SoftwareVertex& a = in[i];
+            const SoftwareVertex& b = in[(i + 1) % count];
+            f32 da = GetClipDistance(a.clip, plane);
+            f32 db = GetClipDistance(b.clip, plane);
+            if (da >= 0.0f)
+            {
+                out[out_count++] = a;
+            }
+            if ((da >= 0.0f) != (db >= 0.0f))
+            {
+                f32 t = da / (da - db);
+                SoftwareVertex& split = out[out_count++];
+                split.clip = a.clip + (b.clip - a.clip) * t;
+                for (u32 attribute = 0; attribute < SOFTWARE_ATTRIBUTE_COUNT; ++attribute)
+                {
+                    split.attributes[attribute] = a.attributes[attribute] + (b.attributes[attribute] - a.attributes[attribute]) * t;
+                }
+            }
+        }
+        count = out_count;
+        current ^= 1;
+    }
+
+    for (u32 i = 1; i + 1 < count; ++i)
+    {
+        SetupTriangle(rasterizer, &buffers[current][0], &buffers[current][i], &buffers[current][i + 1], texture, flags);
+    }
+}
+
+// Copies the texture description into the frame so draws can reference it until they are drawn.
+// The texels themselves are not copied.
+const SoftwareTexture* PushTexture(SoftwareRasterizer* rasterizer, const SoftwareTexture& texture)
+{
+    SoftwareTexture* copy = (SoftwareTexture*)memory::VMArenaAlloc(&rasterizer->frame_arena, sizeof(SoftwareTexture));
+    *copy = texture;
+    return copy;
+}
+
+// Clips, sets up and bins an indexed triangle list. Nothing is drawn until Flush() or EndFrame(), the
+// vertices can go as soon as this returns but the texture must live until then.
+void SubmitTriangles(SoftwareRasterizer* rasterizer, const SoftwareVertex* vertices, const u32* indices, u32 index_count,
+                     const SoftwareTexture* texture, u32 flags)
+{
+    for (u32 i = 0; i + 2 < index_count; i += 3)
+    {
+        const SoftwareVertex* v0 = &vertices[indices[i]];
+        const SoftwareVertex* v1 = &vertices[indices[i + 1]];
+        const SoftwareVertex* v2 = &vertices[indices[i + 2]];
+        ++rasterizer->submitted_triangle_count;
+
+        u32 outcode0 = GetOutcode(v0->clip);
+        u32 outcode1 = GetOutcode(v1->clip);
+        u32 outcode2 = GetOutcode(v2->clip);
+        if (outcode0 & outcode1 & outcode2)
+        {
+            continue;
+        }
+
+        u32 outcode = outcode0 | outcode1 | outcode2;
+        if (outcode == 0)
+        {
+            SetupTriangle(rasterizer, v0, v1, v2, texture, flags);
+        }
+        else
+        {
+            ClipAndSetupTriangle(rasterizer, v0, v1, v2, outcode, texture, flags);
+        }
+    }
+}
+
+internal __m128 EvaluatePlane(const f32* plane, __m128 dx, __m128 dy)
+{
+    return _mm_add_ps(_mm_set1_ps(plane[0]), _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane[1]), dx), _mm_mul_ps(_mm_set1_ps(plane[2]), dy)));
+}
+
+// Walks the part of the triangle inside the tile in 2x2 quads. Lanes are (x, y), (x + 1, y),
+// (x, y + 1), (x + 1, y + 1). Edges entirely positive over the area are dropped, the others fit
+// 32 bits relative to the area's corner.
+internal void RasterizeTriangle(SoftwareRasterizer* rasterizer, const SoftwareTriangle* tri, const SoftwareTileRect& tile)
+{
+    i32 x0 = MaxInt(tri->min_x, tile.x0) & ~1;
+    i32 y0 = MaxInt(tri->min_y, tile.y0) & ~1;
+    i32 x1 = MinInt(tri->max_x, tile.x1);
+    i32 y1 = MinInt(tri->max_y, tile.y1);
+    if (x0 >= x1 || y0 >= y1)
+    {
+        return;
+    }
+
+    __m128i edge_row[3];
+    __m128i edge_step_x[3];
+    __m128i edge_step_y[3];
+    for (u32 i = 0; i < 3; ++i)
+    {
+        if (GetEdgeMax(tri, i, x0, y0, x1, y1) < 0)
+        {
+            return;
+        }
+        if (GetEdgeMin(tri, i, x0, y0, x1, y1) >= 0)
+        {
+            edge_row[i] = _mm_setzero_si128();
+            edge_step_x[i] = _mm_setzero_si128();
+            edge_step_y[i] = _mm_setzero_si128();
+            continue;
+        }
+
+        i64 corner_x = (i64)x0 * SOFTWARE_SUBPIXEL_SCALE + SOFTWARE_SUBPIXEL_SCALE / 2;
+        i64 corner_y = (i64)y0 * SOFTWARE_SUBPIXEL_SCALE + SOFTWARE_SUBPIXEL_SCALE / 2;
+        i32 corner = (i32)(tri->edge_a[i] * corner_x + tri->edge_b[i] * corner_y + tri->edge_c[i]);
+        i32 step_x = tri->edge_a[i] * SOFTWARE_SUBPIXEL_SCALE;
+        i32 step_y = tri->edge_b[i] * SOFTWARE_SUBPIXEL_SCALE;
+        edge_row[i] = _mm_add_epi32(_mm_set1_epi32(corner), _mm_setr_epi32(0, step_x, step_y, step_x + step_y));
+        edge_step_x[i] = _mm_set1_epi32(2 * step_x);
+        edge_step_y[i] = _mm_set1_epi32(2 * step_y);
+    }
+
+    Framebuffer* target = rasterizer->target;
+    bool depth_test = (tri->flags & SOFTWARE_RASTER_DEPTH_TEST) != 0;
+    bool depth_write = (tri->flags & SOFTWARE_RASTER_DEPTH_WRITE) != 0;
+    __m128i all_bits = _mm_set1_epi32(-1);
+    __m128i lane_x = _mm_setr_epi32(0, 1, 0, 1);
+    __m128i lane_y = _mm_setr_epi32(0, 0, 1, 1);
+    __m128i end_x = _mm_set1_epi32(x1);
+    __m128i end_y = _mm_set1_epi32(y1);
+    __m128 center_x = _mm_setr_ps(0.5f, 1.5f, 0.5f, 1.5f);
+    __m128 center_y = _mm_setr_ps(0.5f, 0.5f, 1.5f, 1.5f);
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 zero = _mm_setzero_ps();
+    __m128 to_byte = _mm_set1_ps(255.0f);
+
+    for (i32 y = y0; y < y1; y += 2)
+    {
+        __m128i edge0 = edge_row[0];
+        __m128i edge1 = edge_row[1];
+        __m128i edge2 = edge_row[2];
+        __m128i row_valid = _mm_cmplt_epi32(_mm_add_epi32(_mm_set1_epi32(y), lane_y), end_y);
+        __m128 dy = _mm_add_ps(_mm_set1_ps((f32)y - tri->origin_y), center_y);
+
+        f32* depth_row0 = rasterizer->depth + y * rasterizer->depth_pitch;
+        f32* depth_row1 = depth_row0 + rasterizer->depth_pitch;
+        u32* color_row0 = (u32*)((u8*)target->memory + (target->height - 1 - y) * target->pitch);
+        u32* color_row1 = y + 1 < target->height ? (u32*)((u8*)color_row0 - target->pitch) : color_row0;
+
+        for (i32 x = x0; x < x1; x += 2)
+        {
+            __m128i inside = _mm_and_si128(_mm_cmpgt_epi32(edge0, all_bits), _mm_cmpgt_epi32(edge1, all_bits));
+            inside = _mm_and_si128(inside, _mm_cmpgt_epi32(edge2, all_bits));
+            inside = _mm_and_si128(inside, _mm_and_si128(row_valid, _mm_cmplt_epi32(_mm_add_epi32(_mm_set1_epi32(x), lane_x), end_x)));
+            edge0 = _mm_add_epi32(edge0, edge_step_x[0]);
+            edge1 = _mm_add_epi32(edge1, edge_step_x[1]);
+            edge2 = _mm_add_epi32(edge2, edge_step_x[2]);
+
+            __m128 mask = _mm_castsi128_ps(inside);
+            if (_mm_movemask_ps(mask) == 0)
+            {
+                continue;
+            }
+
+            __m128 dx = _mm_add_ps(_mm_set1_ps((f32)x - tri->origin_x), center_x);
+            __m128 z = EvaluatePlane(tri->z, dx, dy);
+            __m128 depth = _mm_loadh_pi(_mm_loadl_pi(zero, (const __m64*)(depth_row0 + x)), (const __m64*)(depth_row1 + x));
+            if (depth_test)
+            {
+                mask = _mm_and_ps(mask, _mm_cmplt_ps(z, depth));
+            }
+            i32 lanes = _mm_movemask_ps(mask);
+            if (lanes == 0)
+            {
+                continue;
+            }
+            if (depth_write)
+            {
+                depth = _mm_or_ps(_mm_and_ps(mask, z), _mm_andnot_ps(mask, depth));
+                _mm_storel_pi((__m64*)(depth_row0 + x), depth);
+                _mm_storeh_pi((__m64*)(depth_row1 + x), depth);
+            }
+
+            // Perspective correct attributes
+            __m128 w = _mm_div_ps(one, EvaluatePlane(tri->inv_w, dx, dy));
+            __m128 r = _mm_mul_ps(EvaluatePlane(tri->attributes[0], dx, dy), w);
+            __m128 g = _mm_mul_ps(EvaluatePlane(tri->attributes[1], dx, dy), w);
+            __m128 b = _mm_mul_ps(EvaluatePlane(tri->attributes[2], dx, dy), w);
+            __m128 a = one;
+            if (tri->texture)
+            {
+                __m128 u = _mm_mul_ps(EvaluatePlane(tri->attributes[3], dx, dy), w);
+                __m128 v = _mm_mul_ps(EvaluatePlane(tri->attributes[4], dx, dy), w);
+                __m128 texel[4];
+                texture_sampler::SampleQuad(&tri->texture->sampler, &tri->texture->state, u, v, texel);
+                r = _mm_mul_ps(r, texel[0]);
+                g = _mm_mul_ps(g, texel[1]);
+                b = _mm_mul_ps(b, texel[2]);
+                a = texel[3];
+            }
+
+            __m128i r8 = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(r, zero), one), to_byte));
+            __m128i g8 = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(g, zero), one), to_byte));
+            __m128i b8 = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(b, zero), one), to_byte));
+            __m128i a8 = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(a, zero), one), to_byte));
+            __m128i bgra = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(a8, 24), _mm_slli_epi32(r8, 16)), _mm_or_si128(_mm_slli_epi32(g8, 8), b8));
+
+            // The color buffer has no padding, only touch the covered pixels
+            alignas(16) u32 colors[4];
+            _mm_store_si128((__m128i*)colors, bgra);
+            if (lanes & 1) color_row0[x] = colors[0];
+            if (lanes & 2) color_row0[x + 1] = colors[1];
+            if (lanes & 4) color_row1[x] = colors[2];
+            if (lanes & 8) color_row1[x + 1] = colors[3];
+        }
+
+        edge_row[0] = _mm_add_epi32(edge_row[0], edge_step_y[0]);
+        edge_row[1] = _mm_add_epi32(edge_row[1], edge_step_y[1]);
+        edge_row[2] = _mm_add_epi32(edge_row[2], edge_step_y[2]);
+    }
+}
+
+internal void ClearTile(SoftwareRasterizer* rasterizer, const SoftwareTileRect& tile, u32 color)
+{
+    Framebuffer* target = rasterizer->target;
+    size_t count = (size_t)(tile.x1 - tile.x0);
+    for (i32 y = tile.y0; y < tile.y1; ++y)
+    {
+        u32* color_row = (u32*)((u8*)target->memory + (target->height - 1 - y) * target->pitch);
+        f32* depth_row = rasterizer->depth + y * rasterizer->depth_pitch;
+        bulk_memory::Fill32(color_row + tile.x0, color, count, nullptr);
+        bulk_memory::Fill32((u32*)(depth_row + tile.x0), 0x3F800000, count, nullptr); // 1.0f, the far plane
+    }
+}
+
+// Single threaded within the tile, the tiles already keep every thread busy
+internal void BlitTile(SoftwareRasterizer* rasterizer, const SoftwareBlit* command, const SoftwareTileRect& tile)
+{
+    Framebuffer* target = rasterizer->target;
+    BlitRect clip = {};
+    clip.min_x = tile.x0;
+    clip.max_x = tile.x1;
+    clip.min_y = target->height - tile.y1;
+    clip.max_y = target->height - tile.y0;
+    sprite_blitter::BlitWithPath(target, &clip, &command->blit, nullptr, command->path);
+}
+
+internal void ExecuteCommand(SoftwareRasterizer* rasterizer, const SoftwareTileCommand& command, const SoftwareTileRect& tile)
+{
+    switch (command.type)
+    {
+        case SOFTWARE_COMMAND_TRIANGLE:
+            RasterizeTriangle(rasterizer, (const SoftwareTriangle*)command.data, tile);
+            break;
+        case SOFTWARE_COMMAND_CLEAR:
+            ClearTile(rasterizer, tile, ((const SoftwareClear*)command.data)->color);
+            break;
+        case SOFTWARE_COMMAND_BLIT:
+            BlitTile(rasterizer, (const SoftwareBlit*)command.data, tile);
+            break;
+    }
+}
+
+internal u64 GetCommandSignature(const SoftwareTileCommand& command)
+{
+    switch (command.type)
+    {
+        case SOFTWARE_COMMAND_TRIANGLE: return ((const SoftwareTriangle*)command.data)->signature;
+        case SOFTWARE_COMMAND_CLEAR:    return ((const SoftwareClear*)command.data)->signature;
+        default:                        return ((const SoftwareBlit*)command.data)->signature;
+    }
+}
+
+// Each tile owns its pixels and walks its bin in submission order, so the result does
+// not depend on how the tiles are spread over the threads
+internal void RasterizeTiles(void* data, u32 begin, u32 end)
+{
+    SoftwareRasterizer* rasterizer = (SoftwareRasterizer*)data;
+    for (u32 tile_index = begin; tile_index < end; ++tile_index)
+    {
+        const SoftwareTileBin& bin = rasterizer->bins[tile_index];
+        rasterizer->tile_executed[tile_index] = 0;
+        if (!bin.first)
+        {
+            continue;
+        }
+
+        // Only a tile that starts from a clear has content that depends on its commands alone
+        u64 signature = 0;
+        if (rasterizer->compare_signatures && bin.first->commands[0].type == SOFTWARE_COMMAND_CLEAR)
+        {
+            signature = SOFTWARE_HASH_SEED;
+            for (const SoftwareBinChunk* chunk = bin.first; chunk; chunk = chunk->next)
+            {
+                for (u32 i = 0; i < chunk->count; ++i)
+                {
+                    u64 command_signature = GetCommandSignature(chunk->commands[i]);
+                    signature = HashWords(signature, &command_signature, sizeof(command_signature));
+                }
+            }
+            signature |= 1;
+
+            if (signature == rasterizer->tile_signatures[tile_index])
+            {
+                continue;
+            }
+        }
+        rasterizer->tile_signatures[tile_index] = signature;
+        rasterizer->tile_executed[tile_index] = 1;
+
+        i32 tile_x = (i32)tile_index % rasterizer->tiles_x;
+        i32 tile_y = (i32)tile_index / rasterizer->tiles_x;
+        SoftwareTileRect tile = {};
+        tile.x0 = tile_x * SOFTWARE_TILE_SIZE;
+        tile.y0 = tile_y * SOFTWARE_TILE_SIZE;
+        tile.x1 = MinInt(tile.x0 + SOFTWARE_TILE_SIZE, rasterizer->target->width);
+        tile.y1 = MinInt(tile.y0 + SOFTWARE_TILE_SIZE, rasterizer->target->height);
+
+        for (const SoftwareBinChunk* chunk = bin.first; chunk; chunk = chunk->next)
+        {
+            for (u32 i = 0; i < chunk->count; ++i)
+            {
+                ExecuteCommand(rasterizer, chunk->commands[i], tile);
+            }
+        }
+    }
+}
+
+// Runs every binned command on the work queue, blocks until it is done and marks the
+// tiles that changed in the target's dirty region
+internal void ExecuteBins(SoftwareRasterizer* rasterizer, bool compare_signatures)
+{
+    u32 tile_count = (u32)(rasterizer->tiles_x * rasterizer->tiles_y);
+    rasterizer->compare_signatures = compare_signatures;
+    rasterizer->skipped_tile_count = 0;
+    if (rasterizer->binned_command_count > 0)
+    {
+        work_queue::ParallelFor(rasterizer->queue, tile_count, 1, RasterizeTiles, rasterizer);
+
+        Framebuffer* target = rasterizer->target;
+        for (u32 tile_index = 0; tile_index < tile_count; ++tile_index)
+        {
+            if (!rasterizer->tile_executed[tile_index])
+            {
+                rasterizer->skipped_tile_count += rasterizer->bins[tile_index].first != nullptr;
+                continue;
+            }
+            if (target->dirty)
+            {
+                // Tiles count rows from the bottom, the dirty region from the top
+                i32 x0 = ((i32)tile_index % rasterizer->tiles_x) * SOFTWARE_TILE_SIZE;
+                i32 y0 = ((i32)tile_index / rasterizer->tiles_x) * SOFTWARE_TILE_SIZE;
+                dirty_region::MarkRect(target->dirty, x0, target->height - (y0 + SOFTWARE_TILE_SIZE), x0 + SOFTWARE_TILE_SIZE, target->height - y0);
+            }
+        }
+    }
+    ResetBins(rasterizer);
+}
+
+// Draws everything submitted so far. Tiles cannot be skipped in a frame that flushes before
+// EndFrame(), their final content is not known yet.
+void Flush(SoftwareRasterizer* rasterizer)
+{
+    if (rasterizer->binned_command_count == 0)
+    {
+        return;
+    }
+    rasterizer->frame_is_split = true;
+    ExecuteBins(rasterizer, false);
+}
+
+// Draws the rest of the frame, skipping tiles whose commands match the previous frame's
+void EndFrame(SoftwareRasterizer* rasterizer)
+{
+    ExecuteBins(rasterizer, !rasterizer->frame_is_split);
+    rasterizer->frame_is_split = false;
+}
+
+// Clears the whole target, not only the viewport, like glClear on the scene target
+void Clear(SoftwareRasterizer* rasterizer, f32 r, f32 g, f32 b, f32 a)
+{
+    PushClear(rasterizer, PackColor(r, g, b, a));
+}
+
+// Queues a sprite blit behind the triangles submitted so far. The image must live until
+// the frame is drawn; it is referenced by address, call InvalidateTiles() if it changes.
+void SubmitBlit(SoftwareRasterizer* rasterizer, const SpriteBlit* blit)
+{
+    BlitRect bounds;
+    if (!sprite_blitter::GetBlitBounds(rasterizer->target, nullptr, blit, &bounds))
+    {
+        return;
+    }
+
+    if (rasterizer->frame_arena.curr_offset + SOFTWARE_FRAME_ARENA_SLACK > SOFTWARE_FRAME_ARENA_SIZE)
+    {
+        Flush(rasterizer);
+    }
+
+    SoftwareBlit* command = (SoftwareBlit*)memory::VMArenaAlloc(&rasterizer->frame_arena, sizeof(SoftwareBlit));
+    command->image = *blit->image;
+    command->blit = *blit;
+    command->blit.image = &command->image;
+    command->path = sprite_blitter::GetBestPath();
+
+    // Field by field, BlitImage has tail padding
+    u64 signature = HashWords(SOFTWARE_HASH_SEED, &command->image.pixels, sizeof(command->image.pixels));
+    signature = HashWords(signature, &command->image.width, 3 * sizeof(i32));
+    signature = HashWords(signature, &command->blit.transform, sizeof(BlitTransform));
+    signature = HashWords(signature, &command->blit.tint, sizeof(command->blit.tint));
+    signature = HashWords(signature, &command->blit.filter, sizeof(command->blit.filter));
+    command->signature = signature;
+
+    // Blit bounds are top-down, tiles bottom-up
+    Framebuffer* target = rasterizer->target;
+    i32 tile_x0 = bounds.min_x / SOFTWARE_TILE_SIZE;
+    i32 tile_x1 = (bounds.max_x - 1) / SOFTWARE_TILE_SIZE;
+    i32 tile_y0 = (target->height - bounds.max_y) / SOFTWARE_TILE_SIZE;
+    i32 tile_y1 = (target->height - bounds.min_y - 1) / SOFTWARE_TILE_SIZE;
+    for (i32 tile_y = tile_y0; tile_y <= tile_y1; ++tile_y)
+    {
+        for (i32 tile_x = tile_x0; tile_x <= tile_x1; ++tile_x)
+        {
+            AppendToBin(rasterizer, &rasterizer->bins[tile_y * rasterizer->tiles_x + tile_x], SOFTWARE_COMMAND_BLIT, command);
+        }
+    }
+    ++rasterizer->binned_command_count;
+}
+
+// Stretches the viewport over the whole target with nearest filtering, then resets the
+// viewport. Works in place: walking backwards, every pixel read is at or before the one written.
+void UpscaleViewport(SoftwareRasterizer* rasterizer)
+{
+    Framebuffer* target = rasterizer->target;
+    i32 source_width = rasterizer->viewport_width;
+    i32 source_height = rasterizer->viewport_height;
+    rasterizer->viewport_width = target->width;
+    rasterizer->viewport_height = target->height;
+    if (source_width == target->width && source_height == target->height)
+    {
+        return;
+    }
+
+    // Every tile reads from others here, so these frames always redraw everything
+    Flush(rasterizer);
+    for (i32 y = target->height - 1; y >= 0; --y)
+    {
+        i32 source_y = (i32)(((i64)y * source_height) / target->height);
+        const u32* source_row = (const u32*)((u8*)target->memory + (target->height - 1 - source_y) * target->pitch);
+        u32* row = (u32*)((u8*)target->memory + (target->height - 1 - y) * target->pitch);
+        for (i32 x = target->width - 1; x >= 0; --x)
+        {
+            row[x] = source_row[((i64)x * source_width) / target->width];
+        }
+    }
+
+    InvalidateTiles(rasterizer);
+    if (target->dirty)
+    {
+        dirty_region::MarkAll(target->dirty);
+    }
+}
+
+} // namespace software_rasterizer
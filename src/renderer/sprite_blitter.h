@@ -0,0 +1,790 @@
+#pragma once
+
+#include "core.h"
+#include "core/memory.h"
+#include "core/work_queue.h"
+#include "core/cpu_features.h"
+#include "renderer/dirty_region.h"
+#include "renderer/pixel_convert.h"
+#include "utils/handmade_math.h"
+
+#include <immintrin.h>
+#include <time.h>
+#include <stdio.h>
+
+#define SPRITE_BLIT_PIXELS_PER_TASK     (64 * 256)  // Rows are batched until a task covers about this many pixels
+#define SPRITE_BLIT_MAX_DIMENSION       16384       // Keeps the 25.7 fixed point texel coordinates in range
+
+#define SPRITE_BENCHMARK_WIDTH          1920
+#define SPRITE_BENCHMARK_HEIGHT         1080
+#define SPRITE_BENCHMARK_IMAGE_SIZE     256
+#define SPRITE_BENCHMARK_BLIT_COUNT     256
+
+// Premultiplied BGRA, the layout of Framebuffer pixels. Row 0 is the top of the image.
+struct BlitImage
+{
+    const u32* pixels;
+    i32 width;
+    i32 height;
+    i32 pitch;      // In pixels
+};
+
+enum BlitFilter
+{
+    BLIT_FILTER_NEAREST,
+    BLIT_FILTER_BILINEAR,   // Texels outside the image are transparent, so the edges come out antialiased
+};
+
+// The kernel a blit runs with, Blit() picks the widest one the CPU supports
+enum BlitPath
+{
+    BLIT_PATH_SCALAR,
+    BLIT_PATH_SSE,          // 8 pixels per iteration in two registers
+    BLIT_PATH_AVX2,         // 8 pixels per iteration, hardware gathers
+    BLIT_PATH_COUNT
+};
+
+static const char* blit_path_names[BLIT_PATH_COUNT] = {
+    "scalar",
+    "SSE",
+    "AVX2",
+};
+
+// Maps image coordinates (x along a row, y down the rows) to framebuffer pixels:
+// dest = (m00 * x + m01 * y + tx, m10 * x + m11 * y + ty)
+struct BlitTransform
+{
+    f32 m00, m01;
+    f32 m10, m11;
+    f32 tx, ty;
+};
+
+// Min inclusive, max exclusive
+struct BlitRect
+{
+    i32 min_x;
+    i32 min_y;
+    i32 max_x;
+    i32 max_y;
+};
+
+struct SpriteBlit
+{
+    const BlitImage* image;
+    BlitTransform transform;
+    glm::vec4 tint;         // Straight alpha, (1, 1, 1, 1) draws the image as is
+    BlitFilter filter;
+};
+
+// Everything the row kernels need, the inverse mapping goes from pixel centers to texels
+struct SpriteBlitJob
+{
+    u32* target;
+    i32 target_pitch;       // In pixels
+    BlitRect bounds;
+
+    const u32* texels;
+    i32 image_width;
+    i32 image_height;
+    i32 image_pitch;
+
+    f32 u_origin;
+    f32 v_origin;
+    f32 du_dx;
+    f32 du_dy;
+    f32 dv_dx;
+    f32 dv_dy;
+    f32 span_min_u;         // Texel coordinates that can still reach a texel of the image
+    f32 span_max_u;
+    f32 span_min_v;
+    f32 span_max_v;
+
+    u16 tint[4];            // Premultiplied B, G, R, A, 256 is 1.0
+    BlitFilter filter;
+    BlitPath path;
+};
+
+namespace sprite_blitter
+{
+
+// Converts straight alpha RGBA8, the layout of loaded images, to premultiplied BGRA in place
+void PremultiplyImage(u32* pixels, u32 count)
+{
+    PixelImage image = {};
+    image.pixels = pixels;
+    image.width = (i32)count;
+    image.height = 1;
+    image.pitch = (i32)(count * 4);
+    image.format = PIXEL_FORMAT_RGBA8;
+    PixelImage premultiplied = image;
+    premultiplied.format = PIXEL_FORMAT_BGRA8;
+    pixel_convert::Convert(&image, &premultiplied, PIXEL_CONVERT_PREMULTIPLY, nullptr);
+}
+
+// Scale and rotation around the image center, placed at (x, y). Rotation is clockwise on screen.
+BlitTransform MakeTransform(const BlitImage* image, f32 x, f32 y, f32 scale_x, f32 scale_y, f32 rotation)
+{
+    f32 c = cosf(rotation);
+    f32 s = sinf(rotation);
+
+    BlitTransform transform = {};
+    transform.m00 = c * scale_x;
+    transform.m01 = -s * scale_y;
+    transform.m10 = s * scale_x;
+    transform.m11 = c * scale_y;
+    f32 half_width = 0.5f * (f32)image->width;
+    f32 half_height = 0.5f * (f32)image->height;
+    transform.tx = x - (transform.m00 * half_width + transform.m01 * half_height);
+    transform.ty = y - (transform.m10 * half_width + transform.m11 * half_height);
+    return transform;
+}
+
+// Exact round(x / 255) for x up to 255 * 255, shared by every path so they agree to the bit
+internal u32 Div255(u32 x)
+{
+    return ((x + 128) * 257) >> 16;
+}
+
+internal u32 FetchTexel(const SpriteBlitJob* job, i32 x, i32 y)
+{
+    if ((u32)x >= (u32)job->image_width || (u32)y >= (u32)job->image_height)
+    {
+        return 0;
+    }
+    return job->texels[y * job->image_pitch + x];
+}
+
+internal u32 LerpChannel(u32 a, u32 b, i32 fraction, u32 shift)
+{
+    i32 ca = (i32)((a >> shift) & 0xFF);
+    i32 cb = (i32)((b >> shift) & 0xFF);
+    return (u32)(ca + (((cb - ca) * fraction) >> 7));
+}
+
+// Out of range coordinates would overflow the fixed point conversion, clamp them to a miss
+internal f32 ClampTexelCoordinate(f32 value, f32 size)
+{
+    return MinFloat(MaxFloat(value, -4.0f), size + 4.0f);
+}
+
+internal u32 BlendPixel(const SpriteBlitJob* job, u32 src, u32 dst)
+{
+    u32 channels[4];
+    for (u32 c = 0; c < 4; ++c)
+    {
+        channels[c] = (((src >> (8 * c)) & 0xFF) * job->tint[c]) >> 8;
+    }
+
+    u32 inverse_alpha = 255 - channels[3];
+    u32 result = 0;
+    for (u32 c = 0; c < 4; ++c)
+    {
+        u32 value = channels[c] + Div255(((dst >> (8 * c)) & 0xFF) * inverse_alpha);
+        result |= (value < 255 ? value : 255) << (8 * c);
+    }
+    return result;
+}
+
+// The reference the SIMD kernels are checked against, also finishes their partial chunks
+internal void BlitPixelsScalar(const SpriteBlitJob* job, u32* row, i32 y, i32 x_begin, i32 x_end)
+{
+    f32 u_row = job->u_origin + (f32)y * job->du_dy;
+    f32 v_row = job->v_origin + (f32)y * job->dv_dy;
+    for (i32 x = x_begin; x < x_end; ++x)
+    {
+        f32 u = ClampTexelCoordinate(u_row + (f32)x * job->du_dx, (f32)job->image_width);
+        f32 v = ClampTexelCoordinate(v_row + (f32)x * job->dv_dx, (f32)job->image_height);
+
+        u32 src;
+        if (job->filter == BLIT_FILTER_NEAREST)
+        {
+            src = FetchTexel(job, FloorFloatToInt(u), FloorFloatToInt(v));
+        }
+        else
+        {
+            // 7 fraction bits keep the weighted differences in 16 bits on the SIMD paths
+            i32 fixed_u = FloorFloatToInt(u * 128.0f);
+            i32 fixed_v = FloorFloatToInt(v * 128.0f);
+            i32 x0 = fixed_u >> 7;
+            i32 y0 = fixed_v >> 7;
+            i32 fx = fixed_u & 127;
+            i32 fy = fixed_v & 127;
+
+            u32 t00 = FetchTexel(job, x0, y0);
+            u32 t10 = FetchTexel(job, x0 + 1, y0);
+            u32 t01 = FetchTexel(job, x0, y0 + 1);
+            u32 t11 = FetchTexel(job, x0 + 1, y0 + 1);
+            src = 0;
+            for (u32 shift = 0; shift < 32; shift += 8)
+            {
+                u32 top = LerpChannel(t00, t10, fx, shift);
+                u32 bottom = LerpChannel(t01, t11, fx, shift);
+                src |= LerpChannel(top << shift, bottom << shift, fy, shift) << shift;
+            }
+        }
+
+        // Transparent texels leave the pixel as is
+        if (src != 0)
+        {
+            row[x] = BlendPixel(job, src, row[x]);
+        }
+    }
+}
+
+// Premultiplied "over" on two pixels per register, widened to 16 bits per channel
+internal __m128i BlendHalfSse(__m128i src, __m128i dst, __m128i tint)
+{
+    src = _mm_srli_epi16(_mm_mullo_epi16(src, tint), 8);
+    __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(src, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    __m128i inverse_alpha = _mm_sub_epi16(_mm_set1_epi16(255), alpha);
+    __m128i product = _mm_mullo_epi16(dst, inverse_alpha);
+    __m128i scaled = _mm_mulhi_epu16(_mm_add_epi16(product, _mm_set1_epi16(128)), _mm_set1_epi16(257));
+    return _mm_add_epi16(src, scaled);
+}
+
+internal __m128i BlendSse(__m128i src, __m128i dst, __m128i tint)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i low = BlendHalfSse(_mm_unpacklo_epi8(src, zero), _mm_unpacklo_epi8(dst, zero), tint);
+    __m128i high = BlendHalfSse(_mm_unpackhi_epi8(src, zero), _mm_unpackhi_epi8(dst, zero), tint);
+    return _mm_packus_epi16(low, high);
+}
+
+// a + (b - a) * f per channel, f holds each pixel's 7 bit weight in all four of its channels
+internal __m128i LerpHalfSse(__m128i a, __m128i b, __m128i f)
+{
+    return _mm_add_epi16(a, _mm_srai_epi16(_mm_mullo_epi16(_mm_sub_epi16(b, a), f), 7));
+}
+
+internal __m128i LerpSse(__m128i a, __m128i b, __m128i fraction)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i paired = _mm_or_si128(fraction, _mm_slli_epi32(fraction, 16));
+    __m128i low = LerpHalfSse(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi32(paired, paired));
+    __m128i high = LerpHalfSse(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi32(paired, paired));
+    return _mm_packus_epi16(low, high);
+}
+
+// No gathers before AVX2, the taps are loaded one lane at a time
+internal __m128i GatherSse(const SpriteBlitJob* job, __m128i x, __m128i y)
+{
+    alignas(16) i32 xs[4];
+    alignas(16) i32 ys[4];
+    alignas(16) u32 texels[4];
+    _mm_store_si128((__m128i*)xs, x);
+    _mm_store_si128((__m128i*)ys, y);
+    for (u32 lane = 0; lane < 4; ++lane)
+    {
+        texels[lane] = FetchTexel(job, xs[lane], ys[lane]);
+    }
+    return _mm_load_si128((const __m128i*)texels);
+}
+
+// Texels for four pixels at (u, v), clamped to just around the image so misses stay misses
+internal __m128i SampleSse(const SpriteBlitJob* job, __m128 u, __m128 v)
+{
+    u = _mm_min_ps(_mm_max_ps(u, _mm_set1_ps(-4.0f)), _mm_set1_ps((f32)job->image_width + 4.0f));
+    v = _mm_min_ps(_mm_max_ps(v, _mm_set1_ps(-4.0f)), _mm_set1_ps((f32)job->image_height + 4.0f));
+    if (job->filter == BLIT_FILTER_NEAREST)
+    {
+        return GatherSse(job, _mm_cvttps_epi32(_mm_floor_ps(u)), _mm_cvttps_epi32(_mm_floor_ps(v)));
+    }
+
+    __m128 to_fixed = _mm_set1_ps(128.0f);
+    __m128i fraction_mask = _mm_set1_epi32(127);
+    __m128i one = _mm_set1_epi32(1);
+    __m128i fixed_u = _mm_cvttps_epi32(_mm_floor_ps(_mm_mul_ps(u, to_fixed)));
+    __m128i fixed_v = _mm_cvttps_epi32(_mm_floor_ps(_mm_mul_ps(v, to_fixed)));
+    __m128i x0 = _mm_srai_epi32(fixed_u, 7);
+    __m128i y0 = _mm_srai_epi32(fixed_v, 7);
+    __m128i x1 = _mm_add_epi32(x0, one);
+    __m128i y1 = _mm_add_epi32(y0, one);
+    __m128i fx = _mm_and_si128(fixed_u, fraction_mask);
+    __m128i fy = _mm_and_si128(fixed_v, fraction_mask);
+
+    __m128i top = LerpSse(GatherSse(job, x0, y0), GatherSse(job, x1, y0), fx);
+    __m128i bottom = LerpSse(GatherSse(job, x0, y1), GatherSse(job, x1, y1), fx);
+    return LerpSse(top, bottom, fy);
+}
+
+// Blends four texels over the pixels at dest, empty texels leave their pixel untouched
+internal void BlendStoreSse(u32* dest, __m128i src, __m128i tint)
+{
+    __m128i dst = _mm_loadu_si128((const __m128i*)dest);
+    __m128i blended = BlendSse(src, dst, tint);
+    __m128i is_empty = _mm_cmpeq_epi32(src, _mm_setzero_si128());
+    _mm_storeu_si128((__m128i*)dest, _mm_blendv_epi8(blended, dst, is_empty));
+}
+
+// Two registers of four pixels per iteration, so one half's gathers overlap the other's math
+internal void BlitPixelsSse(const SpriteBlitJob* job, u32* row, i32 y, i32 x_begin, i32 x_end)
+{
+    __m128 u_row = _mm_set1_ps(job->u_origin + (f32)y * job->du_dy);
+    __m128 v_row = _mm_set1_ps(job->v_origin + (f32)y * job->dv_dy);
+    __m128 du_dx = _mm_set1_ps(job->du_dx);
+    __m128 dv_dx = _mm_set1_ps(job->dv_dx);
+    __m128i lane_offsets = _mm_setr_epi32(0, 1, 2, 3);
+    __m128i high_offsets = _mm_setr_epi32(4, 5, 6, 7);
+    __m128i tint = _mm_setr_epi16((i16)job->tint[0], (i16)job->tint[1], (i16)job->tint[2], (i16)job->tint[3],
+                                  (i16)job->tint[0], (i16)job->tint[1], (i16)job->tint[2], (i16)job->tint[3]);
+
+    i32 x = x_begin;
+    for (; x + 8 <= x_end; x += 8)
+    {
+        __m128i base = _mm_set1_epi32(x);
+        __m128 xf_low = _mm_cvtepi32_ps(_mm_add_epi32(base, lane_offsets));
+        __m128 xf_high = _mm_cvtepi32_ps(_mm_add_epi32(base, high_offsets));
+        __m128i src_low = SampleSse(job, _mm_add_ps(u_row, _mm_mul_ps(xf_low, du_dx)), _mm_add_ps(v_row, _mm_mul_ps(xf_low, dv_dx)));
+        __m128i src_high = SampleSse(job, _mm_add_ps(u_row, _mm_mul_ps(xf_high, du_dx)), _mm_add_ps(v_row, _mm_mul_ps(xf_high, dv_dx)));
+
+        // Whole chunk outside the sprite, usually the corners of a rotated one
+        __m128i any = _mm_or_si128(src_low, src_high);
+        if (_mm_testz_si128(any, any))
+        {
+            continue;
+        }
+
+        BlendStoreSse(row + x, src_low, tint);
+        BlendStoreSse(row + x + 4, src_high, tint);
+    }
+
+    if (x + 4 <= x_end)
+    {
+        __m128 xf = _mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32(x), lane_offsets));
+        __m128i src = SampleSse(job, _mm_add_ps(u_row, _mm_mul_ps(xf, du_dx)), _mm_add_ps(v_row, _mm_mul_ps(xf, dv_dx)));
+        if (!_mm_testz_si128(src, src))
+        {
+            BlendStoreSse(row + x, src, tint);
+        }
+        x += 4;
+    }
+
+    BlitPixelsScalar(job, row, y, x, x_end);
+}
+
+internal __m256i BlendHalfAvx2(__m256i src, __m256i dst, __m256i tint)
+{
+    src = _mm256_srli_epi16(_mm256_mullo_epi16(src, tint), 8);
+    __m256i alpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(src, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    __m256i inverse_alpha = _mm256_sub_epi16(_mm256_set1_epi16(255), alpha);
+    __m256i product = _mm256_mullo_epi16(dst, inverse_alpha);
+    __m256i scaled = _mm256_mulhi_epu16(_mm256_add_epi16(product, _mm256_set1_epi16(128)), _mm256_set1_epi16(257));
+    return _mm256_add_epi16(src, scaled);
+}
+
+// Unpack and pack both work within 128 bit lanes, so the pixel order survives the round trip
+internal __m256i BlendAvx2(__m256i src, __m256i dst, __m256i tint)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i low = BlendHalfAvx2(_mm256_unpacklo_epi8(src, zero), _mm256_unpacklo_epi8(dst, zero), tint);
+    __m256i high = BlendHalfAvx2(_mm256_unpackhi_epi8(src, zero), _mm256_unpackhi_epi8(dst, zero), tint);
+    return _mm256_packus_epi16(low, high);
+}
+
+internal __m256i LerpHalfAvx2(__m256i a, __m256i b, __m256i f)
+{
+    return _mm256_add_epi16(a, _mm256_srai_epi16(_mm256_mullo_epi16(_mm256_sub_epi16(b, a), f), 7));
+}
+
+internal __m256i LerpAvx2(__m256i a, __m256i b, __m256i fraction)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i paired = _mm256_or_si256(fraction, _mm256_slli_epi32(fraction, 16));
+    __m256i low = LerpHalfAvx2(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero), _mm256_unpacklo_epi32(paired, paired));
+    __m256i high = LerpHalfAvx2(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero), _mm256_unpackhi_epi32(paired, paired));
+    return _mm256_packus_epi16(low, high);
+}
+
+// Lanes outside the image read nothing and come back transparent
+internal __m256i GatherAvx2(const SpriteBlitJob* job, __m256i x, __m256i y)
+{
+    __m256i minus_one = _mm256_set1_epi32(-1);
+    __m256i inside = _mm256_and_si256(_mm256_and_si256(_mm256_cmpgt_epi32(x, minus_one), _mm256_cmpgt_epi32(_mm256_set1_epi32(job->image_width), x)),
+                                      _mm256_and_si256(_mm256_cmpgt_epi32(y, minus_one), _mm256_cmpgt_epi32(_mm256_set1_epi32(job->image_height), y)));
+    __m256i index = _mm256_add_epi32(_mm256_mullo_epi32(y, _mm256_set1_epi32(job->image_pitch)), x);
+    return _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int*)job->texels, index, inside, 4);
+}
+
+internal void BlitPixelsAvx2(const SpriteBlitJob* job, u32* row, i32 y, i32 x_begin, i32 x_end)
+{
+    __m256 u_row = _mm256_set1_ps(job->u_origin + (f32)y * job->du_dy);
+    __m256 v_row = _mm256_set1_ps(job->v_origin + (f32)y * job->dv_dy);
+    __m256 du_dx = _mm256_set1_ps(job->du_dx);
+    __m256 dv_dx = _mm256_set1_ps(job->dv_dx);
+    __m256 min_coordinate = _mm256_set1_ps(-4.0f);
+    __m256 max_u = _mm256_set1_ps((f32)job->image_width + 4.0f);
+    __m256 max_v = _mm256_set1_ps((f32)job->image_height + 4.0f);
+    __m256 to_fixed = _mm256_set1_ps(128.0f);
+    __m256i fraction_mask = _mm256_set1_epi32(127);
+    __m256i lane_offsets = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i one = _mm256_set1_epi32(1);
+    __m256i tint = _mm256_setr_epi16((i16)job->tint[0], (i16)job->tint[1], (i16)job->tint[2], (i16)job->tint[3],
+                                     (i16)job->tint[0], (i16)job->tint[1], (i16)job->tint[2], (i16)job->tint[3],
+                                     (i16)job->tint[0], (i16)job->tint[1], (i16)job->tint[2], (i16)job->tint[3],
+                                     (i16)job->tint[0], (i16)job->tint[1], (i16)job->tint[2], (i16)job->tint[3]);
+
+    i32 x = x_begin;
+    for (; x + 8 <= x_end; x += 8)
+    {
+        __m256 xf = _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(x), lane_offsets));
+        __m256 u = _mm256_min_ps(_mm256_max_ps(_mm256_add_ps(u_row, _mm256_mul_ps(xf, du_dx)), min_coordinate), max_u);
+        __m256 v = _mm256_min_ps(_mm256_max_ps(_mm256_add_ps(v_row, _mm256_mul_ps(xf, dv_dx)), min_coordinate), max_v);
+
+        __m256i src;
+        if (job->filter == BLIT_FILTER_NEAREST)
+        {
+            src = GatherAvx2(job, _mm256_cvttps_epi32(_mm256_floor_ps(u)), _mm256_cvttps_epi32(_mm256_floor_ps(v)));
+        }
+        else
+        {
+            __m256i fixed_u = _mm256_cvttps_epi32(_mm256_floor_ps(_mm256_mul_ps(u, to_fixed)));
+            __m256i fixed_v = _mm256_cvttps_epi32(_mm256_floor_ps(_mm256_mul_ps(v, to_fixed)));
+            __m256i x0 = _mm256_srai_epi32(fixed_u, 7);
+            __m256i y0 = _mm256_srai_epi32(fixed_v, 7);
+            __m256i x1 = _mm256_add_epi32(x0, one);
+            __m256i y1 = _mm256_add_epi32(y0, one);
+            __m256i fx = _mm256_and_si256(fixed_u, fraction_mask);
+            __m256i fy = _mm256_and_si256(fixed_v, fraction_mask);
+
+            __m256i top = LerpAvx2(GatherAvx2(job, x0, y0), GatherAvx2(job, x1, y0), fx);
+            __m256i bottom = LerpAvx2(GatherAvx2(job, x0, y1), GatherAvx2(job, x1, y1), fx);
+            src = LerpAvx2(top, bottom, fy);
+        }
+
+        if (_mm256_testz_si256(src, src))
+        {
+            continue;
+        }
+
+        __m256i dst = _mm256_loadu_si256((const __m256i*)(row + x));
+        __m256i blended = BlendAvx2(src, dst, tint);
+        __m256i is_empty = _mm256_cmpeq_epi32(src, _mm256_setzero_si256());
+        _mm256_storeu_si256((__m256i*)(row + x), _mm256_blendv_epi8(blended, dst, is_empty));
+    }
+
+    BlitPixelsScalar(job, row, y, x, x_end);
+}
+
+// Narrows [x_min, x_max) to the pixels whose coordinate base + x * step can land in [lo, hi].
+// Conservative by a pixel on each side, the kernels reject the rest per lane.
+internal void ClipSpan(f32 base, f32 step, f32 lo, f32 hi, i32* x_min, i32* x_max)
+{
+    if (fabsf(step) < 1e-12f)
+    {
+        if (base < lo || base > hi)
+        {
+            *x_max = *x_min;
+        }
+        return;
+    }
+
+    f32 t0 = (lo - base) / step;
+    f32 t1 = (hi - base) / step;
+    if (t0 > t1)
+    {
+        f32 swap = t0;
+        t0 = t1;
+        t1 = swap;
+    }
+    t0 = MaxFloat(t0, (f32)*x_min);
+    t1 = MinFloat(t1, (f32)*x_max);
+    *x_min = MaxInt(*x_min, FloorFloatToInt(t0) - 1);
+    *x_max = MinInt(*x_max, CeilFloatToInt(t1) + 1);
+}
+
+internal void BlitRows(void* data, u32 begin, u32 end)
+{
+    const SpriteBlitJob* job = (const SpriteBlitJob*)data;
+    for (u32 i = begin; i < end; ++i)
+    {
+        i32 y = job->bounds.min_y + (i32)i;
+        i32 x_begin = job->bounds.min_x;
+        i32 x_end = job->bounds.max_x;
+        ClipSpan(job->u_origin + (f32)y * job->du_dy, job->du_dx, job->span_min_u, job->span_max_u, &x_begin, &x_end);
+        ClipSpan(job->v_origin + (f32)y * job->dv_dy, job->dv_dx, job->span_min_v, job->span_max_v, &x_begin, &x_end);
+        if (x_begin >= x_end)
+        {
+            continue;
+        }
+
+        u32* row = job->target + (size_t)y * (size_t)job->target_pitch;
+        switch (job->path)
+        {
+            case BLIT_PATH_AVX2:
+                BlitPixelsAvx2(job, row, y, x_begin, x_end);
+                break;
+            case BLIT_PATH_SSE:
+                BlitPixelsSse(job, row, y, x_begin, x_end);
+                break;
+            default:
+                BlitPixelsScalar(job, row, y, x_begin, x_end);
+                break;
+        }
+    }
+}
+
+BlitPath GetBestPath()
+{
+    const CpuFeatures* features = cpu_features::Get();
+    if (features->avx2) return BLIT_PATH_AVX2;
+    if (features->sse41) return BLIT_PATH_SSE;
+    return BLIT_PATH_SCALAR;
+}
+
+// Fills in the job for a blit, false when the sprite is clipped away
+internal bool SetupBlitJob(const Framebuffer* target, const BlitRect* clip, const SpriteBlit* blit, BlitPath path, SpriteBlitJob* job)
+{
+    const BlitImage* image = blit->image;
+    const BlitTransform& m = blit->transform;
+    Assert(target->bytes_per_pixel == 4);
+    Assert(image->width <= SPRITE_BLIT_MAX_DIMENSION && image->height <= SPRITE_BLIT_MAX_DIMENSION);
+
+    f32 determinant = m.m00 * m.m11 - m.m01 * m.m10;
+    if (image->width <= 0 || image->height <= 0 || fabsf(determinant) < 1e-8f || blit->tint.a <= 0.0f)
+    {
+        return false;
+    }
+
+    // Bilinear taps reach half a texel past the image
+    f32 margin = blit->filter == BLIT_FILTER_BILINEAR ? 0.5f : 0.0f;
+    f32 min_x = (f32)target->width;
+    f32 min_y = (f32)target->height;
+    f32 max_x = 0.0f;
+    f32 max_y = 0.0f;
+    for (u32 corner = 0; corner < 4; ++corner)
+    {
+        f32 x = (corner & 1) ? (f32)image->width + margin : -margin;
+        f32 y = (corner & 2) ? (f32)image->height + margin : -margin;
+        f32 dest_x = m.m00 * x + m.m01 * y + m.tx;
+        f32 dest_y = m.m10 * x + m.m11 * y + m.ty;
+        min_x = MinFloat(min_x, dest_x);
+        min_y = MinFloat(min_y, dest_y);
+        max_x = MaxFloat(max_x, dest_x);
+        max_y = MaxFloat(max_y, dest_y);
+    }
+
+    BlitRect bounds = { 0, 0, target->width, target->height };
+    if (clip)
+    {
+        bounds.min_x = MaxInt(bounds.min_x, clip->min_x);
+        bounds.min_y = MaxInt(bounds.min_y, clip->min_y);
+        bounds.max_x = MinInt(bounds.max_x, clip->max_x);
+        bounds.max_y = MinInt(bounds.max_y, clip->max_y);
+    }
+    bounds.min_x = MaxInt(bounds.min_x, FloorFloatToInt(MaxFloat(min_x, -1.0f)));
+    bounds.min_y = MaxInt(bounds.min_y, FloorFloatToInt(MaxFloat(min_y, -1.0f)));
+    bounds.max_x = MinInt(bounds.max_x, CeilFloatToInt(MinFloat(max_x, (f32)target->width + 1.0f)));
+    bounds.max_y = MinInt(bounds.max_y, CeilFloatToInt(MinFloat(max_y, (f32)target->height + 1.0f)));
+    if (bounds.min_x >= bounds.max_x || bounds.min_y >= bounds.max_y)
+    {
+        return false;
+    }
+
+    *job = {};
+    job->target = (u32*)target->memory;
+    job->target_pitch = target->pitch / 4;
+    job->bounds = bounds;
+    job->texels = image->pixels;
+    job->image_width = image->width;
+    job->image_height = image->height;
+    job->image_pitch = image->pitch;
+    job->filter = blit->filter;
+    job->path = path;
+
+    // Inverse of the 2x2 part, sampled at pixel centers. Bilinear samples sit on texel centers.
+    f32 inverse_determinant = 1.0f / determinant;
+    job->du_dx = m.m11 * inverse_determinant;
+    job->du_dy = -m.m01 * inverse_determinant;
+    job->dv_dx = -m.m10 * inverse_determinant;
+    job->dv_dy = m.m00 * inverse_determinant;
+    job->u_origin = job->du_dx * (0.5f - m.tx) + job->du_dy * (0.5f - m.ty) - margin;
+    job->v_origin = job->dv_dx * (0.5f - m.tx) + job->dv_dy * (0.5f - m.ty) - margin;
+    job->span_min_u = -2.0f * margin;
+    job->span_min_v = -2.0f * margin;
+    job->span_max_u = (f32)image->width;
+    job->span_max_v = (f32)image->height;
+
+    f32 tint_alpha = MinFloat(MaxFloat(blit->tint.a, 0.0f), 1.0f);
+    job->tint[0] = (u16)RoundFloatToInt(MinFloat(MaxFloat(blit->tint.b, 0.0f), 1.0f) * tint_alpha * 256.0f);
+    job->tint[1] = (u16)RoundFloatToInt(MinFloat(MaxFloat(blit->tint.g, 0.0f), 1.0f) * tint_alpha * 256.0f);
+    job->tint[2] = (u16)RoundFloatToInt(MinFloat(MaxFloat(blit->tint.r, 0.0f), 1.0f) * tint_alpha * 256.0f);
+    job->tint[3] = (u16)RoundFloatToInt(tint_alpha * 256.0f);
+    return true;
+}
+
+// The pixels a blit may touch, false when it is clipped away
+bool GetBlitBounds(const Framebuffer* target, const BlitRect* clip, const SpriteBlit* blit, BlitRect* bounds)
+{
+    SpriteBlitJob job;
+    if (!SetupBlitJob(target, clip, blit, BLIT_PATH_SCALAR, &job))
+    {
+        return false;
+    }
+    *bounds = job.bounds;
+    return true;
+}
+
+// Rows never share pixels, so any split of them gives the same image
+internal void RunBlitJob(SpriteBlitJob* job, WorkQueue* queue)
+{
+    u32 row_count = (u32)(job->bounds.max_y - job->bounds.min_y);
+    u32 rows_per_task = (u32)MaxInt(SPRITE_BLIT_PIXELS_PER_TASK / (job->bounds.max_x - job->bounds.min_x), 1);
+    work_queue::ParallelFor(queue, row_count, rows_per_task, BlitRows, job);
+}
+
+internal u64 GetCoveredPixels(const SpriteBlit* blit)
+{
+    const BlitTransform& m = blit->transform;
+    return (u64)(fabsf(m.m00 * m.m11 - m.m01 * m.m10) * (f32)blit->image->width * (f32)blit->image->height);
+}
+
+// Returns the area the sprite covers in destination pixels before clipping, 0 when it is clipped away.
+// Leaves the target's dirty region alone, for callers that draw from jobs and mark it themselves.
+u64 BlitWithPath(Framebuffer* target, const BlitRect* clip, const SpriteBlit* blit, WorkQueue* queue, BlitPath path)
+{
+    SpriteBlitJob job;
+    if (!SetupBlitJob(target, clip, blit, path, &job))
+    {
+        return 0;
+    }
+    RunBlitJob(&job, queue);
+    return GetCoveredPixels(blit);
+}
+
+u64 Blit(Framebuffer* target, const BlitRect* clip, const SpriteBlit* blit, WorkQueue* queue)
+{
+    SpriteBlitJob job;
+    if (!SetupBlitJob(target, clip, blit, GetBestPath(), &job))
+    {
+        return 0;
+    }
+    RunBlitJob(&job, queue);
+
+    if (target->dirty)
+    {
+        dirty_region::MarkRect(target->dirty, job.bounds.min_x, job.bounds.min_y, job.bounds.max_x, job.bounds.max_y);
+    }
+    return GetCoveredPixels(blit);
+}
+
+struct SpriteBenchmarkResult
+{
+    f32 megapixels_per_second;
+    u32 mismatched_pixels;  // Against the scalar path
+};
+
+internal f64 GetBenchmarkSeconds()
+{
+    timespec now;
+    timespec_get(&now, TIME_UTC);
+    return (f64)now.tv_sec + (f64)now.tv_nsec * 1e-9;
+}
+
+internal SpriteBenchmarkResult RunBenchmarkPass(Framebuffer* target, const Framebuffer* reference, const BlitImage* image,
+                                                BlitFilter filter, BlitPath path, WorkQueue* queue)
+{
+    u32 pixel_count = (u32)(target->width * target->height);
+    u32* pixels = (u32*)target->memory;
+    for (u32 i = 0; i < pixel_count; ++i)
+    {
+        pixels[i] = 0xFF203040;
+    }
+
+    // Same pseudo random sprites every pass: scaled a quarter to twice, any rotation, all on screen
+    u32 seed = 0x9E3779B9u;
+    u64 covered_pixels = 0;
+    f64 start = GetBenchmarkSeconds();
+    for (u32 i = 0; i < SPRITE_BENCHMARK_BLIT_COUNT; ++i)
+    {
+        f32 random[5];
+        for (u32 r = 0; r < ArrayCount(random); ++r)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            random[r] = (f32)(seed >> 8) / 16777216.0f;
+        }
+
+        f32 scale = 0.25f + random[2] * random[2] * 1.75f;
+        f32 radius = 0.7072f * scale * (f32)MaxInt(image->width, image->height) + 1.0f;
+        f32 x = radius + random[0] * ((f32)target->width - 2.0f * radius);
+        f32 y = radius + random[1] * ((f32)target->height - 2.0f * radius);
+        SpriteBlit blit = {};
+        blit.image = image;
+        blit.transform = MakeTransform(image, x, y, scale, scale, random[3] * 6.2831853f);
+        blit.tint = glm::vec4(1.0f, 1.0f - 0.5f * random[4], 1.0f, 0.5f + 0.5f * random[4]);
+        blit.filter = filter;
+        covered_pixels += BlitWithPath(target, nullptr, &blit, queue, path);
+    }
+    f64 seconds = GetBenchmarkSeconds() - start;
+
+    SpriteBenchmarkResult result = {};
+    result.megapixels_per_second = (f32)((f64)covered_pixels / 1000000.0 / MaxFloat((f32)seconds, 1e-9f));
+    if (reference)
+    {
+        const u32* expected = (const u32*)reference->memory;
+        for (u32 i = 0; i < pixel_count; ++i)
+        {
+            result.mismatched_pixels += pixels[i] != expected[i];
+        }
+    }
+    return result;
+}
+
+// Draws the same batch of rotated, scaled and tinted sprites with every path the CPU has,
+// single threaded and on the queue, and prints megapixels per second against the scalar path
+void Benchmark(WorkQueue* queue, VMArena* scratch_arena)
+{
+    u32 image_pixel_count = SPRITE_BENCHMARK_IMAGE_SIZE * SPRITE_BENCHMARK_IMAGE_SIZE;
+    u32* image_pixels = (u32*)memory::VMArenaAllocAligned(scratch_arena, image_pixel_count * sizeof(u32), 64);
+    for (u32 y = 0; y < SPRITE_BENCHMARK_IMAGE_SIZE; ++y)
+    {
+        for (u32 x = 0; x < SPRITE_BENCHMARK_IMAGE_SIZE; ++x)
+        {
+            // A soft disc over a color ramp, with a hard edged transparent checker inside
+            f32 dx = ((f32)x + 0.5f) / (f32)SPRITE_BENCHMARK_IMAGE_SIZE - 0.5f;
+            f32 dy = ((f32)y + 0.5f) / (f32)SPRITE_BENCHMARK_IMAGE_SIZE - 0.5f;
+            f32 coverage = MinFloat(MaxFloat((0.5f - sqrtf(dx * dx + dy * dy)) * 16.0f, 0.0f), 1.0f);
+            if (((x / 32) + (y / 32)) % 2) coverage *= 0.5f;
+            u32 a = (u32)(coverage * 255.0f);
+            image_pixels[y * SPRITE_BENCHMARK_IMAGE_SIZE + x] = (a << 24) | ((255 - x) << 16) | (y << 8) | x;
+        }
+    }
+    PremultiplyImage(image_pixels, image_pixel_count);
+
+    BlitImage image = {};
+    image.pixels = image_pixels;
+    image.width = SPRITE_BENCHMARK_IMAGE_SIZE;
+    image.height = SPRITE_BENCHMARK_IMAGE_SIZE;
+    image.pitch = SPRITE_BENCHMARK_IMAGE_SIZE;
+
+    Framebuffer targets[2] = {};
+    for (u32 i = 0; i < ArrayCount(targets); ++i)
+    {
+        targets[i].width = SPRITE_BENCHMARK_WIDTH;
+        targets[i].height = SPRITE_BENCHMARK_HEIGHT;
+        targets[i].bytes_per_pixel = 4;
+        targets[i].pitch = SPRITE_BENCHMARK_WIDTH * 4;
+        targets[i].memory = memory::VMArenaAllocAligned(scratch_arena, (size_t)SPRITE_BENCHMARK_WIDTH * SPRITE_BENCHMARK_HEIGHT * 4, 64);
+    }
+
+    local const char* filter_names[] = { "nearest", "bilinear" };
+    BlitPath best_path = GetBestPath();
+    for (u32 filter = BLIT_FILTER_NEAREST; filter <= BLIT_FILTER_BILINEAR; ++filter)
+    {
+        SpriteBenchmarkResult scalar = RunBenchmarkPass(&targets[0], nullptr, &image, (BlitFilter)filter, BLIT_PATH_SCALAR, nullptr);
+        printf("Sprite blit %-8s %-6s 1 thread : %8.1f MP/s\n", filter_names[filter], blit_path_names[BLIT_PATH_SCALAR], scalar.megapixels_per_second);
+
+        for (u32 path = BLIT_PATH_SSE; path <= (u32)best_path; ++path)
+        {
+            SpriteBenchmarkResult single = RunBenchmarkPass(&targets[1], &targets[0], &image, (BlitFilter)filter, (BlitPath)path, nullptr);
+            printf("Sprite blit %-8s %-6s 1 thread : %8.1f MP/s, %.2fx scalar, %u pixels differ\n", filter_names[filter], blit_path_names[path],
+                   single.megapixels_per_second, single.megapixels_per_second / scalar.megapixels_per_second, single.mismatched_pixels);
+        }
+
+        SpriteBenchmarkResult threaded = RunBenchmarkPass(&targets[1], &targets[0], &image, (BlitFilter)filter, best_path, queue);
+        printf("Sprite blit %-8s %-6s %u threads: %8.1f MP/s, %.2fx scalar, %u pixels differ\n", filter_names[filter], blit_path_names[best_path],
+               queue ? work_queue::GetWorkerCount(queue) + 1 : 1, threaded.megapixels_per_second,
+               threaded.megapixels_per_second / scalar.megapixels_per_second, threaded.mismatched_pixels);
+    }
+}
+
+} // namespace sprite_blitter
@@ -0,0 +1,657 @@
+#pragma once
+
+#include "core.h"
+#include "core/cpu_features.h"
+#include "renderer/renderer.h"
+#include "utils/handmade_math.h"
+
+#include <immintrin.h>
+#include <string.h>
+
+#define SAMPLER_MAX_LEVELS          16
+#define SAMPLER_TILE_SIZE           4           // Texels per tile side, a tile of RGBA8 is one cache line
+#define SAMPLER_TILE_TEXELS         (SAMPLER_TILE_SIZE * SAMPLER_TILE_SIZE)
+#define SAMPLER_MAX_TEXEL_COORD     4194304.0f  // 2^22, keeps far out coordinates exact and in int range
+
+// log2(1 + m) ~ m + m (1 - m) (a + b m) on [0, 1), exact at both ends and within 0.0011
+#define SAMPLER_LOG2_A              0.42086454f
+#define SAMPLER_LOG2_B              -0.15638611f
+
+enum SamplerFormat
+{
+    SAMPLER_FORMAT_RGBA8,       // Read back as 0..1
+    SAMPLER_FORMAT_RGBA32F,
+};
+
+// Same behavior as the GL wrap modes of the same name
+enum SamplerWrap
+{
+    SAMPLER_WRAP_REPEAT,
+    SAMPLER_WRAP_MIRRORED_REPEAT,
+    SAMPLER_WRAP_CLAMP_TO_EDGE,
+};
+
+enum SamplerFilter
+{
+    SAMPLER_FILTER_NEAREST,
+    SAMPLER_FILTER_LINEAR,
+};
+
+enum SamplerMipMode
+{
+    SAMPLER_MIP_NONE,           // Level 0 only, like GL_NEAREST / GL_LINEAR
+    SAMPLER_MIP_NEAREST,        // GL_*_MIPMAP_NEAREST
+    SAMPLER_MIP_LINEAR,         // GL_*_MIPMAP_LINEAR, trilinear with a linear min filter
+};
+
+// No padding, so a state can be hashed as raw bytes
+struct SamplerState
+{
+    SamplerWrap wrap_u;
+    SamplerWrap wrap_v;
+    SamplerFilter mag_filter;
+    SamplerFilter min_filter;
+    SamplerMipMode mip_mode;
+    f32 lod_bias;
+};
+
+// Every level is stored as 4x4 tiles in row-major order, texels inside a tile in Morton order,
+// so a bilinear footprint mostly stays within one tile. The level arrays are laid out to be
+// gathered by level index. Row 0 sits at v = 0, like GL.
+struct SamplerTexture
+{
+    const u8* texels;                       // Storage for every level, can be moved by pointing this at the copy
+    SamplerFormat format;
+    u32 level_count;
+    i32 width[SAMPLER_MAX_LEVELS];
+    i32 height[SAMPLER_MAX_LEVELS];
+    i32 tiles_x[SAMPLER_MAX_LEVELS];
+    i32 offset[SAMPLER_MAX_LEVELS];         // In texels from the start of the storage
+};
+
+namespace texture_sampler
+{
+
+internal u32 GetTexelSize(SamplerFormat format)
+{
+    return format == SAMPLER_FORMAT_RGBA32F ? 16 : 4;
+}
+
+internal i32 GetLevelTexelCount(i32 width, i32 height)
+{
+    i32 tiles_x = (width + SAMPLER_TILE_SIZE - 1) / SAMPLER_TILE_SIZE;
+    i32 tiles_y = (height + SAMPLER_TILE_SIZE - 1) / SAMPLER_TILE_SIZE;
+    return tiles_x * tiles_y * SAMPLER_TILE_TEXELS;
+}
+
+// Position of (x, y) inside its tile
+internal i32 GetMortonIndex(i32 x, i32 y)
+{
+    return (x & 1) | ((y & 1) << 1) | ((x & 2) << 1) | ((y & 2) << 2);
+}
+
+internal i32 GetTexelIndex(const SamplerTexture* texture, i32 level, i32 x, i32 y)
+{
+    i32 tile = (y >> 2) * texture->tiles_x[level] + (x >> 2);
+    return texture->offset[level] + tile * SAMPLER_TILE_TEXELS + GetMortonIndex(x, y);
+}
+
+// Bytes Init() needs for the levels, row-major RGBA8 or RGBA float texels
+size_t GetStorageSize(SamplerFormat format, const TextureLevel* levels, u32 level_count)
+{
+    size_t texel_count = 0;
+    for (u32 i = 0; i < level_count && i < SAMPLER_MAX_LEVELS; ++i)
+    {
+        texel_count += (size_t)GetLevelTexelCount(levels[i].width, levels[i].height);
+    }
+    return texel_count * GetTexelSize(format);
+}
+
+// Reorders the levels into storage, GetStorageSize() bytes. Padding texels of partial tiles
+// are zero, the sampler never reads them.
+void Init(SamplerTexture* texture, SamplerFormat format, const TextureLevel* levels, u32 level_count, void* storage)
+{
+    *texture = {};
+    texture->texels = (const u8*)storage;
+    texture->format = format;
+    texture->level_count = level_count < SAMPLER_MAX_LEVELS ? level_count : SAMPLER_MAX_LEVELS;
+
+    u32 texel_size = GetTexelSize(format);
+    i32 offset = 0;
+    for (u32 level = 0; level < texture->level_count; ++level)
+    {
+        i32 width = levels[level].width;
+        i32 height = levels[level].height;
+        texture->width[level] = width;
+        texture->height[level] = height;
+        texture->tiles_x[level] = (width + SAMPLER_TILE_SIZE - 1) / SAMPLER_TILE_SIZE;
+        texture->offset[level] = offset;
+
+        i32 level_texels = GetLevelTexelCount(width, height);
+        u8* dest = (u8*)storage + (size_t)offset * texel_size;
+        memset(dest, 0, (size_t)level_texels * texel_size);
+
+        const u8* source = (const u8*)levels[level].pixels;
+        for (i32 y = 0; y < height; ++y)
+        {
+            for (i32 x = 0; x < width; ++x)
+            {
+                i32 index = GetTexelIndex(texture, (i32)level, x, y) - offset;
+                memcpy(dest + (size_t)index * texel_size, source + ((size_t)y * (size_t)width + (size_t)x) * texel_size, texel_size);
+            }
+        }
+        offset += level_texels;
+    }
+}
+
+SamplerState MakeState(SamplerWrap wrap, SamplerFilter mag_filter, SamplerFilter min_filter, SamplerMipMode mip_mode)
+{
+    SamplerState state = {};
+    state.wrap_u = wrap;
+    state.wrap_v = wrap;
+    state.mag_filter = mag_filter;
+    state.min_filter = min_filter;
+    state.mip_mode = mip_mode;
+    return state;
+}
+
+internal f32 Log2(f32 value)
+{
+    u32 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    f32 exponent = (f32)((i32)(bits >> 23) - 127);
+    u32 mantissa_bits = (bits & 0x7FFFFF) | 0x3F800000;
+    f32 m;
+    memcpy(&m, &mantissa_bits, sizeof(m));
+    m -= 1.0f;
+    return exponent + (m + m * (1.0f - m) * (SAMPLER_LOG2_A + SAMPLER_LOG2_B * m));
+}
+
+// LOD of level 0 from the UV derivatives along x and y on screen, log2 of the longer footprint
+f32 ComputeLod(const SamplerTexture* texture, f32 du_dx, f32 dv_dx, f32 du_dy, f32 dv_dy)
+{
+    f32 width = (f32)texture->width[0];
+    f32 height = (f32)texture->height[0];
+    f32 x_u = du_dx * width;
+    f32 x_v = dv_dx * height;
+    f32 y_u = du_dy * width;
+    f32 y_v = dv_dy * height;
+    f32 rho_sq = MaxFloat(x_u * x_u + x_v * x_v, y_u * y_u + y_v * y_v);
+    return 0.5f * Log2(rho_sq);
+}
+
+// ---------------------------------------------------------------------------------------------
+// Scalar, the reference for the SIMD paths: same operations in the same order
+
+internal i32 WrapCoordinate(SamplerWrap wrap, i32 x, i32 size)
+{
+    if (wrap == SAMPLER_WRAP_CLAMP_TO_EDGE)
+    {
+        return MinInt(MaxInt(x, 0), size - 1);
+    }
+
+    // Floor division through floats: exact for the clamped coordinate range and vectorizes
+    f32 inverse_size = 1.0f / (f32)size;
+    i32 wrapped;
+    if (wrap == SAMPLER_WRAP_REPEAT)
+    {
+        i32 quotient = (i32)floorf(((f32)x + 0.5f) * inverse_size);
+        wrapped = x - quotient * size;
+    }
+    else
+    {
+        i32 quotient = (i32)floorf(((f32)x + 0.5f) * (inverse_size * 0.5f));
+        wrapped = x - quotient * 2 * size;
+        wrapped = wrapped >= size ? 2 * size - 1 - wrapped : wrapped;
+    }
+    return MinInt(MaxInt(wrapped, 0), size - 1);
+}
+
+internal void FetchTexel(const SamplerTexture* texture, i32 index, f32* rgba)
+{
+    if (texture->format == SAMPLER_FORMAT_RGBA32F)
+    {
+        memcpy(rgba, texture->texels + (size_t)index * 16, 16);
+        return;
+    }
+
+    u32 texel;
+    memcpy(&texel, texture->texels + (size_t)index * 4, 4);
+    for (u32 c = 0; c < 4; ++c)
+    {
+        rgba[c] = (f32)((texel >> (8 * c)) & 0xFF) * (1.0f / 255.0f);
+    }
+}
+
+internal void SampleLevel(const SamplerTexture* texture, const SamplerState* state, i32 level, bool linear, f32 u, f32 v, f32* rgba)
+{
+    i32 width = texture->width[level];
+    i32 height = texture->height[level];
+    f32 half = linear ? 0.5f : 0.0f;
+    f32 tx = MinFloat(MaxFloat(u * (f32)width - half, -SAMPLER_MAX_TEXEL_COORD), SAMPLER_MAX_TEXEL_COORD);
+    f32 ty = MinFloat(MaxFloat(v * (f32)height - half, -SAMPLER_MAX_TEXEL_COORD), SAMPLER_MAX_TEXEL_COORD);
+    f32 x0f = floorf(tx);
+    f32 y0f = floorf(ty);
+    f32 fx = linear ? tx - x0f : 0.0f;
+    f32 fy = linear ? ty - y0f : 0.0f;
+
+    i32 x0 = WrapCoordinate(state->wrap_u, (i32)x0f, width);
+    i32 x1 = WrapCoordinate(state->wrap_u, (i32)x0f + 1, width);
+    i32 y0 = WrapCoordinate(state->wrap_v, (i32)y0f, height);
+    i32 y1 = WrapCoordinate(state->wrap_v, (i32)y0f + 1, height);
+
+    f32 c00[4], c10[4], c01[4], c11[4];
+    FetchTexel(texture, GetTexelIndex(texture, level, x0, y0), c00);
+    FetchTexel(texture, GetTexelIndex(texture, level, x1, y0), c10);
+    FetchTexel(texture, GetTexelIndex(texture, level, x0, y1), c01);
+    FetchTexel(texture, GetTexelIndex(texture, level, x1, y1), c11);
+    for (u32 c = 0; c < 4; ++c)
+    {
+        f32 top = c00[c] + fx * (c10[c] - c00[c]);
+        f32 bottom = c01[c] + fx * (c11[c] - c01[c]);
+        rgba[c] = top + fy * (bottom - top);
+    }
+}
+
+// Picks the levels, their blend and the filter for a LOD like GL does
+internal void SelectLevels(const SamplerTexture* texture, const SamplerState* state, f32 lod,
+                           i32* level0, i32* level1, f32* fraction, bool* linear)
+{
+    lod += state->lod_bias;
+    bool magnify = lod <= 0.0f;
+    *linear = (magnify ? state->mag_filter : state->min_filter) == SAMPLER_FILTER_LINEAR;
+    *level0 = 0;
+    *level1 = 0;
+    *fraction = 0.0f;
+
+    i32 max_level = (i32)texture->level_count - 1;
+    if (state->mip_mode == SAMPLER_MIP_NEAREST)
+    {
+        *level0 = MinInt(MaxInt((i32)floorf(lod + 0.5f), 0), max_level);
+        *level1 = *level0;
+    }
+    else if (state->mip_mode == SAMPLER_MIP_LINEAR)
+    {
+        f32 clamped = MaxFloat(lod, 0.0f);
+        f32 whole = floorf(clamped);
+        *level0 = MinInt((i32)whole, max_level);
+        *level1 = MinInt(*level0 + 1, max_level);
+        *fraction = *level0 < max_level ? clamped - whole : 0.0f;
+    }
+}
+
+void Sample(const SamplerTexture* texture, const SamplerState* state, f32 u, f32 v, f32 lod, f32* rgba)
+{
+    i32 level0, level1;
+    f32 fraction;
+    bool linear;
+    SelectLevels(texture, state, lod, &level0, &level1, &fraction, &linear);
+
+    SampleLevel(texture, state, level0, linear, u, v, rgba);
+    if (fraction > 0.0f)
+    {
+        f32 next[4];
+        SampleLevel(texture, state, level1, linear, u, v, next);
+        for (u32 c = 0; c < 4; ++c)
+        {
+            rgba[c] = rgba[c] + fraction * (next[c] - rgba[c]);
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------------
+// 4 wide, SSE4.1. Callers check for it, SampleQuad() does
+
+internal __m128i WrapCoordinate4(SamplerWrap wrap, __m128i x, __m128i size, __m128 size_f)
+{
+    __m128i size_minus_one = _mm_sub_epi32(size, _mm_set1_epi32(1));
+    if (wrap != SAMPLER_WRAP_CLAMP_TO_EDGE)
+    {
+        __m128 inverse_size = _mm_div_ps(_mm_set1_ps(1.0f), size_f);
+        __m128 x_center = _mm_add_ps(_mm_cvtepi32_ps(x), _mm_set1_ps(0.5f));
+        if (wrap == SAMPLER_WRAP_REPEAT)
+        {
+            __m128i quotient = _mm_cvttps_epi32(_mm_floor_ps(_mm_mul_ps(x_center, inverse_size)));
+            x = _mm_sub_epi32(x, _mm_mullo_epi32(quotient, size));
+        }
+        else
+        {
+            __m128i period = _mm_add_epi32(size, size);
+            __m128i quotient = _mm_cvttps_epi32(_mm_floor_ps(_mm_mul_ps(x_center, _mm_mul_ps(inverse_size, _mm_set1_ps(0.5f)))));
+            x = _mm_sub_epi32(x, _mm_mullo_epi32(quotient, period));
+            __m128i mirrored = _mm_sub_epi32(_mm_sub_epi32(period, _mm_set1_epi32(1)), x);
+            x = _mm_blendv_epi8(x, mirrored, _mm_cmpgt_epi32(x, size_minus_one));
+        }
+    }
+    return _mm_min_epi32(_mm_max_epi32(x, _mm_setzero_si128()), size_minus_one);
+}
+
+internal __m128i GetTexelIndex4(__m128i offset, __m128i tiles_x, __m128i x, __m128i y)
+{
+    __m128i one = _mm_set1_epi32(1);
+    __m128i two = _mm_set1_epi32(2);
+    __m128i tile = _mm_add_epi32(_mm_mullo_epi32(_mm_srai_epi32(y, 2), tiles_x), _mm_srai_epi32(x, 2));
+    __m128i morton = _mm_or_si128(_mm_and_si128(x, one), _mm_slli_epi32(_mm_and_si128(y, one), 1));
+    morton = _mm_or_si128(morton, _mm_or_si128(_mm_slli_epi32(_mm_and_si128(x, two), 1), _mm_slli_epi32(_mm_and_si128(y, two), 2)));
+    return _mm_add_epi32(offset, _mm_add_epi32(_mm_slli_epi32(tile, 4), morton));
+}
+
+internal void FetchTexels4(const SamplerTexture* texture, __m128i index, __m128* rgba)
+{
+    alignas(16) i32 indices[4];
+    _mm_store_si128((__m128i*)indices, index);
+    if (texture->format == SAMPLER_FORMAT_RGBA32F)
+    {
+        const f32* texels = (const f32*)texture->texels;
+        __m128 t0 = _mm_loadu_ps(texels + (size_t)indices[0] * 4);
+        __m128 t1 = _mm_loadu_ps(texels + (size_t)indices[1] * 4);
+        __m128 t2 = _mm_loadu_ps(texels + (size_t)indices[2] * 4);
+        __m128 t3 = _mm_loadu_ps(texels + (size_t)indices[3] * 4);
+        _MM_TRANSPOSE4_PS(t0, t1, t2, t3);
+        rgba[0] = t0;
+        rgba[1] = t1;
+        rgba[2] = t2;
+        rgba[3] = t3;
+        return;
+    }
+
+    const u32* texels = (const u32*)texture->texels;
+    __m128i packed = _mm_setr_epi32((i32)texels[indices[0]], (i32)texels[indices[1]], (i32)texels[indices[2]], (i32)texels[indices[3]]);
+    __m128i byte_mask = _mm_set1_epi32(0xFF);
+    __m128 to_unit = _mm_set1_ps(1.0f / 255.0f);
+    for (u32 c = 0; c < 4; ++c)
+    {
+        __m128i channel = _mm_and_si128(_mm_srli_epi32(packed, (i32)(8 * c)), byte_mask);
+        rgba[c] = _mm_mul_ps(_mm_cvtepi32_ps(channel), to_unit);
+    }
+}
+
+internal __m128 Lerp4(__m128 a, __m128 b, __m128 t)
+{
+    return _mm_add_ps(a, _mm_mul_ps(t, _mm_sub_ps(b, a)));
+}
+
+internal void SampleLevel4(const SamplerTexture* texture, const SamplerState* state, __m128i level, __m128 linear,
+                           __m128 u, __m128 v, __m128* rgba)
+{
+    alignas(16) i32 levels[4];
+    _mm_store_si128((__m128i*)levels, level);
+    __m128i width = _mm_setr_epi32(texture->width[levels[0]], texture->width[levels[1]], texture->width[levels[2]], texture->width[levels[3]]);
+    __m128i height = _mm_setr_epi32(texture->height[levels[0]], texture->height[levels[1]], texture->height[levels[2]], texture->height[levels[3]]);
+    __m128i tiles_x = _mm_setr_epi32(texture->tiles_x[levels[0]], texture->tiles_x[levels[1]], texture->tiles_x[levels[2]], texture->tiles_x[levels[3]]);
+    __m128i offset = _mm_setr_epi32(texture->offset[levels[0]], texture->offset[levels[1]], texture->offset[levels[2]], texture->offset[levels[3]]);
+    __m128 width_f = _mm_cvtepi32_ps(width);
+    __m128 height_f = _mm_cvtepi32_ps(height);
+
+    __m128 half = _mm_and_ps(linear, _mm_set1_ps(0.5f));
+    __m128 max_coord = _mm_set1_ps(SAMPLER_MAX_TEXEL_COORD);
+    __m128 min_coord = _mm_set1_ps(-SAMPLER_MAX_TEXEL_COORD);
+    __m128 tx = _mm_min_ps(_mm_max_ps(_mm_sub_ps(_mm_mul_ps(u, width_f), half), min_coord), max_coord);
+    __m128 ty = _mm_min_ps(_mm_max_ps(_mm_sub_ps(_mm_mul_ps(v, height_f), half), min_coord), max_coord);
+    __m128 x0f = _mm_floor_ps(tx);
+    __m128 y0f = _mm_floor_ps(ty);
+    __m128 fx = _mm_and_ps(linear, _mm_sub_ps(tx, x0f));
+    __m128 fy = _mm_and_ps(linear, _mm_sub_ps(ty, y0f));
+
+    __m128i one = _mm_set1_epi32(1);
+    __m128i x0_raw = _mm_cvttps_epi32(x0f);
+    __m128i y0_raw = _mm_cvttps_epi32(y0f);
+    __m128i x0 = WrapCoordinate4(state->wrap_u, x0_raw, width, width_f);
+    __m128i x1 = WrapCoordinate4(state->wrap_u, _mm_add_epi32(x0_raw, one), width, width_f);
+    __m128i y0 = WrapCoordinate4(state->wrap_v, y0_raw, height, height_f);
+    __m128i y1 = WrapCoordinate4(state->wrap_v, _mm_add_epi32(y0_raw, one), height, height_f);
+
+    __m128 c00[4], c10[4], c01[4], c11[4];
+    FetchTexels4(texture, GetTexelIndex4(offset, tiles_x, x0, y0), c00);
+    FetchTexels4(texture, GetTexelIndex4(offset, tiles_x, x1, y0), c10);
+    FetchTexels4(texture, GetTexelIndex4(offset, tiles_x, x0, y1), c01);
+    FetchTexels4(texture, GetTexelIndex4(offset, tiles_x, x1, y1), c11);
+    for (u32 c = 0; c < 4; ++c)
+    {
+        rgba[c] = Lerp4(Lerp4(c00[c], c10[c], fx), Lerp4(c01[c], c11[c], fx), fy);
+    }
+}
+
+// Four independent samples, each with its own LOD. rgba gets one register per channel.
+void Sample4(const SamplerTexture* texture, const SamplerState* state, __m128 u, __m128 v, __m128 lod, __m128* rgba)
+{
+    __m128 zero = _mm_setzero_ps();
+    lod = _mm_add_ps(lod, _mm_set1_ps(state->lod_bias));
+    __m128 magnify = _mm_cmple_ps(lod, zero);
+    __m128 mag_linear = _mm_castsi128_ps(_mm_set1_epi32(state->mag_filter == SAMPLER_FILTER_LINEAR ? -1 : 0));
+    __m128 min_linear = _mm_castsi128_ps(_mm_set1_epi32(state->min_filter == SAMPLER_FILTER_LINEAR ? -1 : 0));
+    __m128 linear = _mm_or_ps(_mm_and_ps(magnify, mag_linear), _mm_andnot_ps(magnify, min_linear));
+
+    __m128i max_level = _mm_set1_epi32((i32)texture->level_count - 1);
+    __m128i level0 = _mm_setzero_si128();
+    __m128i level1 = _mm_setzero_si128();
+    __m128 fraction = zero;
+    if (state->mip_mode == SAMPLER_MIP_NEAREST)
+    {
+        level0 = _mm_cvttps_epi32(_mm_floor_ps(_mm_add_ps(lod, _mm_set1_ps(0.5f))));
+        level0 = _mm_min_epi32(_mm_max_epi32(level0, _mm_setzero_si128()), max_level);
+    }
+    else if (state->mip_mode == SAMPLER_MIP_LINEAR)
+    {
+        __m128 clamped = _mm_max_ps(lod, zero);
+        __m128 whole = _mm_floor_ps(clamped);
+        level0 = _mm_min_epi32(_mm_cvttps_epi32(whole), max_level);
+        level1 = _mm_min_epi32(_mm_add_epi32(level0, _mm_set1_epi32(1)), max_level);
+        fraction = _mm_and_ps(_mm_castsi128_ps(_mm_cmplt_epi32(level0, max_level)), _mm_sub_ps(clamped, whole));
+    }
+
+    SampleLevel4(texture, state, level0, linear, u, v, rgba);
+    if (_mm_movemask_ps(_mm_cmpgt_ps(fraction, zero)))
+    {
+        __m128 next[4];
+        SampleLevel4(texture, state, level1, linear, u, v, next);
+        for (u32 c = 0; c < 4; ++c)
+        {
+            rgba[c] = Lerp4(rgba[c], next[c], fraction);
+        }
+    }
+}
+
+// A 2x2 pixel quad with lanes (x, y), (x + 1, y), (x, y + 1), (x + 1, y + 1): the LOD comes
+// from the differences between the lanes, one for the whole quad like on a GPU
+void SampleQuad(const SamplerTexture* texture, const SamplerState* state, __m128 u, __m128 v, __m128* rgba)
+{
+    alignas(16) f32 us[4];
+    alignas(16) f32 vs[4];
+    _mm_store_ps(us, u);
+    _mm_store_ps(vs, v);
+    f32 lod = ComputeLod(texture, us[1] - us[0], vs[1] - vs[0], us[2] - us[0], vs[2] - vs[0]);
+    if (cpu_features::Get()->sse41)
+    {
+        Sample4(texture, state, u, v, _mm_set1_ps(lod), rgba);
+        return;
+    }
+
+    alignas(16) f32 channels[4][4];
+    for (u32 lane = 0; lane < 4; ++lane)
+    {
+        f32 texel[4];
+        Sample(texture, state, us[lane], vs[lane], lod, texel);
+        for (u32 c = 0; c < 4; ++c)
+        {
+            channels[c][lane] = texel[c];
+        }
+    }
+    for (u32 c = 0; c < 4; ++c)
+    {
+        rgba[c] = _mm_load_ps(channels[c]);
+    }
+}
+
+// ---------------------------------------------------------------------------------------------
+// 8 wide, AVX2 with hardware gathers
+
+internal __m256i WrapCoordinate8(SamplerWrap wrap, __m256i x, __m256i size, __m256 size_f)
+{
+    __m256i size_minus_one = _mm256_sub_epi32(size, _mm256_set1_epi32(1));
+    if (wrap != SAMPLER_WRAP_CLAMP_TO_EDGE)
+    {
+        __m256 inverse_size = _mm256_div_ps(_mm256_set1_ps(1.0f), size_f);
+        __m256 x_center = _mm256_add_ps(_mm256_cvtepi32_ps(x), _mm256_set1_ps(0.5f));
+        if (wrap == SAMPLER_WRAP_REPEAT)
+        {
+            __m256i quotient = _mm256_cvttps_epi32(_mm256_floor_ps(_mm256_mul_ps(x_center, inverse_size)));
+            x = _mm256_sub_epi32(x, _mm256_mullo_epi32(quotient, size));
+        }
+        else
+        {
+            __m256i period = _mm256_add_epi32(size, size);
+            __m256i quotient = _mm256_cvttps_epi32(_mm256_floor_ps(_mm256_mul_ps(x_center, _mm256_mul_ps(inverse_size, _mm256_set1_ps(0.5f)))));
+            x = _mm256_sub_epi32(x, _mm256_mullo_epi32(quotient, period));
+            __m256i mirrored = _mm256_sub_epi32(_mm256_sub_epi32(period, _mm256_set1_epi32(1)), x);
+            x = _mm256_blendv_epi8(x, mirrored, _mm256_cmpgt_epi32(x, size_minus_one));
+        }
+    }
+    return _mm256_min_epi32(_mm256_max_epi32(x, _mm256_setzero_si256()), size_minus_one);
+}
+
+internal __m256i GetTexelIndex8(__m256i offset, __m256i tiles_x, __m256i x, __m256i y)
+{
+    __m256i one = _mm256_set1_epi32(1);
+    __m256i two = _mm256_set1_epi32(2);
+    __m256i tile = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srai_epi32(y, 2), tiles_x), _mm256_srai_epi32(x, 2));
+    __m256i morton = _mm256_or_si256(_mm256_and_si256(x, one), _mm256_slli_epi32(_mm256_and_si256(y, one), 1));
+    morton = _mm256_or_si256(morton, _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(x, two), 1), _mm256_slli_epi32(_mm256_and_si256(y, two), 2)));
+    return _mm256_add_epi32(offset, _mm256_add_epi32(_mm256_slli_epi32(tile, 4), morton));
+}
+
+internal void FetchTexels8(const SamplerTexture* texture, __m256i index, __m256* rgba)
+{
+    if (texture->format == SAMPLER_FORMAT_RGBA32F)
+    {
+        const f32* texels = (const f32*)texture->texels;
+        __m256i float_index = _mm256_slli_epi32(index, 2);
+        for (u32 c = 0; c < 4; ++c)
+        {
+            rgba[c] = _mm256_i32gather_ps(texels + c, float_index, 4);
+        }
+        return;
+    }
+
+    __m256i packed = _mm256_i32gather_epi32((const int*)texture->texels, index, 4);
+    __m256i byte_mask = _mm256_set1_epi32(0xFF);
+    __m256 to_unit = _mm256_set1_ps(1.0f / 255.0f);
+    for (u32 c = 0; c < 4; ++c)
+    {
+        __m256i channel = _mm256_and_si256(_mm256_srli_epi32(packed, (i32)(8 * c)), byte_mask);
+        rgba[c] = _mm256_mul_ps(_mm256_cvtepi32_ps(channel), to_unit);
+    }
+}
+
+internal __m256 Lerp8(__m256 a, __m256 b, __m256 t)
+{
+    return _mm256_add_ps(a, _mm256_mul_ps(t, _mm256_sub_ps(b, a)));
+}
+
+internal void SampleLevel8(const SamplerTexture* texture, const SamplerState* state, __m256i level, __m256 linear,
+                           __m256 u, __m256 v, __m256* rgba)
+{
+    __m256i width = _mm256_i32gather_epi32(texture->width, level, 4);
+    __m256i height = _mm256_i32gather_epi32(texture->height, level, 4);
+    __m256i tiles_x = _mm256_i32gather_epi32(texture->tiles_x, level, 4);
+    __m256i offset = _mm256_i32gather_epi32(texture->offset, level, 4);
+    __m256 width_f = _mm256_cvtepi32_ps(width);
+    __m256 height_f = _mm256_cvtepi32_ps(height);
+
+    __m256 half = _mm256_and_ps(linear, _mm256_set1_ps(0.5f));
+    __m256 max_coord = _mm256_set1_ps(SAMPLER_MAX_TEXEL_COORD);
+    __m256 min_coord = _mm256_set1_ps(-SAMPLER_MAX_TEXEL_COORD);
+    __m256 tx = _mm256_min_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_mul_ps(u, width_f), half), min_coord), max_coord);
+    __m256 ty = _mm256_min_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_mul_ps(v, height_f), half), min_coord), max_coord);
+    __m256 x0f = _mm256_floor_ps(tx);
+    __m256 y0f = _mm256_floor_ps(ty);
+    __m256 fx = _mm256_and_ps(linear, _mm256_sub_ps(tx, x0f));
+    __m256 fy = _mm256_and_ps(linear, _mm256_sub_ps(ty, y0f));
+
+    __m256i one = _mm256_set1_epi32(1);
+    __m256i x0_raw = _mm256_cvttps_epi32(x0f);
+    __m256i y0_raw = _mm256_cvttps_epi32(y0f);
+    __m256i x0 = WrapCoordinate8(state->wrap_u, x0_raw, width, width_f);
+    __m256i x1 = WrapCoordinate8(state->wrap_u, _mm256_add_epi32(x0_raw, one), width, width_f);
+    __m256i y0 = WrapCoordinate8(state->wrap_v, y0_raw, height, height_f);
+    __m256i y1 = WrapCoordinate8(state->wrap_v, _mm256_add_epi32(y0_raw, one), height, height_f);
+
+    __m256 c00[4], c10[4], c01[4], c11[4];
+    FetchTexels8(texture, GetTexelIndex8(offset, tiles_x, x0, y0), c00);
+    FetchTexels8(texture, GetTexelIndex8(offset, tiles_x, x1, y0), c10);
+    FetchTexels8(texture, GetTexelIndex8(offset, tiles_x, x0, y1), c01);
+    FetchTexels8(texture, GetTexelIndex8(offset, tiles_x, x1, y1), c11);
+    for (u32 c = 0; c < 4; ++c)
+    {
+        rgba[c] = Lerp8(Lerp8(c00[c], c10[c], fx), Lerp8(c01[c], c11[c], fx), fy);
+    }
+}
+
+internal void Sample8Avx2(const SamplerTexture* texture, const SamplerState* state, const f32* u, const f32* v, const f32* lod, f32* rgba)
+{
+    __m256 zero = _mm256_setzero_ps();
+    __m256 lods = _mm256_add_ps(_mm256_loadu_ps(lod), _mm256_set1_ps(state->lod_bias));
+    __m256 magnify = _mm256_cmp_ps(lods, zero, _CMP_LE_OQ);
+    __m256 mag_linear = _mm256_castsi256_ps(_mm256_set1_epi32(state->mag_filter == SAMPLER_FILTER_LINEAR ? -1 : 0));
+    __m256 min_linear = _mm256_castsi256_ps(_mm256_set1_epi32(state->min_filter == SAMPLER_FILTER_LINEAR ? -1 : 0));
+    __m256 linear = _mm256_or_ps(_mm256_and_ps(magnify, mag_linear), _mm256_andnot_ps(magnify, min_linear));
+
+    __m256i max_level = _mm256_set1_epi32((i32)texture->level_count - 1);
+    __m256i level0 = _mm256_setzero_si256();
+    __m256i level1 = _mm256_setzero_si256();
+    __m256 fraction = zero;
+    if (state->mip_mode == SAMPLER_MIP_NEAREST)
+    {
+        level0 = _mm256_cvttps_epi32(_mm256_floor_ps(_mm256_add_ps(lods, _mm256_set1_ps(0.5f))));
+        level0 = _mm256_min_epi32(_mm256_max_epi32(level0, _mm256_setzero_si256()), max_level);
+    }
+    else if (state->mip_mode == SAMPLER_MIP_LINEAR)
+    {
+        __m256 clamped = _mm256_max_ps(lods, zero);
+        __m256 whole = _mm256_floor_ps(clamped);
+        level0 = _mm256_min_epi32(_mm256_cvttps_epi32(whole), max_level);
+        level1 = _mm256_min_epi32(_mm256_add_epi32(level0, _mm256_set1_epi32(1)), max_level);
+        fraction = _mm256_and_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(max_level, level0)), _mm256_sub_ps(clamped, whole));
+    }
+
+    __m256 us = _mm256_loadu_ps(u);
+    __m256 vs = _mm256_loadu_ps(v);
+    __m256 result[4];
+    SampleLevel8(texture, state, level0, linear, us, vs, result);
+    if (_mm256_movemask_ps(_mm256_cmp_ps(fraction, zero, _CMP_GT_OQ)))
+    {
+        __m256 next[4];
+        SampleLevel8(texture, state, level1, linear, us, vs, next);
+        for (u32 c = 0; c < 4; ++c)
+        {
+            result[c] = Lerp8(result[c], next[c], fraction);
+        }
+    }
+    for (u32 c = 0; c < 4; ++c)
+    {
+        _mm256_storeu_ps(rgba + c * 8, result[c]);
+    }
+}
+
+// Eight independent samples. Arrays in, channel planes out: rgba holds 8 reds, then 8 greens...
+// Without AVX2 it runs as two Sample4() calls with the same results, needs SSE4.1 either way.
+void Sample8(const SamplerTexture* texture, const SamplerState* state, const f32* u, const f32* v, const f32* lod, f32* rgba)
+{
+    if (cpu_features::Get()->avx2)
+    {
+        Sample8Avx2(texture, state, u, v, lod, rgba);
+        return;
+    }
+
+    for (u32 half = 0; half < 2; ++half)
+    {
+        __m128 result[4];
+        Sample4(texture, state, _mm_loadu_ps(u + half * 4), _mm_loadu_ps(v + half * 4), _mm_loadu_ps(lod + half * 4), result);
+        for (u32 c = 0; c < 4; ++c)
+        {
+            _mm_storeu_ps(rgba + c * 8 + half * 4, result[c]);
+        }
+    }
+}
+
+} // namespace texture_sampler
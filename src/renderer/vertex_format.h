@@ -0,0 +1,212 @@
+#pragma once
+
+#include "core.h"
+#include "renderer/renderer.h"
+#include "utils/handmade_math.h"
+
+#include <cstddef>
+#include <cstring>
+
+#define MAX_VERTEX_ATTRIBUTES   8
+#define MAX_16BIT_INDEX_VERTICES 65536
+
+enum class AttributeType
+{
+    FLOAT32,
+    HALF_FLOAT,
+    SNORM16,
+    UNORM8
+};
+
+struct VertexAttribute
+{
+    u32 location;           // Matches layout (location = N) in the shaders
+    u32 component_count;
+    AttributeType type;
+    bool normalized;        // Integer types read as [-1, 1] / [0, 1] floats
+    u32 offset;
+};
+
+// Describes one vertex struct, the backend turns it into glVertexAttribPointer calls
+struct VertexLayout
+{
+    VertexAttribute attributes[MAX_VERTEX_ATTRIBUTES];
+    u32 attribute_count;
+    u32 stride;
+};
+
+// GPU side mesh vertex, 20 bytes instead of the 44 of Vertex.
+// Positions are snorm16 inside the mesh bounds; the backend folds the bounds into the model
+// matrix. Normals are octahedral encoded and need OctDecode() in the vertex shader.
+struct CompactVertex
+{
+    i16 position[4];    // w is padding, keeps the next attribute 4 byte aligned
+    i16 normal[2];
+    u8 color[4];        // a is padding
+    u16 uv[2];          // Half floats
+};
+static_assert(sizeof(CompactVertex) == 20, "CompactVertex must stay tightly packed");
+
+constexpr VertexLayout compact_vertex_layout = {
+    {
+        { 0, 3, AttributeType::SNORM16,    true,  offsetof(CompactVertex, position) },
+        { 1, 2, AttributeType::SNORM16,    true,  offsetof(CompactVertex, normal) },
+        { 2, 3, AttributeType::UNORM8,     true,  offsetof(CompactVertex, color) },
+        { 3, 2, AttributeType::HALF_FLOAT, false, offsetof(CompactVertex, uv) },
+    },
+    4,
+    sizeof(CompactVertex)
+};
+
+constexpr VertexLayout vertex_2d_layout = {
+    {
+        { 0, 2, AttributeType::FLOAT32, false, offsetof(Vertex2D, position) },
+        { 1, 3, AttributeType::FLOAT32, false, offsetof(Vertex2D, color) },
+        { 2, 2, AttributeType::FLOAT32, false, offsetof(Vertex2D, uv) },
+    },
+    3,
+    sizeof(Vertex2D)
+};
+
+// GLSL for the compact normal, paste into vertex shaders reading CompactVertex meshes
+#define OCT_DECODE_GLSL \
+    "vec3 OctDecode(vec2 e) {\n" \
+    "    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));\n" \
+    "    float t = max(-n.z, 0.0);\n" \
+    "    n.x += n.x >= 0.0 ? -t : t;\n" \
+    "    n.y += n.y >= 0.0 ? -t : t;\n" \
+    "    return normalize(n);\n" \
+    "}\n"
+
+namespace vertex_format
+{
+
+// Round to nearest even, overflow goes to infinity and tiny values flush to zero
+u16 FloatToHalf(f32 value)
+{
+    u32 bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    u32 sign = (bits >> 16) & 0x8000;
+    i32 exponent = (i32)((bits >> 23) & 0xFF) - 127 + 15;
+    u32 mantissa = bits & 0x7FFFFF;
+
+    if (exponent >= 31)
+    {
+        // Infinity, or NaN with a mantissa bit kept set
+        bool is_nan = ((bits >> 23) & 0xFF) == 0xFF && mantissa != 0;
+        return (u16)(sign | 0x7C00 | (is_nan ? 0x200 : 0));
+    }
+    if (exponent <= 0)
+    {
+        if (exponent < -10)
+        {
+            return (u16)sign;
+        }
+
+        // Denormal: shift the mantissa with its implicit bit into place
+        mantissa |= 0x800000;
+        u32 shift = (u32)(14 - exponent);
+        u32 half_mantissa = mantissa >> shift;
+        u32 remainder = mantissa & ((1u << shift) - 1);
+        u32 halfway = 1u << (shift - 1);
+        if (remainder > halfway || (remainder == halfway && (half_mantissa & 1)))
+        {
+            ++half_mantissa;
+        }
+        return (u16)(sign | half_mantissa);
+    }
+
+    u32 half = sign | ((u32)exponent << 10) | (mantissa >> 13);
+    u32 remainder = mantissa & 0x1FFF;
+    if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))
+    {
+        ++half; // May carry into the exponent, which rounds up correctly
+    }
+    return (u16)half;
+}
+
+i16 FloatToSnorm16(f32 value)
+{
+    f32 clamped = MinFloat(MaxFloat(value, -1.0f), 1.0f);
+    return (i16)(clamped >= 0.0f ? (i32)(clamped * 32767.0f + 0.5f) : (i32)(clamped * 32767.0f - 0.5f));
+}
+
+// Maps a unit normal onto the octahedron, then unfolds the lower half over the corners
+void OctEncode(const f32* normal, i16* out)
+{
+    f32 x = normal[0];
+    f32 y = normal[1];
+    f32 z = normal[2];
+    f32 length = fabsf(x) + fabsf(y) + fabsf(z);
+    if (length <= 0.0f)
+    {
+        out[0] = 0;
+        out[1] = 0;
+        return;
+    }
+
+    x /= length;
+    y /= length;
+    if (z < 0.0f)
+    {
+        f32 folded_x = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        f32 folded_y = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = folded_x;
+        y = folded_y;
+    }
+
+    out[0] = FloatToSnorm16(x);
+    out[1] = FloatToSnorm16(y);
+}
+
+// Quantizes full precision vertices. Returns the bounds center and half extent the
+// snorm16 positions are relative to: position = center + extent * decoded.
+void EncodeCompactVertices(const Vertex* vertices, u32 count, CompactVertex* out, glm::vec3* center, glm::vec3* extent)
+{
+    glm::vec3 min_position = glm::vec3(0.0f);
+    glm::vec3 max_position = glm::vec3(0.0f);
+    for (u32 i = 0; i < count; ++i)
+    {
+        glm::vec3 position = glm::vec3(vertices[i].position[0], vertices[i].position[1], vertices[i].position[2]);
+        if (i == 0)
+        {
+            min_position = position;
+            max_position = position;
+        }
+        for (u32 axis = 0; axis < 3; ++axis)
+        {
+            min_position[axis] = MinFloat(min_position[axis], position[axis]);
+            max_position[axis] = MaxFloat(max_position[axis], position[axis]);
+        }
+    }
+
+    *center = (min_position + max_position) * 0.5f;
+    *extent = (max_position - min_position) * 0.5f;
+
+    for (u32 i = 0; i < count; ++i)
+    {
+        const Vertex& vertex = vertices[i];
+        CompactVertex& compact = out[i];
+        for (u32 axis = 0; axis < 3; ++axis)
+        {
+            // Flat axes have no extent, every vertex sits on the center
+            f32 normalized = (*extent)[axis] > 0.0f ? (vertex.position[axis] - (*center)[axis]) / (*extent)[axis] : 0.0f;
+            compact.position[axis] = FloatToSnorm16(normalized);
+        }
+        compact.position[3] = 0;
+
+        OctEncode(vertex.normal, compact.normal);
+
+        for (u32 c = 0; c < 3; ++c)
+        {
+            compact.color[c] = (u8)RoundFloatToUInt(MinFloat(MaxFloat(vertex.color[c], 0.0f), 1.0f) * 255.0f);
+        }
+        compact.color[3] = 255;
+
+        compact.uv[0] = FloatToHalf(vertex.uv[0]);
+        compact.uv[1] = FloatToHalf(vertex.uv[1]);
+    }
+}
+
+} // namespace vertex_format
@@ -0,0 +1,1844 @@
+#pragma once
+
+#include "core.h"
+#include "core/memory.h"
+#include "core/cpu_features.h"
+#include "utils/handmade_math.h"
+
+#include <immintrin.h>
+#include <string.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define PNG_MAX_DIMENSION           16384   // Keeps the decoded size of an image inside 32 bits
+#define PNG_HUFFMAN_FAST_BITS       10      // Codes up to this long decode with a single table lookup
+#define PNG_HUFFMAN_FAST_SIZE       (1 << PNG_HUFFMAN_FAST_BITS)
+#define PNG_INVALID_SYMBOL          0xFFFF
+#define PNG_ROW_PADDING             16      // Slack after the inflated rows, the filters and match copies may touch it
+
+#define PNG_BENCHMARK_SIZE          1024
+#define PNG_BENCHMARK_MIN_BYTES     Megabytes(64)   // Every path decodes each image until at least this much came out
+#define PNG_BENCHMARK_BLOCK_TOKENS  16384   // LZ77 tokens per block when the benchmark encoder fits Huffman codes
+#define PNG_MAX_CODE_BITS           15      // Longest literal/length and distance code deflate allows
+#define PNG_MAX_CODE_LENGTH_BITS    7       // Longest code of the code length alphabet
+
+enum PngColorType
+{
+    PNG_COLOR_GRAY = 0,
+    PNG_COLOR_RGB = 2,
+    PNG_COLOR_PALETTE = 3,
+    PNG_COLOR_GRAY_ALPHA = 4,
+    PNG_COLOR_RGBA = 6,
+};
+
+enum PngFilter
+{
+    PNG_FILTER_NONE,
+    PNG_FILTER_SUB,
+    PNG_FILTER_UP,
+    PNG_FILTER_AVERAGE,
+    PNG_FILTER_PAETH,
+    PNG_FILTER_COUNT
+};
+
+// How a decode runs, Decode() picks the fastest one
+enum PngDecodePath
+{
+    PNG_DECODE_PATH_REFERENCE,  // Bit at a time canonical Huffman decoding like zlib's puff, scalar filters
+    PNG_DECODE_PATH_SCALAR,     // Table driven inflate, scalar filters
+    PNG_DECODE_PATH_SSE2,       // Table driven inflate, SSE2 filters and RGB expansion
+    PNG_DECODE_PATH_COUNT
+};
+
+static const char* png_decode_path_names[PNG_DECODE_PATH_COUNT] = {
+    "reference",
+    "scalar",
+    "SSE2",
+};
+
+struct PngInfo
+{
+    i32 width;
+    i32 height;
+    u8 bit_depth;
+    u8 color_type;
+    u8 interlace;   // 1 for Adam7
+};
+
+// What the decoder needs out of the chunks, pointing into the file
+struct PngFile
+{
+    PngInfo info;
+    const u8* palette;
+    u32 palette_count;
+    const u8* transparency;
+    u32 transparency_size;
+    size_t first_data_offset;   // Of the first IDAT chunk
+    size_t data_size;           // Of all IDAT chunks together
+    u32 data_chunk_count;
+};
+
+// One Adam7 pass, or the whole image when it isn't interlaced
+struct PngPass
+{
+    u32 x;
+    u32 y;
+    u32 step_x;
+    u32 step_y;
+    u32 width;
+    u32 height;
+    u32 row_bytes;
+};
+
+// Canonical Huffman code. The fast table resolves short codes directly, the rest of the
+// fields serve both the long code fallback and the bit at a time reference decoder.
+struct PngHuffman
+{
+    u16 fast[PNG_HUFFMAN_FAST_SIZE];    // (length << 9) | symbol, 0 where the code is longer than the fast bits
+    u16 counts[16];                     // Codes per length
+    u16 first_code[16];
+    u16 first_symbol[16];
+    u32 max_code[17];                   // One past the last code of each length, left aligned to 16 bits
+    u16 symbols[288];                   // In canonical order
+};
+
+struct PngBitReader
+{
+    const u8* in;
+    const u8* in_end;
+    u64 bits;
+    u32 bit_count;
+    u32 padding;        // Zero bytes fed in past the end of the input
+};
+
+struct PngInflater
+{
+    PngBitReader reader;
+    u8* out;
+    u8* out_begin;
+    u8* out_end;        // At least PNG_ROW_PADDING bytes of slack follow it
+    bool reference;
+    PngHuffman literals;
+    PngHuffman distances;
+};
+
+struct PngBitWriter
+{
+    u8* out;
+    u64 bits;
+    u32 bit_count;
+};
+
+// The blocks the benchmark encoder wrote, to show which inflate paths an image exercises
+struct PngEncodeStats
+{
+    u32 fixed_blocks;
+    u32 dynamic_blocks;
+    u32 stored_blocks;
+    u32 longest_code;       // Over the dynamic literal/length and distance codes, past PNG_HUFFMAN_FAST_BITS takes the slow path
+};
+
+namespace png_decoder
+{
+
+global const u8 png_signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+global const u16 png_length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+global const u8 png_length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+global const u16 png_distance_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769,
+    1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+global const u8 png_distance_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+global const u8 png_code_length_order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+// Adam7 pass origins and steps
+global const u8 png_adam7_x[7] = { 0, 4, 0, 2, 0, 1, 0 };
+global const u8 png_adam7_y[7] = { 0, 0, 4, 0, 2, 0, 1 };
+global const u8 png_adam7_step_x[7] = { 8, 8, 4, 4, 2, 2, 1 };
+global const u8 png_adam7_step_y[7] = { 8, 8, 8, 4, 4, 2, 2 };
+
+// SSE2 is the baseline, the table driven inflate is always there
+PngDecodePath GetBestPath()
+{
+    return PNG_DECODE_PATH_SSE2;
+}
+
+internal u32 ReadBigEndian32(const u8* p)
+{
+    return ((u32)p[0] << 24) | ((u32)p[1] << 16) | ((u32)p[2] << 8) | (u32)p[3];
+}
+
+internal u32 Reverse16(u32 value)
+{
+    value = ((value & 0xAAAA) >> 1) | ((value & 0x5555) << 1);
+    value = ((value & 0xCCCC) >> 2) | ((value & 0x3333) << 2);
+    value = ((value & 0xF0F0) >> 4) | ((value & 0x0F0F) << 4);
+    value = ((value & 0xFF00) >> 8) | ((value & 0x00FF) << 8);
+    return value;
+}
+
+internal u32 GetChannelCount(u32 color_type)
+{
+    switch (color_type)
+    {
+        case PNG_COLOR_RGB:         return 3;
+        case PNG_COLOR_GRAY_ALPHA:  return 2;
+        case PNG_COLOR_RGBA:        return 4;
+        default:                    return 1;
+    }
+}
+
+internal bool IsValidBitDepth(u32 color_type, u32 bit_depth)
+{
+    switch (color_type)
+    {
+        case PNG_COLOR_GRAY:        return bit_depth == 1 || bit_depth == 2 || bit_depth == 4 || bit_depth == 8 || bit_depth == 16;
+        case PNG_COLOR_PALETTE:     return bit_depth == 1 || bit_depth == 2 || bit_depth == 4 || bit_depth == 8;
+        case PNG_COLOR_RGB:
+        case PNG_COLOR_GRAY_ALPHA:
+        case PNG_COLOR_RGBA:        return bit_depth == 8 || bit_depth == 16;
+        default:                    return false;
+    }
+}
+
+bool IsPng(const void* data, size_t size)
+{
+    return data != nullptr && size >= sizeof(png_signature) && memcmp(data, png_signature, sizeof(png_signature)) == 0;
+}
+
+// Walks the chunks once. CRCs are not checked, the assets come from our own pipeline.
+internal bool ParseFile(const void* data, size_t size, PngFile* file)
+{
+    *file = {};
+    if (!IsPng(data, size))
+    {
+        return false;
+    }
+
+    const u8* bytes = (const u8*)data;
+    bool has_header = false;
+    size_t offset = sizeof(png_signature);
+    while (size - offset >= 12)
+    {
+        u32 length = ReadBigEndian32(bytes + offset);
+        const u8* type = bytes + offset + 4;
+        const u8* body = bytes + offset + 8;
+        if (length > size - offset - 12)
+        {
+            printf("PNG: chunk runs past the end of the file\n");
+            return false;
+        }
+
+        if (memcmp(type, "IHDR", 4) == 0 && length >= 13)
+        {
+            u32 width = ReadBigEndian32(body);
+            u32 height = ReadBigEndian32(body + 4);
+            if (width == 0 || height == 0 || width > PNG_MAX_DIMENSION || height > PNG_MAX_DIMENSION)
+            {
+                printf("PNG: unsupported size %ux%u\n", width, height);
+                return false;
+            }
+            file->info.width = (i32)width;
+            file->info.height = (i32)height;
+            file->info.bit_depth = body[8];
+            file->info.color_type = body[9];
+            file->info.interlace = body[12];
+            if (!IsValidBitDepth(body[9], body[8]) || body[10] != 0 || body[11] != 0 || body[12] > 1)
+            {
+                printf("PNG: invalid header, color type %u at %u bits\n", body[9], body[8]);
+                return false;
+            }
+            has_header = true;
+        }
+        else if (memcmp(type, "PLTE", 4) == 0)
+        {
+            file->palette = body;
+            file->palette_count = (u32)MinInt((i32)(length / 3), 256);
+        }
+        else if (memcmp(type, "tRNS", 4) == 0)
+        {
+            file->transparency = body;
+            file->transparency_size = length;
+        }
+        else if (memcmp(type, "IDAT", 4) == 0)
+        {
+            if (file->data_chunk_count == 0)
+            {
+                file->first_data_offset = offset;
+            }
+            file->data_size += length;
+            ++file->data_chunk_count;
+        }
+        else if (memcmp(type, "IEND", 4) == 0)
+        {
+            break;
+        }
+        else if ((type[0] & 0x20) == 0)
+        {
+            printf("PNG: unknown critical chunk %.4s\n", (const char*)type);
+            return false;
+        }
+        offset += 12 + (size_t)length;
+    }
+
+    if (!has_header || file->data_chunk_count == 0)
+    {
+        printf("PNG: missing IHDR or IDAT\n");
+        return false;
+    }
+    if (file->info.color_type == PNG_COLOR_PALETTE && file->palette == nullptr)
+    {
+        printf("PNG: palette image without a PLTE chunk\n");
+        return false;
+    }
+    return true;
+}
+
+bool ReadInfo(const void* data, size_t size, PngInfo* info)
+{
+    PngFile file;
+    if (!ParseFile(data, size, &file))
+    {
+        return false;
+    }
+    *info = file.info;
+    return true;
+}
+
+// ---------------------------------------------------------------------------------------------
+// Inflate, the output buffer holds the whole image and doubles as the window
+
+// Tops the bit buffer up to at least 56 bits. While 8 bytes are left a whole word goes in at once;
+// the bits above bit_count then already hold the following bytes, so OR-ing them in again is harmless.
+internal void Refill(PngBitReader* r)
+{
+    if (r->in_end - r->in >= 8)
+    {
+        u64 word;
+        memcpy(&word, r->in, sizeof(word));
+        r->bits |= word << r->bit_count;
+        r->in += (63 - r->bit_count) >> 3;
+        r->bit_count |= 56;
+    }
+    else
+    {
+        while (r->bit_count <= 56)
+        {
+            u64 byte = 0;
+            if (r->in < r->in_end)
+            {
+                byte = *r->in++;
+            }
+            else
+            {
+                ++r->padding;
+            }
+            r->bits |= byte << r->bit_count;
+            r->bit_count += 8;
+        }
+    }
+}
+
+internal void ConsumeBits(PngBitReader* r, u32 count)
+{
+    r->bits >>= count;
+    r->bit_count -= count;
+}
+
+internal u32 ReadBits(PngBitReader* r, u32 count)
+{
+    if (r->bit_count < count)
+    {
+        Refill(r);
+    }
+    u32 value = (u32)(r->bits & ((1ull << count) - 1));
+    ConsumeBits(r, count);
+    return value;
+}
+
+// Incomplete codes are allowed, a stream that uses a missing code fails to decode instead
+internal bool BuildHuffman(PngHuffman* h, const u8* lengths, u32 count)
+{
+    memset(h->fast, 0, sizeof(h->fast));
+    memset(h->counts, 0, sizeof(h->counts));
+    for (u32 i = 0; i < count; ++i)
+    {
+        ++h->counts[lengths[i]];
+    }
+    h->counts[0] = 0;
+
+    u32 next_code[16] = {};
+    u32 code = 0;
+    u32 symbol = 0;
+    for (u32 length = 1; length < 16; ++length)
+    {
+        next_code[length] = code;
+        h->first_code[length] = (u16)code;
+        h->first_symbol[length] = (u16)symbol;
+        code += h->counts[length];
+        if (code > (1u << length))
+        {
+            return false; // Over-subscribed
+        }
+        h->max_code[length] = code << (16 - length);
+        code <<= 1;
+        symbol += h->counts[length];
+    }
+    h->max_code[16] = 0x10000;
+
+    for (u32 i = 0; i < count; ++i)
+    {
+        u32 length = lengths[i];
+        if (length == 0) continue;
+
+        u32 index = next_code[length] - h->first_code[length] + h->first_symbol[length];
+        h->symbols[index] = (u16)i;
+        if (length <= PNG_HUFFMAN_FAST_BITS)
+        {
+            // The stream stores codes LSB first, so every index ending in the reversed code maps to it
+            u16 entry = (u16)((length << 9) | i);
+            for (u32 j = Reverse16(next_code[length]) >> (16 - length); j < PNG_HUFFMAN_FAST_SIZE; j += 1u << length)
+            {
+                h->fast[j] = entry;
+            }
+        }
+        ++next_code[length];
+    }
+    return true;
+}
+
+// Needs 15 bits in the buffer
+internal u32 DecodeSymbol(PngBitReader* r, const PngHuffman* h)
+{
+    u32 entry = h->fast[r->bits & (PNG_HUFFMAN_FAST_SIZE - 1)];
+    if (entry != 0)
+    {
+        ConsumeBits(r, entry >> 9);
+        return entry & 511;
+    }
+
+    // A longer code, found by comparing the bit reversed lookahead against each length's range
+    u32 code = Reverse16((u32)r->bits & 0xFFFF);
+    u32 length = PNG_HUFFMAN_FAST_BITS + 1;
+    while (length < 16 && code >= h->max_code[length])
+    {
+        ++length;
+    }
+    if (length == 16)
+    {
+        return PNG_INVALID_SYMBOL;
+    }
+    u32 index = (code >> (16 - length)) - h->first_code[length] + h->first_symbol[length];
+    ConsumeBits(r, length);
+    return h->symbols[index];
+}
+
+internal u32 DecodeSymbolReference(PngBitReader* r, const PngHuffman* h)
+{
+    i32 code = 0;
+    i32 first = 0;
+    i32 index = 0;
+    for (u32 length = 1; length < 16; ++length)
+    {
+        code |= (i32)ReadBits(r, 1);
+        i32 count = h->counts[length];
+        if (code - count < first)
+        {
+            return h->symbols[index + (code - first)];
+        }
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    return PNG_INVALID_SYMBOL;
+}
+
+internal u32 DecodeNext(PngBitReader* r, const PngHuffman* h, bool reference)
+{
+    return reference ? DecodeSymbolReference(r, h) : DecodeSymbol(r, h);
+}
+
+internal void CopyMatch(u8* out, u32 length, u32 distance, bool reference)
+{
+    const u8* source = out - distance;
+    if (reference)
+    {
+        for (u32 i = 0; i < length; ++i)
+        {
+            out[i] = source[i];
+        }
+    }
+    else if (distance >= 8)
+    {
+        // Each word only reads bytes that are already final; the last one may run up to 7 bytes
+        // past the match into the slack after out_end, later output overwrites them
+        for (u32 i = 0; i < length; i += 8)
+        {
+            u64 word;
+            memcpy(&word, source + i, sizeof(word));
+            memcpy(out + i, &word, sizeof(word));
+        }
+    }
+    else if (distance == 1)
+    {
+        memset(out, source[0], length);
+    }
+    else
+    {
+        for (u32 i = 0; i < length; ++i)
+        {
+            out[i] = source[i];
+        }
+    }
+}
+
+// The bit reader and output pointer are copied into locals for the loop, the byte stores could
+// alias the inflater and would otherwise force them back to memory after every literal
+internal bool InflateCodes(PngInflater* z)
+{
+    PngBitReader r = z->reader;
+    u8* out = z->out;
+    bool reference = z->reference;
+    bool ok = false;
+    for (;;)
+    {
+        Refill(&r);
+        // 56 bits cover a literal/length code, its extra bits, a distance code and its extra bits
+        u32 symbol = DecodeNext(&r, &z->literals, reference);
+        if (symbol < 256)
+        {
+            if (out == z->out_end) break;
+            *out++ = (u8)symbol;
+            continue;
+        }
+        if (symbol == 256)
+        {
+            ok = true;
+            break;
+        }
+
+        symbol -= 257;
+        if (symbol >= ArrayCount(png_length_base)) break;
+        u32 length = png_length_base[symbol] + ReadBits(&r, png_length_extra[symbol]);
+
+        u32 distance_symbol = DecodeNext(&r, &z->distances, reference);
+        if (distance_symbol >= ArrayCount(png_distance_base)) break;
+        u32 distance = png_distance_base[distance_symbol] + ReadBits(&r, png_distance_extra[distance_symbol]);
+
+        if (distance > (size_t)(out - z->out_begin) || length > (size_t)(z->out_end - out)) break;
+        CopyMatch(out, length, distance, reference);
+        out += length;
+    }
+
+    z->reader = r;
+    z->out = out;
+    return ok;
+}
+
+internal bool InflateStored(PngInflater* z)
+{
+    // Give the whole bytes still in the bit buffer back to the input
+    PngBitReader* r = &z->reader;
+    ConsumeBits(r, r->bit_count & 7);
+    u32 buffered = r->bit_count >> 3;
+    if (buffered < r->padding) return false;
+    r->in -= buffered - r->padding;
+    r->padding = 0;
+    r->bits = 0;
+    r->bit_count = 0;
+
+    if (r->in_end - r->in < 4) return false;
+    u32 length = (u32)r->in[0] | ((u32)r->in[1] << 8);
+    u32 inverse = (u32)r->in[2] | ((u32)r->in[3] << 8);
+    r->in += 4;
+    if ((length ^ 0xFFFF) != inverse) return false;
+    if ((size_t)(r->in_end - r->in) < length || (size_t)(z->out_end - z->out) < length) return false;
+
+    memcpy(z->out, r->in, length);
+    r->in += length;
+    z->out += length;
+    return true;
+}
+
+internal bool BuildFixedTables(PngInflater* z)
+{
+    u8 lengths[288];
+    memset(lengths, 8, 144);
+    memset(lengths + 144, 9, 112);
+    memset(lengths + 256, 7, 24);
+    memset(lengths + 280, 8, 8);
+    if (!BuildHuffman(&z->literals, lengths, 288)) return false;
+
+    memset(lengths, 5, 32);
+    return BuildHuffman(&z->distances, lengths, 32);
+}
+
+internal bool ReadDynamicTables(PngInflater* z)
+{
+    PngBitReader* r = &z->reader;
+    u32 literal_count = ReadBits(r, 5) + 257;
+    u32 distance_count = ReadBits(r, 5) + 1;
+    u32 code_length_count = ReadBits(r, 4) + 4;
+    if (literal_count > 286 || distance_count > 30) return false;
+
+    u8 code_length_lengths[19] = {};
+    for (u32 i = 0; i < code_length_count; ++i)
+    {
+        code_length_lengths[png_code_length_order[i]] = (u8)ReadBits(r, 3);
+    }
+    PngHuffman code_lengths;
+    if (!BuildHuffman(&code_lengths, code_length_lengths, ArrayCount(code_length_lengths))) return false;
+
+    u8 lengths[286 + 30];
+    u32 total = literal_count + distance_count;
+    u32 i = 0;
+    while (i < total)
+    {
+        Refill(r);
+        u32 symbol = DecodeNext(r, &code_lengths, z->reference);
+        if (symbol < 16)
+        {
+            lengths[i++] = (u8)symbol;
+            continue;
+        }
+
+        u32 repeat = 0;
+        u8 value = 0;
+        if (symbol == 16)
+        {
+            if (i == 0) return false;
+            value = lengths[i - 1];
+            repeat = 3 + ReadBits(r, 2);
+        }
+        else if (symbol == 17)
+        {
+            repeat = 3 + ReadBits(r, 3);
+        }
+        else if (symbol == 18)
+        {
+            repeat = 11 + ReadBits(r, 7);
+        }
+        else
+        {
+            return false;
+        }
+        if (total - i < repeat) return false;
+        memset(lengths + i, value, repeat);
+        i += repeat;
+    }
+
+    // A block without an end of block code could never finish
+    if (lengths[256] == 0) return false;
+    return BuildHuffman(&z->literals, lengths, literal_count) && BuildHuffman(&z->distances, lengths + literal_count, distance_count);
+}
+
+// Inflates a zlib stream into exactly out_size bytes. The Adler-32 trailer is not checked.
+internal bool Inflate(const u8* in, size_t in_size, u8* out, size_t out_size, bool reference)
+{
+    if (in_size < 2) return false;
+    u32 method = in[0];
+    u32 flags = in[1];
+    if ((method & 15) != 8 || (method >> 4) > 7 || ((method << 8) | flags) % 31 != 0 || (flags & 0x20) != 0)
+    {
+        printf("PNG: invalid zlib header\n");
+        return false;
+    }
+
+    PngInflater z;
+    z.reader.in = in + 2;
+    z.reader.in_end = in + in_size;
+    z.reader.bits = 0;
+    z.reader.bit_count = 0;
+    z.reader.padding = 0;
+    z.out = out;
+    z.out_begin = out;
+    z.out_end = out + out_size;
+    z.reference = reference;
+
+    bool is_last = false;
+    while (!is_last)
+    {
+        is_last = ReadBits(&z.reader, 1) != 0;
+        u32 type = ReadBits(&z.reader, 2);
+        bool ok = false;
+        if (type == 0)
+        {
+            ok = InflateStored(&z);
+        }
+        else if (type == 1)
+        {
+            ok = BuildFixedTables(&z) && InflateCodes(&z);
+        }
+        else if (type == 2)
+        {
+            ok = ReadDynamicTables(&z) && InflateCodes(&z);
+        }
+        if (!ok)
+        {
+            printf("PNG: corrupt deflate stream\n");
+            return false;
+        }
+    }
+
+    // Having consumed any of the zero padding means the stream was cut short
+    if (z.reader.bit_count < z.reader.padding * 8 || z.out != z.out_end)
+    {
+        printf("PNG: truncated image data\n");
+        return false;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------------------------
+// Filters, undone in place on the inflated rows
+
+internal u8 PaethPredictor(i32 a, i32 b, i32 c)
+{
+    i32 pa = abs(b - c);
+    i32 pb = abs(a - c);
+    i32 pc = abs(a + b - 2 * c);
+    if (pa <= pb && pa <= pc) return (u8)a;
+    if (pb <= pc) return (u8)b;
+    return (u8)c;
+}
+
+internal void UnfilterRowScalar(u8* row, const u8* prior, u32 row_bytes, u32 bpp, u32 filter)
+{
+    switch (filter)
+    {
+        case PNG_FILTER_SUB:
+            for (u32 i = bpp; i < row_bytes; ++i)
+            {
+                row[i] = (u8)(row[i] + row[i - bpp]);
+            }
+            break;
+        case PNG_FILTER_UP:
+            for (u32 i = 0; i < row_bytes; ++i)
+            {
+                row[i] = (u8)(row[i] + prior[i]);
+            }
+            break;
+        case PNG_FILTER_AVERAGE:
+            for (u32 i = 0; i < bpp; ++i)
+            {
+                row[i] = (u8)(row[i] + (prior[i] >> 1));
+            }
+            for (u32 i = bpp; i < row_bytes; ++i)
+            {
+                row[i] = (u8)(row[i] + ((row[i - bpp] + prior[i]) >> 1));
+            }
+            break;
+        case PNG_FILTER_PAETH:
+            for (u32 i = 0; i < bpp; ++i)
+            {
+                row[i] = (u8)(row[i] + prior[i]);
+            }
+            for (u32 i = bpp; i < row_bytes; ++i)
+            {
+                row[i] = (u8)(row[i] + PaethPredictor(row[i - bpp], prior[i], prior[i - bpp]));
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+internal __m128i LoadPixel(const u8* p)
+{
+    u32 value;
+    memcpy(&value, p, sizeof(value));
+    return _mm_cvtsi32_si128((i32)value);
+}
+
+internal void StorePixel(u8* p, __m128i value, u32 bpp)
+{
+    u32 bytes = (u32)_mm_cvtsi128_si32(value);
+    memcpy(p, &bytes, bpp);
+}
+
+internal __m128i Abs16(__m128i value)
+{
+    return _mm_max_epi16(value, _mm_sub_epi16(_mm_setzero_si128(), value));
+}
+
+internal void UnfilterUpSse2(u8* row, const u8* prior, u32 row_bytes)
+{
+    u32 i = 0;
+    for (; i + 16 <= row_bytes; i += 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i*)(row + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(prior + i));
+        _mm_storeu_si128((__m128i*)(row + i), _mm_add_epi8(x, b));
+    }
+    for (; i < row_bytes; ++i)
+    {
+        row[i] = (u8)(row[i] + prior[i]);
+    }
+}
+
+// Sub is a running sum along the row, done as a log step prefix sum over the pixels of a vector
+internal void UnfilterSub4Sse2(u8* row, u32 row_bytes)
+{
+    __m128i carry = _mm_setzero_si128();    // The previous pixel in every lane
+    u32 i = 0;
+    for (; i + 16 <= row_bytes; i += 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i*)(row + i));
+        x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+        x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+        x = _mm_add_epi8(x, carry);
+        _mm_storeu_si128((__m128i*)(row + i), x);
+        carry = _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+    }
+    for (i = (u32)MaxInt((i32)i, 4); i < row_bytes; ++i)
+    {
+        row[i] = (u8)(row[i] + row[i - 4]);
+    }
+}
+
+// Four 3 byte pixels per step, the 16 byte load stays inside the row
+internal void UnfilterSub3Sse2(u8* row, u32 row_bytes)
+{
+    __m128i carry = _mm_setzero_si128();    // The previous pixel in the low 12 bytes
+    __m128i pixel_mask = _mm_cvtsi32_si128(0xFFFFFF);
+    u32 i = 0;
+    for (; i + 16 <= row_bytes; i += 12)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i*)(row + i));
+        x = _mm_add_epi8(x, _mm_slli_si128(x, 3));
+        x = _mm_add_epi8(x, _mm_slli_si128(x, 6));
+        x = _mm_add_epi8(x, carry);
+        _mm_storel_epi64((__m128i*)(row + i), x);
+        StorePixel(row + i + 8, _mm_srli_si128(x, 8), 4);
+
+        __m128i last = _mm_and_si128(_mm_srli_si128(x, 9), pixel_mask);
+        last = _mm_or_si128(last, _mm_slli_si128(last, 3));
+        carry = _mm_or_si128(last, _mm_slli_si128(last, 6));
+    }
+    for (i = (u32)MaxInt((i32)i, 3); i < row_bytes; ++i)
+    {
+        row[i] = (u8)(row[i] + row[i - 3]);
+    }
+}
+
+// Average and Paeth depend on the pixel just decoded, so they go a pixel at a time with all channels at once.
+// The 4 byte loads of 3 byte pixels read one byte past the row, into the next row's filter byte or the padding.
+internal void UnfilterAverageSse2(u8* row, const u8* prior, u32 row_bytes, u32 bpp)
+{
+    __m128i a = _mm_setzero_si128();
+    __m128i one = _mm_set1_epi8(1);
+    for (u32 i = 0; i < row_bytes; i += bpp)
+    {
+        __m128i b = LoadPixel(prior + i);
+        __m128i x = LoadPixel(row + i);
+        // pavgb rounds up, the filter rounds down
+        __m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+        x = _mm_add_epi8(x, average);
+        StorePixel(row + i, x, bpp);
+        a = x;
+    }
+}
+
+internal void UnfilterPaethSse2(u8* row, const u8* prior, u32 row_bytes, u32 bpp)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i byte_mask = _mm_set1_epi16(0xFF);
+    __m128i a = zero;   // Left, widened to 16 bits
+    __m128i c = zero;   // Upper left
+    for (u32 i = 0; i < row_bytes; i += bpp)
+    {
+        __m128i b = _mm_unpacklo_epi8(LoadPixel(prior + i), zero);
+        __m128i x = _mm_unpacklo_epi8(LoadPixel(row + i), zero);
+
+        // With p = a + b - c: p - a = b - c, p - b = a - c and p - c = the sum of both
+        __m128i pa = _mm_sub_epi16(b, c);
+        __m128i pb = _mm_sub_epi16(a, c);
+        __m128i pc = Abs16(_mm_add_epi16(pa, pb));
+        pa = Abs16(pa);
+        pb = Abs16(pb);
+
+        // a when it is closest, then b, then c, with ties going the same way as the scalar version
+        __m128i not_a = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+        __m128i not_b = _mm_cmpgt_epi16(pb, pc);
+        __m128i predictor = _mm_or_si128(_mm_andnot_si128(not_b, b), _mm_and_si128(not_b, c));
+        predictor = _mm_or_si128(_mm_andnot_si128(not_a, a), _mm_and_si128(not_a, predictor));
+
+        x = _mm_and_si128(_mm_add_epi16(x, predictor), byte_mask);
+        StorePixel(row + i, _mm_packus_epi16(x, x), bpp);
+        a = x;
+        c = b;
+    }
+}
+
+// Only 8 bit RGB and RGBA, where bpp is 3 or 4, have vector versions of the sequential filters
+internal void UnfilterRow(u8* row, const u8* prior, u32 row_bytes, u32 bpp, u32 filter, PngDecodePath path)
+{
+    if (path != PNG_DECODE_PATH_SSE2)
+    {
+        UnfilterRowScalar(row, prior, row_bytes, bpp, filter);
+        return;
+    }
+
+    bool vector_pixels = bpp == 3 || bpp == 4;
+    switch (filter)
+    {
+        case PNG_FILTER_SUB:
+            if (bpp == 4) UnfilterSub4Sse2(row, row_bytes);
+            else if (bpp == 3) UnfilterSub3Sse2(row, row_bytes);
+            else UnfilterRowScalar(row, prior, row_bytes, bpp, filter);
+            break;
+        case PNG_FILTER_UP:
+            UnfilterUpSse2(row, prior, row_bytes);
+            break;
+        case PNG_FILTER_AVERAGE:
+            if (vector_pixels) UnfilterAverageSse2(row, prior, row_bytes, bpp);
+            else UnfilterRowScalar(row, prior, row_bytes, bpp, filter);
+            break;
+        case PNG_FILTER_PAETH:
+            if (vector_pixels) UnfilterPaethSse2(row, prior, row_bytes, bpp);
+            else UnfilterRowScalar(row, prior, row_bytes, bpp, filter);
+            break;
+        default:
+            break;
+    }
+}
+
+// ---------------------------------------------------------------------------------------------
+// Expansion of unfiltered rows to RGBA8
+
+internal u32 ReadSample(const u8* row, u32 index, u32 bit_depth)
+{
+    switch (bit_depth)
+    {
+        case 16:
+            return ((u32)row[index * 2] << 8) | row[index * 2 + 1];
+        case 8:
+            return row[index];
+        default:
+        {
+            // Packed MSB first
+            u32 bit = index * bit_depth;
+            return ((u32)row[bit >> 3] >> (8 - bit_depth - (bit & 7))) & ((1u << bit_depth) - 1);
+        }
+    }
+}
+
+internal u32 SampleToByte(u32 sample, u32 bit_depth)
+{
+    if (bit_depth == 16) return sample >> 8;
+    if (bit_depth == 8) return sample;
+    return sample * 255 / ((1u << bit_depth) - 1);
+}
+
+// Four pixels per shuffle. The 16 byte load reads past the 12 bytes it uses, into the next row or the padding.
+internal u32 ExpandRgbSsse3(const u8* source, u8* dest, u32 width)
+{
+    __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    __m128i alpha = _mm_set1_epi32((i32)0xFF000000);
+    u32 x = 0;
+    for (; x + 4 <= width; x += 4)
+    {
+        __m128i rgb = _mm_loadu_si128((const __m128i*)(source + x * 3));
+        _mm_storeu_si128((__m128i*)(dest + x * 4), _mm_or_si128(_mm_shuffle_epi8(rgb, shuffle), alpha));
+    }
+    return x;
+}
+
+internal void ExpandRow(const PngFile* file, const u32* palette, const u8* source, u8* dest, u32 width, PngDecodePath path)
+{
+    u32 color_type = file->info.color_type;
+    u32 bit_depth = file->info.bit_depth;
+    if (color_type == PNG_COLOR_RGBA && bit_depth == 8)
+    {
+        memcpy(dest, source, (size_t)width * 4);
+        return;
+    }
+    if (color_type == PNG_COLOR_PALETTE)
+    {
+        for (u32 x = 0; x < width; ++x)
+        {
+            memcpy(dest + x * 4, &palette[ReadSample(source, x, bit_depth)], 4);
+        }
+        return;
+    }
+
+    // A tRNS chunk on gray and RGB images names one color that is fully transparent
+    bool has_key = file->transparency != nullptr && (color_type == PNG_COLOR_GRAY || color_type == PNG_COLOR_RGB);
+    u32 key[3] = {};
+    if (has_key)
+    {
+        u32 key_count = color_type == PNG_COLOR_GRAY ? 1 : 3;
+        if (file->transparency_size < key_count * 2) has_key = false;
+        for (u32 c = 0; has_key && c < key_count; ++c)
+        {
+            key[c] = ((u32)file->transparency[c * 2] << 8) | file->transparency[c * 2 + 1];
+        }
+    }
+
+    u32 x = 0;
+    if (color_type == PNG_COLOR_RGB && bit_depth == 8 && !has_key && path == PNG_DECODE_PATH_SSE2 && cpu_features::Get()->sse41)
+    {
+        x = ExpandRgbSsse3(source, dest, width);
+    }
+
+    u32 channel_count = GetChannelCount(color_type);
+    for (; x < width; ++x)
+    {
+        u32 samples[4];
+        for (u32 c = 0; c < channel_count; ++c)
+        {
+            samples[c] = ReadSample(source, x * channel_count + c, bit_depth);
+        }
+
+        u8* pixel = dest + x * 4;
+        switch (color_type)
+        {
+            case PNG_COLOR_GRAY:
+                pixel[0] = pixel[1] = pixel[2] = (u8)SampleToByte(samples[0], bit_depth);
+                pixel[3] = has_key && samples[0] == key[0] ? 0 : 0xFF;
+                break;
+            case PNG_COLOR_GRAY_ALPHA:
+                pixel[0] = pixel[1] = pixel[2] = (u8)SampleToByte(samples[0], bit_depth);
+                pixel[3] = (u8)SampleToByte(samples[1], bit_depth);
+                break;
+            case PNG_COLOR_RGB:
+                for (u32 c = 0; c < 3; ++c) pixel[c] = (u8)SampleToByte(samples[c], bit_depth);
+                pixel[3] = has_key && samples[0] == key[0] && samples[1] == key[1] && samples[2] == key[2] ? 0 : 0xFF;
+                break;
+            default:
+                for (u32 c = 0; c < 4; ++c) pixel[c] = (u8)SampleToByte(samples[c], bit_depth);
+                break;
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------------
+// Decoding
+
+internal u32 GetPasses(const PngFile* file, PngPass* passes)
+{
+    u32 width = (u32)file->info.width;
+    u32 height = (u32)file->info.height;
+    u32 bits_per_pixel = GetChannelCount(file->info.color_type) * file->info.bit_depth;
+    u32 pass_count = file->info.interlace ? 7 : 1;
+    for (u32 p = 0; p < pass_count; ++p)
+    {
+        PngPass* pass = &passes[p];
+        pass->x = file->info.interlace ? png_adam7_x[p] : 0;
+        pass->y = file->info.interlace ? png_adam7_y[p] : 0;
+        pass->step_x = file->info.interlace ? png_adam7_step_x[p] : 1;
+        pass->step_y = file->info.interlace ? png_adam7_step_y[p] : 1;
+        pass->width = width > pass->x ? (width - pass->x + pass->step_x - 1) / pass->step_x : 0;
+        pass->height = height > pass->y ? (height - pass->y + pass->step_y - 1) / pass->step_y : 0;
+        pass->row_bytes = (pass->width * bits_per_pixel + 7) / 8;
+    }
+    return pass_count;
+}
+
+// dest receives width * height RGBA8 pixels, the top row at dest and each next one dest_pitch bytes on;
+// a negative pitch with dest on the last row stores them bottom up. It can be any writable memory,
+// an arena allocation or a mapped pixel buffer. The inflated rows live in scratch, which is back
+// where it was on return.
+bool DecodeWithPath(const void* data, size_t size, u8* dest, i32 dest_pitch, VMArena* scratch, PngDecodePath path)
+{
+    PngFile file;
+    if (!ParseFile(data, size, &file))
+    {
+        return false;
+    }
+
+    PngPass passes[7];
+    u32 pass_count = GetPasses(&file, passes);
+    size_t inflated_size = 0;
+    u32 max_row_bytes = 0;
+    for (u32 p = 0; p < pass_count; ++p)
+    {
+        // Empty passes have no rows and no filter bytes at all
+        if (passes[p].width == 0 || passes[p].height == 0) continue;
+        inflated_size += (size_t)passes[p].height * (1 + passes[p].row_bytes);
+        max_row_bytes = (u32)MaxInt((i32)max_row_bytes, (i32)passes[p].row_bytes);
+    }
+
+    size_t scratch_offset = scratch->curr_offset;
+    u8* inflated = (u8*)memory::VMArenaAllocAligned(scratch, inflated_size + PNG_ROW_PADDING, 16);
+    u8* zero_row = (u8*)memory::VMArenaAllocAligned(scratch, max_row_bytes + PNG_ROW_PADDING, 16);
+    u8* pass_row = file.info.interlace ? (u8*)memory::VMArenaAllocAligned(scratch, (size_t)file.info.width * 4, 16) : nullptr;
+    if (!inflated || !zero_row || (file.info.interlace && !pass_row))
+    {
+        printf("PNG: not enough scratch memory for a %dx%d image\n", file.info.width, file.info.height);
+        scratch->curr_offset = scratch_offset;
+        return false;
+    }
+    memset(zero_row, 0, max_row_bytes + PNG_ROW_PADDING);
+    memset(inflated + inflated_size, 0, PNG_ROW_PADDING);
+
+    // The IDAT chunks form one zlib stream, only split ones need gathering
+    const u8* bytes = (const u8*)data;
+    const u8* stream = bytes + file.first_data_offset + 8;
+    if (file.data_chunk_count > 1)
+    {
+        u8* gathered = (u8*)memory::VMArenaAlloc(scratch, file.data_size);
+        if (!gathered)
+        {
+            printf("PNG: not enough scratch memory for the image data\n");
+            scratch->curr_offset = scratch_offset;
+            return false;
+        }
+        size_t gathered_size = 0;
+        for (size_t offset = file.first_data_offset; gathered_size < file.data_size;)
+        {
+            u32 length = ReadBigEndian32(bytes + offset);
+            if (memcmp(bytes + offset + 4, "IDAT", 4) == 0)
+            {
+                memcpy(gathered + gathered_size, bytes + offset + 8, length);
+                gathered_size += length;
+            }
+            offset += 12 + (size_t)length;
+        }
+        stream = gathered;
+    }
+
+    bool ok = Inflate(stream, file.data_size, inflated, inflated_size, path == PNG_DECODE_PATH_REFERENCE);
+
+    u32 palette[256];
+    if (ok && file.info.color_type == PNG_COLOR_PALETTE)
+    {
+        // Indices past the palette come out opaque black
+        for (u32 i = 0; i < 256; ++i)
+        {
+            u32 color = 0xFF000000;
+            if (i < file.palette_count)
+            {
+                const u8* entry = file.palette + i * 3;
+                u32 alpha = file.transparency && i < file.transparency_size ? file.transparency[i] : 0xFF;
+                color = (alpha << 24) | ((u32)entry[2] << 16) | ((u32)entry[1] << 8) | entry[0];
+            }
+            palette[i] = color;
+        }
+    }
+
+    u32 filter_bpp = (u32)MaxInt((i32)(GetChannelCount(file.info.color_type) * file.info.bit_depth / 8), 1);
+    u8* rows = inflated;
+    for (u32 p = 0; ok && p < pass_count; ++p)
+    {
+        const PngPass* pass = &passes[p];
+        if (pass->width == 0 || pass->height == 0) continue;
+
+        const u8* prior = zero_row;
+        for (u32 y = 0; y < pass->height; ++y)
+        {
+            u32 filter = rows[0];
+            u8* row = rows + 1;
+            if (filter >= PNG_FILTER_COUNT)
+            {
+                printf("PNG: invalid filter type %u\n", filter);
+                ok = false;
+                break;
+            }
+            UnfilterRow(row, prior, pass->row_bytes, filter_bpp, filter, path);
+
+            u8* dest_row = dest + (ptrdiff_t)(pass->y + y * pass->step_y) * dest_pitch;
+            if (pass->step_x == 1)
+            {
+                ExpandRow(&file, palette, row, dest_row, pass->width, path);
+            }
+            else
+            {
+                ExpandRow(&file, palette, row, pass_row, pass->width, path);
+                for (u32 x = 0; x < pass->width; ++x)
+                {
+                    memcpy(dest_row + (size_t)(pass->x + x * pass->step_x) * 4, pass_row + x * 4, 4);
+                }
+            }
+
+            prior = row;
+            rows += 1 + pass->row_bytes;
+        }
+    }
+
+    scratch->curr_offset = scratch_offset;
+    return ok;
+}
+
+bool Decode(const void* data, size_t size, u8* dest, i32 dest_pitch, VMArena* scratch)
+{
+    return DecodeWithPath(data, size, dest, dest_pitch, scratch, GetBestPath());
+}
+
+// Tightly packed RGBA8 allocated from the arena, the decode's own scratch is taken above it and
+// given back. bottom_up puts the last row first, the way GL and the software sampler address textures.
+// Returns nullptr and leaves the arena untouched on failure.
+u8* DecodeToArena(const void* data, size_t size, VMArena* arena, bool bottom_up, PngInfo* info)
+{
+    if (!ReadInfo(data, size, info))
+    {
+        return nullptr;
+    }
+
+    size_t arena_offset = arena->curr_offset;
+    i32 pitch = info->width * 4;
+    u8* pixels = (u8*)memory::VMArenaAllocAligned(arena, (size_t)pitch * (size_t)info->height, 16);
+    u8* first_row = pixels && bottom_up ? pixels + (size_t)pitch * (size_t)(info->height - 1) : pixels;
+    if (!pixels || !Decode(data, size, first_row, bottom_up ? -pitch : pitch, arena))
+    {
+        arena->curr_offset = arena_offset;
+        return nullptr;
+    }
+    return pixels;
+}
+
+// ---------------------------------------------------------------------------------------------
+// Benchmark
+
+internal f64 GetBenchmarkSeconds()
+{
+    timespec now;
+    timespec_get(&now, TIME_UTC);
+    return (f64)now.tv_sec + (f64)now.tv_nsec * 1e-9;
+}
+
+internal void WriteBits(PngBitWriter* w, u32 value, u32 count)
+{
+    w->bits |= (u64)value << w->bit_count;
+    w->bit_count += count;
+    while (w->bit_count >= 8)
+    {
+        *w->out++ = (u8)w->bits;
+        w->bits >>= 8;
+        w->bit_count -= 8;
+    }
+}
+
+// Huffman code lengths for the counts, at most max_length bits, symbols with a zero count get none.
+// Leaves past the limit are folded back like zlib and miniz do: moved up to the limit, then leaves
+// are pushed down a level until the code is complete again. The shortest codes go to the most frequent symbols.
+internal void BuildCodeLengths(const u32* counts, u32 count, u32 max_length, u8* lengths)
+{
+    u32 symbols[288];
+    u32 symbol_count = 0;
+    memset(lengths, 0, count);
+    for (u32 i = 0; i < count; ++i)
+    {
+        if (counts[i] > 0) symbols[symbol_count++] = i;
+    }
+    if (symbol_count == 0) return;
+    if (symbol_count == 1)
+    {
+        lengths[symbols[0]] = 1;
+        return;
+    }
+
+    // Most frequent first, ties by symbol
+    for (u32 i = 1; i < symbol_count; ++i)
+    {
+        u32 symbol = symbols[i];
+        u32 j = i;
+        for (; j > 0 && counts[symbols[j - 1]] < counts[symbol]; --j)
+        {
+            symbols[j] = symbols[j - 1];
+        }
+        symbols[j] = symbol;
+    }
+
+    // Plain Huffman tree, merging the two lightest nodes left. Leaves are the first symbol_count nodes.
+    u64 weights[2 * 288];
+    i32 parents[2 * 288];
+    bool merged[2 * 288] = {};
+    for (u32 i = 0; i < symbol_count; ++i)
+    {
+        weights[i] = counts[symbols[i]];
+    }
+    u32 node_count = symbol_count;
+    for (u32 merge = 0; merge + 1 < symbol_count; ++merge)
+    {
+        i32 lightest[2] = { -1, -1 };
+        for (u32 node = 0; node < node_count; ++node)
+        {
+            if (merged[node]) continue;
+            if (lightest[0] < 0 || weights[node] < weights[lightest[0]])
+            {
+                lightest[1] = lightest[0];
+                lightest[0] = (i32)node;
+            }
+            else if (lightest[1] < 0 || weights[node] < weights[lightest[1]])
+            {
+                lightest[1] = (i32)node;
+            }
+        }
+        weights[node_count] = weights[lightest[0]] + weights[lightest[1]];
+        parents[lightest[0]] = (i32)node_count;
+        parents[lightest[1]] = (i32)node_count;
+        merged[lightest[0]] = true;
+        merged[lightest[1]] = true;
+        ++node_count;
+    }
+    parents[node_count - 1] = -1;
+
+    u32 length_counts[PNG_MAX_CODE_BITS + 1] = {};
+    for (u32 i = 0; i < symbol_count; ++i)
+    {
+        u32 depth = 0;
+        for (i32 node = (i32)i; parents[node] >= 0; node = parents[node]) ++depth;
+        ++length_counts[MinInt((i32)depth, (i32)max_length)];
+    }
+
+    u32 total = 0;
+    for (u32 length = max_length; length > 0; --length)
+    {
+        total += length_counts[length] << (max_length - length);
+    }
+    while (total != (1u << max_length))
+    {
+        --length_counts[max_length];
+        for (u32 length = max_length - 1; length > 0; --length)
+        {
+            if (length_counts[length] > 0)
+            {
+                --length_counts[length];
+                length_counts[length + 1] += 2;
+                break;
+            }
+        }
+        --total;
+    }
+
+    u32 next = 0;
+    for (u32 length = 1; length <= max_length; ++length)
+    {
+        for (u32 i = 0; i < length_counts[length]; ++i)
+        {
+            lengths[symbols[next++]] = (u8)length;
+        }
+    }
+}
+
+// Canonical codes for the lengths, bit reversed so they go out through WriteBits() MSB first
+internal void BuildCanonicalCodes(const u8* lengths, u32 count, u16* codes)
+{
+    u32 length_counts[PNG_MAX_CODE_BITS + 1] = {};
+    for (u32 i = 0; i < count; ++i)
+    {
+        ++length_counts[lengths[i]];
+    }
+    length_counts[0] = 0;
+
+    u32 next_code[PNG_MAX_CODE_BITS + 1] = {};
+    u32 code = 0;
+    for (u32 length = 1; length <= PNG_MAX_CODE_BITS; ++length)
+    {
+        code = (code + length_counts[length - 1]) << 1;
+        next_code[length] = code;
+    }
+    for (u32 i = 0; i < count; ++i)
+    {
+        codes[i] = lengths[i] > 0 ? (u16)(Reverse16(next_code[lengths[i]]++) >> (16 - lengths[i])) : 0;
+    }
+}
+
+// Tokens are literal bytes, or a match: bit 31 set, the length above bit 16 and the distance below
+#define PNG_TOKEN_MATCH     0x80000000u
+
+internal u32 GetLengthSymbol(u32 length)
+{
+    u32 symbol = ArrayCount(png_length_base) - 1;
+    while (png_length_base[symbol] > length) --symbol;
+    return symbol;
+}
+
+internal u32 GetDistanceSymbol(u32 distance)
+{
+    u32 symbol = ArrayCount(png_distance_base) - 1;
+    while (png_distance_base[symbol] > distance) --symbol;
+    return symbol;
+}
+
+// The tokens and the end of block symbol with the given literal/length and distance codes
+internal void WriteTokens(PngBitWriter* w, const u32* tokens, u32 token_count, const u8* literal_lengths, const u8* distance_lengths)
+{
+    u16 literal_codes[288];
+    u16 distance_codes[30];
+    BuildCanonicalCodes(literal_lengths, 288, literal_codes);
+    BuildCanonicalCodes(distance_lengths, 30, distance_codes);
+
+    for (u32 i = 0; i < token_count; ++i)
+    {
+        u32 token = tokens[i];
+        if (!(token & PNG_TOKEN_MATCH))
+        {
+            WriteBits(w, literal_codes[token], literal_lengths[token]);
+            continue;
+        }
+
+        u32 length = (token >> 16) & 0x1FF;
+        u32 distance = token & 0xFFFF;
+        u32 length_symbol = GetLengthSymbol(length);
+        WriteBits(w, literal_codes[257 + length_symbol], literal_lengths[257 + length_symbol]);
+        WriteBits(w, length - png_length_base[length_symbol], png_length_extra[length_symbol]);
+        u32 distance_symbol = GetDistanceSymbol(distance);
+        WriteBits(w, distance_codes[distance_symbol], distance_lengths[distance_symbol]);
+        WriteBits(w, distance - png_distance_base[distance_symbol], png_distance_extra[distance_symbol]);
+    }
+    WriteBits(w, literal_codes[256], literal_lengths[256]);
+}
+
+internal u32 GetCodeLengthExtraBits(u32 symbol)
+{
+    return symbol == 16 ? 2 : (symbol == 17 ? 3 : (symbol == 18 ? 7 : 0));
+}
+
+// Run length codes the code lengths with symbols 16, 17 and 18 into symbol | (extra bits << 8)
+// entries. Runs may cross from the literal/length lengths into the distance ones. Returns the entry count.
+internal u32 RunLengthCodeLengths(const u8* lengths, u32 count, u16* runs)
+{
+    u32 run_count = 0;
+    for (u32 i = 0; i < count;)
+    {
+        u32 length = lengths[i];
+        u32 run = 1;
+        while (i + run < count && lengths[i + run] == length) ++run;
+
+        if (length == 0 && run >= 3)
+        {
+            run = (u32)MinInt((i32)run, 138);
+            runs[run_count++] = (u16)(run >= 11 ? (18 | ((run - 11) << 8)) : (17 | ((run - 3) << 8)));
+            i += run;
+        }
+        else if (length != 0 && run >= 4)
+        {
+            u32 repeat = (u32)MinInt((i32)run - 1, 6);
+            runs[run_count++] = (u16)length;
+            runs[run_count++] = (u16)(16 | ((repeat - 3) << 8));
+            i += 1 + repeat;
+        }
+        else
+        {
+            runs[run_count++] = (u16)length;
+            ++i;
+        }
+    }
+    return run_count;
+}
+
+// Stored blocks of at most 65535 bytes each, the last one final when is_final is set. Returns the block count.
+internal u32 WriteStoredBlocks(PngBitWriter* w, bool is_final, const u8* bytes, size_t byte_count)
+{
+    u32 block_count = 0;
+    do
+    {
+        u32 size = byte_count > 65535 ? 65535 : (u32)byte_count;
+        bool is_last = size == byte_count;
+        WriteBits(w, is_final && is_last ? 1 : 0, 1);
+        WriteBits(w, 0, 2);
+        WriteBits(w, 0, (8 - w->bit_count) & 7);
+        WriteBits(w, size, 16);
+        WriteBits(w, ~size & 0xFFFF, 16);
+        memcpy(w->out, bytes, size);
+        w->out += size;
+        bytes += size;
+        byte_count -= size;
+        ++block_count;
+    } while (byte_count > 0);
+    return block_count;
+}
+
+// One block with Huffman codes fitted to its tokens, or stored blocks when the bytes they cover
+// don't compress, the way zlib falls back on noise. bytes is where the block's output starts.
+internal void WriteDynamicBlock(PngBitWriter* w, bool is_final, const u32* tokens, u32 token_count, const u8* bytes, PngEncodeStats* stats)
+{
+    u32 literal_counts[288] = {};
+    u32 distance_counts[30] = {};
+    size_t byte_count = 0;
+    u64 extra_bits = 0;
+    for (u32 i = 0; i < token_count; ++i)
+    {
+        u32 token = tokens[i];
+        if (!(token & PNG_TOKEN_MATCH))
+        {
+            ++literal_counts[token];
+            ++byte_count;
+            continue;
+        }
+        u32 length = (token >> 16) & 0x1FF;
+        u32 length_symbol = GetLengthSymbol(length);
+        u32 distance_symbol = GetDistanceSymbol(token & 0xFFFF);
+        ++literal_counts[257 + length_symbol];
+        ++distance_counts[distance_symbol];
+        extra_bits += png_length_extra[length_symbol] + png_distance_extra[distance_symbol];
+        byte_count += length;
+    }
+    literal_counts[256] = 1;
+
+    u8 literal_lengths[288];
+    u8 distance_lengths[30];
+    BuildCodeLengths(literal_counts, 286, PNG_MAX_CODE_BITS, literal_lengths);
+    literal_lengths[286] = 0;
+    literal_lengths[287] = 0;
+    BuildCodeLengths(distance_counts, 30, PNG_MAX_CODE_BITS, distance_lengths);
+    u32 literal_count = 286;
+    while (literal_count > 257 && literal_lengths[literal_count - 1] == 0) --literal_count;
+    u32 distance_count = 30;
+    while (distance_count > 1 && distance_lengths[distance_count - 1] == 0) --distance_count;
+    if (distance_lengths[0] == 0 && distance_count == 1)
+    {
+        distance_lengths[0] = 1;    // No matches, the header still needs one distance code
+    }
+
+    // Both lengths go out as one sequence
+    u8 lengths[286 + 30];
+    memcpy(lengths, literal_lengths, literal_count);
+    memcpy(lengths + literal_count, distance_lengths, distance_count);
+    u16 runs[286 + 30];
+    u32 run_count = RunLengthCodeLengths(lengths, literal_count + distance_count, runs);
+
+    u32 code_length_counts[19] = {};
+    for (u32 i = 0; i < run_count; ++i)
+    {
+        ++code_length_counts[runs[i] & 0xFF];
+    }
+    u8 code_length_lengths[19];
+    BuildCodeLengths(code_length_counts, 19, PNG_MAX_CODE_LENGTH_BITS, code_length_lengths);
+    u32 code_length_count = 19;
+    while (code_length_count > 4 && code_length_lengths[png_code_length_order[code_length_count - 1]] == 0) --code_length_count;
+
+    // Compare sizes in bits, stored blocks pay up to 7 bits of padding each
+    u64 dynamic_bits = 3 + 14 + 3 * code_length_count + extra_bits;
+    for (u32 i = 0; i < run_count; ++i)
+    {
+        u32 symbol = runs[i] & 0xFF;
+        dynamic_bits += code_length_lengths[symbol] + GetCodeLengthExtraBits(symbol);
+    }
+    for (u32 i = 0; i < 286; ++i)
+    {
+        dynamic_bits += (u64)literal_counts[i] * literal_lengths[i];
+    }
+    for (u32 i = 0; i < 30; ++i)
+    {
+        dynamic_bits += (u64)distance_counts[i] * distance_lengths[i];
+    }
+    u64 stored_bits = (u64)((byte_count + 65534) / 65535) * (3 + 7 + 32) + 8 * (u64)byte_count;
+    if (stored_bits < dynamic_bits)
+    {
+        stats->stored_blocks += WriteStoredBlocks(w, is_final, bytes, byte_count);
+        return;
+    }
+
+    WriteBits(w, is_final ? 1 : 0, 1);
+    WriteBits(w, 2, 2);     // Dynamic Huffman
+    WriteBits(w, literal_count - 257, 5);
+    WriteBits(w, distance_count - 1, 5);
+    WriteBits(w, code_length_count - 4, 4);
+    for (u32 i = 0; i < code_length_count; ++i)
+    {
+        WriteBits(w, code_length_lengths[png_code_length_order[i]], 3);
+    }
+
+    u16 code_length_codes[19];
+    BuildCanonicalCodes(code_length_lengths, 19, code_length_codes);
+    for (u32 i = 0; i < run_count; ++i)
+    {
+        u32 symbol = runs[i] & 0xFF;
+        WriteBits(w, code_length_codes[symbol], code_length_lengths[symbol]);
+        WriteBits(w, runs[i] >> 8, GetCodeLengthExtraBits(symbol));
+    }
+    WriteTokens(w, tokens, token_count, literal_lengths, distance_lengths);
+
+    ++stats->dynamic_blocks;
+    for (u32 i = 0; i < literal_count + distance_count; ++i)
+    {
+        stats->longest_code = (u32)MaxInt((i32)stats->longest_code, (i32)lengths[i]);
+    }
+}
+
+internal void WriteBigEndian32(u8* p, u32 value)
+{
+    p[0] = (u8)(value >> 24);
+    p[1] = (u8)(value >> 16);
+    p[2] = (u8)(value >> 8);
+    p[3] = (u8)value;
+}
+
+// Chunk CRCs are left zero, the decoder doesn't read them
+internal u8* WriteChunk(u8* out, const char* type, const u8* body, u32 length)
+{
+    WriteBigEndian32(out, length);
+    memcpy(out + 4, type, 4);
+    if (length > 0) memcpy(out + 8, body, length);
+    WriteBigEndian32(out + 8 + length, 0);
+    return out + 12 + length;
+}
+
+// A small stand in for an encoder, so the benchmark needs no files: rows cycle through all five filters,
+// then greedy LZ77 with a single entry hash table. The tokens go out in one fixed Huffman block, or with
+// dynamic set, in blocks of PNG_BENCHMARK_BLOCK_TOKENS with their own codes or stored, like zlib's level 9
+// output. Returns the file size.
+internal size_t EncodeForBenchmark(const u8* pixels, i32 width, i32 height, u32 channel_count, bool dynamic,
+                                   u8* out, VMArena* scratch, PngEncodeStats* stats)
+{
+    *stats = {};
+    u32 row_bytes = (u32)width * channel_count;
+    size_t filtered_size = (size_t)height * (1 + row_bytes);
+    size_t scratch_offset = scratch->curr_offset;
+    u8* filtered = (u8*)memory::VMArenaAlloc(scratch, filtered_size);
+    u32* hash_table = (u32*)memory::VMArenaAlloc(scratch, (1 << 15) * sizeof(u32));
+    u32* tokens = (u32*)memory::VMArenaAlloc(scratch, filtered_size * sizeof(u32));
+    if (!filtered || !hash_table || !tokens)
+    {
+        scratch->curr_offset = scratch_offset;
+        return 0;
+    }
+    memset(hash_table, 0, (1 << 15) * sizeof(u32));
+
+    for (i32 y = 0; y < height; ++y)
+    {
+        const u8* row = pixels + (size_t)y * row_bytes;
+        const u8* prior = y > 0 ? row - row_bytes : nullptr;
+        u8* filtered_row = filtered + (size_t)y * (1 + row_bytes);
+        u32 filter = (u32)y % PNG_FILTER_COUNT;
+        filtered_row[0] = (u8)filter;
+        for (u32 i = 0; i < row_bytes; ++i)
+        {
+            i32 a = i >= channel_count ? row[i - channel_count] : 0;
+            i32 b = prior ? prior[i] : 0;
+            i32 c = prior && i >= channel_count ? prior[i - channel_count] : 0;
+            i32 predictor = 0;
+            switch (filter)
+            {
+                case PNG_FILTER_SUB:        predictor = a; break;
+                case PNG_FILTER_UP:         predictor = b; break;
+                case PNG_FILTER_AVERAGE:    predictor = (a + b) >> 1; break;
+                case PNG_FILTER_PAETH:      predictor = PaethPredictor(a, b, c); break;
+                default:                    break;
+            }
+            filtered_row[1 + i] = (u8)(row[i] - predictor);
+        }
+    }
+
+    u8 header[13];
+    WriteBigEndian32(header, (u32)width);
+    WriteBigEndian32(header + 4, (u32)height);
+    header[8] = 8;
+    header[9] = channel_count == 4 ? PNG_COLOR_RGBA : PNG_COLOR_RGB;
+    header[10] = 0;
+    header[11] = 0;
+    header[12] = 0;
+    memcpy(out, png_signature, sizeof(png_signature));
+    u8* cursor = WriteChunk(out + sizeof(png_signature), "IHDR", header, sizeof(header));
+
+    // IDAT is written in place, its length is filled in afterwards
+    u8* data_chunk = cursor;
+    PngBitWriter w = {};
+    w.out = data_chunk + 8;
+    *w.out++ = 0x78;
+    *w.out++ = 0x01;
+
+    u32 token_count = 0;
+    size_t i = 0;
+    while (i < filtered_size)
+    {
+        u32 best_length = 0;
+        u32 best_distance = 0;
+        if (i + 3 <= filtered_size)
+        {
+            u32 key = ((u32)filtered[i] << 16) | ((u32)filtered[i + 1] << 8) | filtered[i + 2];
+            u32 hash = (key * 2654435761u) >> 17;
+            size_t candidate = hash_table[hash];
+            hash_table[hash] = (u32)i + 1;
+            if (candidate != 0 && i - (candidate - 1) <= 32768)
+            {
+                candidate -= 1;
+                u32 max_length = filtered_size - i < 258 ? (u32)(filtered_size - i) : 258;
+                u32 length = 0;
+                while (length < max_length && filtered[candidate + length] == filtered[i + length])
+                {
+                    ++length;
+                }
+                if (length >= 3)
+                {
+                    best_length = length;
+                    best_distance = (u32)(i - candidate);
+                }
+            }
+        }
+
+        if (best_length == 0)
+        {
+            tokens[token_count++] = filtered[i];
+            ++i;
+            continue;
+        }
+        tokens[token_count++] = PNG_TOKEN_MATCH | (best_length << 16) | best_distance;
+        i += best_length;
+    }
+
+    if (dynamic)
+    {
+        const u8* block_bytes = filtered;
+        for (u32 first = 0; first < token_count; first += PNG_BENCHMARK_BLOCK_TOKENS)
+        {
+            u32 block_tokens = (u32)MinInt((i32)(token_count - first), PNG_BENCHMARK_BLOCK_TOKENS);
+            WriteDynamicBlock(&w, first + block_tokens == token_count, tokens + first, block_tokens, block_bytes, stats);
+            for (u32 j = first; j < first + block_tokens; ++j)
+            {
+                block_bytes += (tokens[j] & PNG_TOKEN_MATCH) ? (tokens[j] >> 16) & 0x1FF : 1;
+            }
+        }
+    }
+    else
+    {
+        // The fixed code from the spec, 5 bit distance codes
+        u8 literal_lengths[288];
+        u8 distance_lengths[30];
+        memset(literal_lengths, 8, 144);
+        memset(literal_lengths + 144, 9, 256 - 144);
+        memset(literal_lengths + 256, 7, 280 - 256);
+        memset(literal_lengths + 280, 8, 288 - 280);
+        memset(distance_lengths, 5, sizeof(distance_lengths));
+        WriteBits(&w, 1, 1);    // Final block
+        WriteBits(&w, 1, 2);    // Fixed Huffman
+        WriteTokens(&w, tokens, token_count, literal_lengths, distance_lengths);
+        stats->fixed_blocks = 1;
+    }
+    WriteBits(&w, 0, (8 - w.bit_count) & 7);    // Flush to a byte boundary
+
+    u32 adler_a = 1;
+    u32 adler_b = 0;
+    for (size_t j = 0; j < filtered_size; ++j)
+    {
+        adler_a = (adler_a + filtered[j]) % 65521;
+        adler_b = (adler_b + adler_a) % 65521;
+    }
+    WriteBigEndian32(w.out, (adler_b << 16) | adler_a);
+    w.out += 4;
+
+    u32 data_length = (u32)(w.out - (data_chunk + 8));
+    WriteBigEndian32(data_chunk, data_length);
+    memcpy(data_chunk + 4, "IDAT", 4);
+    WriteBigEndian32(data_chunk + 8 + data_length, 0);
+    cursor = WriteChunk(data_chunk + 12 + data_length, "IEND", nullptr, 0);
+
+    scratch->curr_offset = scratch_offset;
+    return (size_t)(cursor - out);
+}
+
+struct PngBenchmarkImage
+{
+    const char* name;
+    u32 channel_count;
+    bool dynamic;           // Dynamic Huffman and stored blocks instead of the fixed code, with a band of noise for the stored ones
+};
+
+global const PngBenchmarkImage png_benchmark_images[] = {
+    { "RGBA fixed",     4, false },
+    { "RGB fixed",      3, false },
+    { "RGBA dynamic",   4, true },
+};
+
+// Encodes a sprite like RGBA image and an RGB one with the fixed code, and the RGBA one again the way
+// zlib at level 9 would, so dynamic tables, the long code fallback and stored blocks are timed too.
+// Decodes each with every path and prints MB/s of decoded pixels against the bit at a time reference,
+// along with any pixels that didn't survive the round trip.
+void Benchmark(VMArena* scratch_arena)
+{
+    const i32 size = PNG_BENCHMARK_SIZE;
+    size_t pixel_count = (size_t)size * size;
+    u8* source = (u8*)memory::VMArenaAlloc(scratch_arena, pixel_count * 4);
+    u8* expected = (u8*)memory::VMArenaAllocAligned(scratch_arena, pixel_count * 4, 16);
+    u8* decoded = (u8*)memory::VMArenaAllocAligned(scratch_arena, pixel_count * 4, 16);
+    u8* file = (u8*)memory::VMArenaAlloc(scratch_arena, pixel_count * 6 + 1024);
+    if (!source || !expected || !decoded || !file)
+    {
+        printf("PNG benchmark: not enough scratch memory\n");
+        return;
+    }
+
+    for (u32 image = 0; image < ArrayCount(png_benchmark_images); ++image)
+    {
+        u32 channel_count = png_benchmark_images[image].channel_count;
+        bool dynamic = png_benchmark_images[image].dynamic;
+
+        // Smooth ramps with a little noise and a soft edged disc in alpha, roughly what sprite art compresses like
+        u32 seed = 0x9E3779B9u;
+        for (i32 y = 0; y < size; ++y)
+        {
+            bool is_noise_row = dynamic && y >= size / 2 && y < size / 2 + size / 16;
+            for (i32 x = 0; x < size; ++x)
+            {
+                seed = seed * 1664525u + 1013904223u;
+                u32 noise = (seed >> 24) & 7;
+                f32 dx = ((f32)x + 0.5f) / (f32)size - 0.5f;
+                f32 dy = ((f32)y + 0.5f) / (f32)size - 0.5f;
+                f32 coverage = MinFloat(MaxFloat((0.5f - sqrtf(dx * dx + dy * dy)) * 16.0f, 0.0f), 1.0f);
+                u8 pixel[4] = {
+                    (u8)(((u32)x + noise) & 0xFF),
+                    (u8)(((x + y) / 4) & 0xFF),
+                    (u8)(((x / 32 + y / 32) % 2) ? 0xC0 : 0x40),
+                    (u8)(coverage * 255.0f),
+                };
+                if (is_noise_row)
+                {
+                    // The low bits of the LCG repeat quickly, mix them so the band really doesn't compress
+                    u32 mixed = (seed ^ (seed >> 16)) * 0x85EBCA6Bu;
+                    mixed = (mixed ^ (mixed >> 13)) * 0xC2B2AE35u;
+                    mixed ^= mixed >> 16;
+                    memcpy(pixel, &mixed, 4);
+                }
+                size_t index = (size_t)y * (size_t)size + (size_t)x;
+                memcpy(source + index * channel_count, pixel, channel_count);
+                memcpy(expected + index * 4, pixel, 4);
+                if (channel_count == 3) expected[index * 4 + 3] = 0xFF;
+            }
+        }
+
+        PngEncodeStats encode_stats;
+        size_t file_size = EncodeForBenchmark(source, size, size, channel_count, dynamic, file, scratch_arena, &encode_stats);
+        if (file_size == 0)
+        {
+            printf("PNG benchmark: not enough scratch memory\n");
+            return;
+        }
+        const char* format_name = png_benchmark_images[image].name;
+        printf("PNG %-12s %dx%d: %zu KB compressed, %u fixed, %u dynamic and %u stored blocks, codes up to %u bits\n",
+               format_name, size, size, file_size / 1024, encode_stats.fixed_blocks, encode_stats.dynamic_blocks,
+               encode_stats.stored_blocks, encode_stats.longest_code);
+
+        size_t decoded_size = pixel_count * 4;
+        u32 repeat_count = (u32)MaxInt((i32)(PNG_BENCHMARK_MIN_BYTES / decoded_size), 1);
+        f32 reference_speed = 0.0f;
+        for (u32 path = PNG_DECODE_PATH_REFERENCE; path < PNG_DECODE_PATH_COUNT; ++path)
+        {
+            memset(decoded, 0, decoded_size);
+            bool ok = true;
+            f64 start = GetBenchmarkSeconds();
+            for (u32 i = 0; i < repeat_count && ok; ++i)
+            {
+                ok = DecodeWithPath(file, file_size, decoded, size * 4, scratch_arena, (PngDecodePath)path);
+            }
+            f64 seconds = GetBenchmarkSeconds() - start;
+            if (!ok)
+            {
+                printf("PNG %-12s %-9s: decode failed\n", format_name, png_decode_path_names[path]);
+                continue;
+            }
+
+            u32 mismatched_pixels = 0;
+            for (size_t i = 0; i < pixel_count; ++i)
+            {
+                mismatched_pixels += memcmp(decoded + i * 4, expected + i * 4, 4) != 0;
+            }
+            f32 speed = (f32)((f64)decoded_size * (f64)repeat_count / 1e6 / (seconds > 1e-9 ? seconds : 1e-9));
+            if (path == PNG_DECODE_PATH_REFERENCE) reference_speed = speed;
+            printf("PNG %-12s %-9s: %8.1f MB/s, %.2fx reference, %u pixels differ\n", format_name, png_decode_path_names[path],
+                   speed, reference_speed > 0.0f ? speed / reference_speed : 0.0f, mismatched_pixels);
+        }
+    }
+}
+
+} // namespace png_decoder
@@ -0,0 +1,177 @@
+#pragma once
+
+#include "core.h"
+#include "utils/handmade_math.h"
+
+#include <cfloat>
+
+struct Aabb
+{
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+// Points with dot(normal, p) + d >= 0 are on the inside
+struct Plane
+{
+    glm::vec3 normal;
+    f32 d;
+};
+
+struct Frustum
+{
+    Plane planes[6]; // left, right, bottom, top, near, far
+};
+
+struct Ray
+{
+    glm::vec3 origin;
+    glm::vec3 direction;
+};
+
+namespace bounds
+{
+
+// Inverted box: unions with anything yield the other operand, and it fails every overlap test
+Aabb EmptyAabb()
+{
+    Aabb result = {};
+    result.min = glm::vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+    result.max = glm::vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    return result;
+}
+
+bool IsEmpty(const Aabb& box)
+{
+    return box.min.x > box.max.x || box.min.y > box.max.y || box.min.z > box.max.z;
+}
+
+// NOTE: glm::min/glm::max collide with the Windows.h macros, so stay component-wise
+Aabb Union(const Aabb& a, const Aabb& b)
+{
+    Aabb result = {};
+    result.min = glm::vec3(MinFloat(a.min.x, b.min.x), MinFloat(a.min.y, b.min.y), MinFloat(a.min.z, b.min.z));
+    result.max = glm::vec3(MaxFloat(a.max.x, b.max.x), MaxFloat(a.max.y, b.max.y), MaxFloat(a.max.z, b.max.z));
+    return result;
+}
+
+Aabb Grow(const Aabb& box, const glm::vec3& point)
+{
+    Aabb result = {};
+    result.min = glm::vec3(MinFloat(box.min.x, point.x), MinFloat(box.min.y, point.y), MinFloat(box.min.z, point.z));
+    result.max = glm::vec3(MaxFloat(box.max.x, point.x), MaxFloat(box.max.y, point.y), MaxFloat(box.max.z, point.z));
+    return result;
+}
+
+bool Equals(const Aabb& a, const Aabb& b)
+{
+    return a.min == b.min && a.max == b.max;
+}
+
+bool Overlaps(const Aabb& a, const Aabb& b)
+{
+    return a.min.x <= b.max.x && a.max.x >= b.min.x &&
+           a.min.y <= b.max.y && a.max.y >= b.min.y &&
+           a.min.z <= b.max.z && a.max.z >= b.min.z;
+}
+
+glm::vec3 Center(const Aabb& box)
+{
+    return (box.min + box.max) * 0.5f;
+}
+
+f32 SurfaceArea(const Aabb& box)
+{
+    if (IsEmpty(box)) return 0.0f;
+    glm::vec3 e = box.max - box.min;
+    return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+}
+
+// Arvo's method: the transformed box of a box is the sum of the per-axis extremes
+Aabb Transform(const Aabb& box, const glm::mat4& m)
+{
+    glm::vec3 translation = glm::vec3(m[3]);
+    Aabb result = {};
+    result.min = translation;
+    result.max = translation;
+    for (i32 col = 0; col < 3; ++col)
+    {
+        for (i32 row = 0; row < 3; ++row)
+        {
+            f32 a = m[col][row] * box.min[col];
+            f32 b = m[col][row] * box.max[col];
+            result.min[row] += MinFloat(a, b);
+            result.max[row] += MaxFloat(a, b);
+        }
+    }
+    return result;
+}
+
+// Gribb-Hartmann plane extraction for an OpenGL (-1..1 depth) clip space
+Frustum FrustumFromMatrix(const glm::mat4& view_projection)
+{
+    const glm::mat4& m = view_projection;
+    glm::vec4 row0 = glm::vec4(m[0][0], m[1][0], m[2][0], m[3][0]);
+    glm::vec4 row1 = glm::vec4(m[0][1], m[1][1], m[2][1], m[3][1]);
+    glm::vec4 row2 = glm::vec4(m[0][2], m[1][2], m[2][2], m[3][2]);
+    glm::vec4 row3 = glm::vec4(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+    glm::vec4 planes[6] = {
+        row3 + row0,
+        row3 - row0,
+        row3 + row1,
+        row3 - row1,
+        row3 + row2,
+        row3 - row2
+    };
+
+    Frustum result = {};
+    for (i32 i = 0; i < 6; ++i)
+    {
+        glm::vec3 normal = glm::vec3(planes[i]);
+        f32 inv_length = 1.0f / glm::length(normal);
+        result.planes[i].normal = normal * inv_length;
+        result.planes[i].d = planes[i].w * inv_length;
+    }
+    return result;
+}
+
+bool FrustumIntersectsAabb(const Frustum& frustum, const Aabb& box)
+{
+    for (i32 i = 0; i < 6; ++i)
+    {
+        const Plane& plane = frustum.planes[i];
+        // Test the corner furthest along the plane normal (the "p-vertex")
+        glm::vec3 p = glm::vec3(plane.normal.x >= 0.0f ? box.max.x : box.min.x,
+                                plane.normal.y >= 0.0f ? box.max.y : box.min.y,
+                                plane.normal.z >= 0.0f ? box.max.z : box.min.z);
+        if (glm::dot(plane.normal, p) + plane.d < 0.0f)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Slab test. Returns false on a miss, otherwise the entry distance (0 when the origin is inside)
+bool RayIntersectsAabb(const Ray& ray, const Aabb& box, f32 max_t, f32* out_t)
+{
+    f32 t_near = 0.0f;
+    f32 t_far = max_t;
+    for (i32 axis = 0; axis < 3; ++axis)
+    {
+        f32 inv_dir = 1.0f / ray.direction[axis];
+        f32 t0 = (box.min[axis] - ray.origin[axis]) * inv_dir;
+        f32 t1 = (box.max[axis] - ray.origin[axis]) * inv_dir;
+        t_near = MaxFloat(t_near, MinFloat(t0, t1));
+        t_far = MinFloat(t_far, MaxFloat(t0, t1));
+    }
+    if (t_near > t_far)
+    {
+        return false;
+    }
+    *out_t = t_near;
+    return true;
+}
+
+} // namespace bounds
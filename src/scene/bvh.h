@@ -0,0 +1,651 @@
+#pragma once
+
+#include "core.h"
+#include "scene/bounds.h"
+
+#include <immintrin.h>
+#include <vector>
+
+#define BVH_WIDTH           4
+#define BVH_MAX_LEAF_SIZE   4
+#define BVH_SAH_BIN_COUNT   16
+#define BVH_STACK_SIZE      256
+#define BVH_LEAF            0xFFFFFFFFu
+#define BVH_NO_PARENT       0xFFFFFFFFu
+
+// A 4-wide node. Child bounds are stored SoA so a single SSE register tests all
+// four children against one plane or slab.
+struct alignas(16) BvhNode
+{
+    f32 min_x[BVH_WIDTH];
+    f32 min_y[BVH_WIDTH];
+    f32 min_z[BVH_WIDTH];
+    f32 max_x[BVH_WIDTH];
+    f32 max_y[BVH_WIDTH];
+    f32 max_z[BVH_WIDTH];
+
+    u32 child[BVH_WIDTH];       // Child node index, or BVH_LEAF
+    u32 prim_first[BVH_WIDTH];  // Start of the slot's subtree in Bvh::prim_ids
+    u32 prim_count[BVH_WIDTH];  // 0 marks an unused slot
+
+    u32 parent;
+    u32 parent_slot;
+};
+
+struct Bvh
+{
+    std::vector<BvhNode> nodes;     // nodes[0] is the root, parents always precede their children
+    std::vector<u32> prim_ids;      // Ordered so that every subtree is one contiguous range
+    std::vector<Aabb> prim_bounds;  // Indexed by primitive id
+    std::vector<u32> prim_node;     // Leaf node holding each primitive id
+    std::vector<u8> prim_slot;      // Slot of that leaf node
+};
+
+// Binary SAH tree, only alive during the build before being collapsed into 4-wide nodes
+struct BvhBuildNode
+{
+    Aabb box;
+    u32 left;   // BVH_LEAF for leaves
+    u32 right;
+    u32 first;
+    u32 count;
+};
+
+struct BvhBuilder
+{
+    Bvh* bvh;
+    std::vector<glm::vec3> centroids;
+    std::vector<BvhBuildNode> nodes;
+};
+
+namespace bvh
+{
+
+internal Aabb GetSlotBounds(const BvhNode& node, u32 slot)
+{
+    Aabb result = {};
+    result.min = glm::vec3(node.min_x[slot], node.min_y[slot], node.min_z[slot]);
+    result.max = glm::vec3(node.max_x[slot], node.max_y[slot], node.max_z[slot]);
+    return result;
+}
+
+internal void SetSlotBounds(BvhNode& node, u32 slot, const Aabb& box)
+{
+    node.min_x[slot] = box.min.x;
+    node.min_y[slot] = box.min.y;
+    node.min_z[slot] = box.min.z;
+    node.max_x[slot] = box.max.x;
+    node.max_y[slot] = box.max.y;
+    node.max_z[slot] = box.max.z;
+}
+
+internal Aabb GetNodeBounds(const BvhNode& node)
+{
+    Aabb result = bounds::EmptyAabb();
+    for (u32 slot = 0; slot < BVH_WIDTH; ++slot)
+    {
+        if (node.prim_count[slot] > 0)
+        {
+            result = bounds::Union(result, GetSlotBounds(node, slot));
+        }
+    }
+    return result;
+}
+
+internal Aabb GetRangeBounds(const Bvh* bvh, u32 first, u32 count)
+{
+    Aabb result = bounds::EmptyAabb();
+    for (u32 i = first; i < first + count; ++i)
+    {
+        result = bounds::Union(result, bvh->prim_bounds[bvh->prim_ids[i]]);
+    }
+    return result;
+}
+
+internal u32 BuildBinaryNode(BvhBuilder* builder, u32 first, u32 count)
+{
+    Bvh* bvh = builder->bvh;
+    u32 index = (u32)builder->nodes.size();
+    builder->nodes.push_back({});
+
+    Aabb box = bounds::EmptyAabb();
+    Aabb centroid_box = bounds::EmptyAabb();
+    for (u32 i = first; i < first + count; ++i)
+    {
+        u32 id = bvh->prim_ids[i];
+        box = bounds::Union(box, bvh->prim_bounds[id]);
+        centroid_box = bounds::Grow(centroid_box, builder->centroids[id]);
+    }
+
+    BvhBuildNode node = {};
+    node.box = box;
+    node.first = first;
+    node.count = count;
+    node.left = BVH_LEAF;
+    node.right = BVH_LEAF;
+
+    if (count <= BVH_MAX_LEAF_SIZE)
+    {
+        builder->nodes[index] = node;
+        return index;
+    }
+
+    // Binned SAH: bucket centroids along each axis and sweep the bucket boundaries
+    i32 best_axis = -1;
+    u32 best_split = 0;
+    f32 best_cost = FLT_MAX;
+    for (i32 axis = 0; axis < 3; ++axis)
+    {
+        f32 extent = centroid_box.max[axis] - centroid_box.min[axis];
+        if (extent <= 0.0f)
+        {
+            continue;
+        }
+
+        u32 bin_counts[BVH_SAH_BIN_COUNT] = {};
+        Aabb bin_boxes[BVH_SAH_BIN_COUNT];
+        for (u32 b = 0; b < BVH_SAH_BIN_COUNT; ++b)
+        {
+            bin_boxes[b] = bounds::EmptyAabb();
+        }
+
+        f32 scale = (f32)BVH_SAH_BIN_COUNT / extent;
+        for (u32 i = first; i < first + count; ++i)
+        {
+            u32 id = bvh->prim_ids[i];
+            u32 b = (u32)((builder->centroids[id][axis] - centroid_box.min[axis]) * scale);
+            if (b >= BVH_SAH_BIN_COUNT) b = BVH_SAH_BIN_COUNT - 1;
+            bin_counts[b]++;
+            bin_boxes[b] = bounds::Union(bin_boxes[b], bvh->prim_bounds[id]);
+        }
+
+        // Right-to-left prefix so each split candidate is evaluated in O(1)
+        f32 right_costs[BVH_SAH_BIN_COUNT] = {};
+        Aabb right_box = bounds::EmptyAabb();
+        u32 right_count = 0;
+        for (u32 b = BVH_SAH_BIN_COUNT - 1; b > 0; --b)
+        {
+            right_box = bounds::Union(right_box, bin_boxes[b]);
+            right_count += bin_counts[b];
+            right_costs[b] = (f32)right_count * bounds::SurfaceArea(right_box);
+        }
+
+        Aabb left_box = bounds::EmptyAabb();
+        u32 left_count = 0;
+        for (u32 split = 1; split < BVH_SAH_BIN_COUNT; ++split)
+        {
+            left_box = bounds::Union(left_box, bin_boxes[split - 1]);
+            left_count += bin_counts[split - 1];
+            if (left_count == 0 || left_count == count)
+            {
+                continue;
+            }
+            f32 cost = (f32)left_count * bounds::SurfaceArea(left_box) + right_costs[split];
+            if (cost < best_cost)
+            {
+                best_cost = cost;
+                best_axis = axis;
+                best_split = split;
+            }
+        }
+    }
+
+    u32 mid = first + count / 2;
+    if (best_axis >= 0)
+    {
+        f32 scale = (f32)BVH_SAH_BIN_COUNT / (centroid_box.max[best_axis] - centroid_box.min[best_axis]);
+        u32 i = first;
+        u32 j = first + count;
+        while (i < j)
+        {
+            u32 id = bvh->prim_ids[i];
+            u32 b = (u32)((builder->centroids[id][best_axis] - centroid_box.min[best_axis]) * scale);
+            if (b >= BVH_SAH_BIN_COUNT) b = BVH_SAH_BIN_COUNT - 1;
+            if (b < best_split)
+            {
+                ++i;
+            }
+            else
+            {
+                --j;
+                bvh->prim_ids[i] = bvh->prim_ids[j];
+                bvh->prim_ids[j] = id;
+            }
+        }
+        if (i > first && i < first + count)
+        {
+            mid = i;
+        }
+    }
+    // else: all centroids coincide, any split of the range is as good as another
+
+    node.left = BuildBinaryNode(builder, first, mid - first);
+    node.right = BuildBinaryNode(builder, mid, first + count - mid);
+    builder->nodes[index] = node;
+    return index;
+}
+
+internal u32 CollapseNode(BvhBuilder* builder, u32 build_index, u32 parent, u32 parent_slot)
+{
+    Bvh* bvh = builder->bvh;
+
+    u32 slots[BVH_WIDTH] = {};
+    u32 slot_count = 0;
+    const BvhBuildNode& build_node = builder->nodes[build_index];
+    if (build_node.left == BVH_LEAF)
+    {
+        slots[slot_count++] = build_index;
+    }
+    else
+    {
+        slots[slot_count++] = build_node.left;
+        slots[slot_count++] = build_node.right;
+    }
+
+    // Pull grandchildren up by repeatedly opening the largest internal child
+    while (slot_count < BVH_WIDTH)
+    {
+        i32 best = -1;
+        f32 best_area = -1.0f;
+        for (u32 i = 0; i < slot_count; ++i)
+        {
+            const BvhBuildNode& candidate = builder->nodes[slots[i]];
+            f32 area = bounds::SurfaceArea(candidate.box);
+            if (candidate.left != BVH_LEAF && area > best_area)
+            {
+                best = (i32)i;
+                best_area = area;
+            }
+        }
+        if (best < 0)
+        {
+            break;
+        }
+        u32 opened = slots[best];
+        slots[best] = builder->nodes[opened].left;
+        slots[slot_count++] = builder->nodes[opened].right;
+    }
+
+    u32 node_index = (u32)bvh->nodes.size();
+    BvhNode node = {};
+    node.parent = parent;
+    node.parent_slot = parent_slot;
+    for (u32 slot = 0; slot < BVH_WIDTH; ++slot)
+    {
+        SetSlotBounds(node, slot, bounds::EmptyAabb());
+        node.child[slot] = BVH_LEAF;
+    }
+    bvh->nodes.push_back(node);
+
+    for (u32 slot = 0; slot < slot_count; ++slot)
+    {
+        const BvhBuildNode& child = builder->nodes[slots[slot]];
+        u32 child_index = BVH_LEAF;
+        if (child.left != BVH_LEAF)
+        {
+            // NOTE: Recursing grows bvh->nodes, so don't hold a reference across this call
+            child_index = CollapseNode(builder, slots[slot], node_index, slot);
+        }
+        else
+        {
+            for (u32 i = child.first; i < child.first + child.count; ++i)
+            {
+                u32 id = bvh->prim_ids[i];
+                bvh->prim_node[id] = node_index;
+                bvh->prim_slot[id] = (u8)slot;
+            }
+        }
+
+        BvhNode& dst = bvh->nodes[node_index];
+        SetSlotBounds(dst, slot, child.box);
+        dst.child[slot] = child_index;
+        dst.prim_first[slot] = child.first;
+        dst.prim_count[slot] = child.count;
+    }
+
+    return node_index;
+}
+
+// Full rebuild. Prefer Refit() when only some of the bounds moved.
+void Build(Bvh* bvh, const Aabb* prim_bounds, u32 prim_count)
+{
+    bvh->nodes.clear();
+    bvh->prim_ids.resize(prim_count);
+    bvh->prim_bounds.assign(prim_bounds, prim_bounds + prim_count);
+    bvh->prim_node.resize(prim_count);
+    bvh->prim_slot.resize(prim_count);
+
+    if (prim_count == 0)
+    {
+        return;
+    }
+
+    BvhBuilder builder = {};
+    builder.bvh = bvh;
+    builder.centroids.resize(prim_count);
+    builder.nodes.reserve(2 * (prim_count / BVH_MAX_LEAF_SIZE + 1));
+    for (u32 id = 0; id < prim_count; ++id)
+    {
+        bvh->prim_ids[id] = id;
+        builder.centroids[id] = bounds::Center(prim_bounds[id]);
+    }
+
+    u32 root = BuildBinaryNode(&builder, 0, prim_count);
+
+    bvh->nodes.reserve(builder.nodes.size() / 2 + 1);
+    CollapseNode(&builder, root, BVH_NO_PARENT, 0);
+}
+
+// Updates the bounds of the given primitives and refits only the affected paths to the root.
+// The topology is kept, so quality degrades if objects travel far; Build() again in that case.
+void Refit(Bvh* bvh, const u32* prim_ids, const Aabb* new_bounds, u32 count)
+{
+    for (u32 k = 0; k < count; ++k)
+    {
+        u32 id = prim_ids[k];
+        bvh->prim_bounds[id] = new_bounds[k];
+
+        u32 node_index = bvh->prim_node[id];
+        u32 slot = bvh->prim_slot[id];
+        BvhNode& leaf = bvh->nodes[node_index];
+        Aabb leaf_box = GetRangeBounds(bvh, leaf.prim_first[slot], leaf.prim_count[slot]);
+        if (bounds::Equals(leaf_box, GetSlotBounds(leaf, slot)))
+        {
+            continue;
+        }
+        SetSlotBounds(leaf, slot, leaf_box);
+
+        // Walk up until a parent slot already matches, everything above it is unchanged
+        while (bvh->nodes[node_index].parent != BVH_NO_PARENT)
+        {
+            const BvhNode& node = bvh->nodes[node_index];
+            Aabb node_box = GetNodeBounds(node);
+            BvhNode& parent = bvh->nodes[node.parent];
+            if (bounds::Equals(node_box, GetSlotBounds(parent, node.parent_slot)))
+            {
+                break;
+            }
+            SetSlotBounds(parent, node.parent_slot, node_box);
+            node_index = node.parent;
+        }
+    }
+}
+
+internal u32 EmitRange(const Bvh* bvh, u32 first, u32 count, u32* out_ids, u32 out_count, u32 max_count)
+{
+    for (u32 i = first; i < first + count && out_count < max_count; ++i)
+    {
+        out_ids[out_count++] = bvh->prim_ids[i];
+    }
+    return out_count;
+}
+
+// Writes the ids of every primitive whose bounds touch the frustum. Subtrees fully
+// inside the frustum are emitted without further tests, so the cost follows the
+// visible set rather than the scene size.
+u32 CullFrustum(const Bvh* bvh, const Frustum& frustum, u32* out_ids, u32 max_count)
+{
+    if (bvh->nodes.empty())
+    {
+        return 0;
+    }
+
+    __m128 plane_x[6];
+    __m128 plane_y[6];
+    __m128 plane_z[6];
+    __m128 plane_d[6];
+    for (i32 p = 0; p < 6; ++p)
+    {
+        plane_x[p] = _mm_set1_ps(frustum.planes[p].normal.x);
+        plane_y[p] = _mm_set1_ps(frustum.planes[p].normal.y);
+        plane_z[p] = _mm_set1_ps(frustum.planes[p].normal.z);
+        plane_d[p] = _mm_set1_ps(frustum.planes[p].d);
+    }
+    __m128 zero = _mm_setzero_ps();
+
+    u32 out_count = 0;
+    u32 stack[BVH_STACK_SIZE];
+    u32 stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while (stack_size > 0 && out_count < max_count)
+    {
+        const BvhNode& node = bvh->nodes[stack[--stack_size]];
+        __m128 min_x = _mm_load_ps(node.min_x);
+        __m128 min_y = _mm_load_ps(node.min_y);
+        __m128 min_z = _mm_load_ps(node.min_z);
+        __m128 max_x = _mm_load_ps(node.max_x);
+        __m128 max_y = _mm_load_ps(node.max_y);
+        __m128 max_z = _mm_load_ps(node.max_z);
+
+        __m128 outside = zero;
+        __m128 straddle = zero;
+        for (i32 p = 0; p < 6; ++p)
+        {
+            // p-vertex (furthest along the normal) decides "outside",
+            // n-vertex (nearest) decides "fully inside"
+            const glm::vec3& n = frustum.planes[p].normal;
+            __m128 px = n.x >= 0.0f ? max_x : min_x;
+            __m128 py = n.y >= 0.0f ? max_y : min_y;
+            __m128 pz = n.z >= 0.0f ? max_z : min_z;
+            __m128 nx = n.x >= 0.0f ? min_x : max_x;
+            __m128 ny = n.y >= 0.0f ? min_y : max_y;
+            __m128 nz = n.z >= 0.0f ? min_z : max_z;
+
+            __m128 p_dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(plane_x[p], px), _mm_mul_ps(plane_y[p], py)),
+                                       _mm_add_ps(_mm_mul_ps(plane_z[p], pz), plane_d[p]));
+            __m128 n_dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(plane_x[p], nx), _mm_mul_ps(plane_y[p], ny)),
+                                       _mm_add_ps(_mm_mul_ps(plane_z[p], nz), plane_d[p]));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(p_dist, zero));
+            straddle = _mm_or_ps(straddle, _mm_cmplt_ps(n_dist, zero));
+        }
+        i32 outside_mask = _mm_movemask_ps(outside);
+        i32 straddle_mask = _mm_movemask_ps(straddle);
+
+        for (u32 slot = 0; slot < BVH_WIDTH; ++slot)
+        {
+            if (node.prim_count[slot] == 0 || (outside_mask & (1 << slot)))
+            {
+                continue;
+            }
+
+            if (!(straddle_mask & (1 << slot)))
+            {
+                out_count = EmitRange(bvh, node.prim_first[slot], node.prim_count[slot], out_ids, out_count, max_count);
+            }
+            else if (node.child[slot] == BVH_LEAF)
+            {
+                for (u32 i = node.prim_first[slot]; i < node.prim_first[slot] + node.prim_count[slot] && out_count < max_count; ++i)
+                {
+                    u32 id = bvh->prim_ids[i];
+                    if (bounds::FrustumIntersectsAabb(frustum, bvh->prim_bounds[id]))
+                    {
+                        out_ids[out_count++] = id;
+                    }
+                }
+            }
+            else
+            {
+                Assert(stack_size < BVH_STACK_SIZE);
+                stack[stack_size++] = node.child[slot];
+            }
+        }
+    }
+
+    return out_count;
+}
+
+// Writes the ids of every primitive whose bounds overlap the query box
+u32 QueryAabb(const Bvh* bvh, const Aabb& query, u32* out_ids, u32 max_count)
+{
+    if (bvh->nodes.empty())
+    {
+        return 0;
+    }
+
+    __m128 q_min_x = _mm_set1_ps(query.min.x);
+    __m128 q_min_y = _mm_set1_ps(query.min.y);
+    __m128 q_min_z = _mm_set1_ps(query.min.z);
+    __m128 q_max_x = _mm_set1_ps(query.max.x);
+    __m128 q_max_y = _mm_set1_ps(query.max.y);
+    __m128 q_max_z = _mm_set1_ps(query.max.z);
+
+    u32 out_count = 0;
+    u32 stack[BVH_STACK_SIZE];
+    u32 stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while (stack_size > 0 && out_count < max_count)
+    {
+        const BvhNode& node = bvh->nodes[stack[--stack_size]];
+        __m128 min_x = _mm_load_ps(node.min_x);
+        __m128 min_y = _mm_load_ps(node.min_y);
+        __m128 min_z = _mm_load_ps(node.min_z);
+        __m128 max_x = _mm_load_ps(node.max_x);
+        __m128 max_y = _mm_load_ps(node.max_y);
+        __m128 max_z = _mm_load_ps(node.max_z);
+
+        __m128 overlap = _mm_and_ps(_mm_and_ps(_mm_cmple_ps(min_x, q_max_x), _mm_cmpge_ps(max_x, q_min_x)),
+                         _mm_and_ps(_mm_and_ps(_mm_cmple_ps(min_y, q_max_y), _mm_cmpge_ps(max_y, q_min_y)),
+                                    _mm_and_ps(_mm_cmple_ps(min_z, q_max_z), _mm_cmpge_ps(max_z, q_min_z))));
+        __m128 contained = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(min_x, q_min_x), _mm_cmple_ps(max_x, q_max_x)),
+                           _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(min_y, q_min_y), _mm_cmple_ps(max_y, q_max_y)),
+                                      _mm_and_ps(_mm_cmpge_ps(min_z, q_min_z), _mm_cmple_ps(max_z, q_max_z))));
+        i32 overlap_mask = _mm_movemask_ps(overlap);
+        i32 contained_mask = _mm_movemask_ps(contained);
+
+        for (u32 slot = 0; slot < BVH_WIDTH; ++slot)
+        {
+            if (node.prim_count[slot] == 0 || !(overlap_mask & (1 << slot)))
+            {
+                continue;
+            }
+
+            if (contained_mask & (1 << slot))
+            {
+                out_count = EmitRange(bvh, node.prim_first[slot], node.prim_count[slot], out_ids, out_count, max_count);
+            }
+            else if (node.child[slot] == BVH_LEAF)
+            {
+                for (u32 i = node.prim_first[slot]; i < node.prim_first[slot] + node.prim_count[slot] && out_count < max_count; ++i)
+                {
+                    u32 id = bvh->prim_ids[i];
+                    if (bounds::Overlaps(query, bvh->prim_bounds[id]))
+                    {
+                        out_ids[out_count++] = id;
+                    }
+                }
+            }
+            else
+            {
+                Assert(stack_size < BVH_STACK_SIZE);
+                stack[stack_size++] = node.child[slot];
+            }
+        }
+    }
+
+    return out_count;
+}
+
+// Nearest primitive bounds hit along the ray, e.g. for mouse picking
+bool RayCast(const Bvh* bvh, const Ray& ray, f32 max_t, u32* out_id, f32* out_t)
+{
+    if (bvh->nodes.empty())
+    {
+        return false;
+    }
+
+    __m128 origin_x = _mm_set1_ps(ray.origin.x);
+    __m128 origin_y = _mm_set1_ps(ray.origin.y);
+    __m128 origin_z = _mm_set1_ps(ray.origin.z);
+    __m128 inv_dir_x = _mm_set1_ps(1.0f / ray.direction.x);
+    __m128 inv_dir_y = _mm_set1_ps(1.0f / ray.direction.y);
+    __m128 inv_dir_z = _mm_set1_ps(1.0f / ray.direction.z);
+    __m128 zero = _mm_setzero_ps();
+
+    f32 best_t = max_t;
+    bool hit = false;
+
+    u32 stack_nodes[BVH_STACK_SIZE];
+    f32 stack_t[BVH_STACK_SIZE];
+    u32 stack_size = 0;
+    stack_nodes[stack_size] = 0;
+    stack_t[stack_size++] = 0.0f;
+
+    while (stack_size > 0)
+    {
+        --stack_size;
+        if (stack_t[stack_size] > best_t)
+        {
+            continue;
+        }
+        const BvhNode& node = bvh->nodes[stack_nodes[stack_size]];
+
+        __m128 t0_x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.min_x), origin_x), inv_dir_x);
+        __m128 t1_x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.max_x), origin_x), inv_dir_x);
+        __m128 t0_y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.min_y), origin_y), inv_dir_y);
+        __m128 t1_y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.max_y), origin_y), inv_dir_y);
+        __m128 t0_z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.min_z), origin_z), inv_dir_z);
+        __m128 t1_z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.max_z), origin_z), inv_dir_z);
+
+        __m128 t_near = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0_x, t1_x), _mm_min_ps(t0_y, t1_y)),
+                                   _mm_max_ps(_mm_min_ps(t0_z, t1_z), zero));
+        __m128 t_far = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0_x, t1_x), _mm_max_ps(t0_y, t1_y)),
+                                  _mm_min_ps(_mm_max_ps(t0_z, t1_z), _mm_set1_ps(best_t)));
+        i32 hit_mask = _mm_movemask_ps(_mm_cmple_ps(t_near, t_far));
+
+        alignas(16) f32 near_ts[BVH_WIDTH];
+        _mm_store_ps(near_ts, t_near);
+
+        // Push the children far-to-near so the nearest one is popped first
+        u32 order[BVH_WIDTH] = {};
+        u32 order_count = 0;
+        for (u32 slot = 0; slot < BVH_WIDTH; ++slot)
+        {
+            if (node.prim_count[slot] == 0 || !(hit_mask & (1 << slot)))
+            {
+                continue;
+            }
+            u32 k = order_count++;
+            while (k > 0 && near_ts[order[k - 1]] < near_ts[slot])
+            {
+                order[k] = order[k - 1];
+                --k;
+            }
+            order[k] = slot;
+        }
+
+        for (u32 k = 0; k < order_count; ++k)
+        {
+            u32 slot = order[k];
+            if (node.child[slot] == BVH_LEAF)
+            {
+                for (u32 i = node.prim_first[slot]; i < node.prim_first[slot] + node.prim_count[slot]; ++i)
+                {
+                    u32 id = bvh->prim_ids[i];
+                    f32 t = 0.0f;
+                    if (bounds::RayIntersectsAabb(ray, bvh->prim_bounds[id], best_t, &t) && t < best_t)
+                    {
+                        best_t = t;
+                        *out_id = id;
+                        hit = true;
+                    }
+                }
+            }
+            else
+            {
+                Assert(stack_size < BVH_STACK_SIZE);
+                stack_nodes[stack_size] = node.child[slot];
+                stack_t[stack_size++] = near_ts[slot];
+            }
+        }
+    }
+
+    if (hit)
+    {
+        *out_t = best_t;
+    }
+    return hit;
+}
+
+} // namespace bvh
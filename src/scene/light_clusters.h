@@ -0,0 +1,273 @@
+#pragma once
+
+#include "core.h"
+#include "core/memory.h"
+#include "core/work_queue.h"
+#include "renderer/renderer.h"
+#include "utils/handmade_math.h"
+
+#include <immintrin.h>
+
+#define CLUSTER_MAX_LIGHTS      64      // Per cluster, extra lights are dropped and counted
+#define LIGHT_BIN_CHUNK         256     // Lights gathered on the stack per slice pass
+
+#define LIGHT_CLUSTERS_STRINGIFY_(x)    #x
+#define LIGHT_CLUSTERS_STRINGIFY(x)     LIGHT_CLUSTERS_STRINGIFY_(x)
+
+// GLSL side of the lookup, paste into fragment shaders of meshes drawn with light clusters.
+// The backend binds the buffers and sets the cluster uniforms.
+#define CLUSTERED_LIGHTING_GLSL \
+    "uniform usamplerBuffer clusterRanges;\n" \
+    "uniform usamplerBuffer clusterLightIndices;\n" \
+    "uniform samplerBuffer lightData;\n" \
+    "uniform vec2 clusterViewport;\n" \
+    "uniform vec2 clusterDepth; // Near plane, slices per log unit of depth\n" \
+    "const ivec3 clusterGrid = ivec3(" LIGHT_CLUSTERS_STRINGIFY(CLUSTER_GRID_X) ", " \
+        LIGHT_CLUSTERS_STRINGIFY(CLUSTER_GRID_Y) ", " LIGHT_CLUSTERS_STRINGIFY(CLUSTER_GRID_Z) ");\n" \
+    "vec3 ShadeClusteredLights(vec3 position, vec3 normal, float viewDepth) {\n" \
+    "    ivec3 cluster;\n" \
+    "    cluster.xy = ivec2(gl_FragCoord.xy / clusterViewport * vec2(clusterGrid.xy));\n" \
+    "    cluster.z = int(log(max(viewDepth, clusterDepth.x) / clusterDepth.x) * clusterDepth.y);\n" \
+    "    cluster = clamp(cluster, ivec3(0), clusterGrid - 1);\n" \
+    "    uvec2 range = texelFetch(clusterRanges, cluster.x + clusterGrid.x * (cluster.y + clusterGrid.y * cluster.z)).xy;\n" \
+    "    vec3 result = vec3(0.0);\n" \
+    "    for (uint i = 0u; i < range.y; ++i) {\n" \
+    "        int light = int(texelFetch(clusterLightIndices, int(range.x + i)).r);\n" \
+    "        vec4 positionRadius = texelFetch(lightData, light * 2);\n" \
+    "        vec4 colorIntensity = texelFetch(lightData, light * 2 + 1);\n" \
+    "        vec3 toLight = positionRadius.xyz - position;\n" \
+    "        float distanceSq = dot(toLight, toLight);\n" \
+    "        float falloff = clamp(1.0 - distanceSq / (positionRadius.w * positionRadius.w), 0.0, 1.0);\n" \
+    "        float diffuse = max(dot(normal, toLight * inversesqrt(max(distanceSq, 1e-6))), 0.0);\n" \
+    "        result += diffuse * falloff * falloff * colorIntensity.rgb * colorIntensity.w;\n" \
+    "    }\n" \
+    "    return result;\n" \
+    "}\n"
+
+// Shared by the slice jobs, each one owns CLUSTER_GRID_X * CLUSTER_GRID_Y clusters
+struct LightBinningJob
+{
+    const f32* view_x;
+    const f32* view_y;
+    const f32* view_z;
+    const f32* radius;
+    u32 light_count;
+
+    f32 tan_half_fov_x;
+    f32 tan_half_fov_y;
+    f32 near_plane;
+    f32 far_plane;
+
+    u16* cluster_lights;    // CLUSTER_MAX_LIGHTS per cluster
+    u32* cluster_counts;
+    u32* slice_dropped;
+};
+
+namespace light_clusters
+{
+
+// Exponential slicing keeps clusters roughly cubic: near slices are thin, far ones deep
+f32 GetSliceDepth(f32 near_plane, f32 far_plane, u32 slice)
+{
+    return near_plane * powf(far_plane / near_plane, (f32)slice / (f32)CLUSTER_GRID_Z);
+}
+
+// Appends the lights whose set bits are in mask, in index order
+internal void AppendLights(u32 mask, const u16* indices, u16* cluster_lights, u32* count, u32* dropped)
+{
+    for (u32 lane = 0; lane < 4; ++lane)
+    {
+        if ((mask & (1u << lane)) == 0)
+        {
+            continue;
+        }
+        if (*count < CLUSTER_MAX_LIGHTS)
+        {
+            cluster_lights[(*count)++] = indices[lane];
+        }
+        else
+        {
+            ++*dropped;
+        }
+    }
+}
+
+internal void BinSlices(void* data, u32 begin, u32 end)
+{
+    LightBinningJob* job = (LightBinningJob*)data;
+
+    alignas(16) f32 chunk_x[LIGHT_BIN_CHUNK];
+    alignas(16) f32 chunk_y[LIGHT_BIN_CHUNK];
+    alignas(16) f32 chunk_z[LIGHT_BIN_CHUNK];
+    alignas(16) f32 chunk_radius_sq[LIGHT_BIN_CHUNK];
+    u16 chunk_index[LIGHT_BIN_CHUNK];
+
+    for (u32 slice = begin; slice < end; ++slice)
+    {
+        f32 depth_near = GetSliceDepth(job->near_plane, job->far_plane, slice);
+        f32 depth_far = GetSliceDepth(job->near_plane, job->far_plane, slice + 1);
+        u32 slice_first_cluster = slice * CLUSTER_GRID_X * CLUSTER_GRID_Y;
+        u32 dropped = 0;
+
+        for (u32 first = 0; first < job->light_count; first += LIGHT_BIN_CHUNK)
+        {
+            // Gather the lights overlapping this slice's depth range into SoA form
+            u32 last = MinInt((i32)(first + LIGHT_BIN_CHUNK), (i32)job->light_count);
+            u32 gathered = 0;
+            for (u32 i = first; i < last; ++i)
+            {
+                f32 depth = -job->view_z[i];
+                if (depth + job->radius[i] < depth_near || depth - job->radius[i] > depth_far)
+                {
+                    continue;
+                }
+                chunk_x[gathered] = job->view_x[i];
+                chunk_y[gathered] = job->view_y[i];
+                chunk_z[gathered] = job->view_z[i];
+                chunk_radius_sq[gathered] = job->radius[i] * job->radius[i];
+                chunk_index[gathered] = (u16)i;
+                ++gathered;
+            }
+            if (gathered == 0)
+            {
+                continue;
+            }
+
+            // Pad to the SIMD width with lights that can never pass the test
+            u32 padded = (gathered + 3) & ~3u;
+            for (u32 i = gathered; i < padded; ++i)
+            {
+                chunk_x[i] = 0.0f;
+                chunk_y[i] = 0.0f;
+                chunk_z[i] = 0.0f;
+                chunk_radius_sq[i] = -1.0f;
+                chunk_index[i] = 0;
+            }
+
+            __m128 zero = _mm_setzero_ps();
+            __m128 min_z = _mm_set1_ps(-depth_far);
+            __m128 max_z = _mm_set1_ps(-depth_near);
+            for (u32 tile_y = 0; tile_y < CLUSTER_GRID_Y; ++tile_y)
+            {
+                f32 ndc_y0 = -1.0f + 2.0f * (f32)tile_y / (f32)CLUSTER_GRID_Y;
+                f32 ndc_y1 = -1.0f + 2.0f * (f32)(tile_y + 1) / (f32)CLUSTER_GRID_Y;
+                f32 y0 = ndc_y0 * job->tan_half_fov_y;
+                f32 y1 = ndc_y1 * job->tan_half_fov_y;
+                __m128 min_y = _mm_set1_ps(MinFloat(y0 * depth_near, y0 * depth_far));
+                __m128 max_y = _mm_set1_ps(MaxFloat(y1 * depth_near, y1 * depth_far));
+
+                for (u32 tile_x = 0; tile_x < CLUSTER_GRID_X; ++tile_x)
+                {
+                    // View space AABB of the cluster: the tile's frustum slab between the slice depths
+                    f32 ndc_x0 = -1.0f + 2.0f * (f32)tile_x / (f32)CLUSTER_GRID_X;
+                    f32 ndc_x1 = -1.0f + 2.0f * (f32)(tile_x + 1) / (f32)CLUSTER_GRID_X;
+                    f32 x0 = ndc_x0 * job->tan_half_fov_x;
+                    f32 x1 = ndc_x1 * job->tan_half_fov_x;
+                    __m128 min_x = _mm_set1_ps(MinFloat(x0 * depth_near, x0 * depth_far));
+                    __m128 max_x = _mm_set1_ps(MaxFloat(x1 * depth_near, x1 * depth_far));
+
+                    u32 cluster = slice_first_cluster + tile_y * CLUSTER_GRID_X + tile_x;
+                    u16* cluster_lights = job->cluster_lights + (size_t)cluster * CLUSTER_MAX_LIGHTS;
+                    u32* count = &job->cluster_counts[cluster];
+
+                    // Sphere vs AABB, four lights at a time: squared distance from the
+                    // center to the box, against the squared radius
+                    for (u32 i = 0; i < padded; i += 4)
+                    {
+                        __m128 px = _mm_load_ps(chunk_x + i);
+                        __m128 py = _mm_load_ps(chunk_y + i);
+                        __m128 pz = _mm_load_ps(chunk_z + i);
+                        __m128 dx = _mm_add_ps(_mm_max_ps(_mm_sub_ps(min_x, px), zero), _mm_max_ps(_mm_sub_ps(px, max_x), zero));
+                        __m128 dy = _mm_add_ps(_mm_max_ps(_mm_sub_ps(min_y, py), zero), _mm_max_ps(_mm_sub_ps(py, max_y), zero));
+                        __m128 dz = _mm_add_ps(_mm_max_ps(_mm_sub_ps(min_z, pz), zero), _mm_max_ps(_mm_sub_ps(pz, max_z), zero));
+                        __m128 distance_sq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+                        u32 mask = (u32)_mm_movemask_ps(_mm_cmple_ps(distance_sq, _mm_load_ps(chunk_radius_sq + i)));
+                        if (mask)
+                        {
+                            AppendLights(mask, chunk_index + i, cluster_lights, count, &dropped);
+                        }
+                    }
+                }
+            }
+        }
+
+        job->slice_dropped[slice] = dropped;
+    }
+}
+
+// Bins the lights into the froxel grid of the given camera, one slice per job, and packs
+// the per-cluster lists into out. Everything is allocated from the frame arena.
+// Returns how many light-cluster pairs were dropped because a cluster was full.
+u32 Build(WorkQueue* queue, VMArena* frame_arena, const PointLight* lights, u32 light_count, const glm::mat4& view,
+          f32 fov_degrees, f32 aspect_ratio, f32 near_plane, f32 far_plane, LightClusters* out)
+{
+    if (light_count > MAX_POINT_LIGHTS)
+    {
+        light_count = MAX_POINT_LIGHTS;
+    }
+
+    LightBinningJob job = {};
+    f32* view_x = (f32*)memory::VMArenaAllocAligned(frame_arena, light_count * sizeof(f32) + 16, 16);
+    f32* view_y = (f32*)memory::VMArenaAllocAligned(frame_arena, light_count * sizeof(f32) + 16, 16);
+    f32* view_z = (f32*)memory::VMArenaAllocAligned(frame_arena, light_count * sizeof(f32) + 16, 16);
+    f32* radius = (f32*)memory::VMArenaAllocAligned(frame_arena, light_count * sizeof(f32) + 16, 16);
+    for (u32 i = 0; i < light_count; ++i)
+    {
+        glm::vec4 position = view * glm::vec4(lights[i].position, 1.0f);
+        view_x[i] = position.x;
+        view_y[i] = position.y;
+        view_z[i] = position.z;
+        radius[i] = lights[i].radius;
+    }
+
+    job.view_x = view_x;
+    job.view_y = view_y;
+    job.view_z = view_z;
+    job.radius = radius;
+    job.light_count = light_count;
+    job.tan_half_fov_y = tanf(glm::radians(fov_degrees) * 0.5f);
+    job.tan_half_fov_x = job.tan_half_fov_y * aspect_ratio;
+    job.near_plane = near_plane;
+    job.far_plane = far_plane;
+    job.cluster_lights = (u16*)memory::VMArenaAlloc(frame_arena, (size_t)CLUSTER_COUNT * CLUSTER_MAX_LIGHTS * sizeof(u16));
+    job.cluster_counts = (u32*)memory::VMArenaAlloc(frame_arena, CLUSTER_COUNT * sizeof(u32));
+    job.slice_dropped = (u32*)memory::VMArenaAlloc(frame_arena, CLUSTER_GRID_Z * sizeof(u32));
+    memset(job.cluster_counts, 0, CLUSTER_COUNT * sizeof(u32));
+
+    work_queue::ParallelFor(queue, CLUSTER_GRID_Z, 1, BinSlices, &job);
+
+    // Pack the fixed size per-cluster lists into offset/count ranges over one index list
+    u32 index_count = 0;
+    u32 dropped = 0;
+    for (u32 cluster = 0; cluster < CLUSTER_COUNT; ++cluster)
+    {
+        index_count += job.cluster_counts[cluster];
+    }
+    for (u32 slice = 0; slice < CLUSTER_GRID_Z; ++slice)
+    {
+        dropped += job.slice_dropped[slice];
+    }
+
+    u32* ranges = (u32*)memory::VMArenaAlloc(frame_arena, CLUSTER_COUNT * 2 * sizeof(u32));
+    u16* indices = (u16*)memory::VMArenaAlloc(frame_arena, (index_count + 1) * sizeof(u16));
+    u32 offset = 0;
+    for (u32 cluster = 0; cluster < CLUSTER_COUNT; ++cluster)
+    {
+        u32 count = job.cluster_counts[cluster];
+        ranges[cluster * 2 + 0] = offset;
+        ranges[cluster * 2 + 1] = count;
+        memcpy(indices + offset, job.cluster_lights + (size_t)cluster * CLUSTER_MAX_LIGHTS, count * sizeof(u16));
+        offset += count;
+    }
+
+    out->lights = lights;
+    out->light_count = light_count;
+    out->cluster_ranges = ranges;
+    out->light_indices = indices;
+    out->index_count = index_count;
+    out->near_plane = near_plane;
+    out->far_plane = far_plane;
+    return dropped;
+}
+
+} // namespace light_clusters
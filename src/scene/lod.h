@@ -0,0 +1,55 @@
+#pragma once
+
+#include "core.h"
+#include "renderer/renderer.h"
+#include "utils/handmade_math.h"
+
+#define LOD_CULLED                  0xFFFFFFFFu
+#define LOD_ERROR_THRESHOLD_PIXELS  1.0f
+#define LOD_HYSTERESIS              0.25f   // A coarser LOD must beat the threshold by this fraction
+#define LOD_CULL_THRESHOLD_PIXELS   2.0f    // Objects whose projected diameter is smaller are dropped
+
+namespace lod
+{
+
+// Pixels covered by one world unit at distance 1 along the view axis
+f32 GetProjectionScale(f32 fov_degrees, f32 viewport_height)
+{
+    return viewport_height / (2.0f * tanf(glm::radians(fov_degrees) * 0.5f));
+}
+
+// Picks the coarsest LOD whose projected error stays under the threshold, starting from
+// the current one so that objects sitting on a boundary don't flicker between two LODs.
+// Returns LOD_CULLED for objects too small to matter.
+u32 Select(const MeshLod* lods, u32 lod_count, f32 distance, f32 radius, f32 projection_scale, u32 current_lod)
+{
+    if (lod_count == 0 || distance <= radius)
+    {
+        return 0;
+    }
+
+    f32 pixels_per_unit = projection_scale / distance;
+    f32 projected_diameter = 2.0f * radius * pixels_per_unit;
+    f32 cull_threshold = LOD_CULL_THRESHOLD_PIXELS;
+    if (current_lod == LOD_CULLED)
+    {
+        cull_threshold *= 1.0f + LOD_HYSTERESIS;
+    }
+    if (projected_diameter < cull_threshold)
+    {
+        return LOD_CULLED;
+    }
+
+    u32 result = current_lod < lod_count ? current_lod : lod_count - 1;
+    while (result > 0 && lods[result].error * pixels_per_unit > LOD_ERROR_THRESHOLD_PIXELS)
+    {
+        --result;
+    }
+    while (result + 1 < lod_count && lods[result + 1].error * pixels_per_unit <= LOD_ERROR_THRESHOLD_PIXELS * (1.0f - LOD_HYSTERESIS))
+    {
+        ++result;
+    }
+    return result;
+}
+
+} // namespace lod
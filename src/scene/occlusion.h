@@ -0,0 +1,299 @@
+#pragma once
+
+#include "core.h"
+#include "core/memory.h"
+#include "core/work_queue.h"
+#include "scene/bounds.h"
+
+#include <immintrin.h>
+
+#define OCCLUSION_BUFFER_WIDTH      256
+#define OCCLUSION_BUFFER_HEIGHT     128
+#define OCCLUSION_TILE_SIZE         8
+#define OCCLUSION_TILES_X           (OCCLUSION_BUFFER_WIDTH / OCCLUSION_TILE_SIZE)
+#define OCCLUSION_TILES_Y           (OCCLUSION_BUFFER_HEIGHT / OCCLUSION_TILE_SIZE)
+#define OCCLUSION_BAND_HEIGHT       16 // Rows per raster job, must be a multiple of the tile size
+#define OCCLUSION_BAND_COUNT        (OCCLUSION_BUFFER_HEIGHT / OCCLUSION_BAND_HEIGHT)
+#define OCCLUSION_MIN_W             1e-4f
+#define OCCLUSION_TEST_BATCH        64
+
+// Screen space (pixels, origin bottom-left), depth in [0, 1], counter-clockwise
+struct OcclusionTriangle
+{
+    f32 x[3];
+    f32 y[3];
+    f32 z[3];
+};
+
+struct OcclusionBuffer
+{
+    alignas(16) f32 depth[OCCLUSION_BUFFER_WIDTH * OCCLUSION_BUFFER_HEIGHT];
+
+    // Farthest occluder depth in each tile: anything entirely behind it is hidden
+    alignas(16) f32 tile_max_depth[OCCLUSION_TILES_X * OCCLUSION_TILES_Y];
+
+    glm::mat4 view_projection;
+
+    // Per-frame occluder triangles, allocated from the frame arena in Begin()
+    OcclusionTriangle* triangles;
+    u32 triangle_count;
+    u32 triangle_capacity;
+};
+
+struct OcclusionTestJob
+{
+    const OcclusionBuffer* buffer;
+    const Aabb* bounds;
+    const u32* ids;
+    u8* out_visible;
+};
+
+namespace occlusion
+{
+
+void Begin(OcclusionBuffer* buffer, const glm::mat4& view_projection, VMArena* frame_arena, u32 triangle_capacity)
+{
+    buffer->view_projection = view_projection;
+    buffer->triangles = (OcclusionTriangle*)memory::VMArenaAlloc(frame_arena, triangle_capacity * sizeof(OcclusionTriangle));
+    buffer->triangle_count = 0;
+    buffer->triangle_capacity = buffer->triangles ? triangle_capacity : 0;
+}
+
+// Transforms and sets up an occluder mesh. Back faces and triangles crossing the
+// near plane are dropped: missing occluder area only makes the test more conservative.
+void AddOccluder(OcclusionBuffer* buffer, const glm::mat4& model, const glm::vec3* positions, const u32* indices, u32 index_count)
+{
+    glm::mat4 mvp = buffer->view_projection * model;
+    f32 half_width = 0.5f * (f32)OCCLUSION_BUFFER_WIDTH;
+    f32 half_height = 0.5f * (f32)OCCLUSION_BUFFER_HEIGHT;
+
+    for (u32 i = 0; i + 2 < index_count && buffer->triangle_count < buffer->triangle_capacity; i += 3)
+    {
+        OcclusionTriangle tri = {};
+        bool clipped = false;
+        for (u32 v = 0; v < 3; ++v)
+        {
+            glm::vec4 clip = mvp * glm::vec4(positions[indices[i + v]], 1.0f);
+            if (clip.w < OCCLUSION_MIN_W || clip.z < -clip.w)
+            {
+                clipped = true;
+                break;
+            }
+            f32 inv_w = 1.0f / clip.w;
+            tri.x[v] = (clip.x * inv_w + 1.0f) * half_width;
+            tri.y[v] = (clip.y * inv_w + 1.0f) * half_height;
+            tri.z[v] = clip.z * inv_w * 0.5f + 0.5f;
+        }
+        if (clipped)
+        {
+            continue;
+        }
+
+        f32 area = (tri.x[1] - tri.x[0]) * (tri.y[2] - tri.y[0]) - (tri.y[1] - tri.y[0]) * (tri.x[2] - tri.x[0]);
+        if (area <= 0.0f)
+        {
+            continue;
+        }
+
+        f32 min_x = MinFloat(tri.x[0], MinFloat(tri.x[1], tri.x[2]));
+        f32 max_x = MaxFloat(tri.x[0], MaxFloat(tri.x[1], tri.x[2]));
+        f32 min_y = MinFloat(tri.y[0], MinFloat(tri.y[1], tri.y[2]));
+        f32 max_y = MaxFloat(tri.y[0], MaxFloat(tri.y[1], tri.y[2]));
+        if (max_x < 0.0f || min_x >= (f32)OCCLUSION_BUFFER_WIDTH || max_y < 0.0f || min_y >= (f32)OCCLUSION_BUFFER_HEIGHT)
+        {
+            continue;
+        }
+
+        buffer->triangles[buffer->triangle_count++] = tri;
+    }
+}
+
+internal void RasterizeTriangleRows(OcclusionBuffer* buffer, const OcclusionTriangle& tri, i32 row_begin, i32 row_end)
+{
+    f32 min_x = MinFloat(tri.x[0], MinFloat(tri.x[1], tri.x[2]));
+    f32 max_x = MaxFloat(tri.x[0], MaxFloat(tri.x[1], tri.x[2]));
+    f32 min_y = MinFloat(tri.y[0], MinFloat(tri.y[1], tri.y[2]));
+    f32 max_y = MaxFloat(tri.y[0], MaxFloat(tri.y[1], tri.y[2]));
+
+    i32 y_begin = MaxInt(row_begin, FloorFloatToInt(min_y));
+    i32 y_end = MinInt(row_end, CeilFloatToInt(max_y));
+    i32 x_begin = MaxInt(0, FloorFloatToInt(min_x)) & ~3;
+    i32 x_end = MinInt(OCCLUSION_BUFFER_WIDTH, CeilFloatToInt(max_x));
+    if (y_begin >= y_end || x_begin >= x_end)
+    {
+        return;
+    }
+
+    // Edge i is opposite vertex i: E(p) = a * px + b * py + c, positive inside
+    f32 edge_a[3];
+    f32 edge_b[3];
+    f32 edge_c[3];
+    for (i32 i = 0; i < 3; ++i)
+    {
+        i32 v0 = (i + 1) % 3;
+        i32 v1 = (i + 2) % 3;
+        edge_a[i] = tri.y[v0] - tri.y[v1];
+        edge_b[i] = tri.x[v1] - tri.x[v0];
+        edge_c[i] = -(edge_a[i] * tri.x[v0] + edge_b[i] * tri.y[v0]);
+    }
+
+    // Depth is affine in screen space: the edge functions are unnormalized barycentrics
+    f32 inv_area = 1.0f / (edge_a[0] * tri.x[0] + edge_b[0] * tri.y[0] + edge_c[0]);
+    f32 z_a = (tri.z[0] * edge_a[0] + tri.z[1] * edge_a[1] + tri.z[2] * edge_a[2]) * inv_area;
+    f32 z_b = (tri.z[0] * edge_b[0] + tri.z[1] * edge_b[1] + tri.z[2] * edge_b[2]) * inv_area;
+    f32 z_c = (tri.z[0] * edge_c[0] + tri.z[1] * edge_c[1] + tri.z[2] * edge_c[2]) * inv_area;
+
+    __m128 a0 = _mm_set1_ps(edge_a[0]);
+    __m128 a1 = _mm_set1_ps(edge_a[1]);
+    __m128 a2 = _mm_set1_ps(edge_a[2]);
+    __m128 za = _mm_set1_ps(z_a);
+    __m128 zero = _mm_setzero_ps();
+    __m128 lane_offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+
+    for (i32 y = y_begin; y < y_end; ++y)
+    {
+        f32 py = (f32)y + 0.5f;
+        __m128 row0 = _mm_set1_ps(edge_b[0] * py + edge_c[0]);
+        __m128 row1 = _mm_set1_ps(edge_b[1] * py + edge_c[1]);
+        __m128 row2 = _mm_set1_ps(edge_b[2] * py + edge_c[2]);
+        __m128 row_z = _mm_set1_ps(z_b * py + z_c);
+        f32* depth_row = buffer->depth + y * OCCLUSION_BUFFER_WIDTH;
+
+        for (i32 x = x_begin; x < x_end; x += 4)
+        {
+            __m128 px = _mm_add_ps(_mm_set1_ps((f32)x), lane_offsets);
+            __m128 w0 = _mm_add_ps(_mm_mul_ps(a0, px), row0);
+            __m128 w1 = _mm_add_ps(_mm_mul_ps(a1, px), row1);
+            __m128 w2 = _mm_add_ps(_mm_mul_ps(a2, px), row2);
+            __m128 inside = _mm_and_ps(_mm_cmpge_ps(w0, zero), _mm_and_ps(_mm_cmpge_ps(w1, zero), _mm_cmpge_ps(w2, zero)));
+            if (_mm_movemask_ps(inside) == 0)
+            {
+                continue;
+            }
+
+            __m128 z = _mm_add_ps(_mm_mul_ps(za, px), row_z);
+            __m128 depth = _mm_load_ps(depth_row + x);
+            __m128 nearest = _mm_min_ps(depth, z);
+            _mm_store_ps(depth_row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, depth)));
+        }
+    }
+}
+
+// Each band owns its rows of the depth buffer and its row of tiles, so bands never share writes
+internal void RasterizeBands(void* data, u32 begin, u32 end)
+{
+    OcclusionBuffer* buffer = (OcclusionBuffer*)data;
+    __m128 far_depth = _mm_set1_ps(1.0f);
+
+    for (u32 band = begin; band < end; ++band)
+    {
+        i32 row_begin = (i32)band * OCCLUSION_BAND_HEIGHT;
+        i32 row_end = row_begin + OCCLUSION_BAND_HEIGHT;
+
+        f32* band_depth = buffer->depth + row_begin * OCCLUSION_BUFFER_WIDTH;
+        for (i32 i = 0; i < OCCLUSION_BAND_HEIGHT * OCCLUSION_BUFFER_WIDTH; i += 4)
+        {
+            _mm_store_ps(band_depth + i, far_depth);
+        }
+
+        for (u32 t = 0; t < buffer->triangle_count; ++t)
+        {
+            RasterizeTriangleRows(buffer, buffer->triangles[t], row_begin, row_end);
+        }
+
+        for (i32 tile_y = row_begin / OCCLUSION_TILE_SIZE; tile_y < row_end / OCCLUSION_TILE_SIZE; ++tile_y)
+        {
+            for (i32 tile_x = 0; tile_x < OCCLUSION_TILES_X; ++tile_x)
+            {
+                __m128 tile_max = _mm_setzero_ps();
+                for (i32 y = 0; y < OCCLUSION_TILE_SIZE; ++y)
+                {
+                    const f32* row = buffer->depth + (tile_y * OCCLUSION_TILE_SIZE + y) * OCCLUSION_BUFFER_WIDTH + tile_x * OCCLUSION_TILE_SIZE;
+                    tile_max = _mm_max_ps(tile_max, _mm_max_ps(_mm_load_ps(row), _mm_load_ps(row + 4)));
+                }
+                tile_max = _mm_max_ps(tile_max, _mm_shuffle_ps(tile_max, tile_max, _MM_SHUFFLE(1, 0, 3, 2)));
+                tile_max = _mm_max_ps(tile_max, _mm_shuffle_ps(tile_max, tile_max, _MM_SHUFFLE(2, 3, 0, 1)));
+                buffer->tile_max_depth[tile_y * OCCLUSION_TILES_X + tile_x] = _mm_cvtss_f32(tile_max);
+            }
+        }
+    }
+}
+
+void Rasterize(OcclusionBuffer* buffer, WorkQueue* queue)
+{
+    work_queue::ParallelFor(queue, OCCLUSION_BAND_COUNT, 1, RasterizeBands, buffer);
+}
+
+// Conservative: only returns false when the whole box lies behind the occluders
+bool IsVisible(const OcclusionBuffer* buffer, const Aabb& box)
+{
+    f32 min_x = FLT_MAX;
+    f32 min_y = FLT_MAX;
+    f32 max_x = -FLT_MAX;
+    f32 max_y = -FLT_MAX;
+    f32 min_z = FLT_MAX;
+    for (u32 i = 0; i < 8; ++i)
+    {
+        glm::vec4 corner = glm::vec4((i & 1) ? box.max.x : box.min.x,
+                                     (i & 2) ? box.max.y : box.min.y,
+                                     (i & 4) ? box.max.z : box.min.z,
+                                     1.0f);
+        glm::vec4 clip = buffer->view_projection * corner;
+        if (clip.w < OCCLUSION_MIN_W)
+        {
+            return true; // Straddles the camera plane
+        }
+        f32 inv_w = 1.0f / clip.w;
+        f32 x = (clip.x * inv_w + 1.0f) * 0.5f * (f32)OCCLUSION_BUFFER_WIDTH;
+        f32 y = (clip.y * inv_w + 1.0f) * 0.5f * (f32)OCCLUSION_BUFFER_HEIGHT;
+        min_x = MinFloat(min_x, x);
+        max_x = MaxFloat(max_x, x);
+        min_y = MinFloat(min_y, y);
+        max_y = MaxFloat(max_y, y);
+        min_z = MinFloat(min_z, clip.z * inv_w * 0.5f + 0.5f);
+    }
+
+    if (max_x < 0.0f || min_x >= (f32)OCCLUSION_BUFFER_WIDTH || max_y < 0.0f || min_y >= (f32)OCCLUSION_BUFFER_HEIGHT)
+    {
+        return true; // Off screen, frustum culling's call
+    }
+
+    i32 tile_x_begin = MaxInt(0, FloorFloatToInt(min_x)) / OCCLUSION_TILE_SIZE;
+    i32 tile_x_end = MinInt(OCCLUSION_BUFFER_WIDTH - 1, FloorFloatToInt(max_x)) / OCCLUSION_TILE_SIZE;
+    i32 tile_y_begin = MaxInt(0, FloorFloatToInt(min_y)) / OCCLUSION_TILE_SIZE;
+    i32 tile_y_end = MinInt(OCCLUSION_BUFFER_HEIGHT - 1, FloorFloatToInt(max_y)) / OCCLUSION_TILE_SIZE;
+
+    for (i32 tile_y = tile_y_begin; tile_y <= tile_y_end; ++tile_y)
+    {
+        for (i32 tile_x = tile_x_begin; tile_x <= tile_x_end; ++tile_x)
+        {
+            if (min_z <= buffer->tile_max_depth[tile_y * OCCLUSION_TILES_X + tile_x])
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+internal void TestBatch(void* data, u32 begin, u32 end)
+{
+    OcclusionTestJob* job = (OcclusionTestJob*)data;
+    for (u32 i = begin; i < end; ++i)
+    {
+        job->out_visible[i] = IsVisible(job->buffer, job->bounds[job->ids[i]]) ? 1 : 0;
+    }
+}
+
+// out_visible[i] receives the result for bounds[ids[i]]
+void TestAabbs(const OcclusionBuffer* buffer, WorkQueue* queue, const Aabb* bounds, const u32* ids, u32 count, u8* out_visible)
+{
+    OcclusionTestJob job = {};
+    job.buffer = buffer;
+    job.bounds = bounds;
+    job.ids = ids;
+    job.out_visible = out_visible;
+    work_queue::ParallelFor(queue, count, OCCLUSION_TEST_BATCH, TestBatch, &job);
+}
+
+} // namespace occlusion
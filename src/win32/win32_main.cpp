@@ -1,16 +1,26 @@
 #include "win32/win32_main.h"
 #include "win32/win32_input.h"
+#include "win32/win32_regression.h"
 
 #include "utils/handmade_math.h"
 
 #include "core/memory.h"
+#include "core/work_queue.h"
+#include "core/bulk_memory.h"
 
 #include "renderer/renderer.h"
+#include "renderer/dynamic_resolution.h"
+#include "renderer/sprite_blitter.h"
+#include "renderer/block_compression.h"
+#include "renderer/present.h"
+#include "resources/png_decoder.h"
 #include "app/app.h"
 
 #define APP_NAME "handmade-renderer"
 #define LAPP_NAME L"handmade-renderer"
 
+#define WIN32_FRAMES_IN_FLIGHT 2 // 1 for lowest latency, up to MAX_FRAMES_IN_FLIGHT for throughput
+
 global bool g_running;
 global LONG g_window_style;
 global LONG g_window_ex_style;
@@ -22,6 +32,8 @@ global bool g_show_debug_info = true;
 
 global Win32AppPerfData g_perf_data;
 global Win32Framebuffer g_framebuffer;
+global WorkQueue g_work_queue;
+global DynamicResolution g_dynamic_resolution;
 
 internal HWND Win32_CreateMainGameWindow(_In_ HINSTANCE instance);
 internal BOOL Win32_AppIsAlreadyRunning();
@@ -30,6 +42,9 @@ internal void Win32_ResizeDIBSection(i32 width, i32 height);
 internal void Win32_ProcessPendingMessages(HWND window, Input& input);
 internal LARGE_INTEGER Win32_GetWallClock();
 internal i64 Win32_GetMicroSecondsElapsed(LARGE_INTEGER start, LARGE_INTEGER end);
+internal void Win32_InitWorkQueue(WorkQueue* queue, u32 worker_count);
+internal void Win32_DrawRenderQueue(RenderQueue* render_queue, RenderMode mode);
+internal void Win32_RenderFrame(RenderQueue* render_queue, f32 render_scale);
 
 internal LRESULT CALLBACK Win32_WindowProc(HWND window, UINT message, WPARAM wParam, LPARAM lParam)
 {
@@ -55,6 +70,15 @@ internal LRESULT CALLBACK Win32_WindowProc(HWND window, UINT message, WPARAM wPa
             renderer::Resize(width, height);
         } break;
 
+        case WM_PAINT:
+        {
+            // Whatever got uncovered is not on screen anymore, the next present sends the whole frame
+            PAINTSTRUCT paint;
+            BeginPaint(window, &paint);
+            EndPaint(window, &paint);
+            present::InvalidateWindow(window);
+        } break;
+
         default:
         {
             result = DefWindowProc(window, message, wParam, lParam);
@@ -67,9 +91,11 @@ internal LRESULT CALLBACK Win32_WindowProc(HWND window, UINT message, WPARAM wPa
 i32 __stdcall WinMain(HINSTANCE instance, HINSTANCE prev_instance, LPSTR cmd_line, i32 show_cmd)
 {
     UNREFERENCED_PARAMETER(prev_instance);
-    UNREFERENCED_PARAMETER(cmd_line);
     UNREFERENCED_PARAMETER(show_cmd);
 
+    RegressionOptions regression_options;
+    Win32_ParseRegressionOptions(cmd_line, &regression_options);
+
     HMODULE nt_dll_module_handle;
 
     if ((nt_dll_module_handle = GetModuleHandleA("ntdll.dll")) == NULL)
@@ -131,6 +157,44 @@ i32 __stdcall WinMain(HINSTANCE instance, HINSTANCE prev_instance, LPSTR cmd_lin
 
     NtQueryTimerResolution(&g_perf_data.minimum_timer_resolution, &g_perf_data.maximum_timer_resolution, &g_perf_data.current_timer_resolution);
     GetSystemInfo(&g_perf_data.system_info);
+
+    // Keep one logical processor for the main thread, which also helps drain the queue
+    u32 worker_count = g_perf_data.system_info.dwNumberOfProcessors > 1 ? (u32)g_perf_data.system_info.dwNumberOfProcessors - 1 : 0;
+    Win32_InitWorkQueue(&g_work_queue, worker_count);
+    app_memory.work_queue = &g_work_queue;
+
+#if SPRITE_BLITTER_BENCHMARK
+    {
+        VMArena benchmark_arena = {};
+        memory::InitVMArena(&benchmark_arena, Megabytes(64));
+        sprite_blitter::Benchmark(&g_work_queue, &benchmark_arena);
+        memory::VMArenaFree(&benchmark_arena);
+    }
+#endif
+#if BULK_MEMORY_BENCHMARK
+    {
+        VMArena benchmark_arena = {};
+        memory::InitVMArena(&benchmark_arena, Megabytes(768));
+        bulk_memory::Benchmark(&g_work_queue, &benchmark_arena);
+        memory::VMArenaFree(&benchmark_arena);
+    }
+#endif
+#if BLOCK_COMPRESSION_BENCHMARK
+    {
+        VMArena benchmark_arena = {};
+        memory::InitVMArena(&benchmark_arena, Megabytes(16));
+        block_compression::Benchmark(&g_work_queue, &benchmark_arena);
+        memory::VMArenaFree(&benchmark_arena);
+    }
+#endif
+#if PNG_DECODER_BENCHMARK
+    {
+        VMArena benchmark_arena = {};
+        memory::InitVMArena(&benchmark_arena, Megabytes(64));
+        png_decoder::Benchmark(&benchmark_arena);
+        memory::VMArenaFree(&benchmark_arena);
+    }
+#endif
     GetSystemTimeAsFileTime((FILETIME*)&g_perf_data.previous_system_time);
 
     // TODO: Check for memory failures
@@ -141,17 +205,32 @@ i32 __stdcall WinMain(HINSTANCE instance, HINSTANCE prev_instance, LPSTR cmd_lin
 
         u64 elapsed_cycles_accumulator = 0;
         u64 elapsed_cycles_accumulator_cooked = 0;
+        f32 gpu_ms_accumulator = 0.0f;
+        u32 gpu_frames_resolved = 0;
 
         LARGE_INTEGER frame_start = Win32_GetWallClock();
         u64 cycle_count_start = __rdtsc();
         i64 elapsed_micro_seconds = 0;
 
+        LARGE_INTEGER startup_start = Win32_GetWallClock();
         renderer::Init(window); // Initialize OpenGL context
+        renderer::SetMaxFramesInFlight(WIN32_FRAMES_IN_FLIGHT);
+        dynamic_resolution::Init(&g_dynamic_resolution, MIN_RENDER_SCALE, MAX_RENDER_SCALE, TARGET_SECONDS_PER_FRAME * 1000.0f);
+        u32 render_scale_samples = 0;
+        f32 render_scale_accumulator = 0.0f;
+
+        if (regression_options.enabled)
+        {
+            return Win32_RunRegression(window, app_memory, &regression_options);
+        }
 
         ShowWindow(window, SW_SHOW);
 
         while (g_running)
         {
+            // Throttle before reading input so it is never more than N frames old on screen
+            renderer::WaitForFrameLatency();
+
             old_input = new_input;
             new_input.mouse.wheel_value = 0;
             Win32_ProcessPendingMessages(window, new_input);
@@ -160,15 +239,17 @@ i32 __stdcall WinMain(HINSTANCE instance, HINSTANCE prev_instance, LPSTR cmd_lin
             AppUpdate(app_memory, render_queue, new_input, old_input, g_window_width, g_window_height, (float)(elapsed_micro_seconds) / (1000.0f * 1000.f)); // Fill Render
 
             // Renderer code
-            renderer::ClearScreen(0.2f, 0.3f, 0.3f, 1.0f);
-            for (u64 i = 0; i < render_queue.command_count; ++i)
+            Win32_RenderFrame(&render_queue, g_dynamic_resolution.scale);
+#if !RENDERER_SOFTWARE
+            SwapBuffers(GetDC(window));
+#endif
+
+            if (g_perf_data.total_frame_rendered == 0)
             {
-                renderer::Draw(&render_queue.commands[i]);
+                // Startup benchmark: context creation, resource/shader creation and the first frame
+                printf("Startup took %.02f ms\n", (f32)Win32_GetMicroSecondsElapsed(startup_start, Win32_GetWallClock()) * 0.001f);
             }
 
-            renderer::Present();
-            SwapBuffers(GetDC(window));
-
             //Win32_BlitDIBSection(window);
             ++g_perf_data.total_frame_rendered;
 
@@ -177,6 +258,7 @@ i32 __stdcall WinMain(HINSTANCE instance, HINSTANCE prev_instance, LPSTR cmd_lin
 
             elapsed_micro_seconds = Win32_GetMicroSecondsElapsed(frame_start, frame_end);
             elapsed_micro_seconds_accumulator += elapsed_micro_seconds;
+            f32 raw_frame_ms = (f32)elapsed_micro_seconds * 0.001f;
 
             u64 elapsed_cycles = cycle_count_end - cycle_count_start;
             elapsed_cycles_accumulator += elapsed_cycles;
@@ -193,15 +275,45 @@ i32 __stdcall WinMain(HINSTANCE instance, HINSTANCE prev_instance, LPSTR cmd_lin
                     elapsed_micro_seconds = Win32_GetMicroSecondsElapsed(frame_start, frame_end);
                 }
             }
-            else
-            {
-                OutputDebugStringA("Frame took too long!\n");
-            }
             elapsed_micro_seconds_accumulator_cooked += elapsed_micro_seconds;
 
             elapsed_cycles = __rdtsc() - cycle_count_start;
             elapsed_cycles_accumulator_cooked += elapsed_cycles;
 
+            // Resolution only helps GPU bound frames, so steer on GPU time when the queries
+            // deliver and fall back on the CPU time before the sleep otherwise
+            f32 controller_ms = raw_frame_ms;
+            GpuFrameStats gpu_frame;
+            bool gpu_frame_resolved = renderer::GetGpuFrameStats(&gpu_frame);
+            if (gpu_frame_resolved)
+            {
+                controller_ms = gpu_frame.frame_gpu_ms;
+            }
+
+            f32 previous_scale = g_dynamic_resolution.scale;
+            f32 render_scale = dynamic_resolution::Update(&g_dynamic_resolution, controller_ms);
+            if (render_scale != previous_scale && g_show_debug_info)
+            {
+                i32 render_width, render_height;
+                renderer::SetRenderScale(render_scale);
+                renderer::GetRenderResolution(&render_width, &render_height);
+                printf("Render scale %.02f -> %.02f (%dx%d), smoothed frame %.02f ms\n",
+                       previous_scale, render_scale, render_width, render_height, g_dynamic_resolution.smoothed_ms);
+            }
+            if (render_scale_samples == 0 || render_scale < g_perf_data.render_scale.min) g_perf_data.render_scale.min = render_scale;
+            if (render_scale_samples == 0 || render_scale > g_perf_data.render_scale.max) g_perf_data.render_scale.max = render_scale;
+            render_scale_accumulator += render_scale;
+            ++render_scale_samples;
+
+            if (gpu_frame_resolved)
+            {
+                g_perf_data.gpu_frame = gpu_frame;
+                if (gpu_frames_resolved == 0 || gpu_frame.frame_gpu_ms < g_perf_data.ms_gpu.min) g_perf_data.ms_gpu.min = gpu_frame.frame_gpu_ms;
+                if (gpu_frames_resolved == 0 || gpu_frame.frame_gpu_ms > g_perf_data.ms_gpu.max) g_perf_data.ms_gpu.max = gpu_frame.frame_gpu_ms;
+                gpu_ms_accumulator += gpu_frame.frame_gpu_ms;
+                ++gpu_frames_resolved;
+            }
+
             if ((g_perf_data.total_frame_rendered % CALCULATE_PERF_TIME_EVERY_X_FRAMES) == 0)
             {
                 g_perf_data.ms_raw.avg = (f32)elapsed_micro_seconds_accumulator / (f32)CALCULATE_PERF_TIME_EVERY_X_FRAMES * 0.001f;
@@ -217,10 +329,44 @@ i32 __stdcall WinMain(HINSTANCE instance, HINSTANCE prev_instance, LPSTR cmd_lin
                 g_perf_data.fps_cooked.min = 1.0f / (g_perf_data.ms_cooked.max * 0.001f);
                 g_perf_data.fps_cooked.max = 1.0f / (g_perf_data.ms_cooked.min * 0.001f);
 
+                g_perf_data.ms_gpu.avg = gpu_frames_resolved > 0 ? gpu_ms_accumulator / (f32)gpu_frames_resolved : 0.0f;
+                g_perf_data.render_scale.avg = render_scale_accumulator / (f32)render_scale_samples;
+
+                if (g_show_debug_info)
+                {
+                    printf("CPU %.02f ms, GPU %.02f ms (min %.02f, max %.02f)\n",
+                           g_perf_data.ms_raw.avg, g_perf_data.ms_gpu.avg, g_perf_data.ms_gpu.min, g_perf_data.ms_gpu.max);
+
+                    FramePacingStats pacing;
+                    renderer::GetFramePacingStats(&pacing);
+                    printf("  %u frames in flight, fence wait %.02f ms, present interval %.02f ms +/- %.02f, %u timeouts\n",
+                           pacing.max_frames_in_flight, pacing.avg_wait_ms, pacing.avg_present_interval_ms,
+                           pacing.present_jitter_ms, pacing.timeout_count);
+                    printf("  Render scale %.02f (min %.02f, max %.02f)\n",
+                           g_perf_data.render_scale.avg, g_perf_data.render_scale.min, g_perf_data.render_scale.max);
+                    for (u32 i = 0; i < g_perf_data.gpu_frame.scope_count; ++i)
+                    {
+                        const GpuScopeStats& scope = g_perf_data.gpu_frame.scopes[i];
+                        printf("  %*s%-16s %6.03f ms", (int)scope.depth * 2, "", scope.label, scope.gpu_ms);
+                        if (scope.has_pipeline_stats)
+                        {
+                            printf("  %llu prims, %llu vs, %llu fs",
+                                   (unsigned long long)scope.pipeline.primitives_submitted,
+                                   (unsigned long long)scope.pipeline.vertex_shader_invocations,
+                                   (unsigned long long)scope.pipeline.fragment_shader_invocations);
+                        }
+                        printf("\n");
+                    }
+                }
+
                 elapsed_micro_seconds_accumulator = 0;
                 elapsed_micro_seconds_accumulator_cooked = 0;
                 elapsed_cycles_accumulator = 0;
                 elapsed_cycles_accumulator_cooked = 0;
+                gpu_ms_accumulator = 0.0f;
+                gpu_frames_resolved = 0;
+                render_scale_accumulator = 0.0f;
+                render_scale_samples = 0;
 
                 GetProcessHandleCount(GetCurrentProcess(), &g_perf_data.handle_count);
                 GetProcessMemoryInfo(GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS*)&g_perf_data.mem_info, sizeof(g_perf_data.mem_info));
@@ -279,6 +425,57 @@ i32 __stdcall WinMain(HINSTANCE instance, HINSTANCE prev_instance, LPSTR cmd_lin
     return 0;
 }
 
+// The scene renders at the given scale, 2D sprites go on top at window resolution.
+// Ends with Present(), the buffer swap is up to the caller.
+internal void Win32_RenderFrame(RenderQueue* render_queue, f32 render_scale)
+{
+    renderer::BeginFrame();
+    renderer::SetRenderScale(render_scale);
+    if (render_queue->light_clusters)
+    {
+        renderer::BeginGpuScope("Light upload");
+        renderer::UploadLightClusters(render_queue->light_clusters);
+        renderer::EndGpuScope();
+    }
+    renderer::BeginScene();
+    renderer::BeginGpuScope("Clear");
+    renderer::ClearScreen(0.2f, 0.3f, 0.3f, 1.0f);
+    renderer::EndGpuScope();
+    Win32_DrawRenderQueue(render_queue, RenderMode::MESH);
+    renderer::BeginGpuScope("Upscale");
+    renderer::EndScene();
+    renderer::EndGpuScope();
+    Win32_DrawRenderQueue(render_queue, RenderMode::SPRITE);
+
+    renderer::Present();
+}
+
+// Draws the commands of one mode in submission order, inside a single GPU scope
+internal void Win32_DrawRenderQueue(RenderQueue* render_queue, RenderMode mode)
+{
+    bool scope_open = false;
+    for (u64 i = 0; i < render_queue->command_count; ++i)
+    {
+        RenderCommand* cmd = &render_queue->commands[i];
+        if (cmd->mode != mode)
+        {
+            continue;
+        }
+        if (!scope_open)
+        {
+            renderer::BeginGpuScope(mode == RenderMode::MESH ? "Meshes" : "Sprites");
+            scope_open = true;
+        }
+
+        renderer::Draw(cmd);
+    }
+
+    if (scope_open)
+    {
+        renderer::EndGpuScope();
+    }
+}
+
 internal LARGE_INTEGER Win32_GetWallClock()
 {
     LARGE_INTEGER result;
@@ -514,7 +711,14 @@ internal void Win32_ProcessPendingMessages(HWND window, Input& input)
 }
 
 #include "win32/win32_input.cpp"
+#include "win32/win32_work_queue.cpp"
+#include "win32/win32_present.cpp"
+#include "win32/win32_regression.cpp"
+#if RENDERER_SOFTWARE
+#include "win32/win32_software_renderer.cpp"
+#else
 #include "win32/win32_opengl.cpp"
+#endif
 
 #include "win32/resources/win32_resources_catalog.cpp"
 
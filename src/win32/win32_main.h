@@ -10,6 +10,8 @@
 #pragma warning(pop)
 
 #include "core.h"
+#include "core/work_queue.h"
+#include "renderer/renderer.h"
 
 #define WIN32_STATE_FILE_NAME_COUNT MAX_PATH
 
@@ -37,6 +39,10 @@ struct Win32AppPerfData
     Win32Stat<u64> cycles_raw;
     Win32Stat<u64> cycles_cooked;
 
+    Win32Stat<f32> ms_gpu;      // Whole frame on the GPU, from timestamp queries
+    GpuFrameStats gpu_frame;    // Latest per pass breakdown, a few frames old
+    Win32Stat<f32> render_scale; // Dynamic resolution scale per axis
+
 	i64 perf_frenquency;	
 
 	//MONITORINFO MonitorInfo;
@@ -72,3 +78,23 @@ struct Win32Framebuffer
     BITMAPINFO bitmap_info;
     Framebuffer buffer;
 };
+
+struct WorkQueueEntry
+{
+    WorkQueueCallback* callback;
+    void* data;
+};
+
+struct WorkQueue
+{
+    u32 volatile completion_goal;
+    u32 volatile completion_count;
+
+    u32 volatile next_entry_to_write;
+    u32 volatile next_entry_to_read;
+
+    HANDLE semaphore_handle;
+    u32 worker_count;
+
+    WorkQueueEntry entries[WORK_QUEUE_MAX_ENTRIES];
+};
@@ -1,7 +1,12 @@
 #include "renderer/renderer.h"
+#include "renderer/vertex_format.h"
+#include "renderer/pixel_convert.h"
+#include "renderer/mipmap.h"
+#include "renderer/block_compression.h"
 
 #include "win32_main.h"
 #include "resources/resources_catalog.h"
+#include "resources/png_decoder.h"
 
 #pragma warning(push, 0)
 #include "glad/gl.h"
@@ -11,6 +16,45 @@
 #pragma warning(pop)
 
 #include <vector>
+#include <string.h>
+
+#define SHADER_CACHE_DIRECTORY  "shader_cache"
+#define SHADER_CACHE_MAGIC      0x48534243 // "CBSH"
+#define SHADER_CACHE_VERSION    1
+
+// KHR_parallel_shader_compile is not part of the generated glad core loader
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR  0x91B0
+#define GL_COMPLETION_STATUS_KHR            0x91B1
+typedef void (GLAD_API_PTR *PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+
+// S3TC (BC1/BC3) is an extension the glad core loader leaves out, RGTC and BPTC are core
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT    0x83F1
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT    0x83F3
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT  0x8C4D  // EXT_texture_sRGB
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT  0x8C4F
+
+// Bound in place of programs that are still compiling or failed to build
+static const char* fallback_vertex_shader_source = R"(
+    #version 330 core
+    layout (location = 0) in vec3 aPos;
+
+    uniform mat4 model;
+    uniform mat4 view;
+    uniform mat4 projection;
+
+    void main() {
+        gl_Position = projection * view * model * vec4(aPos, 1.0);
+    }
+)";
+
+static const char* fallback_fragment_shader_source = R"(
+    #version 330 core
+    out vec4 FragColor;
+
+    void main() {
+        FragColor = vec4(0.5, 0.5, 0.5, 1.0);
+    }
+)";
 
 internal void CheckOpenGLError(const char* location)
 {
@@ -36,31 +80,340 @@ struct GLMesh {
     GLuint vao;
     GLuint vbo;
     GLuint ebo;
-    int index_count;
+    GLenum index_type;      // GL_UNSIGNED_SHORT whenever the vertex count allows it
+    u32 index_size;
+    glm::mat4 dequantize;   // Maps the snorm16 positions back into the mesh bounds
+    MeshLod lods[MAX_MESH_LODS];
+    u32 lod_count;
+    bool is_ready;          // False until the upload thread's buffers are visible to us
+    bool upload_pending;    // An upload job still owns the buffers
+    bool is_destroyed;
+    u32 generation;         // Of the slot, see MakeHandleId()
+};
+
+// Written in front of every cached program binary
+struct ShaderCacheHeader {
+    u32 magic;
+    u32 version;
+    u64 key;
+    u32 binary_format;
+    u32 binary_size;
+};
+
+struct GLShader {
+    GLuint program;
+    GLuint vertex_shader;   // Only alive while the program is pending
+    GLuint fragment_shader;
+    u64 cache_key;
+    LARGE_INTEGER create_time;
+    ShaderStatus status;
+    bool is_destroyed;
+    u32 generation;
 };
 
 struct GLSprite {
     GLuint texture_id;
     float width;
     float height;
+    bool is_ready;          // False until the streamed texels are on the GPU
+    bool upload_pending;    // An upload job still owns the texture
+    bool is_destroyed;
+    bool is_srgb;           // Drawn with sRGB writes, so the decode on sampling round trips
+    u32 generation;
+};
+
+// A texture waiting for its texels to go through the staging buffer.
+// The pixels point into the resource catalog and must outlive the upload.
+struct TextureUpload {
+    u32 sprite_id;
+    const u8* pixels;
+    i32 level;
+    i32 width;
+    i32 height;
+    i32 next_row;
+    bool is_last_level;     // Levels are queued in order, the sprite is ready after the last one
+};
+
+// Staging memory written during one frame, released once the GPU consumed it
+struct StagingRegion {
+    GLsync fence;
+    u32 end_offset;
+    u32 size;               // Including any padding skipped when wrapping
+    std::vector<u32> completed_sprites;
+};
+
+enum class UploadJobType
+{
+    MESH,
+    SPRITE
+};
+
+// Work for the upload thread. Mesh data is copied in, since the caller's memory is usually
+// scratch; sprite texels point into the resource catalog like the streamed uploads do.
+struct UploadJob {
+    UploadJobType type;
+    u32 id;
+
+    std::vector<Vertex> vertices;
+    std::vector<int> indices;
+    const u8* pixels;
+    i32 width;
+    i32 height;
+
+    // Filled in by the upload thread
+    GLuint vbo;
+    GLuint ebo;
+    GLuint texture;
+    GLenum index_type;
+    u32 index_size;
+    glm::mat4 dequantize;
+    GLsync fence;
+};
+
+enum class RetiredType
+{
+    MESH,
+    SPRITE,
+    SHADER
+};
+
+struct RetiredResource {
+    RetiredType type;
+    u32 id;
+};
+
+// Resources destroyed while building one frame. The GL objects are deleted and the slot is
+// recycled once that frame's fence has signaled, so in-flight draws never lose them.
+struct RetireList {
+    u64 frame;
+    std::vector<RetiredResource> resources;
+};
+
+#define FRAME_FENCE_TIMEOUT_NS      100000000ull   // Give up on a frame fence after 100ms
+#define FRAME_FENCE_MAX_TIMEOUTS    20             // Before dropping a fence slot's old fence, assume a hung GPU after 2s
+#define FRAME_PACING_SMOOTHING      0.1f
+
+#define GPU_QUERY_FRAME_LATENCY     4   // Frames a query result gets before its slot is reused
+#define GPU_PIPELINE_STAT_COUNT     4
+
+struct GLGpuScope {
+    const char* label;
+    u32 depth;
+    GLuint begin_query;     // GL_TIMESTAMP queries, so scopes can nest
+    GLuint end_query;
+    GLuint stat_queries[GPU_PIPELINE_STAT_COUNT];
+    bool has_pipeline_stats;
+};
+
+struct GLGpuQueryFrame {
+    GLGpuScope scopes[MAX_GPU_SCOPES];
+    u32 scope_count;
+    GLuint frame_begin_query;
+    GLuint frame_end_query;
+    u64 frame_index;
+    bool is_pending;        // Submitted, results not read back yet
 };
 
 // Global state or a static array to manage resources
 // (In a real engine, you'd have a robust resource manager)
 global std::vector<GLMesh> g_meshes;
-global std::vector<GLuint> g_shaders;
+global std::vector<GLShader> g_shaders;
 global std::vector<GLSprite> g_sprites;
+global std::vector<u32> g_free_mesh_slots;
+global std::vector<u32> g_free_shader_slots;
+global std::vector<u32> g_free_sprite_slots;
 
 global GLuint g_sprite_vao;
 global GLuint g_sprite_vbo;
 global GLuint g_sprite_ebo;
 
 global GLuint g_texture0;
+global GLuint g_fallback_texture;
+
+#define TEXTURE_STAGING_BUFFER_SIZE     Megabytes(16)
+#define TEXTURE_UPLOAD_BYTES_PER_FRAME  Megabytes(4)
+#define TEXTURE_DECODE_ARENA_SIZE       Megabytes(256)  // Reserved only, pages are committed by the biggest image decoded
+#define TEXTURE_MIP_FILTER              MipFilter::KAISER
+#define TEXTURE_COMPRESSION_QUALITY     CompressionQuality::NORMAL
+#define TEXTURE_COMPRESSION_MIN_PSNR    32.0            // Sprites whose base level encodes worse stay RGBA8
+
+global GLuint g_staging_pbo;
+global u8* g_staging_mapped = nullptr;  // Only set when the buffer is persistently mapped
+global u32 g_staging_head = 0;
+global u32 g_staging_tail = 0;
+global u32 g_staging_used = 0;
+global std::vector<TextureUpload> g_texture_uploads;
+global std::vector<StagingRegion> g_staging_regions;
+global VMArena g_decode_arena;     // Decoded sprite images and their mip chains until they are uploaded
+global VMArena g_upload_arena;     // Same for the upload thread
+global bool g_texture_storage_supported = false;
+global bool g_s3tc_supported = false;
+global bool g_s3tc_srgb_supported = false;
+global bool g_bptc_supported = false;
 
 global HMODULE g_opengl32_module;
 
 global ResourceCatalog* g_resource_catalog = nullptr;
 
+global bool g_program_binary_supported = false;
+global u64 g_driver_hash = 0;
+
+global bool g_parallel_shader_compile_supported = false;
+global GLuint g_fallback_program = 0;
+global GLuint g_bound_program = 0;    // Draws sorted by shader skip rebinding the same program
+global RenderStats g_render_stats;
+
+global const GLenum g_pipeline_stat_targets[GPU_PIPELINE_STAT_COUNT] = {
+    GL_VERTICES_SUBMITTED,
+    GL_PRIMITIVES_SUBMITTED,
+    GL_VERTEX_SHADER_INVOCATIONS,
+    GL_FRAGMENT_SHADER_INVOCATIONS
+};
+
+global GLGpuQueryFrame g_gpu_query_frames[GPU_QUERY_FRAME_LATENCY];
+global u32 g_gpu_scope_stack[MAX_GPU_SCOPES];
+global u32 g_gpu_scope_depth = 0;
+global u64 g_gpu_frame_index = 0;
+global bool g_gpu_frame_open = false;
+global bool g_pipeline_stats_supported = false;
+global GpuFrameStats g_gpu_last_stats;
+global bool g_gpu_has_stats = false;
+global bool g_gpu_stats_updated = false;   // Since the last GetGpuFrameStats()
+
+// One fence per submitted frame, waited on MaxFramesInFlight frames later
+global GLsync g_frame_fences[MAX_FRAMES_IN_FLIGHT];
+global u64 g_frames_submitted = 0;
+global u64 g_frames_completed = 0;     // Frames the GPU is known to have finished
+global u32 g_max_frames_in_flight = 2;
+global FramePacingStats g_frame_pacing;
+global LARGE_INTEGER g_last_present_time;
+global LARGE_INTEGER g_counter_frequency;
+
+// Clustered lighting, read by the mesh shaders through buffer textures on fixed units
+#define LIGHT_CLUSTER_RANGES_UNIT   1
+#define LIGHT_INDICES_UNIT          2
+#define LIGHT_DATA_UNIT             3
+
+global GLuint g_light_buffers[3];       // Ranges, indices, light data
+global GLuint g_light_textures[3];
+global f32 g_light_near_plane = 0.1f;
+global f32 g_light_far_plane = 100.0f;
+
+// One list per frame that can be in flight, plus the one being built
+global RetireList g_retire_lists[MAX_FRAMES_IN_FLIGHT + 1];
+
+// Offscreen scene target, sized to the window and rendered into at the current scale
+global GLuint g_scene_fbo = 0;
+global GLuint g_scene_color = 0;
+global GLuint g_scene_depth = 0;
+global bool g_scene_target_valid = false;
+global bool g_scene_active = false;
+global i32 g_backbuffer_width = 0;
+global i32 g_backbuffer_height = 0;
+global f32 g_render_scale = MAX_RENDER_SCALE;
+
+// Upload thread, it owns a second context sharing objects with the main one. VAOs are not
+// shared between contexts, so the main thread builds those once the fence has signaled.
+global HDC g_device_context;
+global HGLRC g_upload_context = nullptr;
+global HANDLE g_upload_semaphore;
+global CRITICAL_SECTION g_upload_lock;
+global std::vector<UploadJob*> g_upload_requests;      // Guarded by g_upload_lock
+global std::vector<UploadJob*> g_upload_completed;     // Guarded by g_upload_lock
+global std::vector<UploadJob*> g_upload_fenced;        // Main thread only, waiting on their fence
+
+#define FNV64_OFFSET_BASIS 14695981039346656037ull
+
+// 64-bit FNV-1a, chained through the hash argument to cover several strings
+internal u64 HashStringFNV64(const char* str, u64 hash)
+{
+    if (!str) return hash;
+    for (const char* c = str; *c != 0; ++c)
+    {
+        hash ^= (u8)*c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+internal void GetShaderCachePath(u64 key, char* path, size_t path_size)
+{
+    sprintf_s(path, path_size, "%s/%016llx.bin", SHADER_CACHE_DIRECTORY, (unsigned long long)key);
+}
+
+// Returns 0 when there is no usable entry: missing, from another driver, or rejected on link
+internal GLuint LoadCachedProgram(u64 key)
+{
+    char path[MAX_PATH];
+    GetShaderCachePath(key, path, sizeof(path));
+
+    FILE* file;
+    if (fopen_s(&file, path, "rb") != 0)
+    {
+        return 0;
+    }
+
+    GLuint program = 0;
+    ShaderCacheHeader header = {};
+    if (fread(&header, sizeof(header), 1, file) == 1 &&
+        header.magic == SHADER_CACHE_MAGIC &&
+        header.version == SHADER_CACHE_VERSION &&
+        header.key == key &&
+        header.binary_size > 0)
+    {
+        std::vector<u8> binary(header.binary_size);
+        if (fread(binary.data(), 1, header.binary_size, file) == header.binary_size)
+        {
+            program = glCreateProgram();
+            glProgramBinary(program, (GLenum)header.binary_format, binary.data(), (GLsizei)header.binary_size);
+
+            GLint success = 0;
+            glGetProgramiv(program, GL_LINK_STATUS, &success);
+            if (!success)
+            {
+                glDeleteProgram(program);
+                program = 0;
+            }
+        }
+    }
+    fclose(file);
+
+    return program;
+}
+
+internal void SaveCachedProgram(u64 key, GLuint program)
+{
+    GLint binary_size = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &binary_size);
+    if (binary_size <= 0)
+    {
+        return;
+    }
+
+    std::vector<u8> binary((size_t)binary_size);
+    GLenum binary_format = 0;
+    glGetProgramBinary(program, binary_size, NULL, &binary_format, binary.data());
+
+    char path[MAX_PATH];
+    GetShaderCachePath(key, path, sizeof(path));
+
+    FILE* file;
+    if (fopen_s(&file, path, "wb") != 0)
+    {
+        return;
+    }
+
+    ShaderCacheHeader header = {};
+    header.magic = SHADER_CACHE_MAGIC;
+    header.version = SHADER_CACHE_VERSION;
+    header.key = key;
+    header.binary_format = (u32)binary_format;
+    header.binary_size = (u32)binary_size;
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(binary.data(), 1, (size_t)binary_size, file);
+    fclose(file);
+}
+
 namespace renderer
 {
 internal void SetResourceCatalog(ResourceCatalog* catalog)
@@ -77,6 +430,21 @@ internal GLADloadfunc GetProcAddressWGL(const char* procname)
     return (GLADloadfunc) GetProcAddress(g_opengl32_module, procname);
 }
 
+internal bool HasGLExtension(const char* name)
+{
+    GLint extension_count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extension_count);
+    for (GLint i = 0; i < extension_count; ++i)
+    {
+        const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, (GLuint)i);
+        if (strcmp(extension, name) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
 internal bool Init_OpenGL(void* window_handle)
 {
     HDC device_context = GetDC((HWND)window_handle);
@@ -141,8 +509,10 @@ internal bool Init_OpenGL(void* window_handle)
         0
     };
 
-    // Create the modern context
+    // Create the modern context, and the one the upload thread shares objects with
     HGLRC gl_context = wglCreateContextAttribsARB(device_context, 0, context_attribs);
+    g_upload_context = wglCreateContextAttribsARB(device_context, gl_context, context_attribs);
+    g_device_context = device_context;
 
     // Clean up the dummy
     wglMakeCurrent(NULL, NULL);
@@ -160,21 +530,70 @@ internal bool Init_OpenGL(void* window_handle)
     }
 
     printf("OpenGL Initialized: Version %s\n", glGetString(GL_VERSION));
-    
+
+    // Program binaries are only valid for the driver that produced them. Pre 4.1 drivers can still
+    // expose them through the ARB extension, whose entry points glad only loads with the core version.
+    bool has_program_binary = GLAD_GL_VERSION_4_1 != 0;
+    if (!has_program_binary && HasGLExtension("GL_ARB_get_program_binary"))
+    {
+        glad_glGetProgramBinary = (PFNGLGETPROGRAMBINARYPROC)GetProcAddressWGL("glGetProgramBinary");
+        glad_glProgramBinary = (PFNGLPROGRAMBINARYPROC)GetProcAddressWGL("glProgramBinary");
+        glad_glProgramParameteri = (PFNGLPROGRAMPARAMETERIPROC)GetProcAddressWGL("glProgramParameteri");
+        has_program_binary = glad_glGetProgramBinary && glad_glProgramBinary && glad_glProgramParameteri;
+    }
+    // Drivers may expose the API but report no formats, then every save and load would be a no-op
+    GLint binary_format_count = 0;
+    if (has_program_binary)
+    {
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &binary_format_count);
+    }
+    g_program_binary_supported = binary_format_count > 0;
+    printf("Program binary cache: %s (%d formats)\n", g_program_binary_supported ? "yes" : "no", binary_format_count);
+    g_driver_hash = HashStringFNV64((const char*)glGetString(GL_VENDOR), FNV64_OFFSET_BASIS);
+    g_driver_hash = HashStringFNV64((const char*)glGetString(GL_RENDERER), g_driver_hash);
+    g_driver_hash = HashStringFNV64((const char*)glGetString(GL_VERSION), g_driver_hash);
+    if (g_program_binary_supported)
+    {
+        CreateDirectoryA(SHADER_CACHE_DIRECTORY, NULL);
+    }
+
     glEnable(GL_DEPTH_TEST);
     return true;
 }
 
+internal GLenum GetAttributeGLType(AttributeType type)
+{
+    switch (type)
+    {
+        case AttributeType::HALF_FLOAT: return GL_HALF_FLOAT;
+        case AttributeType::SNORM16:    return GL_SHORT;
+        case AttributeType::UNORM8:     return GL_UNSIGNED_BYTE;
+        default:                        return GL_FLOAT;
+    }
+}
+
+// Issues the attribute setup for the vertex buffer bound to the current VAO
+internal void ApplyVertexLayout(const VertexLayout& layout)
+{
+    for (u32 i = 0; i < layout.attribute_count; ++i)
+    {
+        const VertexAttribute& attribute = layout.attributes[i];
+        glVertexAttribPointer(attribute.location, (GLint)attribute.component_count, GetAttributeGLType(attribute.type),
+                              attribute.normalized ? GL_TRUE : GL_FALSE, (GLsizei)layout.stride, (void*)(size_t)attribute.offset);
+        glEnableVertexAttribArray(attribute.location);
+    }
+}
+
 internal void Init_SpriteRendering()
 {
     // Setup a quad for sprite rendering
     // Use normalized device coordinates (-1 to 1) to ensure visibility regardless of window size
-    float vertices[] = {
+    Vertex2D vertices[] = {
         // positions          // colors            // uvs
-        -0.5f,  -0.5f,        1.0f, 1.0f, 1.0f,   0.0f, 0.0f, // Bottom-left
-        0.5f,   -0.5f,        1.0f, 1.0f, 1.0f,   1.0f, 0.0f, // Bottom-right
-        0.5f,    0.5f,        1.0f, 1.0f, 1.0f,   1.0f, 1.0f, // Top-right
-        -0.5f,   0.5f,        1.0f, 1.0f, 1.0f,   0.0f, 1.0f  // Top-left
+        { { -0.5f, -0.5f },   { 1.0f, 1.0f, 1.0f }, { 0.0f, 0.0f } }, // Bottom-left
+        { {  0.5f, -0.5f },   { 1.0f, 1.0f, 1.0f }, { 1.0f, 0.0f } }, // Bottom-right
+        { {  0.5f,  0.5f },   { 1.0f, 1.0f, 1.0f }, { 1.0f, 1.0f } }, // Top-right
+        { { -0.5f,  0.5f },   { 1.0f, 1.0f, 1.0f }, { 0.0f, 1.0f } }  // Top-left
     };
     unsigned int indices[] = {
         0, 1, 2,
@@ -193,14 +612,7 @@ internal void Init_SpriteRendering()
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
 
     // Layout: position (2), color (3), uv (2)
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 7 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 7 * sizeof(float), (void*)(2 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 7 * sizeof(float), (void*)(5 * sizeof(float)));
-    glEnableVertexAttribArray(2);
+    ApplyVertexLayout(vertex_2d_layout);
     glBindVertexArray(0);
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
@@ -211,286 +623,1917 @@ internal void Init_SpriteRendering()
     glGenTextures(1, &g_texture0);
 }
 
-internal bool renderer::Init(void* window_handle)
+// Queues both compiles and the link without reading anything back, so the driver
+// can work on it (on its own threads with KHR_parallel_shader_compile) meanwhile
+internal void IssueProgramCompile(GLShader* shader, const char* vertex_source, const char* fragment_source)
 {
-    bool init_result = Init_OpenGL(window_handle);
-    if (!init_result)
-    {
-        return false;
-    }
-
-    Init_SpriteRendering();
+    shader->vertex_shader = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(shader->vertex_shader, 1, &vertex_source, NULL);
+    glCompileShader(shader->vertex_shader);
 
-    return true;
-}
-
-internal void renderer::Resize(i32 width, i32 height)
-{
-    glViewport(0, 0, width, height);
-}
+    shader->fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(shader->fragment_shader, 1, &fragment_source, NULL);
+    glCompileShader(shader->fragment_shader);
 
-internal void renderer::Present()
-{
-    glFlush();
-}
+    shader->program = glCreateProgram();
+    if (g_program_binary_supported)
+    {
+        glProgramParameteri(shader->program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+    glAttachShader(shader->program, shader->vertex_shader);
+    glAttachShader(shader->program, shader->fragment_shader);
+    glLinkProgram(shader->program);
 
-internal void renderer::ClearScreen(f32 r, f32 g, f32 b, f32 a)
-{
-    glClearColor(r, g, b, a);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    shader->status = ShaderStatus::PENDING;
 }
 
-internal MeshHandle renderer::CreateMesh(const Vertex* vertices, int v_count, int* indices, int i_count)
+// Reads back the compile and link results. Blocks unless the driver already reported completion.
+internal void FinalizeProgram(GLShader* shader)
 {
-    GLMesh mesh = {};
-
-    // Generate the VAO first
-    glGenVertexArrays(1, &mesh.vao);
-    glBindVertexArray(mesh.vao); // "Start recording configuration..."
-
-    // Generate the VBO and fill it with data
-    glGenBuffers(1, &mesh.vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
-    glBufferData(GL_ARRAY_BUFFER, v_count * static_cast<int>(sizeof(Vertex)), vertices, GL_STATIC_DRAW);
-
-    glGenBuffers(1, &mesh.ebo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, i_count * static_cast<int>(sizeof(int)), indices, GL_STATIC_DRAW);
-    // Layout matches struct Vertex:
-    // 0: Position (3 floats)
-    // 1: Normal (3 floats)
-    // 2: Color (3 floats)
-    // 3: UV (2 floats)
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-    glEnableVertexAttribArray(0);
-    
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(6 * sizeof(float)));
-    glEnableVertexAttribArray(2);
-
-    glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(9 * sizeof(float)));
-    glEnableVertexAttribArray(3);
-
-    glBindBuffer(GL_ARRAY_BUFFER, 0); // Unbind VBO (the VAO "remembers" it)
-    glBindVertexArray(0);
-
-    mesh.index_count = i_count;
-    g_meshes.push_back(mesh);
-
-    MeshHandle handle = {};
-    handle.id = (u32)g_meshes.size() - 1;
-    return handle;
-}
-
-internal ShaderHandle renderer::CreateShader(const char* vertex_source, const char* fragment_source) {
-    // 1. Compile Vertex Shader
-    GLuint vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertex_shader, 1, &vertex_source, NULL);
-    glCompileShader(vertex_shader);
-    
     int  success;
     char infoLog[512];
-    glGetShaderiv(vertex_shader, GL_COMPILE_STATUS, &success);
+    glGetShaderiv(shader->vertex_shader, GL_COMPILE_STATUS, &success);
     if(!success)
     {
-        glGetShaderInfoLog(vertex_shader, 512, NULL, infoLog);
+        glGetShaderInfoLog(shader->vertex_shader, 512, NULL, infoLog);
         printf("ERROR::SHADER::VERTEX::COMPILATION_FAILED\n%s\n", infoLog);
     }
 
-    // 2. Compile Fragment Shader
-    GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragment_shader, 1, &fragment_source, NULL);
-    glCompileShader(fragment_shader);
-    glGetShaderiv(fragment_shader, GL_COMPILE_STATUS, &success);
+    glGetShaderiv(shader->fragment_shader, GL_COMPILE_STATUS, &success);
     if(!success)
     {
-        glGetShaderInfoLog(fragment_shader, 512, NULL, infoLog);
+        glGetShaderInfoLog(shader->fragment_shader, 512, NULL, infoLog);
         printf("ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n%s\n", infoLog);
     }
 
-    // 3. Link them into a "Program"
-    GLuint shader_program = glCreateProgram();
-    glAttachShader(shader_program, vertex_shader);
-    glAttachShader(shader_program, fragment_shader);
-    glLinkProgram(shader_program);
-    glGetProgramiv(shader_program, GL_LINK_STATUS, &success);
+    glGetProgramiv(shader->program, GL_LINK_STATUS, &success);
     if(!success)
     {
-        glGetProgramInfoLog(shader_program, 512, NULL, infoLog);
+        glGetProgramInfoLog(shader->program, 512, NULL, infoLog);
         printf("ERROR::SHADER::PROGRAM::LINKING_FAILED\n%s\n", infoLog);
     }
 
-    // 4. Cleanup (We don't need the individual objects once linked)
-    glDeleteShader(vertex_shader);
-    glDeleteShader(fragment_shader);
+    // We don't need the individual objects once linked
+    glDeleteShader(shader->vertex_shader);
+    glDeleteShader(shader->fragment_shader);
+    shader->vertex_shader = 0;
+    shader->fragment_shader = 0;
 
-    g_shaders.push_back(shader_program);
+    shader->status = success ? ShaderStatus::READY : ShaderStatus::FAILED;
+    if (success && g_program_binary_supported)
+    {
+        SaveCachedProgram(shader->cache_key, shader->program);
+    }
+}
 
-    ShaderHandle handle = {};
-    handle.id = (u32)g_shaders.size() - 1;
-    return handle;
+internal void LogShaderReady(u32 id, const GLShader& shader, const char* how)
+{
+    i64 elapsed = Win32_GetMicroSecondsElapsed(shader.create_time, Win32_GetWallClock());
+    printf("Shader %u %s in %.03f ms\n", id, how, (f32)elapsed * 0.001f);
 }
 
-internal SpriteHandle renderer::CreateSprite(ResourceID resource_id, float width, float height)
+// Without KHR_parallel_shader_compile there is no way to ask without blocking,
+// so the first poll finalizes the program.
+internal void PollShader(u32 id)
 {
-    GLSprite sprite = {};
-    sprite.width = width;
-    sprite.height = height;
+    GLShader& shader = g_shaders[id];
+    if (shader.status != ShaderStatus::PENDING)
+    {
+        return;
+    }
 
-    // Generate and bind a texture
-    glGenTextures(1, &sprite.texture_id);
-    glBindTexture(GL_TEXTURE_2D, sprite.texture_id);
-
-    // Helper lambda to create fallback 32x32 quadrant texture
-    auto create_fallback_texture = [&]() {
-        const int TEX_SIZE = 32;
-        const int QUAD_SIZE = 16; // Each quadrant is 16x16
-        unsigned char fallback_pixels[TEX_SIZE * TEX_SIZE * 4]; // RGBA
-
-        // Fill the texture with 4 colored quadrants
-        for (int y = 0; y < TEX_SIZE; ++y) {
-            for (int x = 0; x < TEX_SIZE; ++x) {
-                // Flip y-coordinate to match OpenGL's texture origin (bottom-left)
-                int flipped_y = TEX_SIZE - 1 - y;
-                int pixel_idx = (flipped_y * TEX_SIZE + x) * 4;
-                
-                // Determine which quadrant and set color
-                if (x < QUAD_SIZE && y < QUAD_SIZE) {
-                    // Top-left: RED
-                    fallback_pixels[pixel_idx + 0] = 255; // R
-                    fallback_pixels[pixel_idx + 1] = 0;   // G
-                    fallback_pixels[pixel_idx + 2] = 0;   // B
-                    fallback_pixels[pixel_idx + 3] = 255; // A
-                } else if (x >= QUAD_SIZE && y < QUAD_SIZE) {
-                    // Top-right: GREEN
-                    fallback_pixels[pixel_idx + 0] = 0;   // R
-                    fallback_pixels[pixel_idx + 1] = 255; // G
-                    fallback_pixels[pixel_idx + 2] = 0;   // B
-                    fallback_pixels[pixel_idx + 3] = 255; // A
-                } else if (x < QUAD_SIZE && y >= QUAD_SIZE) {
-                    // Bottom-left: BLUE
-                    fallback_pixels[pixel_idx + 0] = 0;   // R
-                    fallback_pixels[pixel_idx + 1] = 0;   // G
-                    fallback_pixels[pixel_idx + 2] = 255; // B
-                    fallback_pixels[pixel_idx + 3] = 255; // A
-                } else {
-                    // Bottom-right: WHITE
-                    fallback_pixels[pixel_idx + 0] = 255; // R
-                    fallback_pixels[pixel_idx + 1] = 255; // G
-                    fallback_pixels[pixel_idx + 2] = 255; // B
-                    fallback_pixels[pixel_idx + 3] = 255; // A
-                }
-            }
+    if (g_parallel_shader_compile_supported)
+    {
+        GLint is_complete = 0;
+        glGetProgramiv(shader.program, GL_COMPLETION_STATUS_KHR, &is_complete);
+        if (!is_complete)
+        {
+            return;
         }
-        
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, TEX_SIZE, TEX_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, fallback_pixels);
-    };
+    }
 
-    // Load texture data from resource catalog
-    if (g_resource_catalog != nullptr && resource_id != INVALID_RESOURCE_ID)
+    FinalizeProgram(&shader);
+    LogShaderReady(id, shader, shader.status == ShaderStatus::READY ? "compiled" : "failed");
+}
+
+// The program a draw should bind: the real one once ready, the fallback otherwise
+internal GLuint ResolveProgram(u32 id)
+{
+    PollShader(id);
+    const GLShader& shader = g_shaders[id];
+    return shader.status == ShaderStatus::READY ? shader.program : g_fallback_program;
+}
+
+internal void UseProgram(GLuint program)
+{
+    if (program != g_bound_program)
     {
-        Resource* resource = Catalog_Get(g_resource_catalog, resource_id);
-        if (resource != nullptr && resource->rawBuffer != nullptr)
+        glUseProgram(program);
+        g_bound_program = program;
+        ++g_render_stats.state_changes;
+    }
+}
+
+internal void Init_ShaderCompilation()
+{
+    if (HasGLExtension("GL_KHR_parallel_shader_compile"))
+    {
+        PFNGLMAXSHADERCOMPILERTHREADSKHRPROC glMaxShaderCompilerThreadsKHR =
+            (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)GetProcAddressWGL("glMaxShaderCompilerThreadsKHR");
+        if (glMaxShaderCompilerThreadsKHR)
         {
-            // Assume the resource contains raw RGBA pixel data
-            // For a real implementation, you'd parse format/dimensions from the resource data
-            // For now, assume it's a square texture: size = width * height * 4 (RGBA)
-            // and dimensions = width
-            int texture_dim = (int)sqrt(resource->size / 4);
-            if (texture_dim > 0)
-            {
-                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, texture_dim, texture_dim, 0, GL_RGBA, GL_UNSIGNED_BYTE, resource->rawBuffer);
-            }
-            else
-            {
-                // Fallback: create 32x32 colored quadrant texture
-                create_fallback_texture();
+            // 0xFFFFFFFF lets the driver pick as many threads as it wants
+            glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+            g_parallel_shader_compile_supported = true;
+        }
+    }
+    printf("Parallel shader compilation: %s\n", g_parallel_shader_compile_supported ? "yes" : "no");
+
+    GLShader fallback = {};
+    IssueProgramCompile(&fallback, fallback_vertex_shader_source, fallback_fragment_shader_source);
+    FinalizeProgram(&fallback);
+    g_fallback_program = fallback.program;
+
+    // Sprites never set a view matrix, keep it identity so they still show up
+    glm::mat4 identity = glm::mat4(1.0f);
+    glUseProgram(g_fallback_program);
+    glUniformMatrix4fv(glGetUniformLocation(g_fallback_program, "view"), 1, GL_FALSE, glm::value_ptr(identity));
+    glUseProgram(0);
+}
+
+// Creates the 32x32 colored quadrant texture shown for missing or still-streaming sprites
+internal GLuint CreateFallbackTexture()
+{
+    const int TEX_SIZE = 32;
+    const int QUAD_SIZE = 16; // Each quadrant is 16x16
+    unsigned char fallback_pixels[TEX_SIZE * TEX_SIZE * 4]; // RGBA
+
+    // Fill the texture with 4 colored quadrants
+    for (int y = 0; y < TEX_SIZE; ++y) {
+        for (int x = 0; x < TEX_SIZE; ++x) {
+            // Flip y-coordinate to match OpenGL's texture origin (bottom-left)
+            int flipped_y = TEX_SIZE - 1 - y;
+            int pixel_idx = (flipped_y * TEX_SIZE + x) * 4;
+
+            // Determine which quadrant and set color
+            if (x < QUAD_SIZE && y < QUAD_SIZE) {
+                // Top-left: RED
+                fallback_pixels[pixel_idx + 0] = 255; // R
+                fallback_pixels[pixel_idx + 1] = 0;   // G
+                fallback_pixels[pixel_idx + 2] = 0;   // B
+                fallback_pixels[pixel_idx + 3] = 255; // A
+            } else if (x >= QUAD_SIZE && y < QUAD_SIZE) {
+                // Top-right: GREEN
+                fallback_pixels[pixel_idx + 0] = 0;   // R
+                fallback_pixels[pixel_idx + 1] = 255; // G
+                fallback_pixels[pixel_idx + 2] = 0;   // B
+                fallback_pixels[pixel_idx + 3] = 255; // A
+            } else if (x < QUAD_SIZE && y >= QUAD_SIZE) {
+                // Bottom-left: BLUE
+                fallback_pixels[pixel_idx + 0] = 0;   // R
+                fallback_pixels[pixel_idx + 1] = 0;   // G
+                fallback_pixels[pixel_idx + 2] = 255; // B
+                fallback_pixels[pixel_idx + 3] = 255; // A
+            } else {
+                // Bottom-right: WHITE
+                fallback_pixels[pixel_idx + 0] = 255; // R
+                fallback_pixels[pixel_idx + 1] = 255; // G
+                fallback_pixels[pixel_idx + 2] = 255; // B
+                fallback_pixels[pixel_idx + 3] = 255; // A
             }
         }
-        else
+    }
+
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, TEX_SIZE, TEX_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, fallback_pixels);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    return texture;
+}
+
+// Reserves a contiguous range of the staging ring. Ranges are released in the
+// order they were handed out, when the fence of their frame signals.
+internal bool AllocateStaging(u32 size, u32* offset)
+{
+    if (g_staging_used == 0)
+    {
+        g_staging_head = 0;
+        g_staging_tail = 0;
+    }
+
+    if (g_staging_head >= g_staging_tail && g_staging_used < TEXTURE_STAGING_BUFFER_SIZE)
+    {
+        u32 space_at_end = (u32)TEXTURE_STAGING_BUFFER_SIZE - g_staging_head;
+        if (size <= space_at_end)
         {
-            // Fallback: create 32x32 colored quadrant texture
-            create_fallback_texture();
+            *offset = g_staging_head;
+            g_staging_head += size;
+            g_staging_used += size;
+            return true;
         }
+        if (size <= g_staging_tail)
+        {
+            // Wrap around, the skipped bytes at the end are freed with this range
+            *offset = 0;
+            g_staging_head = size;
+            g_staging_used += space_at_end + size;
+            return true;
+        }
+    }
+    else if (g_staging_head < g_staging_tail && size <= g_staging_tail - g_staging_head)
+    {
+        *offset = g_staging_head;
+        g_staging_head += size;
+        g_staging_used += size;
+        return true;
+    }
+
+    return false;
+}
+
+// Allocates the storage for the whole chain up front and sets the sprite sampling state. The texture stays bound.
+internal GLuint CreateSpriteTexture(const TextureLevel* levels, u32 level_count, bool srgb)
+{
+    GLuint texture = 0;
+    GLenum internal_format = srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    if (g_texture_storage_supported)
+    {
+        glTexStorage2D(GL_TEXTURE_2D, (GLsizei)level_count, internal_format, levels[0].width, levels[0].height);
     }
     else
     {
-        // Fallback: create 32x32 colored quadrant texture
-        create_fallback_texture();
+        for (u32 level = 0; level < level_count; ++level)
+        {
+            glTexImage2D(GL_TEXTURE_2D, (GLint)level, (GLint)internal_format, levels[level].width, levels[level].height, 0,
+                         GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        }
     }
 
     // Set texture parameters
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, level_count > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    g_sprites.push_back(sprite);
-
-    SpriteHandle handle = {};
-    handle.id = (u32)g_sprites.size() - 1;
-    return handle;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)level_count - 1);
+    return texture;
 }
 
-internal void renderer::Draw(RenderCommand* cmd)
+// Returns 0 when the driver can't sample the format. BC4 and BC5 hold data, they have no sRGB variant.
+internal GLenum GetCompressedInternalFormat(TextureFormat format, bool srgb)
 {
-    switch (cmd->mode)
+    switch (format)
     {
-        case RenderMode::MESH:
-            DrawMesh(&cmd->mesh_cmd);
-            break;
-        case RenderMode::SPRITE:
-            DrawSprite(&cmd->sprite_cmd);
-            break;
+        case TextureFormat::BC1:
+            if (srgb) return g_s3tc_srgb_supported ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT : 0;
+            return g_s3tc_supported ? GL_COMPRESSED_RGBA_S3TC_DXT1_EXT : 0;
+        case TextureFormat::BC3:
+            if (srgb) return g_s3tc_srgb_supported ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : 0;
+            return g_s3tc_supported ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : 0;
+        case TextureFormat::BC4: return GL_COMPRESSED_RED_RGTC1;
+        case TextureFormat::BC5: return GL_COMPRESSED_RG_RGTC2;
+        case TextureFormat::BC7:
+            if (!g_bptc_supported) return 0;
+            return srgb ? GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM : GL_COMPRESSED_RGBA_BPTC_UNORM;
+        default:
+            return 0;
     }
 }
 
-internal void renderer::DrawMesh(RenderMeshCommand* cmd)
+// Every level goes in directly, blocks are a quarter to an eighth of the RGBA8 size. Same sampling
+// state as CreateSpriteTexture(), the texture stays bound.
+internal GLuint CreateCompressedTexture(TextureFormat format, GLenum internal_format, const TextureLevel* levels, u32 level_count)
 {
-    //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE); // Wireframe mode
-    if (cmd->mesh.id >= g_meshes.size()) return;
-    if (cmd->shader.id >= g_shaders.size()) return;
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    for (u32 level = 0; level < level_count; ++level)
+    {
+        u32 size = block_compression::GetCompressedSize(format, levels[level].width, levels[level].height);
+        glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)level, internal_format, levels[level].width, levels[level].height, 0,
+                               (GLsizei)size, levels[level].pixels);
+    }
 
-    GLMesh& mesh = g_meshes[cmd->mesh.id];
-    GLuint shader = g_shaders[cmd->shader.id];
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, level_count > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)level_count - 1);
+    return texture;
+}
 
-    // 2. Setup State
-    glUseProgram(shader);
+// Color art goes to BC7 where the driver has BPTC, otherwise to BC1 when the alpha is only ever
+// fully on or off and BC3 when it isn't. RGBA8 when the driver can't sample any of them as sRGB.
+internal TextureFormat ChooseSpriteFormat(const TextureLevel* base_level)
+{
+    if (GetCompressedInternalFormat(TextureFormat::BC7, true) != 0)
+    {
+        return TextureFormat::BC7;
+    }
 
-    // 3. Upload Uniforms
-    GLint loc_model = glGetUniformLocation(shader, "model");
-    glUniformMatrix4fv(loc_model, 1, GL_FALSE, glm::value_ptr(cmd->model));
+    const u8* texels = (const u8*)base_level->pixels;
+    size_t texel_count = (size_t)base_level->width * (size_t)base_level->height;
+    bool is_cutout = true;
+    for (size_t i = 0; i < texel_count && is_cutout; ++i)
+    {
+        u8 alpha = texels[i * 4 + 3];
+        is_cutout = alpha == 0 || alpha == 255;
+    }
 
-    GLint loc_view = glGetUniformLocation(shader, "view");
-    glUniformMatrix4fv(loc_view, 1, GL_FALSE, glm::value_ptr(cmd->view));
+    TextureFormat format = is_cutout ? TextureFormat::BC1 : TextureFormat::BC3;
+    return GetCompressedInternalFormat(format, true) != 0 ? format : TextureFormat::RGBA8;
+}
+
+// Encodes every level of the chain into the arena, on the queue when there is one. Returns RGBA8 and
+// leaves compressed_levels unused when there is no format to use or the base level loses too much.
+internal TextureFormat CompressSpriteChain(WorkQueue* queue, VMArena* arena, const MipChain* chain, TextureLevel* compressed_levels)
+{
+    TextureFormat format = ChooseSpriteFormat(&chain->levels[0]);
+    if (format == TextureFormat::RGBA8)
+    {
+        return format;
+    }
+
+    for (u32 level = 0; level < chain->level_count; ++level)
+    {
+        const TextureLevel& source = chain->levels[level];
+        u8* blocks = (u8*)memory::VMArenaAlloc(arena, block_compression::GetCompressedSize(format, source.width, source.height));
+        block_compression::Compress(queue, format, TEXTURE_COMPRESSION_QUALITY, (const u8*)source.pixels, source.width, source.height, blocks);
+        compressed_levels[level] = source;
+        compressed_levels[level].pixels = blocks;
+    }
+
+    const TextureLevel& base_level = chain->levels[0];
+    f64 psnr = block_compression::MeasurePsnr(format, (const u8*)base_level.pixels, base_level.width, base_level.height,
+                                              (const u8*)compressed_levels[0].pixels);
+    if (psnr < TEXTURE_COMPRESSION_MIN_PSNR)
+    {
+        printf("Sprite %dx%d stays RGBA8, %s only reaches %.1f dB\n", base_level.width, base_level.height,
+               block_compression::texture_format_names[(u32)format], psnr);
+        return TextureFormat::RGBA8;
+    }
+
+    printf("Sprite %dx%d compressed to %s, %.1f dB\n", base_level.width, base_level.height,
+           block_compression::texture_format_names[(u32)format], psnr);
+    return format;
+}
+
+internal void Init_TextureStreaming()
+{
+    g_fallback_texture = CreateFallbackTexture();
+    memory::InitVMArena(&g_decode_arena, TEXTURE_DECODE_ARENA_SIZE);
+    g_texture_storage_supported = GLAD_GL_VERSION_4_2;
+    g_s3tc_supported = HasGLExtension("GL_EXT_texture_compression_s3tc");
+    g_s3tc_srgb_supported = g_s3tc_supported && HasGLExtension("GL_EXT_texture_sRGB");
+    g_bptc_supported = GLAD_GL_VERSION_4_2 || HasGLExtension("GL_ARB_texture_compression_bptc");
+
+    glGenBuffers(1, &g_staging_pbo);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, g_staging_pbo);
+    if (GLAD_GL_VERSION_4_4)
+    {
+        // Map once for the lifetime of the buffer, the fences keep the CPU off ranges still in use
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_PIXEL_UNPACK_BUFFER, TEXTURE_STAGING_BUFFER_SIZE, nullptr, flags);
+        g_staging_mapped = (u8*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, TEXTURE_STAGING_BUFFER_SIZE, flags);
+    }
+    else
+    {
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, TEXTURE_STAGING_BUFFER_SIZE, nullptr, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    printf("Texture streaming: %s staging buffer, %s textures\n",
+           g_staging_mapped ? "persistent" : "mapped per upload",
+           g_texture_storage_supported ? "immutable" : "mutable");
+    printf("Texture compression: BC1/BC3 %s, BC7 %s\n", g_s3tc_supported ? "yes" : "no", g_bptc_supported ? "yes" : "no");
+}
+
+// Called once per frame. Retires the staging ranges the GPU finished with, then copies
+// at most TEXTURE_UPLOAD_BYTES_PER_FRAME of pending texels into their textures.
+internal void ProcessTextureUploads()
+{
+    // A texture becomes visible only once the copy that completed it has retired
+    while (!g_staging_regions.empty())
+    {
+        StagingRegion& region = g_staging_regions.front();
+        GLenum wait_result = glClientWaitSync(region.fence, 0, 0);
+        if (wait_result != GL_ALREADY_SIGNALED && wait_result != GL_CONDITION_SATISFIED)
+        {
+            break;
+        }
+
+        glDeleteSync(region.fence);
+        g_staging_tail = region.end_offset;
+        g_staging_used -= region.size;
+        for (u32 sprite_id : region.completed_sprites)
+        {
+            g_sprites[sprite_id].is_ready = true;
+        }
+        g_staging_regions.erase(g_staging_regions.begin());
+    }
+
+    if (g_texture_uploads.empty())
+    {
+        return;
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, g_staging_pbo);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    StagingRegion region = {};
+    u32 used_before = g_staging_used;
+    u64 budget = TEXTURE_UPLOAD_BYTES_PER_FRAME;
+    size_t finished_count = 0;
+    while (finished_count < g_texture_uploads.size())
+    {
+        TextureUpload& upload = g_texture_uploads[finished_count];
+        u32 row_bytes = (u32)upload.width * 4;
+        u32 rows = (u32)(upload.height - upload.next_row);
+        u32 budget_rows = (u32)(budget / row_bytes);
+        if (budget_rows == 0)
+        {
+            // Always move at least one row per frame, even for textures wider than the budget
+            if (g_staging_used != used_before) break;
+            budget_rows = 1;
+        }
+        if (rows > budget_rows) rows = budget_rows;
+
+        u32 offset = 0;
+        while (rows > 0 && !AllocateStaging(rows * row_bytes, &offset))
+        {
+            rows /= 2;
+        }
+        if (rows == 0)
+        {
+            break; // Staging buffer is full until the GPU catches up
+        }
+
+        u32 size = rows * row_bytes;
+        const u8* source = upload.pixels + (size_t)upload.next_row * row_bytes;
+        if (g_staging_mapped)
+        {
+            memcpy(g_staging_mapped + offset, source, size);
+        }
+        else
+        {
+            // The range is known to be idle, so skip the driver's implicit synchronization
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+            void* destination = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, offset, size, flags);
+            if (destination == nullptr)
+            {
+                printf("Texture streaming: failed to map the staging buffer\n");
+                break;
+            }
+            memcpy(destination, source, size);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        }
+
+        glBindTexture(GL_TEXTURE_2D, g_sprites[upload.sprite_id].texture_id);
+        glTexSubImage2D(GL_TEXTURE_2D, upload.level, 0, upload.next_row, upload.width, (GLsizei)rows,
+                        GL_RGBA, GL_UNSIGNED_BYTE, (void*)(size_t)offset);
+
+        upload.next_row += (i32)rows;
+        budget = size < budget ? budget - size : 0;
+        if (upload.next_row < upload.height)
+        {
+            break; // Ran out of budget or staging space part way through
+        }
+
+        if (upload.is_last_level)
+        {
+            region.completed_sprites.push_back(upload.sprite_id);
+        }
+        ++finished_count;
+    }
+
+    // Leave the unpack buffer unbound, client-memory uploads would read it as an offset otherwise
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    g_texture_uploads.erase(g_texture_uploads.begin(), g_texture_uploads.begin() + finished_count);
+
+    if (g_staging_used != used_before)
+    {
+        region.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        region.end_offset = g_staging_head;
+        region.size = g_staging_used - used_before;
+        g_staging_regions.push_back(region);
+    }
+}
+
+internal void Init_GpuQueries()
+{
+    g_pipeline_stats_supported = GLAD_GL_VERSION_4_6 || HasGLExtension("GL_ARB_pipeline_statistics_query");
+
+    for (u32 f = 0; f < GPU_QUERY_FRAME_LATENCY; ++f)
+    {
+        GLGpuQueryFrame& frame = g_gpu_query_frames[f];
+        glGenQueries(1, &frame.frame_begin_query);
+        glGenQueries(1, &frame.frame_end_query);
+        for (u32 i = 0; i < MAX_GPU_SCOPES; ++i)
+        {
+            glGenQueries(1, &frame.scopes[i].begin_query);
+            glGenQueries(1, &frame.scopes[i].end_query);
+            glGenQueries(GPU_PIPELINE_STAT_COUNT, frame.scopes[i].stat_queries);
+        }
+    }
+
+    printf("GPU queries: timestamps, pipeline statistics %s\n", g_pipeline_stats_supported ? "yes" : "no");
+}
+
+internal u64 GetQueryResult(GLuint query)
+{
+    GLuint64 result = 0;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &result);
+    return (u64)result;
+}
+
+// Copies a submitted frame's results once the GPU has written them, never waits
+internal bool ResolveGpuFrame(GLGpuQueryFrame* frame)
+{
+    GLint available = 0;
+    glGetQueryObjectiv(frame->frame_end_query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+    {
+        return false;
+    }
+
+    // Queries complete in order, so every earlier query of the frame is done too
+    GpuFrameStats stats = {};
+    stats.frame_index = frame->frame_index;
+    stats.frame_gpu_ms = (f32)(GetQueryResult(frame->frame_end_query) - GetQueryResult(frame->frame_begin_query)) * 1e-6f;
+    stats.scope_count = frame->scope_count;
+    for (u32 i = 0; i < frame->scope_count; ++i)
+    {
+        const GLGpuScope& scope = frame->scopes[i];
+        GpuScopeStats& result = stats.scopes[i];
+        result.label = scope.label;
+        result.depth = scope.depth;
+        result.gpu_ms = (f32)(GetQueryResult(scope.end_query) - GetQueryResult(scope.begin_query)) * 1e-6f;
+        result.has_pipeline_stats = scope.has_pipeline_stats;
+        if (scope.has_pipeline_stats)
+        {
+            result.pipeline.vertices_submitted = GetQueryResult(scope.stat_queries[0]);
+            result.pipeline.primitives_submitted = GetQueryResult(scope.stat_queries[1]);
+            result.pipeline.vertex_shader_invocations = GetQueryResult(scope.stat_queries[2]);
+            result.pipeline.fragment_shader_invocations = GetQueryResult(scope.stat_queries[3]);
+        }
+    }
+
+    frame->is_pending = false;
+    if (!g_gpu_has_stats || stats.frame_index > g_gpu_last_stats.frame_index)
+    {
+        g_gpu_last_stats = stats;
+        g_gpu_has_stats = true;
+        g_gpu_stats_updated = true;
+    }
+    return true;
+}
+
+// Attachments are allocated at full window size once per resize, so changing the scale
+// only changes the viewport and never reallocates
+internal void ResizeSceneTarget()
+{
+    if (g_scene_fbo == 0 || g_backbuffer_width <= 0 || g_backbuffer_height <= 0)
+    {
+        g_scene_target_valid = false;
+        return;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, g_scene_color);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, g_backbuffer_width, g_backbuffer_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, g_scene_depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, g_backbuffer_width, g_backbuffer_height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, g_scene_fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, g_scene_color, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, g_scene_depth);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    g_scene_target_valid = status == GL_FRAMEBUFFER_COMPLETE;
+    if (!g_scene_target_valid)
+    {
+        printf("Scene framebuffer incomplete (0x%X), rendering at native resolution\n", status);
+    }
+}
+
+internal void Init_SceneTarget()
+{
+    glGenFramebuffers(1, &g_scene_fbo);
+    glGenTextures(1, &g_scene_color);
+    glGenRenderbuffers(1, &g_scene_depth);
+
+    glBindTexture(GL_TEXTURE_2D, g_scene_color);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    ResizeSceneTarget();
+}
+
+// Reuses a slot freed by a retired resource before growing the table and returns the handle id.
+// A reused slot keeps the generation its previous resource's destroy bumped.
+template<typename Type>
+internal u32 AllocateSlot(std::vector<Type>& slots, std::vector<u32>& free_slots, const Type& value)
+{
+    u32 index;
+    if (!free_slots.empty())
+    {
+        index = free_slots.back();
+        free_slots.pop_back();
+    }
+    else
+    {
+        Assert(slots.size() <= HANDLE_INDEX_MASK);
+        index = (u32)slots.size();
+        slots.push_back(value);
+    }
+
+    u32 generation = slots[index].generation;
+    slots[index] = value;
+    slots[index].generation = generation;
+    return MakeHandleId(index, generation);
+}
+
+// The slot a handle refers to, or nullptr once its resource was destroyed, whether or not the slot was reused since
+template<typename Type>
+internal Type* GetLiveSlot(std::vector<Type>& slots, u32 id)
+{
+    u32 index = GetHandleIndex(id);
+    if (index >= slots.size() || slots[index].generation != GetHandleGeneration(id) || slots[index].is_destroyed)
+    {
+        return nullptr;
+    }
+    return &slots[index];
+}
+
+// Marks the slot destroyed and moves it to the next generation, stale handles stop matching right away
+template<typename Type>
+internal void KillSlot(Type* slot)
+{
+    slot->is_destroyed = true;
+    slot->generation = (slot->generation + 1) & HANDLE_GENERATION_MASK;
+}
+
+// Empties a freed slot, keeping its generation for the next resource
+template<typename Type>
+internal void ClearSlot(Type* slot)
+{
+    u32 generation = slot->generation;
+    *slot = {};
+    slot->generation = generation;
+    slot->is_destroyed = true;
+}
+
+internal void RetireResource(RetiredType type, u32 id);
+
+internal DWORD WINAPI UploadThreadProc(LPVOID parameter)
+{
+    wglMakeCurrent(g_device_context, g_upload_context);
+
+    for (;;)
+    {
+        WaitForSingleObjectEx(g_upload_semaphore, INFINITE, FALSE);
+
+        EnterCriticalSection(&g_upload_lock);
+        UploadJob* job = nullptr;
+        if (!g_upload_requests.empty())
+        {
+            job = g_upload_requests.front();
+            g_upload_requests.erase(g_upload_requests.begin());
+        }
+        LeaveCriticalSection(&g_upload_lock);
+
+        if (job == nullptr)
+        {
+            continue;
+        }
+
+        if (job->type == UploadJobType::MESH)
+        {
+            u32 v_count = (u32)job->vertices.size();
+            u32 i_count = (u32)job->indices.size();
+            std::vector<CompactVertex> compact_vertices(v_count);
+            glm::vec3 center;
+            glm::vec3 extent;
+            vertex_format::EncodeCompactVertices(job->vertices.data(), v_count, compact_vertices.data(), &center, &extent);
+            job->dequantize = glm::scale(glm::translate(glm::mat4(1.0f), center), extent);
+
+            std::vector<u16> short_indices;
+            const void* index_data = job->indices.data();
+            job->index_type = GL_UNSIGNED_INT;
+            job->index_size = sizeof(u32);
+            if (v_count <= MAX_16BIT_INDEX_VERTICES)
+            {
+                short_indices.resize(i_count);
+                for (u32 i = 0; i < i_count; ++i)
+                {
+                    short_indices[i] = (u16)job->indices[i];
+                }
+                index_data = short_indices.data();
+                job->index_type = GL_UNSIGNED_SHORT;
+                job->index_size = sizeof(u16);
+            }
+
+            glGenBuffers(1, &job->vbo);
+            glBindBuffer(GL_ARRAY_BUFFER, job->vbo);
+            glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)v_count * sizeof(CompactVertex), compact_vertices.data(), GL_STATIC_DRAW);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+            glGenBuffers(1, &job->ebo);
+            glBindBuffer(GL_ARRAY_BUFFER, job->ebo);
+            glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)i_count * job->index_size, index_data, GL_STATIC_DRAW);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+            // The main thread no longer needs the source data
+            std::vector<Vertex>().swap(job->vertices);
+            std::vector<int>().swap(job->indices);
+        }
+        else
+        {
+            // Same mip chain, storage and sampling state as the textures created on the main thread,
+            // the chain is filtered on this thread only
+            size_t arena_offset = g_upload_arena.curr_offset;
+            MipChain chain = {};
+            mipmap::GenerateRgba8(nullptr, &g_upload_arena, job->pixels, job->width, job->height, true, TEXTURE_MIP_FILTER, &chain);
+            TextureLevel compressed_levels[MIP_MAX_LEVELS];
+            TextureFormat format = CompressSpriteChain(nullptr, &g_upload_arena, &chain, compressed_levels);
+            if (format != TextureFormat::RGBA8)
+            {
+                job->texture = CreateCompressedTexture(format, GetCompressedInternalFormat(format, true), compressed_levels, chain.level_count);
+            }
+            else
+            {
+                job->texture = CreateSpriteTexture(chain.levels, chain.level_count, true);
+                glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+                for (u32 level = 0; level < chain.level_count; ++level)
+                {
+                    glTexSubImage2D(GL_TEXTURE_2D, (GLint)level, 0, 0, chain.levels[level].width, chain.levels[level].height,
+                                    GL_RGBA, GL_UNSIGNED_BYTE, chain.levels[level].pixels);
+                }
+            }
+            glBindTexture(GL_TEXTURE_2D, 0);
+            g_upload_arena.curr_offset = arena_offset;
+        }
+
+        // Flushing makes sure the fence reaches the GPU even though this context never swaps
+        job->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glFlush();
+
+        EnterCriticalSection(&g_upload_lock);
+        g_upload_completed.push_back(job);
+        LeaveCriticalSection(&g_upload_lock);
+    }
+}
+
+internal void Init_UploadThread()
+{
+    if (g_upload_context == nullptr)
+    {
+        printf("No shared context for the upload thread, resources are created on the main thread\n");
+        return;
+    }
+
+    // The sRGB tables are shared with the main thread, build them before the thread can race for them
+    mipmap::InitSrgbTables();
+    memory::InitVMArena(&g_upload_arena, TEXTURE_DECODE_ARENA_SIZE);
+    InitializeCriticalSection(&g_upload_lock);
+    g_upload_semaphore = CreateSemaphoreEx(0, 0, LONG_MAX, 0, 0, SEMAPHORE_ALL_ACCESS);
+    HANDLE thread = CreateThread(0, 0, UploadThreadProc, nullptr, 0, 0);
+    CloseHandle(thread);
+}
+
+internal void SubmitUploadJob(UploadJob* job)
+{
+    EnterCriticalSection(&g_upload_lock);
+    g_upload_requests.push_back(job);
+    LeaveCriticalSection(&g_upload_lock);
+    ReleaseSemaphore(g_upload_semaphore, 1, 0);
+}
+
+// Publishes the jobs whose fence signaled, without ever blocking on one that didn't
+internal void ProcessCompletedUploads()
+{
+    if (g_upload_context == nullptr)
+    {
+        return;
+    }
+
+    EnterCriticalSection(&g_upload_lock);
+    g_upload_fenced.insert(g_upload_fenced.end(), g_upload_completed.begin(), g_upload_completed.end());
+    g_upload_completed.clear();
+    LeaveCriticalSection(&g_upload_lock);
+
+    u32 pending_count = 0;
+    for (UploadJob* job : g_upload_fenced)
+    {
+        GLenum wait_result = glClientWaitSync(job->fence, 0, 0);
+        if (wait_result != GL_ALREADY_SIGNALED && wait_result != GL_CONDITION_SATISFIED)
+        {
+            g_upload_fenced[pending_count++] = job;
+            continue;
+        }
+        glDeleteSync(job->fence);
+
+        if (job->type == UploadJobType::MESH)
+        {
+            GLMesh& mesh = g_meshes[job->id];
+            mesh.vbo = job->vbo;
+            mesh.ebo = job->ebo;
+            mesh.index_type = job->index_type;
+            mesh.index_size = job->index_size;
+            mesh.dequantize = job->dequantize;
+            mesh.upload_pending = false;
+            if (mesh.is_destroyed)
+            {
+                RetireResource(RetiredType::MESH, job->id);
+                delete job;
+                continue;
+            }
+
+            glGenVertexArrays(1, &mesh.vao);
+            glBindVertexArray(mesh.vao);
+            glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.ebo);
+            ApplyVertexLayout(compact_vertex_layout);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            glBindVertexArray(0);
+            mesh.is_ready = true;
+        }
+        else
+        {
+            GLSprite& sprite = g_sprites[job->id];
+            sprite.texture_id = job->texture;
+            sprite.upload_pending = false;
+            if (sprite.is_destroyed)
+            {
+                RetireResource(RetiredType::SPRITE, job->id);
+            }
+            else
+            {
+                sprite.is_ready = true;
+            }
+        }
+        delete job;
+    }
+    g_upload_fenced.resize(pending_count);
+}
+
+// Advances g_frames_completed over every frame fence that has signaled, oldest first
+internal void UpdateCompletedFrames()
+{
+    while (g_frames_completed < g_frames_submitted)
+    {
+        GLsync fence = g_frame_fences[g_frames_completed % MAX_FRAMES_IN_FLIGHT];
+        GLenum wait_result = glClientWaitSync(fence, 0, 0);
+        if (wait_result != GL_ALREADY_SIGNALED && wait_result != GL_CONDITION_SATISFIED)
+        {
+            break;
+        }
+        ++g_frames_completed;
+    }
+}
+
+internal void FreeRetiredResource(const RetiredResource& retired)
+{
+    switch (retired.type)
+    {
+        case RetiredType::MESH:
+        {
+            GLMesh& mesh = g_meshes[retired.id];
+            if (mesh.vao) glDeleteVertexArrays(1, &mesh.vao);
+            if (mesh.vbo) glDeleteBuffers(1, &mesh.vbo);
+            if (mesh.ebo) glDeleteBuffers(1, &mesh.ebo);
+            ClearSlot(&mesh);
+            g_free_mesh_slots.push_back(retired.id);
+        } break;
+
+        case RetiredType::SPRITE:
+        {
+            GLSprite& sprite = g_sprites[retired.id];
+            if (sprite.texture_id && sprite.texture_id != g_fallback_texture)
+            {
+                glDeleteTextures(1, &sprite.texture_id);
+            }
+            ClearSlot(&sprite);
+            g_free_sprite_slots.push_back(retired.id);
+        } break;
+
+        case RetiredType::SHADER:
+        {
+            GLShader& shader = g_shaders[retired.id];
+            if (shader.vertex_shader) glDeleteShader(shader.vertex_shader);
+            if (shader.fragment_shader) glDeleteShader(shader.fragment_shader);
+            if (shader.program) glDeleteProgram(shader.program);
+            if (shader.program == g_bound_program) g_bound_program = 0; // The name can be handed out again
+            ClearSlot(&shader);
+            shader.status = ShaderStatus::FAILED;
+            g_free_shader_slots.push_back(retired.id);
+        } break;
+    }
+}
+
+internal void ProcessRetireLists()
+{
+    for (u32 i = 0; i < ArrayCount(g_retire_lists); ++i)
+    {
+        RetireList& list = g_retire_lists[i];
+        if (list.resources.empty() || list.frame >= g_frames_completed)
+        {
+            continue;
+        }
+
+        for (const RetiredResource& retired : list.resources)
+        {
+            FreeRetiredResource(retired);
+        }
+        list.resources.clear();
+    }
+}
+
+// Frees the resource once the frame currently being built has finished on the GPU
+internal void RetireResource(RetiredType type, u32 id)
+{
+    RetireList& list = g_retire_lists[g_frames_submitted % ArrayCount(g_retire_lists)];
+    if (list.frame != g_frames_submitted && !list.resources.empty() && list.frame < g_frames_completed)
+    {
+        for (const RetiredResource& retired : list.resources)
+        {
+            FreeRetiredResource(retired);
+        }
+        list.resources.clear();
+    }
+
+    // Normally the older list is done by now. It is not when Present() gave up on a hung fence; its
+    // resources then stay and wait for this frame instead, frames finish in order so that is later.
+
+    list.frame = g_frames_submitted;
+    RetiredResource retired = {};
+    retired.type = type;
+    retired.id = id;
+    list.resources.push_back(retired);
+}
+
+internal void Init_LightClusters()
+{
+    glGenBuffers(3, g_light_buffers);
+    glGenTextures(3, g_light_textures);
+
+    const GLenum formats[3] = { GL_RG32UI, GL_R16UI, GL_RGBA32F };
+    for (u32 i = 0; i < 3; ++i)
+    {
+        // Start empty so shaders see zero lights in every cluster until the first upload
+        glBindBuffer(GL_TEXTURE_BUFFER, g_light_buffers[i]);
+        glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+        glBindTexture(GL_TEXTURE_BUFFER, g_light_textures[i]);
+        glTexBuffer(GL_TEXTURE_BUFFER, formats[i], g_light_buffers[i]);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+internal bool renderer::Init(void* window_handle)
+{
+    bool init_result = Init_OpenGL(window_handle);
+    if (!init_result)
+    {
+        return false;
+    }
+
+    Init_ShaderCompilation();
+    Init_SpriteRendering();
+    Init_TextureStreaming();
+    Init_GpuQueries();
+    Init_SceneTarget();
+    Init_UploadThread();
+    Init_LightClusters();
+
+    QueryPerformanceFrequency(&g_counter_frequency);
+    g_frame_pacing.max_frames_in_flight = g_max_frames_in_flight;
+
+    return true;
+}
+
+internal void renderer::Resize(i32 width, i32 height)
+{
+    g_backbuffer_width = width;
+    g_backbuffer_height = height;
+    glViewport(0, 0, width, height);
+    ResizeSceneTarget();
+}
+
+internal void renderer::SetRenderScale(f32 scale)
+{
+    g_render_scale = MinFloat(MaxFloat(scale, MIN_RENDER_SCALE), MAX_RENDER_SCALE);
+}
+
+internal void renderer::GetRenderResolution(i32* width, i32* height)
+{
+    if (!g_scene_target_valid)
+    {
+        *width = g_backbuffer_width;
+        *height = g_backbuffer_height;
+        return;
+    }
+
+    *width = MaxInt(RoundFloatToInt((f32)g_backbuffer_width * g_render_scale), 1);
+    *height = MaxInt(RoundFloatToInt((f32)g_backbuffer_height * g_render_scale), 1);
+}
+
+internal void renderer::BeginScene()
+{
+    if (!g_scene_target_valid)
+    {
+        return;
+    }
+
+    i32 width, height;
+    GetRenderResolution(&width, &height);
+    glBindFramebuffer(GL_FRAMEBUFFER, g_scene_fbo);
+    glViewport(0, 0, width, height);
+    g_scene_active = true;
+}
+
+internal void renderer::EndScene()
+{
+    if (!g_scene_active)
+    {
+        return;
+    }
+
+    // Bilinear upscale of the rendered corner to the whole window
+    i32 width, height;
+    GetRenderResolution(&width, &height);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, g_scene_fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, g_backbuffer_width, g_backbuffer_height,
+                      GL_COLOR_BUFFER_BIT, width == g_backbuffer_width ? GL_NEAREST : GL_LINEAR);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, g_backbuffer_width, g_backbuffer_height);
+    g_scene_active = false;
+}
+
+internal f32 GetMillisecondsSince(LARGE_INTEGER start)
+{
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return (f32)(now.QuadPart - start.QuadPart) * 1000.0f / (f32)g_counter_frequency.QuadPart;
+}
+
+internal void renderer::SetMaxFramesInFlight(u32 count)
+{
+    g_max_frames_in_flight = count < 1 ? 1 : (count > MAX_FRAMES_IN_FLIGHT ? MAX_FRAMES_IN_FLIGHT : count);
+    g_frame_pacing.max_frames_in_flight = g_max_frames_in_flight;
+}
+
+// Blocks until at most MaxFramesInFlight - 1 frames are still queued on the GPU. Call it
+// before sampling input so the latency from input to display stays bounded.
+internal void renderer::WaitForFrameLatency()
+{
+    if (g_frames_submitted < g_max_frames_in_flight)
+    {
+        return;
+    }
+
+    u64 frame = g_frames_submitted - g_max_frames_in_flight;
+    GLsync fence = g_frame_fences[frame % MAX_FRAMES_IN_FLIGHT];
+    if (fence == nullptr || frame < g_frames_completed)
+    {
+        return;
+    }
+
+    LARGE_INTEGER wait_start;
+    QueryPerformanceCounter(&wait_start);
+    GLenum wait_result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, FRAME_FENCE_TIMEOUT_NS);
+    f32 wait_ms = GetMillisecondsSince(wait_start);
+
+    if (wait_result == GL_TIMEOUT_EXPIRED || wait_result == GL_WAIT_FAILED)
+    {
+        ++g_frame_pacing.timeout_count;
+    }
+    else
+    {
+        g_frames_completed = frame + 1;
+    }
+
+    g_frame_pacing.last_wait_ms = wait_ms;
+    g_frame_pacing.avg_wait_ms += (wait_ms - g_frame_pacing.avg_wait_ms) * FRAME_PACING_SMOOTHING;
+}
+
+internal void renderer::GetFramePacingStats(FramePacingStats* stats)
+{
+    *stats = g_frame_pacing;
+}
+
+internal void renderer::BeginFrame()
+{
+    UpdateCompletedFrames();
+    ProcessRetireLists();
+    ProcessCompletedUploads();
+    g_bound_program = 0;
+    g_render_stats = {};
+
+    // Read back whatever finished, oldest first
+    for (u32 i = 0; i < GPU_QUERY_FRAME_LATENCY; ++i)
+    {
+        GLGpuQueryFrame* frame = &g_gpu_query_frames[(g_gpu_frame_index + i) % GPU_QUERY_FRAME_LATENCY];
+        if (frame->is_pending)
+        {
+            ResolveGpuFrame(frame);
+        }
+    }
+
+    // A GPU this far behind loses the oldest frame's timings rather than stalling us
+    GLGpuQueryFrame* frame = &g_gpu_query_frames[g_gpu_frame_index % GPU_QUERY_FRAME_LATENCY];
+    frame->is_pending = false;
+    frame->frame_index = g_gpu_frame_index;
+    frame->scope_count = 0;
+    g_gpu_scope_depth = 0;
+    g_gpu_frame_open = true;
+    glQueryCounter(frame->frame_begin_query, GL_TIMESTAMP);
+}
+
+internal void renderer::BeginGpuScope(const char* label)
+{
+    if (!g_gpu_frame_open || g_gpu_scope_depth == MAX_GPU_SCOPES)
+    {
+        return;
+    }
+
+    GLGpuQueryFrame* frame = &g_gpu_query_frames[g_gpu_frame_index % GPU_QUERY_FRAME_LATENCY];
+    if (frame->scope_count == MAX_GPU_SCOPES)
+    {
+        // Out of scopes: keep the stack balanced, EndGpuScope() skips it
+        g_gpu_scope_stack[g_gpu_scope_depth++] = MAX_GPU_SCOPES;
+        return;
+    }
+
+    u32 scope_index = frame->scope_count++;
+    GLGpuScope& scope = frame->scopes[scope_index];
+    scope.label = label;
+    scope.depth = g_gpu_scope_depth;
+    glQueryCounter(scope.begin_query, GL_TIMESTAMP);
+
+    // Only one statistics query per target can be active, so nested scopes go without
+    scope.has_pipeline_stats = g_pipeline_stats_supported && g_gpu_scope_depth == 0;
+    if (scope.has_pipeline_stats)
+    {
+        for (u32 i = 0; i < GPU_PIPELINE_STAT_COUNT; ++i)
+        {
+            glBeginQuery(g_pipeline_stat_targets[i], scope.stat_queries[i]);
+        }
+    }
+
+    g_gpu_scope_stack[g_gpu_scope_depth++] = scope_index;
+}
+
+internal void renderer::EndGpuScope()
+{
+    if (!g_gpu_frame_open || g_gpu_scope_depth == 0)
+    {
+        return;
+    }
+
+    u32 scope_index = g_gpu_scope_stack[--g_gpu_scope_depth];
+    if (scope_index == MAX_GPU_SCOPES)
+    {
+        return;
+    }
+
+    GLGpuScope& scope = g_gpu_query_frames[g_gpu_frame_index % GPU_QUERY_FRAME_LATENCY].scopes[scope_index];
+    if (scope.has_pipeline_stats)
+    {
+        for (u32 i = 0; i < GPU_PIPELINE_STAT_COUNT; ++i)
+        {
+            glEndQuery(g_pipeline_stat_targets[i]);
+        }
+    }
+    glQueryCounter(scope.end_query, GL_TIMESTAMP);
+}
+
+internal bool renderer::GetGpuFrameStats(GpuFrameStats* stats)
+{
+    bool updated = g_gpu_stats_updated;
+    *stats = g_gpu_last_stats;
+    g_gpu_stats_updated = false;
+    return updated;
+}
+
+internal void renderer::GetRenderStats(RenderStats* stats)
+{
+    *stats = g_render_stats;
+}
+
+// A synchronous read of the back buffer, it waits for the GPU to finish the frame
+internal bool renderer::ReadFramebuffer(VMArena* arena, u8** pixels, i32* width, i32* height)
+{
+    if (g_backbuffer_width <= 0 || g_backbuffer_height <= 0)
+    {
+        return false;
+    }
+
+    PixelImage image = {};
+    image.width = g_backbuffer_width;
+    image.height = g_backbuffer_height;
+    image.pitch = g_backbuffer_width * 4;
+    image.format = PIXEL_FORMAT_BGRA8;
+    image.pixels = memory::VMArenaAllocAligned(arena, (size_t)image.pitch * (size_t)image.height, 16);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    glReadBuffer(GL_BACK);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, image.width, image.height, GL_BGRA, GL_UNSIGNED_BYTE, image.pixels);
+    CheckOpenGLError("ReadFramebuffer");
+
+    // GL rows start at the bottom
+    pixel_convert::FlipRows(&image, &g_work_queue);
+
+    *pixels = (u8*)image.pixels;
+    *width = image.width;
+    *height = image.height;
+    return true;
+}
+
+internal void renderer::Present()
+{
+    BeginGpuScope("Texture uploads");
+    ProcessTextureUploads();
+    EndGpuScope();
+
+    if (g_gpu_frame_open)
+    {
+        while (g_gpu_scope_depth > 0)
+        {
+            EndGpuScope();
+        }
+
+        GLGpuQueryFrame* frame = &g_gpu_query_frames[g_gpu_frame_index % GPU_QUERY_FRAME_LATENCY];
+        glQueryCounter(frame->frame_end_query, GL_TIMESTAMP);
+        frame->is_pending = true;
+        g_gpu_frame_open = false;
+        ++g_gpu_frame_index;
+    }
+
+    // The slot's previous fence belongs to the frame MAX_FRAMES_IN_FLIGHT ago. It has normally
+    // been waited on already, but retire lists rely on it, so never count it complete unsignaled.
+    // If the GPU hangs we stop waiting and leave g_frames_completed behind. RetireResource() then
+    // keeps that frame's resources for a later frame, freed once UpdateCompletedFrames() gets past it.
+    u32 fence_slot = (u32)(g_frames_submitted % MAX_FRAMES_IN_FLIGHT);
+    if (g_frame_fences[fence_slot] != nullptr)
+    {
+        if (g_frames_completed + MAX_FRAMES_IN_FLIGHT <= g_frames_submitted)
+        {
+            GLenum wait_result;
+            u32 timeouts = 0;
+            do
+            {
+                wait_result = glClientWaitSync(g_frame_fences[fence_slot], GL_SYNC_FLUSH_COMMANDS_BIT, FRAME_FENCE_TIMEOUT_NS);
+            } while (wait_result == GL_TIMEOUT_EXPIRED && ++timeouts < FRAME_FENCE_MAX_TIMEOUTS);
+
+            if (wait_result == GL_ALREADY_SIGNALED || wait_result == GL_CONDITION_SATISFIED)
+            {
+                g_frames_completed = g_frames_submitted - MAX_FRAMES_IN_FLIGHT + 1;
+            }
+            else
+            {
+                g_frame_pacing.timeout_count += timeouts;
+                printf("Frame %llu fence did not signal after %u waits, the GPU may be hung\n",
+                       g_frames_submitted - MAX_FRAMES_IN_FLIGHT, timeouts);
+            }
+        }
+        glDeleteSync(g_frame_fences[fence_slot]);
+    }
+    g_frame_fences[fence_slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    ++g_frames_submitted;
+
+    if (g_last_present_time.QuadPart != 0)
+    {
+        f32 interval_ms = GetMillisecondsSince(g_last_present_time);
+        g_frame_pacing.avg_present_interval_ms += (interval_ms - g_frame_pacing.avg_present_interval_ms) * FRAME_PACING_SMOOTHING;
+        f32 deviation = fabsf(interval_ms - g_frame_pacing.avg_present_interval_ms);
+        g_frame_pacing.present_jitter_ms += (deviation - g_frame_pacing.present_jitter_ms) * FRAME_PACING_SMOOTHING;
+    }
+    QueryPerformanceCounter(&g_last_present_time);
+
+    glFlush();
+}
+
+internal void renderer::ClearScreen(f32 r, f32 g, f32 b, f32 a)
+{
+    glClearColor(r, g, b, a);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+internal MeshHandle renderer::CreateMesh(const Vertex* vertices, int v_count, int* indices, int i_count)
+{
+    MeshLod lod = {};
+    lod.index_offset = 0;
+    lod.index_count = (u32)i_count;
+    lod.error = 0.0f;
+    return CreateMeshWithLods(vertices, v_count, indices, i_count, &lod, 1);
+}
+
+internal MeshHandle renderer::CreateMeshWithLods(const Vertex* vertices, int v_count, int* indices, int i_count, const MeshLod* lods, u32 lod_count)
+{
+    GLMesh mesh = {};
+
+    // Quantize to the compact GPU format, and drop to 16-bit indices when they fit
+    std::vector<CompactVertex> compact_vertices((size_t)v_count);
+    glm::vec3 center;
+    glm::vec3 extent;
+    vertex_format::EncodeCompactVertices(vertices, (u32)v_count, compact_vertices.data(), &center, &extent);
+    mesh.dequantize = glm::scale(glm::translate(glm::mat4(1.0f), center), extent);
+
+    std::vector<u16> short_indices;
+    const void* index_data = indices;
+    mesh.index_type = GL_UNSIGNED_INT;
+    mesh.index_size = sizeof(u32);
+    if (v_count <= MAX_16BIT_INDEX_VERTICES)
+    {
+        short_indices.resize((size_t)i_count);
+        for (int i = 0; i < i_count; ++i)
+        {
+            short_indices[(size_t)i] = (u16)indices[i];
+        }
+        index_data = short_indices.data();
+        mesh.index_type = GL_UNSIGNED_SHORT;
+        mesh.index_size = sizeof(u16);
+    }
+
+    // Generate the VAO first
+    glGenVertexArrays(1, &mesh.vao);
+    glBindVertexArray(mesh.vao); // "Start recording configuration..."
+
+    // Generate the VBO and fill it with data
+    glGenBuffers(1, &mesh.vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
+    glBufferData(GL_ARRAY_BUFFER, v_count * static_cast<int>(sizeof(CompactVertex)), compact_vertices.data(), GL_STATIC_DRAW);
+
+    glGenBuffers(1, &mesh.ebo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, i_count * static_cast<int>(mesh.index_size), index_data, GL_STATIC_DRAW);
+    // Layout matches struct CompactVertex:
+    // 0: Position (3 snorm16)
+    // 1: Normal (2 snorm16, octahedral)
+    // 2: Color (3 unorm8)
+    // 3: UV (2 half floats)
+    ApplyVertexLayout(compact_vertex_layout);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0); // Unbind VBO (the VAO "remembers" it)
+    glBindVertexArray(0);
+
+    // Every LOD indexes into the same buffers, finest first
+    Assert(lod_count > 0 && lod_count <= MAX_MESH_LODS);
+    mesh.lod_count = lod_count < MAX_MESH_LODS ? lod_count : MAX_MESH_LODS;
+    for (u32 i = 0; i < mesh.lod_count; ++i)
+    {
+        mesh.lods[i] = lods[i];
+    }
+    mesh.is_ready = true;
+
+    MeshHandle handle = {};
+    handle.id = AllocateSlot(g_meshes, g_free_mesh_slots, mesh);
+    return handle;
+}
+
+internal MeshHandle renderer::CreateMeshAsync(const Vertex* vertices, int v_count, int* indices, int i_count, const MeshLod* lods, u32 lod_count)
+{
+    if (g_upload_context == nullptr)
+    {
+        return CreateMeshWithLods(vertices, v_count, indices, i_count, lods, lod_count);
+    }
+
+    GLMesh mesh = {};
+    Assert(lod_count > 0 && lod_count <= MAX_MESH_LODS);
+    mesh.lod_count = lod_count < MAX_MESH_LODS ? lod_count : MAX_MESH_LODS;
+    for (u32 i = 0; i < mesh.lod_count; ++i)
+    {
+        mesh.lods[i] = lods[i];
+    }
+    mesh.upload_pending = true;
+
+    MeshHandle handle = {};
+    handle.id = AllocateSlot(g_meshes, g_free_mesh_slots, mesh);
+
+    UploadJob* job = new UploadJob();
+    job->type = UploadJobType::MESH;
+    job->id = GetHandleIndex(handle.id);
+    job->vertices.assign(vertices, vertices + v_count);
+    job->indices.assign(indices, indices + i_count);
+    SubmitUploadJob(job);
+    return handle;
+}
+
+internal bool renderer::IsMeshReady(MeshHandle handle)
+{
+    const GLMesh* mesh = GetLiveSlot(g_meshes, handle.id);
+    return mesh != nullptr && mesh->is_ready;
+}
+
+internal void renderer::DestroyMesh(MeshHandle handle)
+{
+    GLMesh* mesh = GetLiveSlot(g_meshes, handle.id);
+    if (mesh == nullptr) return;
+
+    // A pending upload retires the mesh itself once its buffers arrive
+    KillSlot(mesh);
+    mesh->is_ready = false;
+    if (!mesh->upload_pending)
+    {
+        RetireResource(RetiredType::MESH, GetHandleIndex(handle.id));
+    }
+}
+
+internal ShaderHandle renderer::CreateShaderAsync(const char* vertex_source, const char* fragment_source)
+{
+    GLShader shader = {};
+    shader.create_time = Win32_GetWallClock();
+
+    // Any change to either source or to the driver yields a new key, stale entries are simply never hit
+    shader.cache_key = HashStringFNV64(vertex_source, g_driver_hash);
+    shader.cache_key = HashStringFNV64("\x1f", shader.cache_key);
+    shader.cache_key = HashStringFNV64(fragment_source, shader.cache_key);
+
+    if (g_program_binary_supported)
+    {
+        shader.program = LoadCachedProgram(shader.cache_key);
+    }
+
+    if (shader.program)
+    {
+        shader.status = ShaderStatus::READY;
+    }
+    else
+    {
+        IssueProgramCompile(&shader, vertex_source, fragment_source);
+    }
+
+    ShaderHandle handle = {};
+    handle.id = AllocateSlot(g_shaders, g_free_shader_slots, shader);
+    if (shader.status == ShaderStatus::READY)
+    {
+        LogShaderReady(GetHandleIndex(handle.id), shader, "loaded from cache");
+    }
+    return handle;
+}
+
+internal ShaderHandle renderer::CreateShader(const char* vertex_source, const char* fragment_source)
+{
+    ShaderHandle handle = CreateShaderAsync(vertex_source, fragment_source);
+
+    GLShader& shader = g_shaders[GetHandleIndex(handle.id)];
+    if (shader.status == ShaderStatus::PENDING)
+    {
+        FinalizeProgram(&shader);
+        LogShaderReady(GetHandleIndex(handle.id), shader, shader.status == ShaderStatus::READY ? "compiled" : "failed");
+    }
+    return handle;
+}
+
+internal void renderer::DestroyShader(ShaderHandle handle)
+{
+    GLShader* shader = GetLiveSlot(g_shaders, handle.id);
+    if (shader == nullptr) return;
+
+    KillSlot(shader);
+    RetireResource(RetiredType::SHADER, GetHandleIndex(handle.id));
+}
+
+internal ShaderStatus renderer::GetShaderStatus(ShaderHandle handle)
+{
+    if (GetLiveSlot(g_shaders, handle.id) == nullptr) return ShaderStatus::FAILED;
+
+    PollShader(GetHandleIndex(handle.id));
+    return g_shaders[GetHandleIndex(handle.id)].status;
+}
+
+// Builds the whole mip chain in the decode arena and block compresses it when the driver can sample
+// the result. Otherwise every level is uploaded at once: through the staging buffer when it has room,
+// the sprite then shows up once the copy retired like a streamed one, or straight from client memory.
+// Sprites are color art, filtered and sampled as sRGB. The caller resets the arena.
+internal SpriteHandle CreateSpriteFromPixels(const u8* pixels, i32 texture_width, i32 texture_height, float width, float height)
+{
+    MipChain chain = {};
+    mipmap::GenerateRgba8(&g_work_queue, &g_decode_arena, pixels, texture_width, texture_height, true, TEXTURE_MIP_FILTER, &chain);
+
+    TextureLevel compressed_levels[MIP_MAX_LEVELS];
+    TextureFormat format = CompressSpriteChain(&g_work_queue, &g_decode_arena, &chain, compressed_levels);
+    if (format != TextureFormat::RGBA8)
+    {
+        return renderer::CreateCompressedSprite(format, compressed_levels, chain.level_count, true, width, height);
+    }
+
+    GLSprite sprite = {};
+    sprite.width = width;
+    sprite.height = height;
+    sprite.is_srgb = true;
+    sprite.texture_id = CreateSpriteTexture(chain.levels, chain.level_count, true);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    u32 level_offsets[MIP_MAX_LEVELS];
+    u32 size = 0;
+    for (u32 level = 0; level < chain.level_count; ++level)
+    {
+        level_offsets[level] = size;
+        size += (u32)chain.levels[level].width * (u32)chain.levels[level].height * 4;
+    }
+
+    u32 used_before = g_staging_used;
+    u32 offset = 0;
+    bool is_staged = AllocateStaging(size, &offset);
+    u8* destination = nullptr;
+    if (is_staged)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, g_staging_pbo);
+        destination = g_staging_mapped ? g_staging_mapped + offset : nullptr;
+        if (!g_staging_mapped)
+        {
+            // The range is known to be idle, so skip the driver's implicit synchronization
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+            destination = (u8*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, offset, size, flags);
+        }
+        if (destination != nullptr)
+        {
+            for (u32 level = 0; level < chain.level_count; ++level)
+            {
+                memcpy(destination + level_offsets[level], chain.levels[level].pixels,
+                       (size_t)chain.levels[level].width * (size_t)chain.levels[level].height * 4);
+            }
+            if (!g_staging_mapped)
+            {
+                glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            }
+            for (u32 level = 0; level < chain.level_count; ++level)
+            {
+                glTexSubImage2D(GL_TEXTURE_2D, (GLint)level, 0, 0, chain.levels[level].width, chain.levels[level].height,
+                                GL_RGBA, GL_UNSIGNED_BYTE, (void*)(size_t)(offset + level_offsets[level]));
+            }
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+    if (destination == nullptr)
+    {
+        for (u32 level = 0; level < chain.level_count; ++level)
+        {
+            glTexSubImage2D(GL_TEXTURE_2D, (GLint)level, 0, 0, chain.levels[level].width, chain.levels[level].height,
+                            GL_RGBA, GL_UNSIGNED_BYTE, chain.levels[level].pixels);
+        }
+        sprite.is_ready = true;
+    }
+
+    SpriteHandle handle = {};
+    handle.id = AllocateSlot(g_sprites, g_free_sprite_slots, sprite);
+
+    if (is_staged)
+    {
+        // The range goes back to the ring with the frame's other staging memory
+        StagingRegion region = {};
+        region.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        region.end_offset = g_staging_head;
+        region.size = g_staging_used - used_before;
+        if (destination != nullptr)
+        {
+            region.completed_sprites.push_back(GetHandleIndex(handle.id));
+        }
+        g_staging_regions.push_back(region);
+    }
+    return handle;
+}
+
+// Rows are decoded bottom up, GL's first row is the bottom one
+internal SpriteHandle CreateSpriteFromPng(const Resource* resource, float width, float height)
+{
+    size_t arena_offset = g_decode_arena.curr_offset;
+    PngInfo info = {};
+    u8* pixels = png_decoder::DecodeToArena(resource->rawBuffer, resource->size, &g_decode_arena, true, &info);
+    if (!pixels)
+    {
+        g_decode_arena.curr_offset = arena_offset;
+        return renderer::CreateSprite(INVALID_RESOURCE_ID, width, height);
+    }
+
+    SpriteHandle handle = CreateSpriteFromPixels(pixels, info.width, info.height, width, height);
+    g_decode_arena.curr_offset = arena_offset;
+    return handle;
+}
+
+internal SpriteHandle renderer::CreateSprite(ResourceID resource_id, float width, float height)
+{
+    GLSprite sprite = {};
+    sprite.width = width;
+    sprite.height = height;
+
+    // Load texture data from resource catalog
+    const u8* pixels = nullptr;
+    int texture_dim = 0;
+    if (g_resource_catalog != nullptr && resource_id != INVALID_RESOURCE_ID)
+    {
+        Resource* resource = Catalog_Get(g_resource_catalog, resource_id);
+        if (resource != nullptr && resource->rawBuffer != nullptr && png_decoder::IsPng(resource->rawBuffer, resource->size))
+        {
+            return CreateSpriteFromPng(resource, width, height);
+        }
+        if (resource != nullptr && resource->rawBuffer != nullptr)
+        {
+            // Assume the resource contains raw RGBA pixel data
+            // For a real implementation, you'd parse format/dimensions from the resource data
+            // For now, assume it's a square texture: size = width * height * 4 (RGBA)
+            // and dimensions = width
+            texture_dim = (int)sqrt(resource->size / 4);
+            pixels = (const u8*)resource->rawBuffer;
+        }
+    }
+
+    if (texture_dim > 0)
+    {
+        size_t arena_offset = g_decode_arena.curr_offset;
+        SpriteHandle handle = CreateSpriteFromPixels(pixels, texture_dim, texture_dim, width, height);
+        g_decode_arena.curr_offset = arena_offset;
+        return handle;
+    }
+
+    // Fallback: share the 32x32 colored quadrant texture
+    sprite.texture_id = g_fallback_texture;
+    sprite.is_ready = true;
+
+    SpriteHandle handle = {};
+    handle.id = AllocateSlot(g_sprites, g_free_sprite_slots, sprite);
+    return handle;
+}
+
+// The texels point into the resource catalog, which outlives the upload
+internal SpriteHandle renderer::CreateSpriteAsync(ResourceID resource_id, float width, float height)
+{
+    Resource* resource = nullptr;
+    if (g_resource_catalog != nullptr && resource_id != INVALID_RESOURCE_ID)
+    {
+        resource = Catalog_Get(g_resource_catalog, resource_id);
+    }
+    // PNGs are decoded on this thread, their upload already goes through the staging buffer
+    if (g_upload_context == nullptr || resource == nullptr || resource->rawBuffer == nullptr ||
+        png_decoder::IsPng(resource->rawBuffer, resource->size))
+    {
+        return CreateSprite(resource_id, width, height);
+    }
+
+    GLSprite sprite = {};
+    sprite.width = width;
+    sprite.height = height;
+    sprite.upload_pending = true;
+    sprite.is_srgb = true;
+
+    SpriteHandle handle = {};
+    handle.id = AllocateSlot(g_sprites, g_free_sprite_slots, sprite);
+
+    // Same square RGBA assumption as CreateSprite()
+    i32 texture_dim = (i32)sqrt(resource->size / 4);
+    UploadJob* job = new UploadJob();
+    job->type = UploadJobType::SPRITE;
+    job->id = GetHandleIndex(handle.id);
+    job->pixels = (const u8*)resource->rawBuffer;
+    job->width = texture_dim;
+    job->height = texture_dim;
+    SubmitUploadJob(job);
+    return handle;
+}
+
+internal bool renderer::IsSpriteReady(SpriteHandle handle)
+{
+    const GLSprite* sprite = GetLiveSlot(g_sprites, handle.id);
+    return sprite != nullptr && sprite->is_ready;
+}
+
+internal u32 renderer::GetPendingUploadCount()
+{
+    u32 count = 0;
+    for (const GLMesh& mesh : g_meshes)
+    {
+        count += (!mesh.is_destroyed && !mesh.is_ready) ? 1 : 0;
+    }
+    for (const GLSprite& sprite : g_sprites)
+    {
+        count += (!sprite.is_destroyed && !sprite.is_ready) ? 1 : 0;
+    }
+    return count;
+}
+
+internal void renderer::DestroySprite(SpriteHandle handle)
+{
+    GLSprite* sprite = GetLiveSlot(g_sprites, handle.id);
+    if (sprite == nullptr) return;
+
+    u32 sprite_id = GetHandleIndex(handle.id);
+    KillSlot(sprite);
+    sprite->is_ready = false;
+
+    // Stop streaming into it, and make sure a finishing staging region can't flag a recycled slot
+    for (size_t i = 0; i < g_texture_uploads.size();)
+    {
+        if (g_texture_uploads[i].sprite_id == sprite_id)
+        {
+            g_texture_uploads.erase(g_texture_uploads.begin() + (ptrdiff_t)i);
+        }
+        else
+        {
+            ++i;
+        }
+    }
+    for (StagingRegion& region : g_staging_regions)
+    {
+        std::vector<u32>& completed = region.completed_sprites;
+        for (size_t i = 0; i < completed.size();)
+        {
+            if (completed[i] == sprite_id)
+            {
+                completed.erase(completed.begin() + (ptrdiff_t)i);
+            }
+            else
+            {
+                ++i;
+            }
+        }
+    }
+
+    if (!sprite->upload_pending)
+    {
+        RetireResource(RetiredType::SPRITE, sprite_id);
+    }
+}
+
+// The texels of every level are streamed in by ProcessTextureUploads() and must stay alive until then
+internal SpriteHandle renderer::CreateSpriteWithMips(const TextureLevel* levels, u32 level_count, bool srgb, float width, float height)
+{
+    GLSprite sprite = {};
+    sprite.width = width;
+    sprite.height = height;
+    sprite.is_srgb = srgb;
+    sprite.texture_id = CreateSpriteTexture(levels, level_count, srgb);
+
+    SpriteHandle handle = {};
+    handle.id = AllocateSlot(g_sprites, g_free_sprite_slots, sprite);
+    u32 sprite_id = GetHandleIndex(handle.id);
+    for (u32 level = 0; level < level_count; ++level)
+    {
+        TextureUpload upload = {};
+        upload.sprite_id = sprite_id;
+        upload.pixels = (const u8*)levels[level].pixels;
+        upload.level = (i32)level;
+        upload.width = levels[level].width;
+        upload.height = levels[level].height;
+        upload.is_last_level = level + 1 == level_count;
+        g_texture_uploads.push_back(upload);
+    }
+    return handle;
+}
+
+internal SpriteHandle renderer::CreateCompressedSprite(TextureFormat format, const TextureLevel* levels, u32 level_count, bool srgb,
+                                                       float width, float height)
+{
+    GLSprite sprite = {};
+    sprite.width = width;
+    sprite.height = height;
+    sprite.is_ready = true;
+
+    GLenum internal_format = GetCompressedInternalFormat(format, srgb);
+    if (internal_format != 0 && levels != nullptr && level_count > 0 && levels[0].width > 0 && levels[0].height > 0)
+    {
+        sprite.texture_id = CreateCompressedTexture(format, internal_format, levels, level_count);
+        sprite.is_srgb = srgb;
+        CheckOpenGLError("CreateCompressedSprite");
+    }
+    else
+    {
+        printf("Compressed texture format %s is not supported, using the fallback texture\n", block_compression::texture_format_names[(u32)format]);
+        sprite.texture_id = g_fallback_texture;
+    }
+
+    SpriteHandle handle = {};
+    handle.id = AllocateSlot(g_sprites, g_free_sprite_slots, sprite);
+    return handle;
+}
+
+// Orphans and refills the three buffers; the frames still in flight keep the old storage
+internal void renderer::UploadLightClusters(const LightClusters* clusters)
+{
+    const void* data[3] = { clusters->cluster_ranges, clusters->light_indices, clusters->lights };
+    GLsizeiptr sizes[3] = {
+        (GLsizeiptr)CLUSTER_COUNT * 2 * sizeof(u32),
+        (GLsizeiptr)clusters->index_count * sizeof(u16),
+        (GLsizeiptr)clusters->light_count * sizeof(PointLight),
+    };
+    const GLenum units[3] = { LIGHT_CLUSTER_RANGES_UNIT, LIGHT_INDICES_UNIT, LIGHT_DATA_UNIT };
+
+    for (u32 i = 0; i < 3; ++i)
+    {
+        glBindBuffer(GL_TEXTURE_BUFFER, g_light_buffers[i]);
+        glBufferData(GL_TEXTURE_BUFFER, sizes[i] > 0 ? sizes[i] : 16, nullptr, GL_STREAM_DRAW);
+        if (sizes[i] > 0)
+        {
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, sizes[i], data[i]);
+        }
+
+        glActiveTexture(GL_TEXTURE0 + units[i]);
+        glBindTexture(GL_TEXTURE_BUFFER, g_light_textures[i]);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    glActiveTexture(GL_TEXTURE0);
+
+    g_light_near_plane = clusters->near_plane;
+    g_light_far_plane = clusters->far_plane;
+}
+
+internal void renderer::Draw(RenderCommand* cmd)
+{
+    switch (cmd->mode)
+    {
+        case RenderMode::MESH:
+            DrawMesh(&cmd->mesh_cmd);
+            break;
+        case RenderMode::SPRITE:
+            DrawSprite(&cmd->sprite_cmd);
+            break;
+    }
+}
+
+internal void renderer::DrawMesh(RenderMeshCommand* cmd)
+{
+    //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE); // Wireframe mode
+    GLMesh* live_mesh = GetLiveSlot(g_meshes, cmd->mesh.id);
+    if (live_mesh == nullptr || !live_mesh->is_ready) return;
+    if (GetLiveSlot(g_shaders, cmd->shader.id) == nullptr) return;
+    GLMesh& mesh = *live_mesh;
+    GLuint shader = ResolveProgram(GetHandleIndex(cmd->shader.id));
+
+    // 2. Setup State
+    UseProgram(shader);
+
+    // 3. Upload Uniforms
+    glm::mat4 model = cmd->model * mesh.dequantize;
+    GLint loc_model = glGetUniformLocation(shader, "model");
+    glUniformMatrix4fv(loc_model, 1, GL_FALSE, glm::value_ptr(model));
+
+    GLint loc_view = glGetUniformLocation(shader, "view");
+    glUniformMatrix4fv(loc_view, 1, GL_FALSE, glm::value_ptr(cmd->view));
 
     GLint loc_projection = glGetUniformLocation(shader, "projection");
     glUniformMatrix4fv(loc_projection, 1, GL_FALSE, glm::value_ptr(cmd->projection));
 
+    // Cluster lookup: gl_FragCoord over the scene viewport picks the tile, view depth the slice
+    GLint loc_cluster_depth = glGetUniformLocation(shader, "clusterDepth");
+    if (loc_cluster_depth != -1)
+    {
+        i32 viewport_width, viewport_height;
+        GetRenderResolution(&viewport_width, &viewport_height);
+        glUniform1i(glGetUniformLocation(shader, "clusterRanges"), LIGHT_CLUSTER_RANGES_UNIT);
+        glUniform1i(glGetUniformLocation(shader, "clusterLightIndices"), LIGHT_INDICES_UNIT);
+        glUniform1i(glGetUniformLocation(shader, "lightData"), LIGHT_DATA_UNIT);
+        glUniform2f(glGetUniformLocation(shader, "clusterViewport"), (f32)viewport_width, (f32)viewport_height);
+        glUniform2f(loc_cluster_depth, g_light_near_plane, (f32)CLUSTER_GRID_Z / logf(g_light_far_plane / g_light_near_plane));
+    }
+
     // 4. Draw
     glBindVertexArray(mesh.vao);
+    ++g_render_stats.state_changes;
     auto mode = cmd->draw_mode == DrawMode::TRIANGLES ? GL_TRIANGLES :
                 cmd->draw_mode == DrawMode::LINES ? GL_LINES :
                 cmd->draw_mode == DrawMode::LINE_STRIP ? GL_LINE_STRIP : GL_TRIANGLES;
-    glDrawElements((GLenum)mode, mesh.index_count, GL_UNSIGNED_INT, 0);
+    const MeshLod& lod = mesh.lods[cmd->lod < mesh.lod_count ? cmd->lod : mesh.lod_count - 1];
+    glDrawElements((GLenum)mode, (GLsizei)lod.index_count, mesh.index_type, (void*)((size_t)lod.index_offset * mesh.index_size));
+    ++g_render_stats.draw_calls;
 }
 
 internal void renderer::DrawSprite(RenderSpriteCommand* cmd)
 {
-    if (cmd->sprite.id >= g_sprites.size()) return;
-    if (cmd->shader.id >= g_shaders.size()) return;
-
-    GLSprite& sprite = g_sprites[cmd->sprite.id];
-    GLuint shader = g_shaders[cmd->shader.id];
+    GLSprite* live_sprite = GetLiveSlot(g_sprites, cmd->sprite.id);
+    if (live_sprite == nullptr || GetLiveSlot(g_shaders, cmd->shader.id) == nullptr) return;
+    GLSprite& sprite = *live_sprite;
+    GLuint shader = ResolveProgram(GetHandleIndex(cmd->shader.id));
 
     // Disable depth testing for 2D rendering
     glDisable(GL_DEPTH_TEST);
     glDepthMask(GL_FALSE);
+    g_render_stats.state_changes += 2;
+
+    // sRGB textures come out of the sampler linear, encode them again on the way into the framebuffer
+    bool srgb_writes = sprite.is_ready && sprite.is_srgb && shader != g_fallback_program;
+    if (srgb_writes)
+    {
+        glEnable(GL_FRAMEBUFFER_SRGB);
+        ++g_render_stats.state_changes;
+    }
 
     // 2. Setup State
-    glUseProgram(shader);
+    UseProgram(shader);
 
     // 3. Upload Uniforms
     GLint loc_model = glGetUniformLocation(shader, "model");
@@ -499,19 +2542,38 @@ internal void renderer::DrawSprite(RenderSpriteCommand* cmd)
     GLint loc_projection = glGetUniformLocation(shader, "projection");
     glUniformMatrix4fv(loc_projection, 1, GL_FALSE, glm::value_ptr(cmd->projection));
 
+    // Screen space shaders have no view, but the fallback program does and would otherwise
+    // keep the camera matrix of the last DrawMesh
+    GLint loc_view = glGetUniformLocation(shader, "view");
+    if (loc_view != -1)
+    {
+        glm::mat4 identity = glm::mat4(1.0f);
+        glUniformMatrix4fv(loc_view, 1, GL_FALSE, glm::value_ptr(identity));
+    }
+
     // Bind texture
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, sprite.texture_id);
+    glBindTexture(GL_TEXTURE_2D, sprite.is_ready ? sprite.texture_id : g_fallback_texture);
+    ++g_render_stats.state_changes;
     GLint loc_texture = glGetUniformLocation(shader, "spriteTexture");
     glUniform1i(loc_texture, 0); // Texture unit 0
 
     // 4. Draw
     glBindVertexArray(g_sprite_vao);
     glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+    ++g_render_stats.state_changes;
+    ++g_render_stats.draw_calls;
+
+    if (srgb_writes)
+    {
+        glDisable(GL_FRAMEBUFFER_SRGB);
+        ++g_render_stats.state_changes;
+    }
 
     // Re-enable depth testing
     glEnable(GL_DEPTH_TEST);
     glDepthMask(GL_TRUE);
+    g_render_stats.state_changes += 2;
 }
 
 } // namespace renderer
\ No newline at end of file
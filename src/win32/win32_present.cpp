@@ -0,0 +1,68 @@
+#include "renderer/present.h"
+
+#include "win32_main.h"
+
+global bool g_present_window_invalid = true;
+
+namespace present
+{
+
+// WM_PAINT lands here: whatever got uncovered has been erased, the next present sends everything
+internal void InvalidateWindow(void* window)
+{
+    g_present_window_invalid = true;
+}
+
+internal void PresentFramebuffer(void* window, const Framebuffer* framebuffer, const DirtyRect* rects, u32 rect_count)
+{
+    DirtyRect full_rect = { 0, 0, framebuffer->width, framebuffer->height };
+    if (g_present_window_invalid)
+    {
+        rects = &full_rect;
+        rect_count = 1;
+        g_present_window_invalid = false;
+    }
+    if (rect_count == 0)
+    {
+        return;
+    }
+
+    BITMAPINFO bitmap_info = {};
+    bitmap_info.bmiHeader.biSize = sizeof(bitmap_info.bmiHeader);
+    bitmap_info.bmiHeader.biWidth = framebuffer->width;
+    bitmap_info.bmiHeader.biHeight = -framebuffer->height; // TOP-down
+    bitmap_info.bmiHeader.biPlanes = 1;
+    bitmap_info.bmiHeader.biBitCount = (WORD)(framebuffer->bytes_per_pixel * 8);
+    bitmap_info.bmiHeader.biCompression = BI_RGB;
+
+    HWND window_handle = (HWND)window;
+    HDC context = GetDC(window_handle);
+    RECT client_rect;
+    GetClientRect(window_handle, &client_rect);
+    i64 window_width = client_rect.right - client_rect.left;
+    i64 window_height = client_rect.bottom - client_rect.top;
+
+    for (u32 i = 0; i < rect_count; ++i)
+    {
+        const DirtyRect& rect = rects[i];
+        i32 dest_x0 = (i32)((rect.min_x * window_width) / framebuffer->width);
+        i32 dest_y0 = (i32)((rect.min_y * window_height) / framebuffer->height);
+        i32 dest_x1 = (i32)((rect.max_x * window_width) / framebuffer->width);
+        i32 dest_y1 = (i32)((rect.max_y * window_height) / framebuffer->height);
+
+        // The source rect's y counts from the bottom of the DIB even for a top-down one
+        StretchDIBits(
+            context,
+            dest_x0, dest_y0, dest_x1 - dest_x0, dest_y1 - dest_y0,
+            rect.min_x, framebuffer->height - rect.max_y, rect.max_x - rect.min_x, rect.max_y - rect.min_y,
+            framebuffer->memory,
+            &bitmap_info,
+            DIB_RGB_COLORS,
+            SRCCOPY
+        );
+    }
+
+    ReleaseDC(window_handle, context);
+}
+
+} // namespace present
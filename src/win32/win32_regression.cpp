@@ -0,0 +1,412 @@
+#include "win32_regression.h"
+
+#include "renderer/image_compare.h"
+#include "renderer/pixel_convert.h"
+#include "app/app.h"
+
+#include <vector>
+#include <string.h>
+#include <stdlib.h>
+
+// A fixed sequence of scenes rendered with a fixed time step, the last frame of each one is
+// compared with its golden image. Timings and counters of every scene are appended to the
+// results file. The window is never shown and the frame rate is not capped.
+// A scene without a golden image is reported as "no_golden" and does not count as a failure, the
+// run exits with REGRESSION_EXIT_NO_GOLDEN instead so a fresh checkout knows to bootstrap them.
+
+#define REGRESSION_DIRECTORY            "regression"
+#define REGRESSION_RESULTS_PATH         REGRESSION_DIRECTORY "/results.csv"
+#define REGRESSION_WIDTH                APP_RES_WIDTH
+#define REGRESSION_HEIGHT               APP_RES_HEIGHT
+#define REGRESSION_DEFAULT_FRAMES       120
+#define REGRESSION_WARMUP_FRAMES        60      // Frozen clock, lets the async uploads and shader compiles land
+#define REGRESSION_MAX_WARMUP_FRAMES    600     // Warm up keeps going while uploads are pending, up to this many frames
+#define REGRESSION_DRAIN_FRAMES         4       // Frozen clock after the last scene, the GPU timings lag behind
+#define REGRESSION_DELTA_TIME           (1.0f / 60.0f)
+#define REGRESSION_SCRATCH_SIZE         Megabytes(256)
+
+// A frame passes when all of these hold
+#define REGRESSION_CHANNEL_TOLERANCE    2       // Per channel, in 8-bit steps
+#define REGRESSION_MAX_DIFFERING        0.001   // Fraction of the pixels past the tolerance
+#define REGRESSION_MIN_PSNR             40.0
+#define REGRESSION_MIN_SSIM             0.98
+
+// Process exit codes
+#define REGRESSION_EXIT_PASS            0
+#define REGRESSION_EXIT_FAIL            1       // A scene did not match, or could not be captured
+#define REGRESSION_EXIT_NO_GOLDEN       2       // Everything else passed, run -regression-update to create the missing images
+
+#if RENDERER_SOFTWARE
+#define REGRESSION_BACKEND_NAME         "software"
+#else
+#define REGRESSION_BACKEND_NAME         "opengl"
+#endif
+
+// Keys held down for the whole scene, scenes continue where the previous one left off
+struct RegressionScene
+{
+    const char* name;
+    bool hold_forward;
+    bool hold_back;
+    bool hold_left;
+    bool hold_right;
+};
+
+global const RegressionScene g_regression_scenes[] = {
+    { "start",          false, false, false, false },
+    { "walk_forward",   true,  false, false, false },
+    { "strafe_right",   false, false, false, true  },
+    { "walk_back",      false, true,  false, false },
+};
+
+struct RegressionSceneStats
+{
+    u64 first_frame;
+    u64 end_frame;
+    Win32Stat<f32> cpu_ms;
+    f32 gpu_ms_sum;
+    u32 gpu_frames;
+    u64 draw_calls;
+    u64 state_changes;
+};
+
+#pragma pack(push, 1)
+struct TgaHeader
+{
+    u8 id_length;
+    u8 color_map_type;
+    u8 image_type;
+    u16 color_map_first;
+    u16 color_map_length;
+    u8 color_map_depth;
+    u16 x_origin;
+    u16 y_origin;
+    u16 width;
+    u16 height;
+    u8 bits_per_pixel;
+    u8 descriptor;
+};
+#pragma pack(pop)
+
+#define TGA_IMAGE_TYPE_TRUE_COLOR   2
+#define TGA_DESCRIPTOR_TOP_DOWN     0x20
+#define TGA_DESCRIPTOR_ALPHA_BITS   0x08
+
+internal bool Win32_ParseRegressionOptions(const char* cmd_line, RegressionOptions* options)
+{
+    *options = {};
+    options->frame_count = REGRESSION_DEFAULT_FRAMES;
+    if (!cmd_line)
+    {
+        return false;
+    }
+
+    options->update_golden = strstr(cmd_line, "-regression-update") != nullptr;
+    options->enabled = options->update_golden || strstr(cmd_line, "-regression") != nullptr;
+
+    const char* frames = strstr(cmd_line, "-frames");
+    if (frames)
+    {
+        i32 count = atoi(frames + strlen("-frames"));
+        options->frame_count = count > 0 ? (u32)count : REGRESSION_DEFAULT_FRAMES;
+    }
+    return options->enabled;
+}
+
+internal void Win32_GetGoldenPath(const char* scene_name, char* path, size_t path_size)
+{
+    sprintf_s(path, path_size, "%s/%s/%s.tga", REGRESSION_DIRECTORY, REGRESSION_BACKEND_NAME, scene_name);
+}
+
+// Uncompressed 32-bit TGA, BGRA like the image. Alpha is written opaque for image viewers.
+internal bool Win32_WriteTga(const char* path, const PixelImage* image)
+{
+    FILE* file;
+    if (fopen_s(&file, path, "wb") != 0)
+    {
+        return false;
+    }
+
+    TgaHeader header = {};
+    header.image_type = TGA_IMAGE_TYPE_TRUE_COLOR;
+    header.width = (u16)image->width;
+    header.height = (u16)image->height;
+    header.bits_per_pixel = 32;
+    header.descriptor = TGA_DESCRIPTOR_TOP_DOWN | TGA_DESCRIPTOR_ALPHA_BITS;
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    std::vector<u32> row((size_t)image->width);
+    for (i32 y = 0; y < image->height && ok; ++y)
+    {
+        const u32* source = (const u32*)((const u8*)image->pixels + (size_t)y * (size_t)image->pitch);
+        for (i32 x = 0; x < image->width; ++x)
+        {
+            row[x] = source[x] | 0xFF000000;
+        }
+        ok = fwrite(row.data(), sizeof(u32), row.size(), file) == row.size();
+    }
+    fclose(file);
+    return ok;
+}
+
+// Only reads back what Win32_WriteTga() writes, bottom-up files get flipped
+internal bool Win32_ReadTga(const char* path, VMArena* arena, PixelImage* image)
+{
+    FILE* file;
+    if (fopen_s(&file, path, "rb") != 0)
+    {
+        return false;
+    }
+
+    TgaHeader header = {};
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+              header.image_type == TGA_IMAGE_TYPE_TRUE_COLOR &&
+              header.color_map_type == 0 &&
+              header.bits_per_pixel == 32 &&
+              fseek(file, header.id_length, SEEK_CUR) == 0;
+    if (ok)
+    {
+        image->width = header.width;
+        image->height = header.height;
+        image->pitch = image->width * 4;
+        image->format = PIXEL_FORMAT_BGRA8;
+        size_t size = (size_t)image->pitch * (size_t)image->height;
+        image->pixels = memory::VMArenaAllocAligned(arena, size, 16);
+        ok = fread(image->pixels, 1, size, file) == size;
+        if (ok && !(header.descriptor & TGA_DESCRIPTOR_TOP_DOWN))
+        {
+            pixel_convert::FlipRows(image, &g_work_queue);
+        }
+    }
+    fclose(file);
+    return ok;
+}
+
+internal void Win32_SetRegressionInput(const RegressionScene* scene, Input* input)
+{
+    *input = {};
+    input->keyboard.key_w.is_down = scene->hold_forward;
+    input->keyboard.key_s.is_down = scene->hold_back;
+    input->keyboard.key_a.is_down = scene->hold_left;
+    input->keyboard.key_d.is_down = scene->hold_right;
+}
+
+// Returns the process exit code: 0 when every scene matched its golden image
+internal i32 Win32_RunRegression(HWND window, Memory& app_memory, const RegressionOptions* options)
+{
+    // Same client size on every machine, golden images are compared pixel for pixel
+    RECT window_rect = { 0, 0, REGRESSION_WIDTH, REGRESSION_HEIGHT };
+    AdjustWindowRect(&window_rect, (DWORD)g_window_style, FALSE);
+    SetWindowPos(window, NULL, 0, 0, window_rect.right - window_rect.left, window_rect.bottom - window_rect.top,
+                 SWP_NOMOVE | SWP_NOZORDER | SWP_NOACTIVATE);
+    RECT client_rect;
+    GetClientRect(window, &client_rect);
+    g_window_width = (f32)(client_rect.right - client_rect.left);
+    g_window_height = (f32)(client_rect.bottom - client_rect.top);
+    renderer::Resize((i32)g_window_width, (i32)g_window_height);
+
+    CreateDirectoryA(REGRESSION_DIRECTORY, NULL);
+    CreateDirectoryA(REGRESSION_DIRECTORY "/" REGRESSION_BACKEND_NAME, NULL);
+
+    VMArena scratch = {};
+    memory::InitVMArena(&scratch, REGRESSION_SCRATCH_SIZE);
+
+    const u32 scene_count = ArrayCount(g_regression_scenes);
+    RegressionSceneStats scene_stats[ArrayCount(g_regression_scenes)] = {};
+    PixelImage captures[ArrayCount(g_regression_scenes)] = {};
+    u32 pending_uploads[ArrayCount(g_regression_scenes)] = {};
+
+    printf("Regression run (%s), %u scenes of %u frames at %dx%d\n", REGRESSION_BACKEND_NAME, scene_count,
+           options->frame_count, (i32)g_window_width, (i32)g_window_height);
+
+    // Warm up, one stretch per scene and the drain run with the clock stopped
+    u64 frame_index = 0;
+    u32 total_stretches = scene_count + 2;
+    for (u32 stretch = 0; stretch < total_stretches; ++stretch)
+    {
+        bool is_warmup = stretch == 0;
+        bool is_drain = stretch == total_stretches - 1;
+        u32 scene_index = is_warmup ? 0 : (is_drain ? scene_count - 1 : stretch - 1);
+        const RegressionScene* scene = &g_regression_scenes[scene_index];
+        RegressionSceneStats* stats = (is_warmup || is_drain) ? nullptr : &scene_stats[scene_index];
+        u32 frame_count = is_warmup ? REGRESSION_WARMUP_FRAMES : (is_drain ? REGRESSION_DRAIN_FRAMES : options->frame_count);
+        f32 delta_time = stats ? REGRESSION_DELTA_TIME : 0.0f;
+
+        Input input = {};
+        Input old_input = {};
+        if (stats)
+        {
+            Win32_SetRegressionInput(scene, &input);
+            stats->first_frame = frame_index;
+            stats->end_frame = frame_index + frame_count;
+        }
+
+        // Async uploads finish at the driver's pace, the warm up waits them out so captures never show fallbacks
+        for (u32 frame = 0;
+             frame < frame_count || (is_warmup && frame < REGRESSION_MAX_WARMUP_FRAMES && renderer::GetPendingUploadCount() > 0);
+             ++frame, ++frame_index)
+        {
+            renderer::WaitForFrameLatency();
+
+            // Nothing comes from the user, the messages only need to be drained
+            Input ignored_input = {};
+            Win32_ProcessPendingMessages(window, ignored_input);
+
+            LARGE_INTEGER frame_start = Win32_GetWallClock();
+            RenderQueue render_queue = {};
+            AppUpdate(app_memory, render_queue, input, old_input, g_window_width, g_window_height, delta_time);
+            Win32_RenderFrame(&render_queue, MAX_RENDER_SCALE);
+            f32 cpu_ms = (f32)Win32_GetMicroSecondsElapsed(frame_start, Win32_GetWallClock()) * 0.001f;
+            old_input = input;
+
+            if (stats)
+            {
+                if (frame == 0 || cpu_ms < stats->cpu_ms.min) stats->cpu_ms.min = cpu_ms;
+                if (frame == 0 || cpu_ms > stats->cpu_ms.max) stats->cpu_ms.max = cpu_ms;
+                stats->cpu_ms.avg += cpu_ms / (f32)frame_count;
+
+                RenderStats render_stats;
+                renderer::GetRenderStats(&render_stats);
+                stats->draw_calls += render_stats.draw_calls;
+                stats->state_changes += render_stats.state_changes;
+
+                if (frame == frame_count - 1)
+                {
+                    pending_uploads[scene_index] = renderer::GetPendingUploadCount();
+                    PixelImage* capture = &captures[scene_index];
+                    capture->format = PIXEL_FORMAT_BGRA8;
+                    u8* pixels = nullptr;
+                    if (renderer::ReadFramebuffer(&scratch, &pixels, &capture->width, &capture->height))
+                    {
+                        capture->pixels = pixels;
+                        capture->pitch = capture->width * 4;
+                    }
+                }
+            }
+
+#if !RENDERER_SOFTWARE
+            SwapBuffers(GetDC(window));
+#endif
+
+            // GPU timings arrive a few frames late, they go to the scene the frame belonged to
+            GpuFrameStats gpu_frame;
+            if (renderer::GetGpuFrameStats(&gpu_frame))
+            {
+                for (u32 i = 0; i < scene_count; ++i)
+                {
+                    RegressionSceneStats& owner = scene_stats[i];
+                    if (gpu_frame.frame_index >= owner.first_frame && gpu_frame.frame_index < owner.end_frame)
+                    {
+                        owner.gpu_ms_sum += gpu_frame.frame_gpu_ms;
+                        ++owner.gpu_frames;
+                    }
+                }
+            }
+
+            memory::VMArenaReset(&app_memory.render_storage);
+        }
+    }
+
+    FILE* results = nullptr;
+    bool write_header = GetFileAttributesA(REGRESSION_RESULTS_PATH) == INVALID_FILE_ATTRIBUTES;
+    if (fopen_s(&results, REGRESSION_RESULTS_PATH, "a") != 0)
+    {
+        printf("Regression: could not open %s\n", REGRESSION_RESULTS_PATH);
+        results = nullptr;
+    }
+    if (results && write_header)
+    {
+        fprintf(results, "backend,scene,frames,width,height,cpu_ms_avg,cpu_ms_min,cpu_ms_max,gpu_ms_avg,gpu_frames,"
+                         "draw_calls,state_changes,psnr,ssim,differing_pixels,max_difference,result\n");
+    }
+
+    u32 failure_count = 0;
+    u32 missing_golden_count = 0;
+    for (u32 i = 0; i < scene_count; ++i)
+    {
+        const RegressionScene& scene = g_regression_scenes[i];
+        const RegressionSceneStats& stats = scene_stats[i];
+        const PixelImage* capture = &captures[i];
+        char golden_path[MAX_PATH];
+        Win32_GetGoldenPath(scene.name, golden_path, sizeof(golden_path));
+
+        ImageCompareResult compare = {};
+        const char* outcome = "pass";
+        if (!capture->pixels)
+        {
+            outcome = "no_readback";
+        }
+        else if (pending_uploads[i] > 0)
+        {
+            outcome = "uploads_pending";
+        }
+        else if (options->update_golden)
+        {
+            outcome = Win32_WriteTga(golden_path, capture) ? "updated" : "write_failed";
+        }
+        else
+        {
+            PixelImage golden = {};
+            if (GetFileAttributesA(golden_path) == INVALID_FILE_ATTRIBUTES)
+            {
+                outcome = "no_golden";
+                ++missing_golden_count;
+            }
+            else if (!Win32_ReadTga(golden_path, &scratch, &golden))
+            {
+                outcome = "bad_golden";
+            }
+            else if (golden.width != capture->width || golden.height != capture->height)
+            {
+                outcome = "size_mismatch";
+            }
+            else
+            {
+                image_compare::Compare(capture, &golden, REGRESSION_CHANNEL_TOLERANCE, &scratch, &g_work_queue, &compare);
+                f64 differing_fraction = (f64)compare.differing_pixels / ((f64)capture->width * (f64)capture->height);
+                bool matches = differing_fraction <= REGRESSION_MAX_DIFFERING &&
+                               compare.psnr >= REGRESSION_MIN_PSNR &&
+                               compare.ssim >= REGRESSION_MIN_SSIM;
+                outcome = matches ? "pass" : "fail";
+            }
+        }
+
+        bool failed = strcmp(outcome, "pass") != 0 && strcmp(outcome, "updated") != 0 && strcmp(outcome, "no_golden") != 0;
+        failure_count += failed ? 1 : 0;
+
+        f32 frames = (f32)(stats.end_frame - stats.first_frame);
+        f32 gpu_ms = stats.gpu_frames > 0 ? stats.gpu_ms_sum / (f32)stats.gpu_frames : 0.0f;
+        f32 draw_calls = (f32)stats.draw_calls / frames;
+        f32 state_changes = (f32)stats.state_changes / frames;
+        printf("  %-14s %-14s CPU %6.02f ms (%.02f - %.02f), GPU %6.02f ms, %.1f draws, %.1f state changes, PSNR %.02f dB, SSIM %.04f, %u pixels off\n",
+               scene.name, outcome, stats.cpu_ms.avg, stats.cpu_ms.min, stats.cpu_ms.max, gpu_ms, draw_calls, state_changes,
+               compare.psnr, compare.ssim, compare.differing_pixels);
+        if (results)
+        {
+            fprintf(results, "%s,%s,%u,%d,%d,%.03f,%.03f,%.03f,%.03f,%u,%.1f,%.1f,%.02f,%.05f,%u,%u,%s\n",
+                    REGRESSION_BACKEND_NAME, scene.name, (u32)frames, capture->width, capture->height,
+                    stats.cpu_ms.avg, stats.cpu_ms.min, stats.cpu_ms.max, gpu_ms, stats.gpu_frames,
+                    draw_calls, state_changes, compare.psnr, compare.ssim, compare.differing_pixels, compare.max_difference, outcome);
+        }
+    }
+
+    if (results)
+    {
+        fclose(results);
+    }
+    memory::VMArenaFree(&scratch);
+
+    if (failure_count > 0)
+    {
+        printf("Regression FAILED: %u of %u scenes failed\n", failure_count, scene_count);
+        return REGRESSION_EXIT_FAIL;
+    }
+    if (missing_golden_count > 0)
+    {
+        printf("Regression incomplete: %u of %u scenes have no golden image in %s/%s, bootstrap them with -regression-update\n",
+               missing_golden_count, scene_count, REGRESSION_DIRECTORY, REGRESSION_BACKEND_NAME);
+        return REGRESSION_EXIT_NO_GOLDEN;
+    }
+    printf("Regression passed: %u scenes\n", scene_count);
+    return REGRESSION_EXIT_PASS;
+}
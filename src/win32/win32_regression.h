@@ -0,0 +1,24 @@
+#ifndef WIN32_REGRESSION_H
+#define WIN32_REGRESSION_H
+
+#include "win32_main.h"
+#include "core/memory.h"
+
+// Headless golden image and frame time run instead of the interactive loop:
+//   -regression            compare every scene with its golden image, exit code 1 on a mismatch and
+//                          2 when some golden images do not exist yet
+//   -regression-update     write the golden images instead, run it once to bootstrap them
+//   -frames N              frames per scene
+struct RegressionOptions
+{
+    bool enabled;
+    bool update_golden;
+    u32 frame_count;
+};
+
+internal bool Win32_ParseRegressionOptions(const char* cmd_line, RegressionOptions* options);
+
+// Runs right after renderer::Init(), before any other frame. Returns the process exit code.
+internal i32 Win32_RunRegression(HWND window, Memory& app_memory, const RegressionOptions* options);
+
+#endif
@@ -0,0 +1,765 @@
+#include "renderer/renderer.h"
+#include "renderer/software_rasterizer.h"
+#include "renderer/sprite_blitter.h"
+#include "renderer/present.h"
+#include "renderer/mipmap.h"
+#include "renderer/block_compression.h"
+#include "core/bulk_memory.h"
+
+#include "win32_main.h"
+#include "resources/resources_catalog.h"
+#include "resources/png_decoder.h"
+
+#include <vector>
+#include <string.h>
+
+// CPU implementation of the renderer interface, selected with RENDERER_SOFTWARE. Renders into
+// the DIB section framebuffer on the work queue and presents only the tiles that changed.
+// Shaders are not interpreted: meshes get the lit vertex color of the app's mesh variant,
+// evaluated per vertex, and sprites their texture times the vertex color. Sprites with an
+// orthographic transform skip the triangle setup and get binned as sprite blits.
+// A tile whose commands match the previous frame's is not redrawn nor presented.
+
+#define SOFTWARE_FALLBACK_TEXTURE_SIZE  32
+#define SOFTWARE_AMBIENT_LIGHT          0.1f
+#define SOFTWARE_DECODE_ARENA_SIZE      Megabytes(256)  // Reserved only, pages are committed by the biggest image decoded
+#define SOFTWARE_MIP_FILTER             MipFilter::KAISER
+
+// One LOD with only the vertices it references, positions split out for the SIMD transform
+struct SoftwareMeshLod
+{
+    std::vector<f32> x;     // Padded to a multiple of four
+    std::vector<f32> y;
+    std::vector<f32> z;
+    std::vector<Vertex> vertices;
+    std::vector<u32> indices;
+};
+
+struct SoftwareMesh
+{
+    std::vector<SoftwareMeshLod> lods;
+    bool is_destroyed;
+    u32 generation;                 // Of the slot, see MakeHandleId()
+};
+
+struct SoftwareSprite
+{
+    std::vector<u32> texels;        // Tiled levels for the sampler, empty for the fallback texture
+    SoftwareTexture texture;        // Texel pointers are resolved at draw time, the table moves
+    std::vector<u32> blit_texels;   // Premultiplied BGRA copy for the blitter
+    BlitImage blit_image;
+    float width;
+    float height;
+    bool is_destroyed;
+    u32 generation;
+};
+
+struct SoftwareShader
+{
+    bool is_destroyed;
+    u32 generation;
+};
+
+global HWND g_software_window;
+global bool g_software_initialized = false;
+global SoftwareRasterizer g_rasterizer;
+global ResourceCatalog* g_resource_catalog = nullptr;
+global VMArena g_decode_arena;     // Decoded sprite images and mip chains until CreateSpriteWithMips() made its copies
+
+global i32 g_backbuffer_width = 0;
+global i32 g_backbuffer_height = 0;
+global f32 g_render_scale = 1.0f;
+global bool g_scene_active = false;
+global u32 g_max_frames_in_flight = 1;
+
+global std::vector<SoftwareMesh> g_meshes;
+global std::vector<SoftwareSprite> g_sprites;
+global std::vector<SoftwareShader> g_shaders;
+global std::vector<u32> g_free_mesh_slots;
+global std::vector<u32> g_free_sprite_slots;
+global std::vector<u32> g_free_shader_slots;
+
+// Destroyed during a frame, freed at the next BeginFrame once the frame's tiles are done
+global std::vector<u32> g_retired_meshes;
+global std::vector<u32> g_retired_sprites;
+global std::vector<u32> g_retired_shaders;
+
+global DirtyRegion g_dirty_region;
+
+global u32 g_fallback_texels[SOFTWARE_FALLBACK_TEXTURE_SIZE * SOFTWARE_FALLBACK_TEXTURE_SIZE];
+global u32 g_fallback_tiled_texels[SOFTWARE_FALLBACK_TEXTURE_SIZE * SOFTWARE_FALLBACK_TEXTURE_SIZE];
+global SoftwareTexture g_fallback_texture;
+global u32 g_fallback_blit_texels[SOFTWARE_FALLBACK_TEXTURE_SIZE * SOFTWARE_FALLBACK_TEXTURE_SIZE];
+global BlitImage g_fallback_blit_image;
+global const LightClusters* g_light_clusters = nullptr;
+
+// What the previous draw of the frame used, a change counts like a bind on the GL backend
+global RenderStats g_render_stats;
+global u32 g_last_draw_texture;     // Sprite id + 1, 0 for untextured meshes
+global u32 g_last_draw_flags;
+
+// Reused by every draw
+global std::vector<glm::vec4> g_clip_positions;
+global std::vector<glm::vec4> g_world_positions;
+global std::vector<SoftwareVertex> g_shaded_vertices;
+
+// Reuses a slot freed by a retired resource before growing the table and returns the handle id.
+// A reused slot keeps the generation its previous resource's destroy bumped.
+template<typename Type>
+internal u32 AllocateSlot(std::vector<Type>& slots, std::vector<u32>& free_slots, const Type& value)
+{
+    u32 index;
+    if (!free_slots.empty())
+    {
+        index = free_slots.back();
+        free_slots.pop_back();
+    }
+    else
+    {
+        Assert(slots.size() <= HANDLE_INDEX_MASK);
+        index = (u32)slots.size();
+        slots.push_back(value);
+    }
+
+    u32 generation = slots[index].generation;
+    slots[index] = value;
+    slots[index].generation = generation;
+    return MakeHandleId(index, generation);
+}
+
+// The slot a handle refers to, or nullptr once its resource was destroyed, whether or not the slot was reused since
+template<typename Type>
+internal Type* GetLiveSlot(std::vector<Type>& slots, u32 id)
+{
+    u32 index = GetHandleIndex(id);
+    if (index >= slots.size() || slots[index].generation != GetHandleGeneration(id) || slots[index].is_destroyed)
+    {
+        return nullptr;
+    }
+    return &slots[index];
+}
+
+// Marks the slot destroyed and moves it to the next generation, stale handles stop matching right away
+template<typename Type>
+internal void KillSlot(Type* slot)
+{
+    slot->is_destroyed = true;
+    slot->generation = (slot->generation + 1) & HANDLE_GENERATION_MASK;
+}
+
+// Empties a freed slot, keeping its generation for the next resource
+template<typename Type>
+internal void ClearSlot(Type* slot)
+{
+    u32 generation = slot->generation;
+    *slot = {};
+    slot->generation = generation;
+    slot->is_destroyed = true;
+}
+
+// Same 32x32 colored quadrants as the GL fallback texture, row 0 at the bottom
+internal void Init_FallbackTexture()
+{
+    const i32 quad_size = SOFTWARE_FALLBACK_TEXTURE_SIZE / 2;
+    for (i32 y = 0; y < SOFTWARE_FALLBACK_TEXTURE_SIZE; ++y)
+    {
+        for (i32 x = 0; x < SOFTWARE_FALLBACK_TEXTURE_SIZE; ++x)
+        {
+            i32 top_down_y = SOFTWARE_FALLBACK_TEXTURE_SIZE - 1 - y;
+            u32 color;
+            if (x < quad_size && top_down_y < quad_size)        color = 0xFF0000FF; // Top-left: RED
+            else if (x >= quad_size && top_down_y < quad_size)  color = 0xFF00FF00; // Top-right: GREEN
+            else if (x < quad_size)                             color = 0xFFFF0000; // Bottom-left: BLUE
+            else                                                color = 0xFFFFFFFF; // Bottom-right: WHITE
+            g_fallback_texels[y * SOFTWARE_FALLBACK_TEXTURE_SIZE + x] = color;
+        }
+    }
+
+    // Sampled like the GL fallback texture is
+    TextureLevel level = {};
+    level.width = SOFTWARE_FALLBACK_TEXTURE_SIZE;
+    level.height = SOFTWARE_FALLBACK_TEXTURE_SIZE;
+    level.pixels = g_fallback_texels;
+    texture_sampler::Init(&g_fallback_texture.sampler, SAMPLER_FORMAT_RGBA8, &level, 1, g_fallback_tiled_texels);
+    g_fallback_texture.state = texture_sampler::MakeState(SAMPLER_WRAP_MIRRORED_REPEAT, SAMPLER_FILTER_LINEAR, SAMPLER_FILTER_NEAREST, SAMPLER_MIP_NONE);
+
+    memcpy(g_fallback_blit_texels, g_fallback_texels, sizeof(g_fallback_texels));
+    sprite_blitter::PremultiplyImage(g_fallback_blit_texels, ArrayCount(g_fallback_blit_texels));
+    g_fallback_blit_image.pixels = g_fallback_blit_texels;
+    g_fallback_blit_image.width = SOFTWARE_FALLBACK_TEXTURE_SIZE;
+    g_fallback_blit_image.height = SOFTWARE_FALLBACK_TEXTURE_SIZE;
+    g_fallback_blit_image.pitch = SOFTWARE_FALLBACK_TEXTURE_SIZE;
+}
+
+// The ambient term plus the clustered point lights, like ShadeClusteredLights() but once per vertex
+internal glm::vec3 ShadeVertex(const glm::vec4& clip, const glm::vec3& position, const glm::vec3& normal)
+{
+    glm::vec3 result = glm::vec3(SOFTWARE_AMBIENT_LIGHT);
+    const LightClusters* clusters = g_light_clusters;
+    if (!clusters || clip.w <= 0.0f)
+    {
+        return result;
+    }
+
+    f32 view_depth = clip.w; // -z in view space for a perspective projection
+    i32 cluster_x = FloorFloatToInt((clip.x / clip.w * 0.5f + 0.5f) * (f32)CLUSTER_GRID_X);
+    i32 cluster_y = FloorFloatToInt((clip.y / clip.w * 0.5f + 0.5f) * (f32)CLUSTER_GRID_Y);
+    f32 slices_per_log = (f32)CLUSTER_GRID_Z / logf(clusters->far_plane / clusters->near_plane);
+    i32 cluster_z = FloorFloatToInt(logf(MaxFloat(view_depth, clusters->near_plane) / clusters->near_plane) * slices_per_log);
+    cluster_x = MinInt(MaxInt(cluster_x, 0), CLUSTER_GRID_X - 1);
+    cluster_y = MinInt(MaxInt(cluster_y, 0), CLUSTER_GRID_Y - 1);
+    cluster_z = MinInt(MaxInt(cluster_z, 0), CLUSTER_GRID_Z - 1);
+
+    const u32* range = &clusters->cluster_ranges[2 * (cluster_x + CLUSTER_GRID_X * (cluster_y + CLUSTER_GRID_Y * cluster_z))];
+    for (u32 i = 0; i < range[1]; ++i)
+    {
+        const PointLight& light = clusters->lights[clusters->light_indices[range[0] + i]];
+        glm::vec3 to_light = light.position - position;
+        f32 distance_sq = glm::dot(to_light, to_light);
+        f32 falloff = MinFloat(MaxFloat(1.0f - distance_sq / (light.radius * light.radius), 0.0f), 1.0f);
+        f32 diffuse = MaxFloat(glm::dot(normal, to_light / sqrtf(MaxFloat(distance_sq, 1e-6f))), 0.0f);
+        result += diffuse * falloff * falloff * light.color * light.intensity;
+    }
+    return result;
+}
+
+internal void CountDraw(u32 texture, u32 flags)
+{
+    if (g_render_stats.draw_calls > 0)
+    {
+        g_render_stats.state_changes += (texture != g_last_draw_texture ? 1 : 0) + (flags != g_last_draw_flags ? 1 : 0);
+    }
+    g_last_draw_texture = texture;
+    g_last_draw_flags = flags;
+    ++g_render_stats.draw_calls;
+}
+
+internal void FreeSprite(u32 id)
+{
+    ClearSlot(&g_sprites[id]);
+    g_free_sprite_slots.push_back(id);
+}
+
+internal bool renderer::Init(void* window_handle)
+{
+    g_software_window = (HWND)window_handle;
+    software_rasterizer::Init(&g_rasterizer, &g_work_queue);
+    Init_FallbackTexture();
+    memory::InitVMArena(&g_decode_arena, SOFTWARE_DECODE_ARENA_SIZE);
+    g_framebuffer.buffer.dirty = &g_dirty_region;
+    g_software_initialized = true;
+
+    RECT client_rect;
+    GetClientRect(g_software_window, &client_rect);
+    Resize(client_rect.right - client_rect.left, client_rect.bottom - client_rect.top);
+
+    printf("Software renderer: %u worker threads, %dx%d tiles\n", work_queue::GetWorkerCount(&g_work_queue),
+           SOFTWARE_TILE_SIZE, SOFTWARE_TILE_SIZE);
+    return true;
+}
+
+internal void renderer::Resize(i32 width, i32 height)
+{
+    // Minimized windows report 0x0, keep the old buffer around
+    if (!g_software_initialized || width <= 0 || height <= 0)
+    {
+        return;
+    }
+
+    g_backbuffer_width = MinInt(width, SOFTWARE_MAX_DIMENSION);
+    g_backbuffer_height = MinInt(height, SOFTWARE_MAX_DIMENSION);
+    Win32_ResizeDIBSection(g_backbuffer_width, g_backbuffer_height);
+    dirty_region::Init(&g_dirty_region, g_backbuffer_width, g_backbuffer_height);
+    software_rasterizer::Resize(&g_rasterizer, &g_framebuffer.buffer);
+}
+
+internal void renderer::SetResourceCatalog(ResourceCatalog* catalog)
+{
+    g_resource_catalog = catalog;
+}
+
+internal void renderer::SetRenderScale(f32 scale)
+{
+    g_render_scale = MinFloat(MaxFloat(scale, MIN_RENDER_SCALE), MAX_RENDER_SCALE);
+}
+
+internal void renderer::GetRenderResolution(i32* width, i32* height)
+{
+    *width = MaxInt(RoundFloatToInt((f32)g_backbuffer_width * g_render_scale), 1);
+    *height = MaxInt(RoundFloatToInt((f32)g_backbuffer_height * g_render_scale), 1);
+}
+
+// The scene renders into the bottom-left corner of the framebuffer, EndScene() stretches it
+internal void renderer::BeginScene()
+{
+    i32 width, height;
+    GetRenderResolution(&width, &height);
+    software_rasterizer::SetViewport(&g_rasterizer, width, height);
+    g_scene_active = true;
+}
+
+internal void renderer::EndScene()
+{
+    if (!g_scene_active)
+    {
+        return;
+    }
+
+    software_rasterizer::UpscaleViewport(&g_rasterizer);
+    g_scene_active = false;
+}
+
+// Every frame is finished by the time Present() returns, there is nothing to throttle
+internal void renderer::SetMaxFramesInFlight(u32 count)
+{
+    UNREFERENCED_PARAMETER(count);
+    g_max_frames_in_flight = 1;
+}
+
+internal void renderer::WaitForFrameLatency()
+{
+}
+
+internal void renderer::GetFramePacingStats(FramePacingStats* stats)
+{
+    *stats = {};
+    stats->max_frames_in_flight = g_max_frames_in_flight;
+}
+
+internal void renderer::BeginFrame()
+{
+    for (u32 id : g_retired_meshes)
+    {
+        ClearSlot(&g_meshes[id]);
+        g_free_mesh_slots.push_back(id);
+    }
+    for (u32 id : g_retired_sprites)
+    {
+        FreeSprite(id);
+    }
+    for (u32 id : g_retired_shaders)
+    {
+        g_free_shader_slots.push_back(id);
+    }
+    // Tile signatures point at the texels, a new sprite could reuse the freed memory
+    if (!g_retired_sprites.empty())
+    {
+        software_rasterizer::InvalidateTiles(&g_rasterizer);
+    }
+    g_retired_meshes.clear();
+    g_retired_sprites.clear();
+    g_retired_shaders.clear();
+
+    g_rasterizer.submitted_triangle_count = 0;
+    g_render_stats = {};
+}
+
+// No GPU to time: the CPU frame time already contains the rasterization
+internal void renderer::BeginGpuScope(const char* label)
+{
+    UNREFERENCED_PARAMETER(label);
+}
+
+internal void renderer::EndGpuScope()
+{
+}
+
+internal bool renderer::GetGpuFrameStats(GpuFrameStats* stats)
+{
+    UNREFERENCED_PARAMETER(stats);
+    return false;
+}
+
+internal void renderer::GetRenderStats(RenderStats* stats)
+{
+    *stats = g_render_stats;
+}
+
+// The framebuffer already is BGRA8 top-down without padding
+internal bool renderer::ReadFramebuffer(VMArena* arena, u8** pixels, i32* width, i32* height)
+{
+    const Framebuffer& framebuffer = g_framebuffer.buffer;
+    if (!framebuffer.memory)
+    {
+        return false;
+    }
+
+    size_t size = (size_t)framebuffer.pitch * (size_t)framebuffer.height;
+    *pixels = (u8*)memory::VMArenaAllocAligned(arena, size, 16);
+    bulk_memory::Copy(*pixels, framebuffer.memory, size, &g_work_queue);
+    *width = framebuffer.width;
+    *height = framebuffer.height;
+    return true;
+}
+
+internal void renderer::Present()
+{
+    software_rasterizer::EndFrame(&g_rasterizer);
+    present::PresentDirtyRegion(g_software_window, &g_framebuffer.buffer);
+}
+
+internal void renderer::ClearScreen(f32 r, f32 g, f32 b, f32 a)
+{
+    software_rasterizer::Clear(&g_rasterizer, r, g, b, a);
+}
+
+internal MeshHandle renderer::CreateMesh(const Vertex* vertices, int v_count, int* indices, int i_count)
+{
+    MeshLod lod = {};
+    lod.index_offset = 0;
+    lod.index_count = (u32)i_count;
+    lod.error = 0.0f;
+    return CreateMeshWithLods(vertices, v_count, indices, i_count, &lod, 1);
+}
+
+internal MeshHandle renderer::CreateMeshWithLods(const Vertex* vertices, int v_count, int* indices, int i_count, const MeshLod* lods, u32 lod_count)
+{
+    UNREFERENCED_PARAMETER(i_count);
+    SoftwareMesh mesh = {};
+    mesh.lods.resize(MinInt((i32)lod_count, MAX_MESH_LODS));
+
+    // Coarse LODs touch a fraction of the shared vertex buffer, only those get transformed
+    std::vector<i32> remap((size_t)v_count);
+    for (u32 level = 0; level < mesh.lods.size(); ++level)
+    {
+        SoftwareMeshLod& lod = mesh.lods[level];
+        std::fill(remap.begin(), remap.end(), -1);
+        for (u32 i = 0; i < lods[level].index_count; ++i)
+        {
+            i32 index = indices[lods[level].index_offset + i];
+            if (index < 0 || index >= v_count)
+            {
+                printf("CreateMesh: index %d out of range in LOD %u\n", index, level);
+                index = 0;
+            }
+            if (remap[index] < 0)
+            {
+                remap[index] = (i32)lod.vertices.size();
+                lod.vertices.push_back(vertices[index]);
+            }
+            lod.indices.push_back((u32)remap[index]);
+        }
+
+        size_t padded_count = (lod.vertices.size() + 3) & ~(size_t)3;
+        lod.x.resize(padded_count, 0.0f);
+        lod.y.resize(padded_count, 0.0f);
+        lod.z.resize(padded_count, 0.0f);
+        for (size_t i = 0; i < lod.vertices.size(); ++i)
+        {
+            lod.x[i] = lod.vertices[i].position[0];
+            lod.y[i] = lod.vertices[i].position[1];
+            lod.z[i] = lod.vertices[i].position[2];
+        }
+    }
+
+    MeshHandle handle = {};
+    handle.id = AllocateSlot(g_meshes, g_free_mesh_slots, mesh);
+    return handle;
+}
+
+internal MeshHandle renderer::CreateMeshAsync(const Vertex* vertices, int v_count, int* indices, int i_count, const MeshLod* lods, u32 lod_count)
+{
+    return CreateMeshWithLods(vertices, v_count, indices, i_count, lods, lod_count);
+}
+
+internal bool renderer::IsMeshReady(MeshHandle handle)
+{
+    return GetLiveSlot(g_meshes, handle.id) != nullptr;
+}
+
+internal void renderer::DestroyMesh(MeshHandle handle)
+{
+    SoftwareMesh* mesh = GetLiveSlot(g_meshes, handle.id);
+    if (mesh == nullptr) return;
+
+    KillSlot(mesh);
+    g_retired_meshes.push_back(GetHandleIndex(handle.id));
+}
+
+internal ShaderHandle renderer::CreateShader(const char* vertex_source, const char* fragment_source)
+{
+    UNREFERENCED_PARAMETER(vertex_source);
+    UNREFERENCED_PARAMETER(fragment_source);
+    SoftwareShader shader = {};
+    ShaderHandle handle = {};
+    handle.id = AllocateSlot(g_shaders, g_free_shader_slots, shader);
+    return handle;
+}
+
+internal ShaderHandle renderer::CreateShaderAsync(const char* vertex_source, const char* fragment_source)
+{
+    return CreateShader(vertex_source, fragment_source);
+}
+
+internal void renderer::DestroyShader(ShaderHandle handle)
+{
+    SoftwareShader* shader = GetLiveSlot(g_shaders, handle.id);
+    if (shader == nullptr) return;
+
+    KillSlot(shader);
+    g_retired_shaders.push_back(GetHandleIndex(handle.id));
+}
+
+internal ShaderStatus renderer::GetShaderStatus(ShaderHandle handle)
+{
+    if (GetLiveSlot(g_shaders, handle.id) == nullptr) return ShaderStatus::FAILED;
+    return ShaderStatus::READY;
+}
+
+internal SpriteHandle renderer::CreateSpriteWithMips(const TextureLevel* levels, u32 level_count, bool srgb, float width, float height)
+{
+    UNREFERENCED_PARAMETER(srgb);
+
+    // Same sampling as the GL sprite textures, the blitter only reads level 0
+    SoftwareSprite sprite = {};
+    sprite.width = width;
+    sprite.height = height;
+    sprite.texels.resize(texture_sampler::GetStorageSize(SAMPLER_FORMAT_RGBA8, levels, level_count) / sizeof(u32));
+    texture_sampler::Init(&sprite.texture.sampler, SAMPLER_FORMAT_RGBA8, levels, level_count, sprite.texels.data());
+    sprite.texture.state = texture_sampler::MakeState(SAMPLER_WRAP_CLAMP_TO_EDGE, SAMPLER_FILTER_LINEAR, SAMPLER_FILTER_LINEAR,
+                                                      level_count > 1 ? SAMPLER_MIP_LINEAR : SAMPLER_MIP_NONE);
+
+    const u32* base_level = (const u32*)levels[0].pixels;
+    sprite.blit_texels.assign(base_level, base_level + (size_t)levels[0].width * (size_t)levels[0].height);
+    sprite_blitter::PremultiplyImage(sprite.blit_texels.data(), (u32)sprite.blit_texels.size());
+    sprite.blit_image.width = levels[0].width;
+    sprite.blit_image.height = levels[0].height;
+    sprite.blit_image.pitch = levels[0].width;
+
+    SpriteHandle handle = {};
+    handle.id = AllocateSlot(g_sprites, g_free_sprite_slots, sprite);
+    return handle;
+}
+
+// Filters the chain in the decode arena like the GL backend, the sprite keeps tiled and premultiplied copies
+internal SpriteHandle CreateSpriteFromPixels(const u8* pixels, i32 texture_width, i32 texture_height, float width, float height)
+{
+    size_t arena_offset = g_decode_arena.curr_offset;
+    MipChain chain = {};
+    mipmap::GenerateRgba8(&g_work_queue, &g_decode_arena, pixels, texture_width, texture_height, true, SOFTWARE_MIP_FILTER, &chain);
+    SpriteHandle handle = renderer::CreateSpriteWithMips(chain.levels, chain.level_count, true, width, height);
+    g_decode_arena.curr_offset = arena_offset;
+    return handle;
+}
+
+internal SpriteHandle renderer::CreateSprite(ResourceID resource_id, float width, float height)
+{
+    if (g_resource_catalog != nullptr && resource_id != INVALID_RESOURCE_ID)
+    {
+        Resource* resource = Catalog_Get(g_resource_catalog, resource_id);
+        if (resource != nullptr && resource->rawBuffer != nullptr && png_decoder::IsPng(resource->rawBuffer, resource->size))
+        {
+            // The decoded image is only scratch
+            size_t arena_offset = g_decode_arena.curr_offset;
+            PngInfo info = {};
+            u8* pixels = png_decoder::DecodeToArena(resource->rawBuffer, resource->size, &g_decode_arena, true, &info);
+            if (pixels)
+            {
+                SpriteHandle handle = CreateSpriteFromPixels(pixels, info.width, info.height, width, height);
+                g_decode_arena.curr_offset = arena_offset;
+                return handle;
+            }
+        }
+        else if (resource != nullptr && resource->rawBuffer != nullptr)
+        {
+            // Raw square RGBA, like the GL path
+            i32 texture_dim = (i32)sqrt(resource->size / 4);
+            if (texture_dim > 0)
+            {
+                return CreateSpriteFromPixels((const u8*)resource->rawBuffer, texture_dim, texture_dim, width, height);
+            }
+        }
+    }
+
+    SoftwareSprite sprite = {};
+    sprite.width = width;
+    sprite.height = height;
+    sprite.texture = g_fallback_texture;
+    sprite.blit_image = g_fallback_blit_image;
+
+    SpriteHandle handle = {};
+    handle.id = AllocateSlot(g_sprites, g_free_sprite_slots, sprite);
+    return handle;
+}
+
+internal SpriteHandle renderer::CreateSpriteAsync(ResourceID resource_id, float width, float height)
+{
+    return CreateSprite(resource_id, width, height);
+}
+
+// The sampler only reads RGBA8, so the blocks are decoded back on load
+internal SpriteHandle renderer::CreateCompressedSprite(TextureFormat format, const TextureLevel* levels, u32 level_count, bool srgb,
+                                                       float width, float height)
+{
+    if (block_compression::GetBlockBytes(format) == 0 || levels == nullptr || level_count == 0 || level_count > MIP_MAX_LEVELS)
+    {
+        printf("CreateCompressedSprite: unsupported format %s\n", block_compression::texture_format_names[(u32)format]);
+        return CreateSprite(INVALID_RESOURCE_ID, width, height);
+    }
+
+    size_t arena_offset = g_decode_arena.curr_offset;
+    TextureLevel decoded_levels[MIP_MAX_LEVELS];
+    for (u32 level = 0; level < level_count; ++level)
+    {
+        decoded_levels[level] = levels[level];
+        u8* texels = (u8*)memory::VMArenaAlloc(&g_decode_arena, (size_t)levels[level].width * (size_t)levels[level].height * 4);
+        block_compression::Decompress(format, (const u8*)levels[level].pixels, levels[level].width, levels[level].height, texels);
+        decoded_levels[level].pixels = texels;
+    }
+    SpriteHandle handle = CreateSpriteWithMips(decoded_levels, level_count, srgb, width, height);
+    g_decode_arena.curr_offset = arena_offset;
+    return handle;
+}
+
+internal bool renderer::IsSpriteReady(SpriteHandle handle)
+{
+    return GetLiveSlot(g_sprites, handle.id) != nullptr;
+}
+
+// Everything is created in place, nothing waits on an upload
+internal u32 renderer::GetPendingUploadCount()
+{
+    return 0;
+}
+
+internal void renderer::DestroySprite(SpriteHandle handle)
+{
+    SoftwareSprite* sprite = GetLiveSlot(g_sprites, handle.id);
+    if (sprite == nullptr) return;
+
+    KillSlot(sprite);
+    g_retired_sprites.push_back(GetHandleIndex(handle.id));
+}
+
+// The binning output lives in the app's frame arena, which outlives the frame's draws
+internal void renderer::UploadLightClusters(const LightClusters* clusters)
+{
+    g_light_clusters = clusters;
+}
+
+internal void renderer::Draw(RenderCommand* cmd)
+{
+    switch (cmd->mode)
+    {
+        case RenderMode::MESH:
+            DrawMesh(&cmd->mesh_cmd);
+            break;
+        case RenderMode::SPRITE:
+            DrawSprite(&cmd->sprite_cmd);
+            break;
+    }
+}
+
+internal void renderer::DrawMesh(RenderMeshCommand* cmd)
+{
+    SoftwareMesh* live_mesh = GetLiveSlot(g_meshes, cmd->mesh.id);
+    if (live_mesh == nullptr || live_mesh->lods.empty() || GetLiveSlot(g_shaders, cmd->shader.id) == nullptr) return;
+    SoftwareMesh& mesh = *live_mesh;
+
+    // Only filled triangles, lines have no rasterizer here
+    if (cmd->draw_mode != DrawMode::TRIANGLES) return;
+
+    const SoftwareMeshLod& lod = mesh.lods[cmd->lod < mesh.lods.size() ? cmd->lod : mesh.lods.size() - 1];
+    u32 vertex_count = (u32)lod.vertices.size();
+    g_clip_positions.resize(vertex_count);
+    g_world_positions.resize(vertex_count);
+    g_shaded_vertices.resize(vertex_count);
+
+    glm::mat4 model_view_projection = cmd->projection * cmd->view * cmd->model;
+    software_rasterizer::TransformPoints(model_view_projection, lod.x.data(), lod.y.data(), lod.z.data(), vertex_count, g_clip_positions.data());
+    software_rasterizer::TransformPoints(cmd->model, lod.x.data(), lod.y.data(), lod.z.data(), vertex_count, g_world_positions.data());
+
+    for (u32 i = 0; i < vertex_count; ++i)
+    {
+        const Vertex& vertex = lod.vertices[i];
+        SoftwareVertex& shaded = g_shaded_vertices[i];
+
+        // The mesh shader takes the normal as is, without the model rotation
+        glm::vec3 normal = glm::vec3(vertex.normal[0], vertex.normal[1], vertex.normal[2]);
+        f32 normal_length = glm::length(normal);
+        normal = normal_length > 0.0f ? normal / normal_length : glm::vec3(0.0f);
+        glm::vec3 lighting = ShadeVertex(g_clip_positions[i], glm::vec3(g_world_positions[i]), normal);
+
+        shaded.clip = g_clip_positions[i];
+        shaded.attributes[0] = vertex.color[0] * lighting.r;
+        shaded.attributes[1] = vertex.color[1] * lighting.g;
+        shaded.attributes[2] = vertex.color[2] * lighting.b;
+        shaded.attributes[3] = vertex.uv[0];
+        shaded.attributes[4] = vertex.uv[1];
+    }
+
+    software_rasterizer::SubmitTriangles(&g_rasterizer, g_shaded_vertices.data(), lod.indices.data(), (u32)lod.indices.size(),
+                                         nullptr, SOFTWARE_RASTER_DEPTH_TEST | SOFTWARE_RASTER_DEPTH_WRITE);
+    CountDraw(0, SOFTWARE_RASTER_DEPTH_TEST | SOFTWARE_RASTER_DEPTH_WRITE);
+}
+
+internal void renderer::DrawSprite(RenderSpriteCommand* cmd)
+{
+    SoftwareSprite* live_sprite = GetLiveSlot(g_sprites, cmd->sprite.id);
+    if (live_sprite == nullptr || GetLiveSlot(g_shaders, cmd->shader.id) == nullptr) return;
+    SoftwareSprite& sprite = *live_sprite;
+
+    glm::mat4 model_projection = cmd->projection * cmd->model;
+    bool is_affine = model_projection[0][3] == 0.0f && model_projection[1][3] == 0.0f && model_projection[3][3] == 1.0f;
+    if (is_affine)
+    {
+        // The unit quad's corners in pixels, v = 0 at the bottom like the sprite VAO's uvs.
+        // Image row y sits at v = y / height, so rows go up the screen as in the GL path.
+        BlitImage image = sprite.blit_image;
+        if (!sprite.blit_texels.empty())
+        {
+            image.pixels = sprite.blit_texels.data();
+        }
+        f32 half_width = 0.5f * (f32)g_framebuffer.buffer.width;
+        f32 half_height = 0.5f * (f32)g_framebuffer.buffer.height;
+        f32 origin_x = model_projection[3][0] - 0.5f * (model_projection[0][0] + model_projection[1][0]);
+        f32 origin_y = model_projection[3][1] - 0.5f * (model_projection[0][1] + model_projection[1][1]);
+
+        SpriteBlit blit = {};
+        blit.image = &image;
+        blit.transform.m00 = half_width * model_projection[0][0] / (f32)image.width;
+        blit.transform.m01 = half_width * model_projection[1][0] / (f32)image.height;
+        blit.transform.m10 = -half_height * model_projection[0][1] / (f32)image.width;
+        blit.transform.m11 = -half_height * model_projection[1][1] / (f32)image.height;
+        blit.transform.tx = half_width * origin_x + half_width;
+        blit.transform.ty = half_height - half_height * origin_y;
+        blit.tint = glm::vec4(1.0f);
+
+        // The GL sampler filters linearly both ways. The blitter only has the base level, so
+        // minified sprites get bilinear without the mip step, the closest it can come.
+        blit.filter = BLIT_FILTER_BILINEAR;
+
+        software_rasterizer::SubmitBlit(&g_rasterizer, &blit);
+        CountDraw(GetHandleIndex(cmd->sprite.id) + 1, 0);
+        return;
+    }
+
+    // Perspective sprites go through the rasterizer, same unit quad as the GL sprite VAO
+    local const Vertex2D quad[] = {
+        { { -0.5f, -0.5f }, { 1.0f, 1.0f, 1.0f }, { 0.0f, 0.0f } }, // Bottom-left
+        { {  0.5f, -0.5f }, { 1.0f, 1.0f, 1.0f }, { 1.0f, 0.0f } }, // Bottom-right
+        { {  0.5f,  0.5f }, { 1.0f, 1.0f, 1.0f }, { 1.0f, 1.0f } }, // Top-right
+        { { -0.5f,  0.5f }, { 1.0f, 1.0f, 1.0f }, { 0.0f, 1.0f } }  // Top-left
+    };
+    local const u32 quad_indices[] = { 0, 1, 2, 2, 3, 0 };
+
+    SoftwareVertex vertices[ArrayCount(quad)];
+    for (u32 i = 0; i < ArrayCount(quad); ++i)
+    {
+        vertices[i].clip = model_projection * glm::vec4(quad[i].position[0], quad[i].position[1], 0.0f, 1.0f);
+        vertices[i].attributes[0] = quad[i].color[0];
+        vertices[i].attributes[1] = quad[i].color[1];
+        vertices[i].attributes[2] = quad[i].color[2];
+        vertices[i].attributes[3] = quad[i].uv[0];
+        vertices[i].attributes[4] = quad[i].uv[1];
+    }
+
+    SoftwareTexture sprite_texture = sprite.texture;
+    if (!sprite.texels.empty())
+    {
+        sprite_texture.sampler.texels = (const u8*)sprite.texels.data();
+    }
+    const SoftwareTexture* texture = software_rasterizer::PushTexture(&g_rasterizer, sprite_texture);
+    software_rasterizer::SubmitTriangles(&g_rasterizer, vertices, quad_indices, ArrayCount(quad_indices), texture, 0);
+    CountDraw(GetHandleIndex(cmd->sprite.id) + 1, 0);
+}
@@ -0,0 +1,97 @@
+#include "core/work_queue.h"
+
+#include "win32_main.h"
+
+// Returns true when there was nothing to do and the caller may sleep
+internal bool Win32_DoNextWorkQueueEntry(WorkQueue* queue)
+{
+    bool should_sleep = false;
+
+    u32 original_next_entry_to_read = queue->next_entry_to_read;
+    u32 new_next_entry_to_read = (original_next_entry_to_read + 1) % WORK_QUEUE_MAX_ENTRIES;
+    if (original_next_entry_to_read != queue->next_entry_to_write)
+    {
+        u32 index = (u32)InterlockedCompareExchange((LONG volatile*)&queue->next_entry_to_read,
+                                                    (LONG)new_next_entry_to_read,
+                                                    (LONG)original_next_entry_to_read);
+        if (index == original_next_entry_to_read)
+        {
+            WorkQueueEntry entry = queue->entries[index];
+            entry.callback(queue, entry.data);
+            InterlockedIncrement((LONG volatile*)&queue->completion_count);
+        }
+    }
+    else
+    {
+        should_sleep = true;
+    }
+
+    return should_sleep;
+}
+
+internal DWORD WINAPI Win32_WorkerThreadProc(LPVOID parameter)
+{
+    WorkQueue* queue = (WorkQueue*)parameter;
+    for (;;)
+    {
+        if (Win32_DoNextWorkQueueEntry(queue))
+        {
+            WaitForSingleObjectEx(queue->semaphore_handle, INFINITE, FALSE);
+        }
+    }
+}
+
+internal void Win32_InitWorkQueue(WorkQueue* queue, u32 worker_count)
+{
+    if (worker_count > WORK_QUEUE_MAX_WORKERS) worker_count = WORK_QUEUE_MAX_WORKERS;
+
+    queue->completion_goal = 0;
+    queue->completion_count = 0;
+    queue->next_entry_to_write = 0;
+    queue->next_entry_to_read = 0;
+    queue->worker_count = worker_count;
+    queue->semaphore_handle = CreateSemaphoreEx(0, 0, (LONG)(worker_count > 0 ? worker_count : 1), 0, 0, SEMAPHORE_ALL_ACCESS);
+
+    for (u32 i = 0; i < worker_count; ++i)
+    {
+        HANDLE thread = CreateThread(0, 0, Win32_WorkerThreadProc, queue, 0, 0);
+        CloseHandle(thread);
+    }
+}
+
+namespace work_queue
+{
+
+internal void AddEntry(WorkQueue* queue, WorkQueueCallback* callback, void* data)
+{
+    u32 new_next_entry_to_write = (queue->next_entry_to_write + 1) % WORK_QUEUE_MAX_ENTRIES;
+    Assert(new_next_entry_to_write != queue->next_entry_to_read);
+
+    WorkQueueEntry* entry = &queue->entries[queue->next_entry_to_write];
+    entry->callback = callback;
+    entry->data = data;
+    ++queue->completion_goal;
+
+    // The entry must be visible before the workers can see the new write index
+    _WriteBarrier();
+    queue->next_entry_to_write = new_next_entry_to_write;
+    ReleaseSemaphore(queue->semaphore_handle, 1, 0);
+}
+
+internal void CompleteAllWork(WorkQueue* queue)
+{
+    while (queue->completion_goal != queue->completion_count)
+    {
+        Win32_DoNextWorkQueueEntry(queue);
+    }
+
+    queue->completion_goal = 0;
+    queue->completion_count = 0;
+}
+
+internal u32 GetWorkerCount(WorkQueue* queue)
+{
+    return queue->worker_count;
+}
+
+} // namespace work_queue